@@ -0,0 +1,107 @@
+//Multithreaded stress test and throughput benchmark for BPlusTree.
+//Every thread mixes lookups, inserts and removes on one shared tree. Even
+//keys are loaded up front and never removed, so every lookup of one must
+//succeed; odd keys are partitioned between threads, which insert and remove
+//only their own and track what they expect to be left. Afterwards a full
+//scan has to match exactly. Runs once with tiny nodes and a tiny cache, so
+//that splits, merges and evictions race all the time, then measures
+//throughput with page-sized nodes. Exits non-zero on any mismatch.
+//
+//Built by CMake as concurrent_tree_bench and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. bench/ConcurrentTreeBench.cpp index/*.cpp -o concurrent_tree_bench -lpthread
+//  ./concurrent_tree_bench
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <set>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <limits>
+#include "index/BPlusTree.h"
+
+using namespace std;
+
+constexpr int KEYS = 200000;          // even keys loaded before the run
+constexpr int OPS = 400000;           // total operations, split between threads
+constexpr int LOOKUP_PERCENT = 70;    // the rest are split evenly between inserts and removes
+
+struct RunResult {
+    double opsPerSec;
+    bool ok;
+};
+
+RunResult run(const string& file, int order, size_t cacheNodes, int threads) {
+    remove(file.c_str());
+    BPlusTree* tree = order ? new BPlusTree(order, file, cacheNodes) : new BPlusTree(file, cacheNodes);
+
+    vector<pair<Key, RID>> entries;
+    for (int i = 0; i < KEYS; i++)
+        entries.push_back({2 * i, RID{static_cast<uint32_t>(i), 0}});
+    tree->bulkLoad(entries);
+
+    vector<set<Key>> owned(threads);
+    atomic<bool> failed{false};
+    auto worker = [&](int t) {
+        mt19937 rng(t + 1);
+        int slice = KEYS / threads;
+        for (int op = 0; op < OPS / threads; op++) {
+            int kind = rng() % 100;
+            if (kind < LOOKUP_PERCENT) {
+                Key key = 2 * (rng() % KEYS);
+                RID rid;
+                if (!tree->search(key, rid) || rid.pageID != static_cast<uint32_t>(key / 2))
+                    failed = true;
+                continue;
+            }
+            Key key = 2 * ((rng() % slice) * threads + t) + 1;
+            if (kind < LOOKUP_PERCENT + (100 - LOOKUP_PERCENT) / 2) {
+                if (owned[t].insert(key).second)
+                    tree->insert(key, RID{static_cast<uint32_t>(key), 1});
+            } else if (tree->remove(key) != (owned[t].erase(key) == 1)) {
+                failed = true;
+            }
+        }
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) pool.emplace_back(worker, t);
+    for (auto& th : pool) th.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    set<Key> expected;
+    for (int i = 0; i < KEYS; i++) expected.insert(2 * i);
+    for (auto& keys : owned) expected.insert(keys.begin(), keys.end());
+    vector<RID> all = tree->rangeScan(numeric_limits<Key>::min(), numeric_limits<Key>::max());
+    bool ok = !failed && all.size() == expected.size();
+    auto it = expected.begin();
+    for (size_t i = 0; ok && i < all.size(); i++, ++it) {
+        Key key = *it;
+        uint32_t pageID = key % 2 ? static_cast<uint32_t>(key) : static_cast<uint32_t>(key / 2);
+        ok = all[i].pageID == pageID;
+    }
+
+    delete tree;
+    remove(file.c_str());
+    return {OPS / secs, ok};
+}
+
+int main() {
+    bool ok = true;
+    cout << left << setw(12) << "nodes" << setw(10) << "threads"
+         << right << setw(14) << "ops/sec" << setw(8) << "check" << "\n";
+    auto report = [&](const string& nodes, int threads, const RunResult& r) {
+        cout << left << setw(12) << nodes << setw(10) << threads << right << setw(14)
+             << fixed << setprecision(0) << r.opsPerSec << setw(8) << (r.ok ? "ok" : "FAIL") << "\n";
+        ok = ok && r.ok;
+    };
+
+    for (int threads : {1, 4, 16, 64})
+        report("order 4", threads, run("concurrent_stress.db", 4, 64, threads));
+    for (int threads : {1, 4, 16, 64})
+        report("page", threads, run("concurrent_bench.db", 0, DEFAULT_NODE_CACHE, threads));
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+//Microbenchmark for in-node key search.
+//Compares the linear scan findLeaf used to do and std::upper_bound with the
+//NodeSearch kernels, on nodes filled to the page-derived orders.
+//
+//Built by CMake as node_search_bench, or from src/:
+//  g++ -std=c++17 -O2 -I. bench/NodeSearchBench.cpp index/NodeSearch.cpp -o node_search_bench
+//  ./node_search_bench
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include "index/NodePage.h"
+#include "index/NodeSearch.h"
+
+using namespace std;
+
+constexpr size_t NODES = 1024;          // distinct nodes, so the working set exceeds L1/L2
+constexpr size_t LOOKUPS = 10 * 1000 * 1000;
+
+struct Workload {
+    vector<vector<Key>> nodes;
+    vector<Key> probes;
+};
+
+Workload makeWorkload(size_t keysPerNode) {
+    mt19937 rng(42);
+    Workload w;
+    w.nodes.resize(NODES);
+    for (auto& node : w.nodes) {
+        node.resize(keysPerNode);
+        for (auto& k : node) k = static_cast<Key>(rng() % 1000000);
+        sort(node.begin(), node.end());
+    }
+    w.probes.resize(LOOKUPS);
+    for (auto& p : w.probes) p = static_cast<Key>(rng() % 1000000);
+    return w;
+}
+
+double run(const Workload& w, const function<size_t(const vector<Key>&, Key)>& search) {
+    size_t checksum = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < LOOKUPS; i++)
+        checksum += search(w.nodes[i % NODES], w.probes[i]);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (checksum == 0) cout << "";    // keep the loop from being optimized away
+    return LOOKUPS / secs;
+}
+
+int main() {
+    vector<pair<string, size_t>> sizes = {
+        {"leaf", LEAF_ORDER}, {"internal", INTERNAL_ORDER}, {"order 3", 3}};
+
+    cout << left << setw(10) << "node" << setw(6) << "keys"
+         << setw(16) << "kernel" << right << setw(16) << "lookups/sec" << "\n";
+
+    for (auto& size : sizes) {
+        Workload w = makeWorkload(size.second);
+        auto report = [&](const string& name, double rate) {
+            cout << left << setw(10) << size.first << setw(6) << size.second
+                 << setw(16) << name << right << setw(16) << fixed << setprecision(0) << rate << "\n";
+        };
+
+        report("linear", run(w, [](const vector<Key>& keys, Key key) {
+            size_t i = 0;
+            while (i < keys.size() && key >= keys[i]) i++;
+            return i;
+        }));
+        report("upper_bound", run(w, [](const vector<Key>& keys, Key key) {
+            return static_cast<size_t>(upper_bound(keys.begin(), keys.end(), key) - keys.begin());
+        }));
+
+        for (SearchKernel kernel : {SearchKernel::Scalar, SearchKernel::SSE42, SearchKernel::AVX2}) {
+            if (!forceSearchKernel(kernel)) continue;
+            report(searchKernelName(kernel), run(w, [](const vector<Key>& keys, Key key) {
+                return nodeUpperBound(keys, key);
+            }));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,409 @@
+//YCSB-style benchmark for TableFile and BPlusTree.
+//Loads a dataset, then runs the standard YCSB core workloads against it and
+//prints one JSON object per workload with the throughput, the p50/p99/p999
+//latency of each kind of operation and the engine metrics for the run, so
+//results can be diffed between builds. Every workload starts from a freshly
+//loaded dataset and a fixed seed, so runs are repeatable.
+//
+//  A  50% read, 50% update
+//  B  95% read, 5% update
+//  C  100% read
+//  D  95% read, 5% insert; reads favour the newest keys
+//  E  95% short range scan, 5% insert
+//  F  50% read, 50% read-modify-write
+//
+//Keys are chosen from a scrambled zipfian distribution (theta 0.99), or
+//uniformly with --distribution uniform. On the tree target an update is a
+//remove and re-insert of the key, and a read-modify-write a search followed
+//by one.
+//
+//With --read-batch N every read looks up N keys: in one findByKeys or
+//searchBatch call, or with --read-batch-mode loop in N findByKey or search
+//calls, so the two can be compared on the same keys. --direct-io on reads
+//and writes the files with O_DIRECT once the dataset is loaded, so reads
+//that miss the pool or the node cache go to the device.
+//
+//Build with CMake (target ycsb_bench), or from src/:
+//  g++ -std=c++17 -O2 -I. bench/YcsbBench.cpp storage/*.cpp index/*.cpp -o ycsb_bench -lpthread
+//  ./ycsb_bench --target table --records 100000 --operations 100000 --workloads ABCDEF
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include "storage/TableFile.h"
+#include "index/BPlusTree.h"
+#include "include/Metrics.h"
+
+using namespace std;
+
+constexpr double ZIPFIAN_THETA = 0.99;
+constexpr int MAX_SCAN_LENGTH = 100;
+
+struct Options {
+    string target = "table";     // table or tree
+    string workloads = "ABCDEF";
+    string distribution = "zipfian";
+    string dir = ".";
+    uint64_t records = 100000;
+    uint64_t operations = 100000;
+    int threads = 1;
+    int fields = 4;              // value columns per row, besides the key
+    int fieldLength = 50;
+    size_t poolFrames = DEFAULT_POOL_FRAMES;
+    uint64_t seed = 42;
+    size_t readBatch = 1;        // keys per read
+    bool batchedReads = true;    // a read of several keys is one batched call, not a loop
+    bool directIO = false;
+};
+
+enum class OpKind { Read, Update, Insert, Scan, ReadModifyWrite, COUNT };
+constexpr size_t OP_KINDS = static_cast<size_t>(OpKind::COUNT);
+const char* OP_KIND_NAMES[OP_KINDS] = {"read", "update", "insert", "scan", "readModifyWrite"};
+
+struct Workload {
+    char name;
+    int readPercent, updatePercent, insertPercent, scanPercent, rmwPercent;
+    bool latest; // reads favour recently inserted keys
+};
+
+const Workload WORKLOADS[] = {
+    {'A', 50, 50, 0, 0, 0, false}, {'B', 95, 5, 0, 0, 0, false}, {'C', 100, 0, 0, 0, 0, false},
+    {'D', 95, 0, 5, 0, 0, true},   {'E', 0, 0, 5, 95, 0, false}, {'F', 50, 0, 0, 0, 50, false},
+};
+
+// Zipfian ranks in [0, items), as in YCSB's ZipfianGenerator (Gray et al.,
+// "Quickly generating billion-record synthetic databases"). Rank 0 is the
+// most popular.
+class Zipfian {
+public:
+    Zipfian(uint64_t items, double theta = ZIPFIAN_THETA) : items(items), theta(theta) {
+        double zeta2 = zeta(2);
+        zetan = zeta(items);
+        alpha = 1 / (1 - theta);
+        eta = (1 - pow(2.0 / items, 1 - theta)) / (1 - zeta2 / zetan);
+    }
+    uint64_t next(mt19937_64& rng) {
+        double u = uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * zetan;
+        if (uz < 1) return 0;
+        if (uz < 1 + pow(0.5, theta)) return 1;
+        return min<uint64_t>(items - 1, static_cast<uint64_t>(items * pow(eta * u - eta + 1, alpha)));
+    }
+private:
+    uint64_t items;
+    double theta, zetan, alpha, eta;
+
+    double zeta(uint64_t n) const {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; i++)
+            sum += 1 / pow(static_cast<double>(i), theta);
+        return sum;
+    }
+};
+
+// Spreads the popular ranks over the key space, as YCSB's scrambled zipfian does
+static uint64_t fnvHash(uint64_t value) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (int i = 0; i < 8; i++) {
+        hash ^= value & 0xFF;
+        hash *= 0x100000001B3ull;
+        value >>= 8;
+    }
+    return hash;
+}
+
+class KeyChooser {
+public:
+    KeyChooser(const Options& options, bool latest)
+        : records(options.records), uniform(options.distribution == "uniform"), latest(latest),
+          zipfian(uniform ? 1 : options.records) {}
+    // A key in [0, maxKey]; without latest, zipfian keys come from the loaded ones
+    Key next(mt19937_64& rng, Key maxKey) {
+        if (uniform) return static_cast<Key>(rng() % (static_cast<uint64_t>(maxKey) + 1));
+        uint64_t rank = zipfian.next(rng);
+        if (latest) return maxKey - static_cast<Key>(rank % (static_cast<uint64_t>(maxKey) + 1));
+        return static_cast<Key>(fnvHash(rank) % records);
+    }
+private:
+    uint64_t records;
+    bool uniform;
+    bool latest;
+    Zipfian zipfian;
+};
+
+// Latencies of one kind of operation, in nanoseconds
+struct Latencies {
+    vector<uint64_t> nanos;
+
+    void add(const Latencies& other) { nanos.insert(nanos.end(), other.nanos.begin(), other.nanos.end()); }
+    string toJSON() {
+        sort(nanos.begin(), nanos.end());
+        auto percentile = [&](double p) {
+            size_t i = min(nanos.size() - 1, static_cast<size_t>(p * nanos.size()));
+            return nanos[i] / 1000.0;
+        };
+        ostringstream out;
+        out << fixed << setprecision(2) << "{\"count\":" << nanos.size() << ",\"p50\":" << percentile(0.5)
+            << ",\"p99\":" << percentile(0.99) << ",\"p999\":" << percentile(0.999)
+            << ",\"max\":" << nanos.back() / 1000.0 << "}";
+        return out.str();
+    }
+};
+
+// The operations of one target; every one of them may be called from several threads
+class Store {
+public:
+    virtual ~Store() {}
+    virtual void read(Key key) = 0;
+    virtual void readBatch(const vector<Key>& keys) = 0;
+    virtual void update(Key key, mt19937_64& rng) = 0;
+    virtual void insert(Key key, mt19937_64& rng) = 0;
+    virtual void scan(Key key, int length) = 0;
+};
+
+static string randomField(mt19937_64& rng, int length) {
+    string value(length, ' ');
+    for (auto& c : value) c = 'a' + rng() % 26;
+    return value;
+}
+
+class TableStore : public Store {
+public:
+    TableStore(const Options& options) : options(options), base(options.dir + "/ycsb_table") {
+        removeFiles();
+        table = new TableFile(base, options.poolFrames);
+        mt19937_64 rng(options.seed);
+        vector<vector<string>> rows;
+        rows.reserve(options.records);
+        for (uint64_t i = 0; i < options.records; i++)
+            rows.push_back(makeRow(static_cast<Key>(i), rng));
+        table->bulkInsert(rows);
+        if (options.directIO && !table->enableDirectIO())
+            throw runtime_error("The file system under " + options.dir + " does not support O_DIRECT");
+    }
+    ~TableStore() {
+        delete table;
+        removeFiles();
+    }
+    void read(Key key) override {
+        try {
+            table->findByKey(key);
+        } catch (const runtime_error&) {
+            // A key another thread has taken but not inserted yet
+        }
+    }
+    void readBatch(const vector<Key>& keys) override { table->findByKeys(keys); }
+    void update(Key key, mt19937_64& rng) override { table->updateRow(key, makeRow(key, rng)); }
+    void insert(Key key, mt19937_64& rng) override { table->insertRow(makeRow(key, rng)); }
+    void scan(Key key, int length) override { table->rangeQuery(key, key + length - 1); }
+private:
+    const Options& options;
+    string base;
+    TableFile* table;
+
+    vector<string> makeRow(Key key, mt19937_64& rng) const {
+        vector<string> row{to_string(key)};
+        for (int f = 0; f < options.fields; f++)
+            row.push_back(randomField(rng, options.fieldLength));
+        return row;
+    }
+    void removeFiles() const {
+        for (auto suffix : {"", "_index.db", "_fsm.db", "_wal.log", "_schema.db", "_indexes.db"})
+            remove((base + suffix).c_str());
+    }
+};
+
+class TreeStore : public Store {
+public:
+    TreeStore(const Options& options) : file(options.dir + "/ycsb_tree.db") {
+        remove(file.c_str());
+        tree = new BPlusTree(file);
+        vector<pair<Key, RID>> entries;
+        entries.reserve(options.records);
+        for (uint64_t i = 0; i < options.records; i++)
+            entries.push_back({static_cast<Key>(i), ridFor(i)});
+        tree->bulkLoad(entries);
+        if (options.directIO && !tree->enableDirectIO())
+            throw runtime_error("The file system under " + options.dir + " does not support O_DIRECT");
+    }
+    ~TreeStore() {
+        delete tree;
+        remove(file.c_str());
+    }
+    void read(Key key) override {
+        RID rid;
+        tree->search(key, rid);
+    }
+    void readBatch(const vector<Key>& keys) override {
+        vector<RID> rids;
+        vector<bool> found;
+        tree->searchBatch(keys, rids, found);
+    }
+    void update(Key key, mt19937_64&) override {
+        if (tree->remove(key)) tree->insert(key, ridFor(key));
+    }
+    void insert(Key key, mt19937_64&) override { tree->insert(key, ridFor(key)); }
+    void scan(Key key, int length) override {
+        IndexCursor cursor = tree->openRange(key, key + length - 1, length);
+        vector<pair<Key, RID>> batch;
+        cursor.next(batch);
+    }
+private:
+    string file;
+    BPlusTree* tree;
+
+    static RID ridFor(uint64_t key) { return RID{static_cast<uint32_t>(key / 16), static_cast<uint16_t>(key % 16)}; }
+};
+
+static Store* openStore(const Options& options) {
+    if (options.target == "table") return new TableStore(options);
+    if (options.target == "tree") return new TreeStore(options);
+    throw runtime_error("Unknown target " + options.target + ", expected table or tree");
+}
+
+static string runWorkload(const Options& options, const Workload& w) {
+    Store* store = openStore(options);
+    atomic<Key> nextKey{static_cast<Key>(options.records)}; // keys below it exist
+    vector<vector<Latencies>> latencies(options.threads, vector<Latencies>(OP_KINDS));
+
+    auto worker = [&](int t) {
+        mt19937_64 rng(options.seed + 1000 * (t + 1) + w.name);
+        KeyChooser chooser(options, w.latest);
+        uniform_int_distribution<int> percent(0, 99), scanLength(1, MAX_SCAN_LENGTH);
+        uint64_t ops = options.operations / options.threads + (static_cast<uint64_t>(t) < options.operations % options.threads);
+        for (uint64_t i = 0; i < ops; i++) {
+            int roll = percent(rng);
+            OpKind kind = roll < w.readPercent                                     ? OpKind::Read
+                          : (roll -= w.readPercent) < w.updatePercent              ? OpKind::Update
+                          : (roll -= w.updatePercent) < w.insertPercent            ? OpKind::Insert
+                          : (roll -= w.insertPercent) < w.scanPercent              ? OpKind::Scan
+                                                                                   : OpKind::ReadModifyWrite;
+            // Keys are chosen before the clock starts. Only reads look at keys inserted during the run.
+            Key key;
+            if (kind == OpKind::Insert)
+                key = nextKey.fetch_add(1);
+            else if (kind == OpKind::Read)
+                key = chooser.next(rng, nextKey.load() - 1);
+            else
+                key = chooser.next(rng, static_cast<Key>(options.records) - 1);
+            int length = kind == OpKind::Scan ? scanLength(rng) : 0;
+            vector<Key> keys;
+            if (kind == OpKind::Read && options.readBatch > 1) {
+                keys.push_back(key);
+                while (keys.size() < options.readBatch) keys.push_back(chooser.next(rng, nextKey.load() - 1));
+            }
+
+            auto start = chrono::steady_clock::now();
+            switch (kind) {
+            case OpKind::Read:
+                if (keys.empty()) {
+                    store->read(key);
+                } else if (options.batchedReads) {
+                    store->readBatch(keys);
+                } else {
+                    for (Key k : keys) store->read(k);
+                }
+                break;
+            case OpKind::Update: store->update(key, rng); break;
+            case OpKind::Insert: store->insert(key, rng); break;
+            case OpKind::Scan: store->scan(key, length); break;
+            default:
+                store->read(key);
+                store->update(key, rng);
+                break;
+            }
+            latencies[t][static_cast<size_t>(kind)].nanos.push_back(
+                chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+        }
+    };
+
+    Metrics::reset();
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < options.threads; t++) workers.emplace_back(worker, t);
+    for (auto& th : workers) th.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    string metrics = Metrics::toJSON();
+    delete store;
+
+    ostringstream out;
+    out << fixed << setprecision(2) << "{\"workload\":\"" << w.name << "\",\"target\":\"" << options.target
+        << "\",\"distribution\":\"" << options.distribution << "\",\"records\":" << options.records
+        << ",\"operations\":" << options.operations << ",\"threads\":" << options.threads
+        << ",\"readBatch\":" << options.readBatch << ",\"readBatchMode\":\"" << (options.batchedReads ? "batched" : "loop")
+        << "\",\"directIO\":" << (options.directIO ? "true" : "false") << ",\"seconds\":" << secs
+        << ",\"opsPerSec\":" << options.operations / secs << ",\"latencyMicros\":{";
+    bool first = true;
+    for (size_t k = 0; k < OP_KINDS; k++) {
+        Latencies all;
+        for (auto& perThread : latencies) all.add(perThread[k]);
+        if (all.nanos.empty()) continue;
+        out << (first ? "" : ",") << '"' << OP_KIND_NAMES[k] << "\":" << all.toJSON();
+        first = false;
+    }
+    out << "},\"metrics\":" << metrics << "}";
+    return out.str();
+}
+
+static void usage() {
+    cerr << "usage: ycsb_bench [--target table|tree] [--workloads ABCDEF] [--distribution zipfian|uniform]\n"
+            "                  [--records N] [--operations N] [--threads N] [--fields N] [--field-length N]\n"
+            "                  [--pool-frames N] [--seed N] [--dir PATH]\n"
+            "                  [--read-batch N] [--read-batch-mode batched|loop] [--direct-io on|off]\n";
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (i + 1 == argc) {
+            usage();
+            return 2;
+        }
+        string value = argv[++i];
+        if (arg == "--target") options.target = value;
+        else if (arg == "--workloads") options.workloads = value;
+        else if (arg == "--distribution") options.distribution = value;
+        else if (arg == "--dir") options.dir = value;
+        else if (arg == "--records") options.records = stoull(value);
+        else if (arg == "--operations") options.operations = stoull(value);
+        else if (arg == "--threads") options.threads = stoi(value);
+        else if (arg == "--fields") options.fields = stoi(value);
+        else if (arg == "--field-length") options.fieldLength = stoi(value);
+        else if (arg == "--pool-frames") options.poolFrames = stoull(value);
+        else if (arg == "--seed") options.seed = stoull(value);
+        else if (arg == "--read-batch") options.readBatch = stoull(value);
+        else if (arg == "--read-batch-mode" && (value == "batched" || value == "loop")) options.batchedReads = value == "batched";
+        else if (arg == "--direct-io" && (value == "on" || value == "off")) options.directIO = value == "on";
+        else {
+            usage();
+            return 2;
+        }
+    }
+    if (options.records < 2 || options.threads < 1 || options.readBatch < 1 ||
+        (options.distribution != "zipfian" && options.distribution != "uniform")) {
+        usage();
+        return 2;
+    }
+
+    try {
+        for (char name : options.workloads) {
+            auto w = find_if(begin(WORKLOADS), end(WORKLOADS), [&](const Workload& w) { return w.name == toupper(name); });
+            if (w == end(WORKLOADS)) throw runtime_error(string("Unknown workload ") + name);
+            cout << runWorkload(options, *w) << endl;
+        }
+    } catch (const exception& e) {
+        cerr << "ycsb_bench: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
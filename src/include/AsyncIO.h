@@ -0,0 +1,295 @@
+#pragma once
+//Async I/O
+//Runs batches of page reads and writes with many requests in flight. On
+//Linux the requests go through io_uring, driven with raw system calls; where
+//io_uring is missing or forbidden a small thread pool issues pread/pwrite
+//instead. Either way requests complete in whatever order the device finishes
+//them, and the caller is told about each one as it completes.
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+using namespace std;
+
+struct IOConfig {
+    uint32_t queueDepth = 64;  // most requests in flight at once
+    uint32_t submitBatch = 16; // requests handed to the kernel per submission
+    bool useUring = true;      // false forces the thread pool
+};
+
+struct IORequest {
+    bool write;
+    uint64_t offset;
+    char* buf;
+    size_t len;
+};
+
+struct AsyncIOStats {
+    bool uring;            // io_uring backend, otherwise the thread pool
+    uint32_t queueDepth;
+    uint32_t submitBatch;
+    uint64_t reads;        // requests completed
+    uint64_t writes;
+    uint64_t submissions;  // io_uring_enter calls that submitted requests, or hand-offs to the pool
+    uint64_t maxInFlight;  // deepest the queue got
+};
+
+constexpr uint32_t IO_POOL_THREADS = 4; // thread pool size, capped by the queue depth
+
+class AsyncIO {
+public:
+    AsyncIO(int fd, const IOConfig& config = IOConfig())
+        : fd(fd), queueDepth(max(1u, config.queueDepth)), submitBatch(clamp(config.submitBatch, 1u, queueDepth)),
+          stats{}, ringFd(-1) {
+        if (config.useUring) setupRing();
+        stats.uring = ringFd >= 0;
+        stats.queueDepth = queueDepth;
+        stats.submitBatch = submitBatch;
+    }
+    ~AsyncIO() {
+        if (ringFd >= 0) {
+            munmap(sqRing, sqRingBytes);
+            if (cqRing != sqRing) munmap(cqRing, cqRingBytes);
+            munmap(sqes, sqesBytes);
+            close(ringFd);
+        }
+        {
+            lock_guard<mutex> guard(poolLatch);
+            stopping = true;
+        }
+        poolWork.notify_all();
+        for (auto& t : workers)
+            t.join();
+    }
+    AsyncIO(const AsyncIO&) = delete;
+    AsyncIO& operator=(const AsyncIO&) = delete;
+
+    // Runs every request, keeping up to queueDepth in flight, and calls
+    // onComplete(i) on this thread as request i finishes. Returns once all
+    // are done; the first failure is thrown after the rest have finished,
+    // so no transfer is still touching a buffer when it returns. On a file
+    // in direct mode the buffers must be IO_ALIGNMENT aligned.
+    void run(vector<IORequest>& requests, const function<void(size_t)>& onComplete = nullptr) {
+        lock_guard<mutex> guard(runLatch);
+        if (requests.empty()) return;
+        if (ringFd >= 0) {
+            runRing(requests, onComplete);
+        } else {
+            if (workers.empty()) startPool(); // started on first use
+            runPool(requests, onComplete);
+        }
+    }
+
+    AsyncIOStats getStats() const {
+        lock_guard<mutex> guard(runLatch);
+        return stats;
+    }
+private:
+    int fd;
+    uint32_t queueDepth;
+    uint32_t submitBatch;
+    mutable mutex runLatch; // one batch at a time
+    AsyncIOStats stats;
+
+    // io_uring rings, shared with the kernel
+    int ringFd;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingBytes = 0, cqRingBytes = 0, sqesBytes = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+    unsigned *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    // Thread pool fallback: workers take request indexes from work and put
+    // (index, result) on done
+    vector<thread> workers;
+    mutex poolLatch;
+    condition_variable poolWork, poolDone;
+    deque<size_t> work;
+    deque<pair<size_t, ssize_t>> done;
+    vector<IORequest>* batch = nullptr;
+    bool stopping = false;
+
+    bool setupRing() {
+        io_uring_params params{};
+        int ring = syscall(__NR_io_uring_setup, queueDepth, &params);
+        if (ring < 0) return false;
+        sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) sqRingBytes = cqRingBytes = max(sqRingBytes, cqRingBytes);
+        sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+
+        sqRing = mmap(nullptr, sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+        cqRing = singleMap ? sqRing
+                           : mmap(nullptr, cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring,
+                                  IORING_OFF_CQ_RING);
+        void* sqeMap = mmap(nullptr, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqeMap == MAP_FAILED) {
+            if (sqRing != MAP_FAILED) munmap(sqRing, sqRingBytes);
+            if (!singleMap && cqRing != MAP_FAILED) munmap(cqRing, cqRingBytes);
+            if (sqeMap != MAP_FAILED) munmap(sqeMap, sqesBytes);
+            close(ring);
+            return false;
+        }
+        char* sq = static_cast<char*>(sqRing);
+        char* cq = static_cast<char*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        sqes = static_cast<io_uring_sqe*>(sqeMap);
+        // The kernel may round the rings up, never down
+        queueDepth = min(queueDepth, params.sq_entries);
+        submitBatch = min(submitBatch, queueDepth);
+        ringFd = ring;
+        return true;
+    }
+
+    void runRing(vector<IORequest>& requests, const function<void(size_t)>& onComplete) {
+        size_t next = 0, finished = 0;
+        uint32_t inFlight = 0, queued = 0; // queued: in the SQ ring, not yet taken by the kernel
+        string failure;
+        while (finished < requests.size()) {
+            while (next < requests.size() && inFlight + queued < queueDepth && queued < submitBatch) {
+                unsigned tail = *sqTail;
+                unsigned idx = tail & *sqMask;
+                io_uring_sqe* sqe = &sqes[idx];
+                memset(sqe, 0, sizeof(*sqe));
+                const IORequest& req = requests[next];
+                sqe->opcode = req.write ? IORING_OP_WRITE : IORING_OP_READ;
+                sqe->fd = fd;
+                sqe->off = req.offset;
+                sqe->addr = reinterpret_cast<uint64_t>(req.buf);
+                sqe->len = req.len;
+                sqe->user_data = next;
+                sqArray[idx] = idx;
+                __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+                next++;
+                queued++;
+            }
+            // Block for a completion only when nothing more can be queued
+            bool full = next == requests.size() || inFlight + queued >= queueDepth;
+            unsigned minComplete = full && queued + inFlight > 0 ? 1 : 0;
+            int submitted = syscall(__NR_io_uring_enter, ringFd, queued, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (submitted < 0) {
+                // Busy: reap what has completed and try again
+                if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                    throw runtime_error(string("io_uring_enter failed: ") + strerror(errno));
+                submitted = 0;
+            }
+            if (submitted > 0) stats.submissions++;
+            queued -= submitted;
+            inFlight += submitted;
+            stats.maxInFlight = max<uint64_t>(stats.maxInFlight, inFlight);
+
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++) {
+                const io_uring_cqe& cqe = cqes[head & *cqMask];
+                size_t i = cqe.user_data;
+                complete(requests[i], cqe.res, failure);
+                inFlight--;
+                finished++;
+                if (onComplete && failure.empty()) onComplete(i);
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+        if (!failure.empty()) throw runtime_error(failure);
+    }
+
+    void startPool() {
+        uint32_t n = min(IO_POOL_THREADS, queueDepth);
+        for (uint32_t i = 0; i < n; i++)
+            workers.emplace_back([this] { poolWorker(); });
+    }
+
+    void poolWorker() {
+        unique_lock<mutex> guard(poolLatch);
+        while (true) {
+            poolWork.wait(guard, [this] { return stopping || !work.empty(); });
+            if (stopping) return;
+            size_t i = work.front();
+            work.pop_front();
+            IORequest req = (*batch)[i];
+            guard.unlock();
+            ssize_t res = req.write ? pwrite(fd, req.buf, req.len, req.offset) : pread(fd, req.buf, req.len, req.offset);
+            if (res < 0) res = -errno;
+            guard.lock();
+            done.push_back({i, res});
+            poolDone.notify_one();
+        }
+    }
+
+    void runPool(vector<IORequest>& requests, const function<void(size_t)>& onComplete) {
+        size_t next = 0, finished = 0;
+        uint32_t inFlight = 0;
+        string failure;
+        unique_lock<mutex> guard(poolLatch);
+        batch = &requests;
+        while (finished < requests.size()) {
+            uint32_t added = 0;
+            while (next < requests.size() && inFlight < queueDepth && added < submitBatch) {
+                work.push_back(next++);
+                inFlight++;
+                added++;
+            }
+            if (added) {
+                stats.submissions++;
+                stats.maxInFlight = max<uint64_t>(stats.maxInFlight, inFlight);
+                poolWork.notify_all();
+            }
+            poolDone.wait(guard, [this] { return !done.empty(); });
+            while (!done.empty()) {
+                auto [i, res] = done.front();
+                done.pop_front();
+                inFlight--;
+                finished++;
+                guard.unlock();
+                complete(requests[i], res, failure);
+                if (onComplete && failure.empty()) onComplete(i);
+                guard.lock();
+            }
+        }
+        batch = nullptr;
+        if (!failure.empty()) throw runtime_error(failure);
+    }
+
+    // A short transfer (only at the end of the file for reads) finishes
+    // synchronously; errors are kept for the end of the batch
+    void complete(IORequest& req, ssize_t res, string& failure) {
+        if (res >= 0 && static_cast<size_t>(res) < req.len) {
+            size_t have = res;
+            while (have < req.len) {
+                ssize_t n = req.write ? pwrite(fd, req.buf + have, req.len - have, req.offset + have)
+                                      : pread(fd, req.buf + have, req.len - have, req.offset + have);
+                if (n <= 0) {
+                    res = n < 0 ? -errno : -EIO;
+                    break;
+                }
+                have += n;
+            }
+            if (have == req.len) res = req.len;
+        }
+        if (res < 0 && failure.empty())
+            failure = string(req.write ? "Async write" : "Async read") + " failed: " + strerror(-res);
+        (req.write ? stats.writes : stats.reads)++;
+    }
+};
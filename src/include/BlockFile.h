@@ -0,0 +1,144 @@
+#pragma once
+//Block File
+//Positional I/O on a file of fixed-size pages. Reads and writes go through
+//pread/pwrite at an explicit offset, so threads never share a file position
+//and nothing is buffered in user space. Durability points are explicit
+//(datasync), and O_DIRECT can be switched on to bypass the page cache.
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// O_DIRECT needs the buffer, offset and length aligned to the logical block
+// size of the device; 4 KB covers every device we run on
+constexpr size_t IO_ALIGNMENT = 4096;
+
+// Allocator for page buffers that direct I/O can use as they are
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        void* p = nullptr;
+        if (posix_memalign(&p, IO_ALIGNMENT, n * sizeof(T)) != 0) throw bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) { free(p); }
+};
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return false; }
+
+using IOBuffer = vector<char, AlignedAllocator<char>>;
+
+class BlockFile {
+public:
+    explicit BlockFile(const string& path) : filename(path), direct(false) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) throw runtime_error("Failed to open " + path);
+    }
+    ~BlockFile() { close(fd); }
+    BlockFile(const BlockFile&) = delete;
+    BlockFile& operator=(const BlockFile&) = delete;
+
+    // Switches O_DIRECT on or off. Returns false, staying on buffered I/O,
+    // when the file system does not support it. Call before any I/O starts.
+    bool setDirect(bool on) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0) return false;
+        flags = on ? flags | O_DIRECT : flags & ~O_DIRECT;
+        if (fcntl(fd, F_SETFL, flags) != 0) return false;
+        direct = on;
+        return true;
+    }
+    bool isDirect() const { return direct; }
+
+    uint64_t size() const {
+        struct stat st;
+        if (fstat(fd, &st) != 0) throw runtime_error("Failed to stat " + filename);
+        return st.st_size;
+    }
+
+    // Reads exactly len bytes; short reads (past the end) are errors
+    void read(uint64_t offset, char* buf, size_t len) {
+        checkAligned(offset, len);
+        if (direct && !aligned(buf)) {
+            IOBuffer& bounce = bounceBuffer(len);
+            readFully(offset, bounce.data(), len);
+            memcpy(buf, bounce.data(), len);
+            return;
+        }
+        readFully(offset, buf, len);
+    }
+
+    void write(uint64_t offset, const char* buf, size_t len) {
+        checkAligned(offset, len);
+        if (direct && !aligned(buf)) {
+            IOBuffer& bounce = bounceBuffer(len);
+            memcpy(bounce.data(), buf, len);
+            buf = bounce.data();
+        }
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = pwrite(fd, buf + done, len - done, offset + done);
+            if (n <= 0) throw runtime_error("Failed to write " + filename);
+            done += n;
+        }
+    }
+
+    // Forces written data (and the file size) to stable storage
+    void datasync() {
+        if (fdatasync(fd) != 0) throw runtime_error("Failed to sync " + filename);
+    }
+
+    // posix_fadvise hint for [offset, offset + len); len 0 means to the end.
+    // Only a hint, so failures are ignored, and there is no page cache to
+    // advise under O_DIRECT.
+    void advise(uint64_t offset, uint64_t len, int advice) {
+        if (!direct) posix_fadvise(fd, offset, len, advice);
+    }
+
+    const string& path() const { return filename; }
+    // For AsyncIO, which issues its own transfers on the file
+    int descriptor() const { return fd; }
+private:
+    string filename;
+    int fd;
+    atomic<bool> direct;
+
+    static bool aligned(const void* p) { return reinterpret_cast<uintptr_t>(p) % IO_ALIGNMENT == 0; }
+
+    void checkAligned(uint64_t offset, size_t len) const {
+        if (direct && (offset % IO_ALIGNMENT != 0 || len % IO_ALIGNMENT != 0))
+            throw runtime_error("Unaligned direct I/O on " + filename);
+    }
+
+    void readFully(uint64_t offset, char* buf, size_t len) {
+        size_t done = 0;
+        while (done < len) {
+            ssize_t n = pread(fd, buf + done, len - done, offset + done);
+            if (n <= 0) throw runtime_error("Failed to read " + filename);
+            done += n;
+        }
+    }
+
+    // Per-thread staging buffer for callers whose buffers are not aligned
+    static IOBuffer& bounceBuffer(size_t len) {
+        thread_local IOBuffer buffer;
+        if (buffer.size() < len) buffer.resize(len);
+        return buffer;
+    }
+};
@@ -7,3 +7,10 @@ struct RID {
     uint32_t pageID;
     uint16_t slotID;
 };
+
+inline bool operator==(const RID& a, const RID& b) { return a.pageID == b.pageID && a.slotID == b.slotID; }
+inline bool operator!=(const RID& a, const RID& b) { return !(a == b); }
+// Physical order; breaks ties between equal keys in non-unique indexes
+inline bool operator<(const RID& a, const RID& b) {
+    return a.pageID != b.pageID ? a.pageID < b.pageID : a.slotID < b.slotID;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// fstream has no fsync; syncing any descriptor of the file forces its
+// written data to stable storage, so open a throwaway one for it
+inline void syncFile(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("Failed to open " + path + " for sync");
+    int rc = fsync(fd);
+    close(fd);
+    if (rc != 0) throw runtime_error("Failed to sync " + path);
+}
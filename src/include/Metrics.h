@@ -0,0 +1,302 @@
+#pragma once
+//Metrics
+//Engine-wide counters and per-operation latency histograms. Each thread
+//counts into a slot of its own, so the hot paths never share a cache line
+//or take a lock; reading the metrics sums the slots of the live threads and
+//what exited threads left behind. Latencies go into log2 buckets of
+//nanoseconds, which is enough to read off p50/p99/p999 within a factor of two.
+//
+//Every operation is counted, but only one in setTimingSample() of each kind
+//is timed per thread: two clock reads cost as much as a cached tree lookup's
+//descent through one level.
+//
+//The metrics are process wide: every table and tree counts into the same
+//totals. Per-table figures such as tree heights are in TableFile::statsJSON.
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdint>
+
+using namespace std;
+
+enum class Counter : uint32_t {
+    PageReads,        // table pages read from disk, by fetch or prefetch
+    PageWrites,       // table pages written to disk
+    PageBytesRead,
+    PageBytesWritten,
+    PoolHits,         // fetches served from a resident frame
+    PoolMisses,
+    PoolFlushes,      // flushAll batches that wrote anything
+    NodeReads,        // index node pages read from disk
+    NodeWrites,       // index node pages written to disk
+    NodeBytesRead,
+    NodeBytesWritten,
+    NodeCacheHits,    // node lookups served from the node cache
+    NodeCacheMisses,
+    NodeSplits,       // leaf and internal node splits
+    NodeMerges,
+    NodeBorrows,      // entries moved from a sibling to fix an underflow
+    LogFlushes,       // write-ahead log syncs
+    LogBytesWritten,
+    Checkpoints,
+    IndexOnlyRows,    // rows answered from a covering index without reading the heap
+    COUNT
+};
+
+enum class Op : uint32_t {
+    TableInsert,
+    TableLookup,
+    TableRange,
+    TableDelete,
+    IndexInsert,
+    IndexLookup,
+    IndexRange,
+    IndexDelete,
+    TableBatchLookup, // one findByKeys call, whatever the number of keys
+    IndexBatchLookup,
+    COUNT
+};
+
+constexpr size_t COUNTER_COUNT = static_cast<size_t>(Counter::COUNT);
+constexpr size_t OP_COUNT = static_cast<size_t>(Op::COUNT);
+constexpr size_t LATENCY_BUCKETS = 64; // bucket i holds latencies in [2^i, 2^(i+1)) ns; bucket 0 also holds 0
+constexpr uint32_t DEFAULT_TIMING_SAMPLE = 8; // one operation in this many is timed
+
+inline const char* counterName(Counter c) {
+    static const char* names[COUNTER_COUNT] = {
+        "pageReads",     "pageWrites",       "pageBytesRead",   "pageBytesWritten", "poolHits",
+        "poolMisses",    "poolFlushes",      "nodeReads",       "nodeWrites",       "nodeBytesRead",
+        "nodeBytesWritten", "nodeCacheHits", "nodeCacheMisses", "nodeSplits",       "nodeMerges",
+        "nodeBorrows",   "logFlushes",       "logBytesWritten", "checkpoints",
+        "indexOnlyRows"};
+    return names[static_cast<size_t>(c)];
+}
+
+inline const char* opName(Op op) {
+    static const char* names[OP_COUNT] = {"tableInsert", "tableLookup", "tableRange", "tableDelete",
+                                          "indexInsert", "indexLookup", "indexRange", "indexDelete",
+                                          "tableBatchLookup", "indexBatchLookup"};
+    return names[static_cast<size_t>(op)];
+}
+
+struct LatencyHistogram {
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t ops;        // operations run
+    uint64_t count;      // operations timed, the sum of the buckets
+    uint64_t totalNanos; // of the timed ones
+
+    double meanNanos() const { return count ? static_cast<double>(totalNanos) / count : 0; }
+    // Latency below which a fraction p of the operations fell, interpolated
+    // within its bucket
+    double percentileNanos(double p) const {
+        if (count == 0) return 0;
+        double rank = p * count;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+            if (buckets[i] == 0) continue;
+            if (seen + buckets[i] >= rank) {
+                double low = i == 0 ? 0 : static_cast<double>(1ull << i);
+                double high = static_cast<double>(2ull << min<size_t>(i, 62));
+                return low + (high - low) * (rank - seen) / buckets[i];
+            }
+            seen += buckets[i];
+        }
+        return static_cast<double>(2ull << 62);
+    }
+};
+
+struct MetricsSnapshot {
+    uint64_t counters[COUNTER_COUNT];
+    LatencyHistogram latency[OP_COUNT];
+
+    uint64_t operator[](Counter c) const { return counters[static_cast<size_t>(c)]; }
+    const LatencyHistogram& operator[](Op op) const { return latency[static_cast<size_t>(op)]; }
+    string toJSON() const {
+        ostringstream out;
+        out << "{\"counters\":{";
+        for (size_t i = 0; i < COUNTER_COUNT; i++)
+            out << (i ? "," : "") << '"' << counterName(static_cast<Counter>(i)) << "\":" << counters[i];
+        out << "},\"latencyNanos\":{";
+        for (size_t i = 0; i < OP_COUNT; i++) {
+            const LatencyHistogram& h = latency[i];
+            out << (i ? "," : "") << '"' << opName(static_cast<Op>(i)) << "\":{\"ops\":" << h.ops << ",\"timed\":" << h.count
+                << ",\"mean\":" << static_cast<uint64_t>(h.meanNanos())
+                << ",\"p50\":" << static_cast<uint64_t>(h.percentileNanos(0.5))
+                << ",\"p99\":" << static_cast<uint64_t>(h.percentileNanos(0.99))
+                << ",\"p999\":" << static_cast<uint64_t>(h.percentileNanos(0.999)) << ",\"buckets\":[";
+            // Trailing empty buckets are left out
+            size_t last = LATENCY_BUCKETS;
+            while (last > 0 && h.buckets[last - 1] == 0) last--;
+            for (size_t b = 0; b < last; b++)
+                out << (b ? "," : "") << h.buckets[b];
+            out << "]}";
+        }
+        out << "}}";
+        return out.str();
+    }
+};
+
+class Metrics {
+public:
+    static void count(Counter c, uint64_t n = 1) {
+        bump(slot().counters[static_cast<size_t>(c)], n);
+    }
+    // Counts an operation; true when this one should be timed and recorded
+    static bool startOp(Op op) {
+        Slot& s = slot();
+        size_t i = static_cast<size_t>(op);
+        bump(s.ops[i], 1);
+        if (--s.countdown[i] > 0) return false;
+        uint32_t every = sampleEvery().load(memory_order_relaxed);
+        s.countdown[i] = max(every, 1u);
+        return every != 0;
+    }
+    static void record(Op op, uint64_t nanos) {
+        Slot& s = slot();
+        size_t i = static_cast<size_t>(op);
+        size_t bucket = nanos ? 63 - __builtin_clzll(nanos) : 0;
+        bump(s.buckets[i][bucket], 1);
+        bump(s.totalNanos[i], nanos);
+    }
+
+    // Totals since the start or the last reset
+    static MetricsSnapshot snapshot() {
+        Registry& r = registry();
+        lock_guard<mutex> guard(r.latch);
+        MetricsSnapshot totals = sum(r);
+        subtract(totals, r.baseline);
+        return totals;
+    }
+    // Counting goes on; later snapshots only cover what happens from here
+    static void reset() {
+        Registry& r = registry();
+        lock_guard<mutex> guard(r.latch);
+        r.baseline = sum(r);
+    }
+    static string toJSON() { return snapshot().toJSON(); }
+
+    // Times one in every operations of each kind per thread; 1 times them
+    // all, 0 none. A thread picks the new rate up at its next sample.
+    static void setTimingSample(uint32_t every) { sampleEvery().store(every, memory_order_relaxed); }
+
+private:
+    // Only the owning thread writes a slot, so a relaxed load and store
+    // stands in for a locked increment; readers see each value whole
+    struct Slot {
+        atomic<uint64_t> counters[COUNTER_COUNT]{};
+        atomic<uint64_t> buckets[OP_COUNT][LATENCY_BUCKETS]{};
+        atomic<uint64_t> totalNanos[OP_COUNT]{};
+        atomic<uint64_t> ops[OP_COUNT]{};
+        uint32_t countdown[OP_COUNT]; // operations of each kind until the next timed one; owner only
+
+        Slot() {
+            for (auto& c : countdown) c = 1;
+        }
+    };
+
+    struct Registry {
+        mutex latch;
+        vector<Slot*> live;
+        MetricsSnapshot retired{}; // left behind by exited threads
+        MetricsSnapshot baseline{};
+    };
+
+    // Registers the thread's slot on first use and folds it into the
+    // retired totals when the thread exits
+    struct SlotOwner {
+        Slot slot;
+        SlotOwner() {
+            Registry& r = registry();
+            lock_guard<mutex> guard(r.latch);
+            r.live.push_back(&slot);
+        }
+        ~SlotOwner() {
+            Registry& r = registry();
+            lock_guard<mutex> guard(r.latch);
+            add(r.retired, slot);
+            for (size_t i = 0; i < r.live.size(); i++) {
+                if (r.live[i] == &slot) {
+                    r.live[i] = r.live.back();
+                    r.live.pop_back();
+                    break;
+                }
+            }
+        }
+    };
+
+    static void bump(atomic<uint64_t>& value, uint64_t n) {
+        value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+
+    static Slot& slot() {
+        thread_local SlotOwner owner;
+        return owner.slot;
+    }
+
+    static Registry& registry() {
+        static Registry r;
+        return r;
+    }
+
+    static atomic<uint32_t>& sampleEvery() {
+        static atomic<uint32_t> every{DEFAULT_TIMING_SAMPLE};
+        return every;
+    }
+
+    static void add(MetricsSnapshot& totals, const Slot& s) {
+        for (size_t i = 0; i < COUNTER_COUNT; i++)
+            totals.counters[i] += s.counters[i].load(memory_order_relaxed);
+        for (size_t i = 0; i < OP_COUNT; i++) {
+            LatencyHistogram& h = totals.latency[i];
+            for (size_t b = 0; b < LATENCY_BUCKETS; b++) {
+                uint64_t n = s.buckets[i][b].load(memory_order_relaxed);
+                h.buckets[b] += n;
+                h.count += n;
+            }
+            h.totalNanos += s.totalNanos[i].load(memory_order_relaxed);
+            h.ops += s.ops[i].load(memory_order_relaxed);
+        }
+    }
+
+    static MetricsSnapshot sum(Registry& r) {
+        MetricsSnapshot totals = r.retired;
+        for (Slot* s : r.live)
+            add(totals, *s);
+        return totals;
+    }
+
+    static void subtract(MetricsSnapshot& totals, const MetricsSnapshot& base) {
+        for (size_t i = 0; i < COUNTER_COUNT; i++)
+            totals.counters[i] -= base.counters[i];
+        for (size_t i = 0; i < OP_COUNT; i++) {
+            for (size_t b = 0; b < LATENCY_BUCKETS; b++)
+                totals.latency[i].buckets[b] -= base.latency[i].buckets[b];
+            totals.latency[i].ops -= base.latency[i].ops;
+            totals.latency[i].count -= base.latency[i].count;
+            totals.latency[i].totalNanos -= base.latency[i].totalNanos;
+        }
+    }
+};
+
+// Counts one op, and when it is sampled records the time from construction
+// to destruction
+class OpTimer {
+public:
+    explicit OpTimer(Op op) : op(op), timed(Metrics::startOp(op)) {
+        if (timed) start = chrono::steady_clock::now();
+    }
+    ~OpTimer() {
+        if (timed)
+            Metrics::record(op, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+    }
+    OpTimer(const OpTimer&) = delete;
+    OpTimer& operator=(const OpTimer&) = delete;
+private:
+    Op op;
+    bool timed;
+    chrono::steady_clock::time_point start;
+};
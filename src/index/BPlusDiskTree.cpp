@@ -1,113 +1,170 @@
 #include "BPlusDiskTree.h"
+#include "include/Metrics.h"
 #include <stdexcept>
 #include <cstring>
 #include <vector>
+#include <algorithm>
 
 using namespace std;
 
-BPlusDiskTree::BPlusDiskTree(const string& filename) {
-    file.open(filename, ios::in | ios::out | ios::binary);
-    if (!file.is_open()) {
-        file.clear();
-        file.open(filename, ios::out | ios::binary);
-        file.close();
-        file.open(filename, ios::in | ios::out | ios::binary);
-
-        // Initialize metadata page
-        IndexMeta meta{INVALID_NODE};
-        file.write(reinterpret_cast<char*>(&meta), sizeof(meta));
-
-        // Pad rest of first page
-        vector<char> pad(INDEX_PAGE_SIZE - sizeof(meta), 0);
-        file.write(pad.data(), pad.size());
-        file.flush();
+constexpr uint32_t FREE_PAGE_MAGIC = 0x45455246; // "FREE"
+
+static uint64_t nodeOffset(uint32_t nodeID) {
+    return static_cast<uint64_t>(nodeID + 1) * INDEX_PAGE_SIZE;
+}
+
+// Every page transfer counts, the meta page and free list links included
+static void countReads(uint64_t pages) {
+    Metrics::count(Counter::NodeReads, pages);
+    Metrics::count(Counter::NodeBytesRead, pages * INDEX_PAGE_SIZE);
+}
+
+static void countWrites(uint64_t pages) {
+    Metrics::count(Counter::NodeWrites, pages);
+    Metrics::count(Counter::NodeBytesWritten, pages * INDEX_PAGE_SIZE);
+}
+
+BPlusDiskTree::BPlusDiskTree(const string& filename)
+    : file(filename), io(file.descriptor()), nodeCount(0), freePages(0), freeListHead(INVALID_NODE), freeListDirty(false) {
+    uint64_t size = file.size();
+    if (size < INDEX_PAGE_SIZE) {
+        // Initialize metadata page, padded to a full page
+        alignas(IO_ALIGNMENT) char page[INDEX_PAGE_SIZE]{};
+        IndexMeta meta{INVALID_NODE, 0, 0, 0, 0, 0, INVALID_NODE, 0};
+        memcpy(page, &meta, sizeof(meta));
+        file.write(0, page, INDEX_PAGE_SIZE);
+        countWrites(1);
+    } else {
+        nodeCount = size / INDEX_PAGE_SIZE - 1;
+        IndexMeta meta = readMeta();
+        freePages = meta.freePages;
+        freeListHead = freePages ? meta.freeListHead : INVALID_NODE;
     }
-    // file.seekg(0, ios::end);
-    // if (file.tellg() < INDEX_PAGE_SIZE) {
-    //     file.seekp(0);
-    //     IndexMeta meta{INVALID_NODE};
-    //     file.write(reinterpret_cast<char*>(&meta), sizeof(meta));
-    //     vector<char> pad(INDEX_PAGE_SIZE - sizeof(meta), 0);
-    //     file.write(pad.data(), pad.size());
-    //     file.flush();
-    // }
+    // Lookups touch scattered nodes; read-ahead would only evict useful pages
+    file.advise(0, 0, POSIX_FADV_RANDOM);
 }
 
 uint32_t BPlusDiskTree::readRootID() {
-    IndexMeta meta{};
-    file.seekg(0);
-    if (!file.read(reinterpret_cast<char*>(&meta), sizeof(meta))) {
-        return INVALID_NODE;
-    }
-    return meta.rootNodeID;
+    return readMeta().rootNodeID;
 }
 
 
 void BPlusDiskTree::writeRootID(uint32_t id) {
-    IndexMeta meta{id};
-    file.seekp(0);
-    file.write(reinterpret_cast<char*>(&meta), sizeof(meta));
-    file.flush();
+    IndexMeta meta = readMeta();
+    meta.rootNodeID = id;
+    writeMeta(meta);
 }
 
-uint32_t BPlusDiskTree::allocateNode() {
-    file.seekp(0, ios::end);
-    uint32_t nodeID = (file.tellp() / INDEX_PAGE_SIZE) - 1;
-    vector<char> emptyPage(INDEX_PAGE_SIZE, 0);
-    file.write(emptyPage.data(), INDEX_PAGE_SIZE);
-    file.flush();
-    return nodeID;
+IndexMeta BPlusDiskTree::readMeta() {
+    alignas(IO_ALIGNMENT) char page[INDEX_PAGE_SIZE];
+    file.read(0, page, INDEX_PAGE_SIZE);
+    countReads(1);
+    IndexMeta meta;
+    memcpy(&meta, page, sizeof(meta));
+    return meta;
 }
 
-void BPlusDiskTree::writeNode(const NodePage& node) {
-    char buffer[INDEX_PAGE_SIZE]{};
-    size_t offset = 0;
+void BPlusDiskTree::writeMeta(const IndexMeta& meta) {
+    lock_guard<mutex> guard(allocLatch);
+    IndexMeta stamped = meta;
+    stamped.freePages = freePages;
+    stamped.freeListHead = freeListHead;
+    alignas(IO_ALIGNMENT) char page[INDEX_PAGE_SIZE]{};
+    memcpy(page, &stamped, sizeof(stamped));
+    file.write(0, page, INDEX_PAGE_SIZE);
+    countWrites(1);
+    freeListDirty = false;
+}
 
-    memcpy(buffer, &node.header, sizeof(NodeHeader));
-    offset += sizeof(NodeHeader);
+void BPlusDiskTree::flushFreeList() {
+    {
+        lock_guard<mutex> guard(allocLatch);
+        if (!freeListDirty) return;
+    }
+    writeMeta(readMeta());
+}
 
-    memcpy(buffer + offset, node.keys.data(),
-           node.keys.size() * sizeof(Key));
-    offset += node.keys.size() * sizeof(Key);
+void BPlusDiskTree::sync() {
+    file.datasync();
+}
 
-    if (node.header.isLeaf) {
-        memcpy(buffer + offset, node.rids.data(),
-               node.rids.size() * sizeof(RID));
-    } else {
-        memcpy(buffer + offset, node.children.data(),
-               node.children.size() * sizeof(uint32_t));
+uint32_t BPlusDiskTree::allocateNode() {
+    lock_guard<mutex> guard(allocLatch);
+    alignas(IO_ALIGNMENT) char page[INDEX_PAGE_SIZE]{};
+    if (freePages > 0) {
+        FreeNodePage link;
+        uint32_t nodeID = freeListHead;
+        file.read(nodeOffset(nodeID), page, INDEX_PAGE_SIZE);
+        countReads(1);
+        memcpy(&link, page, sizeof(link));
+        if (link.magic != FREE_PAGE_MAGIC)
+            throw runtime_error("Corrupt free page list in " + file.path());
+        freeListHead = link.next;
+        freePages--;
+        freeListDirty = true;
+        return nodeID;
     }
+    uint32_t nodeID = nodeCount;
+    file.write(nodeOffset(nodeID), page, INDEX_PAGE_SIZE);
+    countWrites(1);
+    nodeCount++;
+    return nodeID;
+}
 
-    file.seekp((node.header.nodeID + 1) * INDEX_PAGE_SIZE);
-    file.write(buffer, INDEX_PAGE_SIZE);
-    file.flush();
+void BPlusDiskTree::releaseNode(uint32_t nodeID) {
+    lock_guard<mutex> guard(allocLatch);
+    alignas(IO_ALIGNMENT) char page[INDEX_PAGE_SIZE]{};
+    FreeNodePage link{FREE_PAGE_MAGIC, freeListHead};
+    memcpy(page, &link, sizeof(link));
+    file.write(nodeOffset(nodeID), page, INDEX_PAGE_SIZE);
+    countWrites(1);
+    freeListHead = nodeID;
+    freePages++;
+    freeListDirty = true;
 }
 
-NodePage BPlusDiskTree::readNode(uint32_t nodeID) {
-    file.seekg((nodeID + 1) * INDEX_PAGE_SIZE);
-    char buffer[INDEX_PAGE_SIZE]{};
-    file.read(buffer, INDEX_PAGE_SIZE);
+uint32_t BPlusDiskTree::getNodeCount() {
+    lock_guard<mutex> guard(allocLatch);
+    return nodeCount;
+}
 
-    NodePage node;
-    size_t offset = 0;
+uint32_t BPlusDiskTree::getFreeNodeCount() {
+    lock_guard<mutex> guard(allocLatch);
+    return freePages;
+}
 
-    memcpy(&node.header, buffer, sizeof(NodeHeader));
-    offset += sizeof(NodeHeader);
+void BPlusDiskTree::writeNode(uint32_t nodeID, const char* page) {
+    file.write(nodeOffset(nodeID), page, INDEX_PAGE_SIZE);
+    countWrites(1);
 
-    node.keys.resize(node.header.numKeys);
-    memcpy(node.keys.data(), buffer + offset,
-           node.header.numKeys * sizeof(Key));
-    offset += node.header.numKeys * sizeof(Key);
+    // Bulk loading appends nodes by writing past the end
+    lock_guard<mutex> guard(allocLatch);
+    nodeCount = max(nodeCount, nodeID + 1);
+}
 
-    if (node.header.isLeaf) {
-        node.rids.resize(node.header.numKeys);
-        memcpy(node.rids.data(), buffer + offset,
-               node.header.numKeys * sizeof(RID));
-    } else {
-        node.children.resize(node.header.numKeys + 1);
-        memcpy(node.children.data(), buffer + offset,
-               (node.header.numKeys + 1) * sizeof(uint32_t));
+void BPlusDiskTree::writeNodes(const vector<uint32_t>& nodeIDs, char* pages) {
+    vector<IORequest> requests;
+    uint32_t last = 0;
+    for (size_t i = 0; i < nodeIDs.size(); i++) {
+        requests.push_back({true, nodeOffset(nodeIDs[i]), pages + i * INDEX_PAGE_SIZE, INDEX_PAGE_SIZE});
+        last = max(last, nodeIDs[i] + 1);
     }
+    io.run(requests);
+    countWrites(nodeIDs.size());
+
+    lock_guard<mutex> guard(allocLatch);
+    nodeCount = max(nodeCount, last);
+}
 
-    return node;
-}
\ No newline at end of file
+void BPlusDiskTree::readNode(uint32_t nodeID, char* page) {
+    file.read(nodeOffset(nodeID), page, INDEX_PAGE_SIZE);
+    countReads(1);
+}
+
+void BPlusDiskTree::readNodes(const vector<uint32_t>& nodeIDs, char* pages) {
+    vector<IORequest> requests;
+    for (size_t i = 0; i < nodeIDs.size(); i++)
+        requests.push_back({false, nodeOffset(nodeIDs[i]), pages + i * INDEX_PAGE_SIZE, INDEX_PAGE_SIZE});
+    io.run(requests);
+    countReads(nodeIDs.size());
+}
@@ -1,23 +1,74 @@
 #pragma once
 #include "NodePage.h"
-#include <fstream>
+#include "include/BlockFile.h"
+#include "include/AsyncIO.h"
+#include <string>
+#include <mutex>
 
 using namespace std;
 
 struct IndexMeta {
     uint32_t rootNodeID;
+    uint32_t checkpointInProgress; // set while a checkpoint is rewriting nodes
+    uint64_t checkpointLSN;        // last log record reflected in the nodes on disk
+    uint32_t nonUnique;            // keys may repeat; entries are ordered by (key, RID)
+    uint32_t keyType;              // KeyTraits<K>::TYPE_ID of the key type
+    uint32_t freePages;            // length of the free page list; 0 means freeListHead is unused
+    uint32_t freeListHead;         // first free node page
+    uint32_t payloadBytes;         // payload per leaf entry; 0 in files that predate payloads
 };
 
-constexpr uint32_t INVALID_NODE = UINT32_MAX;
+// A released node page holds the ID of the next free page
+struct FreeNodePage {
+    uint32_t magic;
+    uint32_t next;
+};
 
+// Node pages are read and written with pread/pwrite at their own offset, so
+// threads loading or writing different nodes never share a file position.
+// Pages are raw INDEX_PAGE_SIZE buffers; NodePage<K> encodes the nodes.
+// Every transfer is a whole page, the meta page included, so the file can
+// be switched to direct I/O.
+//
+// Released pages form a list threaded through the pages themselves, with
+// its head in the meta page, and are reused before the file grows. The
+// list is kept in memory and stored by every writeMeta.
 class BPlusDiskTree {
-    fstream file;
+    BlockFile file;
+    AsyncIO io;
+    uint32_t nodeCount;
+    uint32_t freePages;
+    uint32_t freeListHead;
+    bool freeListDirty; // changed since the meta page was last written
+    mutex allocLatch; // guards nodeCount and the free list
 public:
     BPlusDiskTree(const string& filename);
 
+    // Takes the first free page, or appends one
     uint32_t allocateNode();
-    void writeNode(const NodePage& node);
-    NodePage readNode(uint32_t nodeID);
+    // Adds a page that no node on disk refers to any more to the free list
+    void releaseNode(uint32_t nodeID);
+    uint32_t getFreeNodeCount();
+    AsyncIOStats getIOStats() const { return io.getStats(); }
+    // Writes the meta page if the free list changed since it was last written
+    void flushFreeList();
+    // Number of node pages in the file; writing node getNodeCount() appends it
+    uint32_t getNodeCount();
+    void writeNode(uint32_t nodeID, const char* page);
+    // Writes nodeIDs[i] from pages + i * INDEX_PAGE_SIZE, as one batch of
+    // asynchronous writes; pages must be IO_ALIGNMENT aligned
+    void writeNodes(const vector<uint32_t>& nodeIDs, char* pages);
+    void readNode(uint32_t nodeID, char* page);
+    // Reads nodeIDs[i] into pages + i * INDEX_PAGE_SIZE, as one batch of
+    // asynchronous reads; pages must be IO_ALIGNMENT aligned
+    void readNodes(const vector<uint32_t>& nodeIDs, char* pages);
     uint32_t readRootID();
     void writeRootID(uint32_t id);
-};
\ No newline at end of file
+    IndexMeta readMeta();
+    // Also records the current free list
+    void writeMeta(const IndexMeta& meta);
+    // Forces every node written so far to stable storage
+    void sync();
+    // See BlockFile::setDirect
+    bool enableDirectIO() { return file.setDirect(true); }
+};
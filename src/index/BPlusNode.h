@@ -1,17 +1,159 @@
 #pragma once
 #include <vector>
 #include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <shared_mutex>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
 #include "include/Common.h"
+#include "NodePage.h"
 
 using namespace std;
 
+// Fixed-capacity array over storage inside the node's own block, with the
+// part of the vector interface the tree uses. Elements are trivially copyable.
+template <typename T>
+class NodeArray {
+    static_assert(is_trivially_copyable<T>::value, "node arrays hold plain values");
+public:
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    NodeArray() : items(nullptr), count(0), cap(0) {}
+    NodeArray(const NodeArray&) = delete;
+    NodeArray& operator=(const NodeArray&) = delete;
+    void bind(T* storage, uint32_t capacity) {
+        items = storage;
+        cap = capacity;
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return cap; }
+    bool empty() const { return count == 0; }
+    T* data() { return items; }
+    const T* data() const { return items; }
+    iterator begin() { return items; }
+    iterator end() { return items + count; }
+    const_iterator begin() const { return items; }
+    const_iterator end() const { return items + count; }
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+    T& front() { return items[0]; }
+    T& back() { return items[count - 1]; }
+    const T& front() const { return items[0]; }
+    const T& back() const { return items[count - 1]; }
+
+    void clear() { count = 0; }
+    void push_back(const T& value) {
+        reserveFor(1);
+        items[count++] = value;
+    }
+    void pop_back() { count--; }
+    iterator insert(iterator pos, const T& value) {
+        size_t i = pos - items;
+        reserveFor(1);
+        memmove(items + i + 1, items + i, (count - i) * sizeof(T));
+        items[i] = value;
+        count++;
+        return items + i;
+    }
+    template <typename It>
+    iterator insert(iterator pos, It first, It last) {
+        size_t i = pos - items, n = distance(first, last);
+        reserveFor(n);
+        memmove(items + i + n, items + i, (count - i) * sizeof(T));
+        copy(first, last, items + i);
+        count += n;
+        return items + i;
+    }
+    iterator erase(iterator pos) { return erase(pos, pos + 1); }
+    iterator erase(iterator first, iterator last) {
+        memmove(first, last, (end() - last) * sizeof(T));
+        count -= last - first;
+        return first;
+    }
+    void resize(size_t n) {
+        if (n > count) {
+            reserveFor(n - count);
+            fill(items + count, items + n, T{});
+        }
+        count = n;
+    }
+    template <typename It>
+    void assign(It first, It last) {
+        count = 0;
+        insert(end(), first, last);
+    }
+private:
+    T* items;
+    uint32_t count;
+    uint32_t cap;
+
+    void reserveFor(size_t n) const {
+        if (count + n > cap) throw runtime_error("B+ tree node is over its capacity");
+    }
+};
+
+// Fixed-width keys live inline next to the RIDs and children; string keys
+// vary too much in number per node for a fixed array and stay in a vector
+template <typename K>
+using NodeKeys = conditional_t<KeyTraits<K>::VARIABLE, vector<K>, NodeArray<K>>;
+
+// A node and its arrays are one block from the tree's NodeArena:
+// [node][keys][rids][payloads][children], with room for maxKeys entries
+// (one more than the order, for the entry that makes a node split) and, in
+// internal nodes, one more child. Only leaves have payloads: payloadBytes
+// per entry, entry i's at payloadAt(i).
+template <typename K>
 struct BPlusNode {
     uint32_t nodeID;
     bool isLeaf;
-    vector<Key> keys;
-    vector<BPlusNode*> children; // For internal nodes
-    vector<RID> rids;             // For leaf nodes
-    BPlusNode* next;        // Pointer to next leaf node
+    NodeKeys<K> keys;
+    NodeArray<uint32_t> children; // Child node IDs, for internal nodes
+    NodeArray<RID> rids;          // For leaf nodes; internal nodes keep the RID of each separator
+                                  // too, stored on disk by non-unique trees only
+    NodeArray<char> payloads;     // Leaf nodes, payloadBytes per entry
+    uint32_t payloadBytes;
+    uint32_t next;          // Node ID of next leaf node
+    bool dirty;             // changed since last written (write-back mode only)
+    atomic<bool> referenced; // second-chance bit for cache eviction
+    shared_mutex latch;     // guards the entries of a leaf while the tree latch is shared
+
+    // Constructed in place in a block of blockSize(leaf, maxKeys, payloadBytes) bytes
+    BPlusNode(bool leaf, uint32_t maxKeys, uint32_t payloadBytes = 0)
+        : isLeaf(leaf), payloadBytes(leaf ? payloadBytes : 0), next(INVALID_NODE), dirty(false), referenced(true) {
+        char* storage = reinterpret_cast<char*>(this) + headerBytes();
+        if constexpr (!KeyTraits<K>::VARIABLE) {
+            keys.bind(reinterpret_cast<K*>(storage), maxKeys);
+            storage += maxKeys * sizeof(K);
+        }
+        rids.bind(reinterpret_cast<RID*>(storage), maxKeys);
+        storage += maxKeys * sizeof(RID);
+        if (leaf) {
+            payloads.bind(storage, maxKeys * payloadBytes);
+        } else {
+            children.bind(reinterpret_cast<uint32_t*>(storage), maxKeys + 1);
+        }
+    }
+    BPlusNode(const BPlusNode&) = delete;
+    BPlusNode& operator=(const BPlusNode&) = delete;
+
+    char* payloadAt(size_t i) { return payloads.data() + i * payloadBytes; }
+    const char* payloadAt(size_t i) const { return payloads.data() + i * payloadBytes; }
 
-    BPlusNode(bool leaf) : isLeaf(leaf), next(nullptr) {}
-};
\ No newline at end of file
+    static size_t blockSize(bool leaf, uint32_t maxKeys, uint32_t payloadBytes = 0) {
+        size_t bytes = headerBytes() + maxKeys * sizeof(RID);
+        if (!KeyTraits<K>::VARIABLE) bytes += maxKeys * sizeof(K);
+        if (leaf) bytes += maxKeys * payloadBytes;
+        if (!leaf) bytes += (maxKeys + 1) * sizeof(uint32_t);
+        return bytes;
+    }
+private:
+    static constexpr size_t headerBytes() {
+        return (sizeof(BPlusNode) + alignof(K) - 1) / alignof(K) * alignof(K);
+    }
+};
@@ -1,250 +1,1182 @@
 #include "BPlusTree.h"
 #include "BPlusNode.h"
 #include "BPlusDiskTree.h"
+#include "NodeSearch.h"
+#include "NodeArena.h"
+#include "include/Metrics.h"
 
 #include <algorithm>
 #include <stdexcept>
-#include <iostream>
+#include <mutex>
+#include <cstdio>
+#include <numeric>
 
 using namespace std;
 
-BPlusTree::BPlusTree(int order, string filename)
-    : order(order) {
+// Sorts before every real RID, so (key, MIN_RID) seeks to the first entry with key
+constexpr RID MIN_RID{0, 0};
+
+// Nodes with variable-length keys are underfull only when they are below a
+// quarter of a page as well as below half their order
+constexpr size_t MIN_NODE_BYTES = INDEX_PAGE_SIZE / 4;
+
+// Dirty nodes a checkpoint encodes and writes per batch of asynchronous writes
+constexpr size_t CHECKPOINT_BATCH_NODES = 256;
+// Fewer nodes than this are written one by one
+constexpr size_t SYNC_WRITE_NODES = 8;
+// Keys a batched search descends together; the cache is trimmed between groups
+constexpr size_t SEARCH_BATCH_KEYS = 1024;
+// Leaves a range scan reads ahead at a time
+constexpr size_t READAHEAD_LEAVES = 32;
+// Payload of entries inserted without one
+constexpr char ZERO_PAYLOAD[MAX_PAYLOAD_BYTES] = {};
+
+template <typename K>
+BasicBPlusTree<K>::BasicBPlusTree(string filename, size_t cacheCapacity)
+    : BasicBPlusTree(KeyTraits<K>::LEAF_ORDER, KeyTraits<K>::INTERNAL_ORDER, filename, cacheCapacity) {}
+
+template <typename K>
+BasicBPlusTree<K>::BasicBPlusTree(string filename, IndexKeys keys, size_t cacheCapacity, uint32_t payloadBytes)
+    : BasicBPlusTree(KeyTraits<K>::leafOrder(payloadBytes),
+                     keys == IndexKeys::Unique ? KeyTraits<K>::INTERNAL_ORDER : KeyTraits<K>::NON_UNIQUE_INTERNAL_ORDER,
+                     filename, cacheCapacity, keys, payloadBytes) {}
+
+template <typename K>
+BasicBPlusTree<K>::BasicBPlusTree(int order, string filename, size_t cacheCapacity)
+    : BasicBPlusTree(order, order, filename, cacheCapacity) {}
+
+template <typename K>
+BasicBPlusTree<K>::BasicBPlusTree(int leafOrder, int internalOrder, string filename, size_t cacheCapacity,
+                                  IndexKeys keys, uint32_t payloadBytes)
+    : filename(filename), leafOrder(leafOrder), internalOrder(internalOrder), unique(keys == IndexKeys::Unique),
+      payloadBytes(payloadBytes), leafArena(Node::blockSize(true, leafOrder + 1, payloadBytes)),
+      internalArena(Node::blockSize(false, internalOrder + 1)), cacheCapacity(cacheCapacity),
+      trimThreshold(cacheCapacity), writeBack(false), directIO(false), rootDirty(false), deferWrites(false) {
+    if (payloadBytes > MAX_PAYLOAD_BYTES)
+        throw runtime_error("Index entry payload is over " + to_string(MAX_PAYLOAD_BYTES) + " bytes");
+    int maxInternalOrder = unique ? KeyTraits<K>::INTERNAL_ORDER : KeyTraits<K>::NON_UNIQUE_INTERNAL_ORDER;
+    if (leafOrder < 2 || leafOrder > KeyTraits<K>::leafOrder(payloadBytes) || internalOrder < 2 ||
+        internalOrder > maxInternalOrder)
+        throw runtime_error("B+ tree order does not fit in an index page");
     
     file = new BPlusDiskTree(filename);
-    uint32_t rootID = file->readRootID();
+    IndexMeta meta = file->readMeta();
+    uint32_t rootID = meta.rootNodeID;
+    torn = meta.checkpointInProgress != 0;
+    checkpointLSN = meta.checkpointLSN;
 
     if (rootID == INVALID_NODE) {
         // First time creation
-        root = new BPlusNode(true);
-        root->nodeID = file->allocateNode();
+        meta.nonUnique = !unique;
+        meta.keyType = KeyTraits<K>::TYPE_ID;
+        meta.payloadBytes = payloadBytes;
+        file->writeMeta(meta);
+        root = newNode(true);
+        root->nodeID = allocatePage();
+        cacheNode(root);
         persistNode(root);
-        file->writeRootID(root->nodeID);
+        persistRoot();
     } else {
-        // Reload existing tree
-        root = loadNode(rootID);
+        if (meta.nonUnique != !unique) {
+            delete file;
+            throw runtime_error("Index " + filename + " was created with different key uniqueness");
+        }
+        if (meta.keyType != KeyTraits<K>::TYPE_ID) {
+            delete file;
+            throw runtime_error("Index " + filename + " was created with a different key type");
+        }
+        if (meta.payloadBytes != payloadBytes) {
+            delete file;
+            throw runtime_error("Index " + filename + " was created with a different payload width");
+        }
+        // Reload existing tree; only the root is read, the rest on demand
+        root = getNode(rootID);
+    }
+}
+
+template <typename K>
+BasicBPlusTree<K>::~BasicBPlusTree() {
+    clearCache();
+    delete file;
+}
+
+template <typename K>
+size_t BasicBPlusTree<K>::minLeafKeys() const {
+    return (leafOrder + 1) / 2 - 1;
+}
+
+template <typename K>
+size_t BasicBPlusTree<K>::minInternalKeys() const {
+    return (internalOrder + 1) / 2 - 1;
+}
+
+template <typename K>
+size_t BasicBPlusTree<K>::nodeSize(const Node* node, size_t skip) const {
+    size_t numKeys = node->keys.size() - (skip < node->keys.size());
+    return nodeBytes(KeyTraits<K>::keyBytes(node->keys, skip), numKeys, node->isLeaf, !node->isLeaf && !unique,
+                     payloadBytes);
+}
+
+template <typename K>
+bool BasicBPlusTree<K>::overfull(const Node* node) const {
+    if (node->keys.size() > (node->isLeaf ? leafOrder : internalOrder)) return true;
+    return KeyTraits<K>::VARIABLE && nodeSize(node) > INDEX_PAGE_SIZE;
+}
+
+template <typename K>
+bool BasicBPlusTree<K>::underfull(const Node* node, size_t skip) const {
+    size_t numKeys = node->keys.size() - (skip < node->keys.size());
+    if (numKeys >= (node->isLeaf ? minLeafKeys() : minInternalKeys())) return false;
+    return !KeyTraits<K>::VARIABLE || nodeSize(node, skip) < MIN_NODE_BYTES;
+}
+
+// Fixed-width siblings always fit in one node when one of them is underfull;
+// variable-length ones may not, and are then left as they are
+template <typename K>
+bool BasicBPlusTree<K>::canMerge(const Node* left, const Node* right, const K& separator) const {
+    if constexpr (!KeyTraits<K>::VARIABLE) {
+        return true;
+    } else {
+        vector<K> keys(left->keys);
+        if (!left->isLeaf) keys.push_back(separator);
+        keys.insert(keys.end(), right->keys.begin(), right->keys.end());
+        if (keys.size() > (left->isLeaf ? leafOrder : internalOrder)) return false;
+        return nodeBytes(KeyTraits<K>::keyBytes(keys), keys.size(), left->isLeaf, !left->isLeaf && !unique,
+                         payloadBytes) <= INDEX_PAGE_SIZE;
     }
 }
 
-int BPlusTree::minKeys() const {
-    return (order + 1) / 2 - 1;
+// Borrowing an entry can shorten the prefix a node of variable-length keys
+// shares, and so lengthen every key it stores; a borrow is only made when
+// both siblings still fit in their pages afterwards
+template <typename K>
+bool BasicBPlusTree<K>::canBorrow(const Node* node, const Node* sibling, bool fromLeft, const K& separator) const {
+    if constexpr (!KeyTraits<K>::VARIABLE) {
+        return true;
+    } else {
+        vector<K> keys(node->keys);
+        const K& moved = !node->isLeaf ? separator : fromLeft ? sibling->keys.back() : sibling->keys.front();
+        keys.insert(fromLeft ? keys.begin() : keys.end(), moved);
+        if (nodeBytes(KeyTraits<K>::keyBytes(keys), keys.size(), node->isLeaf, !node->isLeaf && !unique,
+                      payloadBytes) > INDEX_PAGE_SIZE)
+            return false;
+        return nodeSize(sibling, fromLeft ? sibling->keys.size() - 1 : 0) <= INDEX_PAGE_SIZE;
+    }
 }
 
-BPlusNode* getLeftSibling(BPlusNode* node, BPlusNode* parent, int& index) {
-    for (int i = 0; i < parent->children.size(); i++) {
-        if (parent->children[i] == node) {
+// Entries that stay in the left node when an overfull node splits. A node
+// of variable-length keys that is over its page size splits at the middle
+// byte, so that both halves fit.
+template <typename K>
+size_t BasicBPlusTree<K>::splitPoint(const Node* node) const {
+    size_t n = node->keys.size();
+    if (node->isLeaf && n > leafOrder) return (leafOrder + 1) / 2;
+    if (!node->isLeaf && n > internalOrder) return internalOrder / 2;
+    if constexpr (KeyTraits<K>::VARIABLE) {
+        size_t entry = sizeof(uint16_t) + (node->isLeaf || !unique ? sizeof(RID) : 0) +
+                       (node->isLeaf ? payloadBytes : sizeof(uint32_t));
+        size_t total = 0, half = 0, mid = 0;
+        for (const auto& key : node->keys) total += key.size() + entry;
+        while (mid < n && half + node->keys[mid].size() + entry <= total / 2)
+            half += node->keys[mid++].size() + entry;
+        // Leaves keep at least one entry each side; internal nodes also promote one
+        return node->isLeaf ? clamp<size_t>(mid, 1, n - 1) : clamp<size_t>(mid, 1, n - 2);
+    }
+    return node->isLeaf ? (leafOrder + 1) / 2 : internalOrder / 2;
+}
+
+template <typename K>
+uint32_t getLeftSibling(BPlusNode<K>* node, BPlusNode<K>* parent, size_t& index) {
+    for (size_t i = 0; i < parent->children.size(); i++) {
+        if (parent->children[i] == node->nodeID) {
             index = i;
             if (i > 0)
                 return parent->children[i - 1];
         }
     }
-    return nullptr;
+    return INVALID_NODE;
 }
 
-BPlusNode* getRightSibling(BPlusNode* node, BPlusNode* parent, int& index) {
-    for (int i = 0; i < parent->children.size(); i++) {
-        if (parent->children[i] == node) {
+template <typename K>
+uint32_t getRightSibling(BPlusNode<K>* node, BPlusNode<K>* parent, size_t& index) {
+    for (size_t i = 0; i < parent->children.size(); i++) {
+        if (parent->children[i] == node->nodeID) {
             index = i;
             if (i < parent->children.size() - 1)
                 return parent->children[i + 1];
         }
     }
-    return nullptr;
+    return INVALID_NODE;
 }
 
 
-BPlusNode* BPlusTree::loadNode(uint32_t nodeID) {
-    NodePage page = file->readNode(nodeID);
+// Reads a single node from disk; children and siblings stay as node IDs
+template <typename K>
+BPlusNode<K>* BasicBPlusTree<K>::loadNode(uint32_t nodeID) {
+    alignas(IO_ALIGNMENT) char buffer[INDEX_PAGE_SIZE];
+    file->readNode(nodeID, buffer);
+    return decodeNode(nodeID, buffer);
+}
 
-    BPlusNode* node = new BPlusNode(page.header.isLeaf);
-    node->nodeID = page.header.nodeID;
-    node->keys = page.keys;
+template <typename K>
+BPlusNode<K>* BasicBPlusTree<K>::decodeNode(uint32_t nodeID, const char* buffer) {
+    NodePage<K> page = NodePage<K>::decode(buffer, payloadBytes);
+
+    Node* node = newNode(page.header.isLeaf);
+    node->nodeID = nodeID;
+    node->keys.assign(make_move_iterator(page.keys.begin()), make_move_iterator(page.keys.end()));
 
     if (node->isLeaf) {
-        node->rids = page.rids;
-        if (page.header.nextLeaf != INVALID_NODE) {
-            node->next = loadNode(page.header.nextLeaf);
-        }
+        node->rids.assign(page.rids.begin(), page.rids.end());
+        node->payloads.assign(page.payloads.begin(), page.payloads.end());
+        node->next = page.header.nextLeaf;
     } else {
-        for (auto childID : page.children) {
-            node->children.push_back(loadNode(childID));
-        }
+        node->children.assign(page.children.begin(), page.children.end());
+        node->rids.assign(page.rids.begin(), page.rids.end());
+        node->rids.resize(node->keys.size());
     }
 
     return node;
 }
 
-void BPlusTree::persistNode(BPlusNode* n) {
-    NodePage page{};
+template <typename K>
+BPlusNode<K>* BasicBPlusTree<K>::getNode(uint32_t nodeID) {
+    {
+        shared_lock<shared_mutex> guard(cacheLatch);
+        auto it = cache.find(nodeID);
+        if (it != cache.end()) {
+            it->second->referenced.store(true, memory_order_relaxed);
+            Metrics::count(Counter::NodeCacheHits);
+            return it->second;
+        }
+    }
+    // Read outside the cache latch; if another thread cached the node in the
+    // meantime, its copy wins since it may already have been changed
+    Metrics::count(Counter::NodeCacheMisses);
+    Node* node = loadNode(nodeID);
+    unique_lock<shared_mutex> guard(cacheLatch);
+    auto inserted = cache.emplace(nodeID, node);
+    if (!inserted.second) {
+        freeNode(node);
+        node = inserted.first->second;
+    }
+    return node;
+}
+
+template <typename K>
+void BasicBPlusTree<K>::loadNodes(vector<uint32_t> nodeIDs) {
+    sort(nodeIDs.begin(), nodeIDs.end());
+    nodeIDs.erase(std::unique(nodeIDs.begin(), nodeIDs.end()), nodeIDs.end());
+    {
+        shared_lock<shared_mutex> guard(cacheLatch);
+        nodeIDs.erase(remove_if(nodeIDs.begin(), nodeIDs.end(), [&](uint32_t id) { return cache.count(id) > 0; }),
+                      nodeIDs.end());
+    }
+    // getNode reads a lone miss itself
+    if (nodeIDs.size() < 2) return;
+    Metrics::count(Counter::NodeCacheMisses, nodeIDs.size());
+    IOBuffer pages(nodeIDs.size() * INDEX_PAGE_SIZE);
+    file->readNodes(nodeIDs, pages.data());
+    for (size_t i = 0; i < nodeIDs.size(); i++) {
+        Node* node = decodeNode(nodeIDs[i], pages.data() + i * INDEX_PAGE_SIZE);
+        unique_lock<shared_mutex> guard(cacheLatch);
+        // As in getNode, a copy cached in the meantime wins
+        if (!cache.emplace(nodeIDs[i], node).second) freeNode(node);
+    }
+}
+
+template <typename K>
+size_t BasicBPlusTree<K>::readAheadLeaves(const Node* parent, size_t from, const K& high) {
+    vector<uint32_t> leafIDs;
+    size_t i = from;
+    for (; i < parent->children.size() && leafIDs.size() < READAHEAD_LEAVES; i++) {
+        // Child i starts at separator i - 1
+        if (i > 0 && parent->keys[i - 1] > high) {
+            i = parent->children.size(); // the rest are past the range
+            break;
+        }
+        leafIDs.push_back(parent->children[i]);
+    }
+    loadNodes(leafIDs);
+    return i;
+}
+
+template <typename K>
+size_t BasicBPlusTree<K>::getCachedNodeCount() const {
+    shared_lock<shared_mutex> guard(cacheLatch);
+    return cache.size();
+}
+
+template <typename K>
+TreeMemoryStats BasicBPlusTree<K>::getMemoryStats() const {
+    TreeMemoryStats stats{};
+    for (const NodeArena* arena : {&leafArena, &internalArena}) {
+        stats.reservedBytes += arena->reservedBytes();
+        stats.usedBytes += arena->liveBlocks() * arena->getBlockSize();
+        stats.liveNodes += arena->liveBlocks();
+    }
+    return stats;
+}
+
+template <typename K>
+BPlusNode<K>* BasicBPlusTree<K>::newNode(bool leaf) {
+    NodeArena& arena = leaf ? leafArena : internalArena;
+    return new (arena.allocate()) Node(leaf, (leaf ? leafOrder : internalOrder) + 1, payloadBytes);
+}
+
+template <typename K>
+void BasicBPlusTree<K>::freeNode(Node* node) {
+    NodeArena& arena = node->isLeaf ? leafArena : internalArena;
+    node->~Node();
+    arena.release(node);
+}
+
+// Drops a node that merged into a sibling or stopped being the root, and
+// frees its page
+template <typename K>
+void BasicBPlusTree<K>::discardNode(Node* node) {
+    {
+        unique_lock<shared_mutex> guard(cacheLatch);
+        cache.erase(node->nodeID);
+    }
+    if (deferWrites && node->dirty)
+        deferred.erase(find(deferred.begin(), deferred.end(), node));
+    releasePage(node->nodeID);
+    freeNode(node);
+}
+
+template <typename K>
+uint32_t BasicBPlusTree<K>::allocatePage() {
+    if (!reserved.empty()) {
+        uint32_t nodeID = reserved.front();
+        reserved.erase(reserved.begin());
+        return nodeID;
+    }
+    uint32_t nodeID = file->allocateNode();
+    if (!writeBack) file->flushFreeList();
+    return nodeID;
+}
+
+// In write-back mode the last checkpoint on disk may still refer to the
+// page, so it only joins the free list at the next checkpoint
+template <typename K>
+void BasicBPlusTree<K>::releasePage(uint32_t nodeID) {
+    if (writeBack) {
+        pendingFree.push_back(nodeID);
+        return;
+    }
+    file->releaseNode(nodeID);
+    file->flushFreeList();
+}
+
+template <typename K>
+uint32_t BasicBPlusTree<K>::getFreeNodeCount() {
+    shared_lock<shared_mutex> tree(treeLatch);
+    return file->getFreeNodeCount() + pendingFree.size();
+}
+
+template <typename K>
+void BasicBPlusTree<K>::clearCache() {
+    unique_lock<shared_mutex> guard(cacheLatch);
+    for (auto& entry : cache)
+        freeNode(entry.second);
+    cache.clear();
+}
+
+template <typename K>
+void BasicBPlusTree<K>::cacheNode(Node* node) {
+    unique_lock<shared_mutex> guard(cacheLatch);
+    cache[node->nodeID] = node;
+}
+
+// Called at the start of an operation, before any latch is taken. Eviction
+// needs the tree latch exclusively so that no other thread holds a pointer
+// to an evicted node.
+template <typename K>
+void BasicBPlusTree<K>::trimCache() {
+    {
+        shared_lock<shared_mutex> guard(cacheLatch);
+        if (cache.size() <= trimThreshold) return;
+    }
+    unique_lock<shared_mutex> tree(treeLatch);
+    evictNodes();
+}
+
+// Second-chance sweep: a node referenced since the last sweep loses its bit
+// and stays, the others go until the cache is 1/8 below capacity, leaving
+// headroom so the sweep is not repeated on every operation. Dirty nodes stay
+// until the next checkpoint writes them.
+template <typename K>
+void BasicBPlusTree<K>::evictNodes() {
+    unique_lock<shared_mutex> guard(cacheLatch);
+    size_t target = cacheCapacity - cacheCapacity / 8;
+    for (int pass = 0; pass < 2 && cache.size() > target; pass++) {
+        for (auto it = cache.begin(); it != cache.end() && cache.size() > target;) {
+            Node* node = it->second;
+            if (node == root || node->dirty) {
+                ++it;
+            } else if (node->referenced.exchange(false, memory_order_relaxed)) {
+                ++it;
+            } else {
+                freeNode(node);
+                it = cache.erase(it);
+            }
+        }
+    }
+    // When dirty nodes keep the cache over capacity, wait for it to grow
+    // by another 1/8 before sweeping again
+    trimThreshold = max(cacheCapacity, cache.size() + cacheCapacity / 8);
+}
+
+template <typename K>
+void BasicBPlusTree<K>::persistNode(Node* n) {
+    if (writeBack) {
+        n->dirty = true;
+        return;
+    }
+    if (deferWrites) {
+        if (!n->dirty) deferred.push_back(n);
+        n->dirty = true;
+        return;
+    }
+    writeNodeToDisk(n);
+}
+
+template <typename K>
+void BasicBPlusTree<K>::persistRoot() {
+    if (writeBack || deferWrites) {
+        rootDirty = true;
+        return;
+    }
+    file->writeRootID(root->nodeID);
+}
+
+// Ends a split or merge of a write-through tree: every node it changed is
+// written once, then the root if it moved. Held under the exclusive tree latch.
+// A failed write leaves the tree writing through again, with the nodes it
+// missed still dirty and the file flagged torn, since only some of the
+// changed nodes may have reached it.
+template <typename K>
+void BasicBPlusTree<K>::flushDeferred() {
+    deferWrites = false;
+    try {
+        writeNodes(deferred);
+        if (rootDirty) {
+            file->writeRootID(root->nodeID);
+            rootDirty = false;
+        }
+    } catch (...) {
+        deferred.clear();
+        markTornLocked();
+        throw;
+    }
+    deferred.clear();
+}
+
+// Pages a split of a leaf can take: one for the leaf and for each full
+// ancestor, and one for a new root if the root splits too. A node of
+// variable-length keys counts as full, since a new key can shorten the
+// prefix its keys share.
+template <typename K>
+size_t BasicBPlusTree<K>::splitPages(const vector<Node*>& path) const {
+    size_t pages = 1;
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        if (!KeyTraits<K>::VARIABLE && (*it)->keys.size() < internalOrder) return pages;
+        pages++;
+    }
+    return pages + 1;
+}
+
+template <typename K>
+void BasicBPlusTree<K>::reservePages(size_t count) {
+    while (reserved.size() < count)
+        reserved.push_back(file->allocateNode());
+    if (!writeBack) file->flushFreeList();
+}
+
+// Unused pages go back in the reverse order they were taken, which rewrites
+// each free-list link as it was: the list of the last checkpoint stays intact,
+// so they can be freed at once even in write-back mode
+template <typename K>
+void BasicBPlusTree<K>::endStructureChange() {
+    vector<uint32_t> unused;
+    unused.swap(reserved);
+    for (auto it = unused.rbegin(); it != unused.rend(); ++it)
+        file->releaseNode(*it);
+    if (!unused.empty() && !writeBack) file->flushFreeList();
+    if (deferWrites) flushDeferred();
+}
+
+// The meta page is marked in progress while nodes are rewritten, so a crash
+// in the middle leaves a tree that is known to be torn rather than silently
+// mixing nodes from two points in time.
+template <typename K>
+void BasicBPlusTree<K>::checkpoint(uint64_t lsn) {
+    unique_lock<shared_mutex> tree(treeLatch);
+    vector<Node*> dirtyNodes;
+    for (auto& entry : cache) {
+        if (entry.second->dirty)
+            dirtyNodes.push_back(entry.second);
+    }
+
+    IndexMeta meta = file->readMeta();
+    if (!dirtyNodes.empty() || rootDirty || !pendingFree.empty()) {
+        meta.checkpointInProgress = 1;
+        file->writeMeta(meta);
+        file->sync();
+
+        writeNodes(dirtyNodes);
+        for (uint32_t nodeID : pendingFree)
+            file->releaseNode(nodeID);
+        pendingFree.clear();
+        file->sync();
+    }
+
+    meta.rootNodeID = root->nodeID;
+    meta.checkpointInProgress = 0;
+    meta.checkpointLSN = lsn;
+    file->writeMeta(meta);
+    file->sync();
+
+    rootDirty = false;
+    torn = false;
+    checkpointLSN = lsn;
+    trimThreshold = cacheCapacity;
+}
+
+template <typename K>
+void BasicBPlusTree<K>::markTorn() {
+    unique_lock<shared_mutex> tree(treeLatch);
+    markTornLocked();
+}
+
+template <typename K>
+bool BasicBPlusTree<K>::enableDirectIO() {
+    unique_lock<shared_mutex> tree(treeLatch);
+    directIO = file->enableDirectIO();
+    return directIO;
+}
+
+template <typename K>
+void BasicBPlusTree<K>::markTornLocked() {
+    IndexMeta meta = file->readMeta();
+    meta.checkpointInProgress = 1;
+    file->writeMeta(meta);
+    file->sync();
+    torn = true;
+}
+
+template <typename K>
+void BasicBPlusTree<K>::writeNodeToDisk(Node* n) {
+    alignas(IO_ALIGNMENT) char buffer[INDEX_PAGE_SIZE]{};
+    encodeNode(n, buffer);
+    file->writeNode(n->nodeID, buffer);
+}
+
+// In node ID order, so the batches write the file front to back
+template <typename K>
+void BasicBPlusTree<K>::writeNodes(vector<Node*>& nodes) {
+    sort(nodes.begin(), nodes.end(), [](const Node* a, const Node* b) { return a->nodeID < b->nodeID; });
+    if (nodes.size() <= SYNC_WRITE_NODES) {
+        // A split or merge changes a handful of nodes; plain writes are cheaper than a batch
+        for (Node* n : nodes) {
+            writeNodeToDisk(n);
+            n->dirty = false;
+        }
+        return;
+    }
+    IOBuffer pages(min(nodes.size(), CHECKPOINT_BATCH_NODES) * INDEX_PAGE_SIZE);
+    for (size_t first = 0; first < nodes.size(); first += CHECKPOINT_BATCH_NODES) {
+        size_t end = min(nodes.size(), first + CHECKPOINT_BATCH_NODES);
+        vector<uint32_t> nodeIDs;
+        for (size_t i = first; i < end; i++) {
+            char* page = pages.data() + (i - first) * INDEX_PAGE_SIZE;
+            memset(page, 0, INDEX_PAGE_SIZE);
+            encodeNode(nodes[i], page);
+            nodeIDs.push_back(nodes[i]->nodeID);
+        }
+        file->writeNodes(nodeIDs, pages.data());
+        for (size_t i = first; i < end; i++)
+            nodes[i]->dirty = false;
+    }
+}
+
+template <typename K>
+void BasicBPlusTree<K>::encodeNode(const Node* n, char* buffer) const {
+    NodePage<K> page{};
     page.header.nodeID = n->nodeID;
     page.header.isLeaf = n->isLeaf;
+    page.header.separatorRIDs = !n->isLeaf && !unique;
     page.header.numKeys = n->keys.size();
-    page.header.nextLeaf =
-        n->isLeaf && n->next ? n->next->nodeID : INVALID_NODE;
+    page.header.nextLeaf = n->isLeaf ? n->next : INVALID_NODE;
 
-    page.keys = n->keys;
+    page.keys.assign(n->keys.begin(), n->keys.end());
 
+    if (n->isLeaf || !unique)
+        page.rids.assign(n->rids.begin(), n->rids.end());
     if (n->isLeaf)
-        page.rids = n->rids;
-    else {
-        for (auto c : n->children)
-            page.children.push_back(c->nodeID);
-    }
+        page.payloads.assign(n->payloads.begin(), n->payloads.end());
+    if (!n->isLeaf)
+        page.children.assign(n->children.begin(), n->children.end());
+
+    page.encode(buffer);
+}
 
-    file->writeNode(page);
+// Position of the first entry >= (key, rid). Unique trees compare keys only;
+// in non-unique trees the SIMD kernels find the run of equal keys and the
+// RIDs within it are searched next.
+template <typename K>
+size_t BasicBPlusTree<K>::entryLowerBound(const Node* node, const K& key, const RID& rid) const {
+    size_t first = nodeLowerBound(node->keys.data(), node->keys.size(), key);
+    if (unique) return first;
+    size_t last = first + nodeUpperBound(node->keys.data() + first, node->keys.size() - first, key);
+    return lower_bound(node->rids.begin() + first, node->rids.begin() + last, rid) - node->rids.begin();
 }
 
-BPlusNode* BPlusTree::findLeaf(Key key, vector<BPlusNode*>& path) {
-    BPlusNode* node = root;
+// Position of the first entry > (key, rid)
+template <typename K>
+size_t BasicBPlusTree<K>::entryUpperBound(const Node* node, const K& key, const RID& rid) const {
+    size_t last = nodeUpperBound(node->keys.data(), node->keys.size(), key);
+    if (unique) return last;
+    size_t first = nodeLowerBound(node->keys.data(), last, key);
+    return upper_bound(node->rids.begin() + first, node->rids.begin() + last, rid) - node->rids.begin();
+}
+
+// Descends to the leaf whose range holds (key, rid). In a non-unique tree
+// the first entry >= (key, rid) is in that leaf or starts the next one.
+template <typename K>
+BPlusNode<K>* BasicBPlusTree<K>::findLeaf(const K& key, const RID& rid, vector<Node*>& path) {
+    Node* node = root;
     while (!node->isLeaf) {
         path.push_back(node);
-        int i = 0;
-        while (i < node->keys.size() && key >= node->keys[i]) {
-            i++;
-        }
-        node = node->children[i];
+        size_t i = entryUpperBound(node, key, rid);
+        node = getNode(node->children[i]);
     }
     return node;
 }
 
-void BPlusTree::insertInternal(BPlusNode* node, Key key, BPlusNode* rightChild, vector<BPlusNode*>& path) {
-    auto it = upper_bound(node->keys.begin(), node->keys.end(), key);
-    size_t index = distance(node->keys.begin(), it);
-    node->keys.insert(it, key);
-    node->children.insert(node->children.begin() + index + 1, rightChild);
+template <typename K>
+void BasicBPlusTree<K>::insertInternal(Node* node, const K& key, const RID& rid, Node* rightChild,
+                               vector<Node*>& path) {
+    size_t index = entryUpperBound(node, key, rid);
+    node->keys.insert(node->keys.begin() + index, key);
+    node->rids.insert(node->rids.begin() + index, rid);
+    node->children.insert(node->children.begin() + index + 1, rightChild->nodeID);
 
-    if (node->keys.size() > order) {
+    if (overfull(node)) {
         splitInternal(node, path);
     }
     persistNode(node);
 }
 
-void BPlusTree::splitInternal(BPlusNode* node, vector<BPlusNode*>& path) {
-    int mid = order / 2;
-    Key promotedKey = node->keys[mid];
+template <typename K>
+void BasicBPlusTree<K>::splitInternal(Node* node, vector<Node*>& path) {
+    Metrics::count(Counter::NodeSplits);
+    size_t mid = splitPoint(node);
+    K promotedKey = node->keys[mid];
+    RID promotedRID = node->rids[mid];
 
-    BPlusNode* newInternal = new BPlusNode(false);
-    newInternal->nodeID = file->allocateNode();
+    Node* newInternal = newNode(false);
+    newInternal->nodeID = allocatePage();
+    cacheNode(newInternal);
 
     newInternal->keys.assign(node->keys.begin() + mid + 1, node->keys.end());
+    newInternal->rids.assign(node->rids.begin() + mid + 1, node->rids.end());
     newInternal->children.assign(node->children.begin() + mid + 1, node->children.end());
 
     node->keys.resize(mid);
+    node->rids.resize(mid);
     node->children.resize(mid + 1);
 
     // If node is root
     if (node == root) {
-        BPlusNode* newRoot = new BPlusNode(false);
+        Node* newRoot = newNode(false);
         newRoot->keys.push_back(promotedKey);
-        newRoot->children.push_back(node);
-        newRoot->children.push_back(newInternal);
-        newRoot->nodeID = file->allocateNode();
+        newRoot->rids.push_back(promotedRID);
+        newRoot->children.push_back(node->nodeID);
+        newRoot->children.push_back(newInternal->nodeID);
+        newRoot->nodeID = allocatePage();
+        cacheNode(newRoot);
         persistNode(newRoot);
         persistNode(node);
         persistNode(newInternal);
         root = newRoot;
-        file->writeRootID(root->nodeID);
+        persistRoot();
         return;
     }
 
     // Insert into parent
-    BPlusNode* parent = path.back();
+    Node* parent = path.back();
     path.pop_back();
-    insertInternal(parent, promotedKey, newInternal, path);
+    insertInternal(parent, promotedKey, promotedRID, newInternal, path);
     persistNode(node);
     persistNode(newInternal);
     persistNode(parent);
 }
 
-void BPlusTree::splitLeaf(BPlusNode* leaf, vector<BPlusNode*>& path) {
-    int mid = (order + 1) / 2;
-    BPlusNode *newLeaf = new BPlusNode(true);
-    newLeaf->nodeID = file->allocateNode();
+template <typename K>
+void BasicBPlusTree<K>::splitLeaf(Node* leaf, vector<Node*>& path) {
+    Metrics::count(Counter::NodeSplits);
+    size_t mid = splitPoint(leaf);
+    Node *newLeaf = newNode(true);
+    newLeaf->nodeID = allocatePage();
+    cacheNode(newLeaf);
     newLeaf->keys.assign(leaf->keys.begin() + mid, leaf->keys.end());
     newLeaf->rids.assign(leaf->rids.begin() + mid, leaf->rids.end());
+    newLeaf->payloads.assign(leaf->payloadAt(mid), leaf->payloads.end());
     leaf->keys.resize(mid);
     leaf->rids.resize(mid);
+    leaf->payloads.resize(mid * payloadBytes);
 
     newLeaf->next = leaf->next;
-    leaf->next = newLeaf;
+    leaf->next = newLeaf->nodeID;
 
-    // Promote the first key of the new leaf to the parent
-    Key promotedKey = newLeaf->keys[0];
+    // Promote the first entry of the new leaf to the parent
+    K promotedKey = newLeaf->keys[0];
+    RID promotedRID = newLeaf->rids[0];
 
     // If leaf is root
     if (leaf == root) {
-        BPlusNode* newRoot = new BPlusNode(false);
+        Node* newRoot = newNode(false);
         newRoot->keys.push_back(promotedKey);
-        newRoot->children.push_back(leaf);
-        newRoot->children.push_back(newLeaf);
-        newRoot->nodeID = file->allocateNode();
+        newRoot->rids.push_back(promotedRID);
+        newRoot->children.push_back(leaf->nodeID);
+        newRoot->children.push_back(newLeaf->nodeID);
+        newRoot->nodeID = allocatePage();
+        cacheNode(newRoot);
         root = newRoot;
         persistNode(leaf);
         persistNode(newLeaf);
         persistNode(newRoot);
-        file->writeRootID(root->nodeID);
+        persistRoot();
         return;
     }
 
     // Insert into parent
-    BPlusNode* parent = path.back();
+    Node* parent = path.back();
     path.pop_back();
-    insertInternal(parent, promotedKey, newLeaf, path);
+    insertInternal(parent, promotedKey, promotedRID, newLeaf, path);
     persistNode(leaf);
     persistNode(newLeaf);
     persistNode(parent); // if exists
 }
 
-bool BPlusTree::search(Key key, RID& out) {
-    vector<BPlusNode*> dummy;
-    BPlusNode* node = findLeaf(key, dummy);
-    auto it = lower_bound(node->keys.begin(), node->keys.end(), key);
-    if (it != node->keys.end() && *it == key) {
-        size_t index = distance(node->keys.begin(), it);
+template <typename K>
+bool BasicBPlusTree<K>::search(const K& key, RID& out, char* payload) {
+    OpTimer timer(Op::IndexLookup);
+    trimCache();
+    shared_lock<shared_mutex> tree(treeLatch);
+    vector<Node*> dummy;
+    Node* node = findLeaf(key, MIN_RID, dummy);
+    shared_lock<shared_mutex> leafLatch(node->latch);
+    size_t index = nodeLowerBound(node->keys.data(), node->keys.size(), key);
+    if (index == node->keys.size() && !unique && node->next != INVALID_NODE) {
+        node = getNode(node->next);
+        leafLatch = shared_lock<shared_mutex>(node->latch);
+        index = 0;
+    }
+    if (index < node->keys.size() && node->keys[index] == key) {
         out = node->rids[index];
+        if (payload) memcpy(payload, node->payloadAt(index), payloadBytes);
         return true;
     }
     return false;
 }
 
-void BPlusTree::insert(Key key, const RID& rid) {
-    vector<BPlusNode*> path;
-    BPlusNode* leaf = findLeaf(key, path);
-    auto it = lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
-    size_t index = distance(leaf->keys.begin(), it);
-    leaf->keys.insert(it, key);
+template <typename K>
+void BasicBPlusTree<K>::searchBatch(const vector<K>& keys, vector<RID>& rids, vector<bool>& found) {
+    OpTimer timer(Op::IndexBatchLookup);
+    rids.assign(keys.size(), RID{0, 0});
+    found.assign(keys.size(), false);
+    vector<size_t> order(keys.size());
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+    for (size_t first = 0; first < order.size(); first += SEARCH_BATCH_KEYS) {
+        size_t end = min(order.size(), first + SEARCH_BATCH_KEYS);
+        trimCache();
+        shared_lock<shared_mutex> tree(treeLatch);
+        // at[j] is the node the j-th key of the group has reached. Sorted keys
+        // that share a node are adjacent, so each node is searched in one run.
+        vector<Node*> at(end - first, root);
+        while (!at[0]->isLeaf) {
+            vector<uint32_t> childIDs(at.size());
+            for (size_t j = 0; j < at.size(); j++) {
+                if (j + 1 < at.size() && at[j + 1] != at[j]) __builtin_prefetch(at[j + 1]->keys.data());
+                childIDs[j] = at[j]->children[entryUpperBound(at[j], keys[order[first + j]], MIN_RID)];
+            }
+            loadNodes(childIDs);
+            for (size_t j = 0; j < at.size(); j++)
+                at[j] = j > 0 && childIDs[j] == childIDs[j - 1] ? at[j - 1] : getNode(childIDs[j]);
+        }
+
+        for (size_t j = 0; j < at.size();) {
+            Node* leaf = at[j];
+            shared_lock<shared_mutex> leafLatch(leaf->latch);
+            for (; j < at.size() && at[j] == leaf; j++) {
+                const K& key = keys[order[first + j]];
+                Node* node = leaf;
+                size_t index = nodeLowerBound(node->keys.data(), node->keys.size(), key);
+                shared_lock<shared_mutex> nextLatch;
+                // As in search: a non-unique key's first entry may start the next leaf
+                if (index == node->keys.size() && !unique && node->next != INVALID_NODE) {
+                    node = getNode(node->next);
+                    nextLatch = shared_lock<shared_mutex>(node->latch);
+                    index = 0;
+                }
+                if (index < node->keys.size() && node->keys[index] == key) {
+                    rids[order[first + j]] = node->rids[index];
+                    found[order[first + j]] = true;
+                }
+            }
+        }
+    }
+}
+
+template <typename K>
+void BasicBPlusTree<K>::insert(const K& key, const RID& rid, const char* payload) {
+    OpTimer timer(Op::IndexInsert);
+    KeyTraits<K>::validate(key);
+    if (!payload) payload = ZERO_PAYLOAD;
+    trimCache();
+    {
+        // Optimistic pass: a leaf with room changes under its own latch only
+        shared_lock<shared_mutex> tree(treeLatch);
+        vector<Node*> dummy;
+        Node* leaf = findLeaf(key, rid, dummy);
+        unique_lock<shared_mutex> leafLatch(leaf->latch);
+        if (leaf->keys.size() < leafOrder) {
+            size_t index = entryLowerBound(leaf, key, rid);
+            leaf->keys.insert(leaf->keys.begin() + index, key);
+            leaf->rids.insert(leaf->rids.begin() + index, rid);
+            if (!overfull(leaf)) {
+                leaf->payloads.insert(leaf->payloadAt(index), payload, payload + payloadBytes);
+                persistNode(leaf);
+                return;
+            }
+            // A long key can fill the page before the entry count does
+            leaf->keys.erase(leaf->keys.begin() + index);
+            leaf->rids.erase(leaf->rids.begin() + index);
+        }
+    }
+
+    // The leaf is full and will split: start over with the tree to ourselves
+    unique_lock<shared_mutex> tree(treeLatch);
+    StructureChange change(this);
+    vector<Node*> path;
+    Node* leaf = findLeaf(key, rid, path);
+    size_t index = entryLowerBound(leaf, key, rid);
+    leaf->keys.insert(leaf->keys.begin() + index, key);
     leaf->rids.insert(leaf->rids.begin() + index, rid);
-    if (leaf->keys.size() > order) {
+    leaf->payloads.insert(leaf->payloadAt(index), payload, payload + payloadBytes);
+    if (overfull(leaf)) {
+        try {
+            reservePages(splitPages(path));
+        } catch (...) {
+            // Nothing has split yet: take the entry back out
+            leaf->keys.erase(leaf->keys.begin() + index);
+            leaf->rids.erase(leaf->rids.begin() + index);
+            leaf->payloads.erase(leaf->payloadAt(index), leaf->payloadAt(index + 1));
+            throw;
+        }
         splitLeaf(leaf, path);
+    } else {
+        persistNode(leaf);
     }
-    persistNode(leaf);
+    change.finish();
+}
+
+template <typename K>
+bool BasicBPlusTree<K>::isEmpty() const {
+    shared_lock<shared_mutex> tree(treeLatch);
+    shared_lock<shared_mutex> rootLatch(root->latch);
+    return root->isLeaf && root->keys.empty();
 }
 
-void BPlusTree::rebalanceInternal(
-    BPlusNode* node,
-    vector<BPlusNode*>& path)
+template <typename K>
+int BasicBPlusTree<K>::getHeight() {
+    shared_lock<shared_mutex> tree(treeLatch);
+    int height = 1;
+    Node* node = root;
+    while (!node->isLeaf) {
+        node = getNode(node->children[0]);
+        height++;
+    }
+    return height;
+}
+
+// Splits n items into the fewest groups of at most perGroup items, spread
+// evenly so that no group ends up much smaller than the others
+static vector<size_t> groupSizes(size_t n, size_t perGroup) {
+    size_t groups = (n + perGroup - 1) / perGroup;
+    vector<size_t> sizes(groups, n / groups);
+    for (size_t i = 0; i < n % groups; i++)
+        sizes[i]++;
+    return sizes;
+}
+
+// Groups for variable-length keys: each takes items in order while the
+// node stays within target bytes and perGroup items. A last group smaller
+// than minGroup takes items from the one before it.
+static vector<size_t> byteGroupSizes(const vector<size_t>& itemBytes, size_t baseBytes, size_t target,
+                                     size_t perGroup, size_t minGroup) {
+    vector<size_t> sizes;
+    size_t count = 0, bytes = baseBytes;
+    for (size_t itemSize : itemBytes) {
+        if (count > 0 && (count == perGroup || bytes + itemSize > target)) {
+            sizes.push_back(count);
+            count = 0;
+            bytes = baseBytes;
+        }
+        count++;
+        bytes += itemSize;
+    }
+    sizes.push_back(count);
+    size_t last = sizes.size() - 1;
+    if (last > 0 && sizes[last] < minGroup && sizes[last - 1] > minGroup) {
+        size_t moved = min(minGroup - sizes[last], sizes[last - 1] - minGroup);
+        sizes[last - 1] -= moved;
+        sizes[last] += moved;
+    }
+    return sizes;
+}
+
+template <typename K>
+void BasicBPlusTree<K>::bulkLoad(vector<pair<K, RID>> entries, double fillFactor, vector<char> payloads) {
+    unique_lock<shared_mutex> tree(treeLatch);
+    if (!root->isLeaf || !root->keys.empty())
+        throw runtime_error("bulkLoad requires an empty tree");
+    if (fillFactor <= 0 || fillFactor > 1)
+        throw runtime_error("bulkLoad fill factor must be in (0, 1]");
+    if (!payloads.empty() && payloads.size() != entries.size() * payloadBytes)
+        throw runtime_error("bulkLoad needs one payload per entry");
+    if (entries.empty()) return;
+
+    // Non-unique trees order equal keys by RID
+    auto byKey = [](const pair<K, RID>& a, const pair<K, RID>& b) { return a.first < b.first; };
+    if (!payloads.empty()) {
+        // Payloads follow their entries through the sort
+        auto before = [&](const pair<K, RID>& a, const pair<K, RID>& b) { return unique ? byKey(a, b) : a < b; };
+        if (!is_sorted(entries.begin(), entries.end(), before)) {
+            vector<size_t> order(entries.size());
+            iota(order.begin(), order.end(), 0);
+            stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return before(entries[a], entries[b]); });
+            vector<pair<K, RID>> sorted;
+            vector<char> sortedPayloads(payloads.size());
+            sorted.reserve(entries.size());
+            for (size_t i = 0; i < order.size(); i++) {
+                sorted.push_back(move(entries[order[i]]));
+                memcpy(sortedPayloads.data() + i * payloadBytes, payloads.data() + order[i] * payloadBytes, payloadBytes);
+            }
+            entries.swap(sorted);
+            payloads.swap(sortedPayloads);
+        }
+    } else if (!unique) {
+        if (!is_sorted(entries.begin(), entries.end()))
+            sort(entries.begin(), entries.end());
+    } else if (!is_sorted(entries.begin(), entries.end(), byKey)) {
+        stable_sort(entries.begin(), entries.end(), byKey);
+    }
+
+    // Even spreading keeps every node at or above half of the per-node
+    // target, so the target must be at least twice the minimum occupancy
+    size_t leafFill = max<size_t>(static_cast<size_t>(leafOrder * fillFactor), 2 * minLeafKeys());
+    size_t internalFill = max<size_t>(static_cast<size_t>((internalOrder + 1) * fillFactor), 2 * (minInternalKeys() + 1));
+    leafFill = max<size_t>(min<size_t>(leafFill, leafOrder), 1);
+    internalFill = max<size_t>(min<size_t>(internalFill, internalOrder + 1), 2);
+    // Nodes of variable-length keys are filled by bytes, sized without
+    // prefix compression, so they fit whatever prefix their keys share
+    size_t targetBytes = clamp<size_t>(INDEX_PAGE_SIZE * fillFactor, 2 * MIN_NODE_BYTES, INDEX_PAGE_SIZE);
+    for (const auto& entry : entries)
+        KeyTraits<K>::validate(entry.first);
+
+    markTornLocked();
+
+    // The empty root becomes the first leaf; every other node is appended
+    // to the end of the file in the order it is built
+    uint32_t nextID = file->getNodeCount();
+    struct LevelEntry {
+        K key;    // smallest entry below the node
+        RID rid;
+        uint32_t nodeID;
+    };
+    vector<LevelEntry> level;
+
+    vector<size_t> leafSizes;
+    if constexpr (KeyTraits<K>::VARIABLE) {
+        vector<size_t> bytes;
+        for (const auto& entry : entries)
+            bytes.push_back(entry.first.size() + sizeof(uint16_t) + sizeof(RID) + payloadBytes);
+        leafSizes = byteGroupSizes(bytes, sizeof(NodeHeader) + sizeof(uint16_t), targetBytes, leafFill, 1);
+    } else {
+        leafSizes = groupSizes(entries.size(), leafFill);
+    }
+    // Each node is built in one scratch node per level kind and written out
+    size_t pos = 0;
+    Node* leaf = newNode(true);
+    for (size_t i = 0; i < leafSizes.size(); i++) {
+        leaf->keys.clear();
+        leaf->rids.clear();
+        leaf->payloads.clear();
+        leaf->nodeID = i == 0 ? root->nodeID : nextID++;
+        if (payloads.empty())
+            leaf->payloads.resize(leafSizes[i] * payloadBytes);
+        else
+            leaf->payloads.assign(payloads.begin() + pos * payloadBytes,
+                                  payloads.begin() + (pos + leafSizes[i]) * payloadBytes);
+        for (size_t j = 0; j < leafSizes[i]; j++, pos++) {
+            leaf->keys.push_back(entries[pos].first);
+            leaf->rids.push_back(entries[pos].second);
+        }
+        leaf->next = i + 1 < leafSizes.size() ? nextID : INVALID_NODE;
+        writeNodeToDisk(leaf);
+        level.push_back({leaf->keys.front(), leaf->rids.front(), leaf->nodeID});
+    }
+    freeNode(leaf);
+
+    Node* node = newNode(false);
+    while (level.size() > 1) {
+        vector<LevelEntry> parents;
+        vector<size_t> sizes;
+        if constexpr (KeyTraits<K>::VARIABLE) {
+            // Every child is counted with a key, one more than the node holds
+            vector<size_t> bytes;
+            for (const auto& entry : level)
+                bytes.push_back(entry.key.size() + sizeof(uint16_t) + (unique ? 0 : sizeof(RID)) + sizeof(uint32_t));
+            sizes = byteGroupSizes(bytes, sizeof(NodeHeader) + sizeof(uint16_t) + sizeof(uint32_t), targetBytes,
+                                   internalFill, 2);
+        } else {
+            sizes = groupSizes(level.size(), internalFill);
+        }
+        size_t child = 0;
+        for (size_t size : sizes) {
+            node->keys.clear();
+            node->rids.clear();
+            node->children.clear();
+            node->nodeID = nextID++;
+            for (size_t j = 0; j < size; j++, child++) {
+                if (j > 0) {
+                    node->keys.push_back(level[child].key);
+                    node->rids.push_back(level[child].rid);
+                }
+                node->children.push_back(level[child].nodeID);
+            }
+            writeNodeToDisk(node);
+            const LevelEntry& first = level[child - size];
+            parents.push_back({first.key, first.rid, node->nodeID});
+        }
+        level.swap(parents);
+    }
+    freeNode(node);
+
+    // Drop the cached empty root and publish the new tree
+    clearCache();
+    root = getNode(level.front().nodeID);
+    IndexMeta meta = file->readMeta();
+    meta.rootNodeID = root->nodeID;
+    meta.checkpointInProgress = 0;
+    file->sync();
+    file->writeMeta(meta);
+    file->sync();
+    rootDirty = false;
+    torn = false;
+}
+
+// Copies the entries into a new file built by bulkLoad, so the leaves are
+// dense and in key order, then renames it over the old one. A crash before
+// the rename leaves the old file as it was.
+template <typename K>
+void BasicBPlusTree<K>::compactIndex(double fillFactor) {
+    unique_lock<shared_mutex> tree(treeLatch);
+    bool dirty = rootDirty || !pendingFree.empty();
+    for (auto& entry : cache)
+        dirty = dirty || entry.second->dirty;
+    if (dirty)
+        throw runtime_error("compactIndex needs a checkpoint of " + filename + " first");
+
+    // Leaves are read straight from disk unless cached, without filling the cache
+    vector<pair<K, RID>> entries;
+    vector<char> payloads;
+    Node* node = root;
+    while (!node->isLeaf)
+        node = getNode(node->children[0]);
+    uint32_t leafID = node->nodeID;
+    while (leafID != INVALID_NODE) {
+        {
+            shared_lock<shared_mutex> guard(cacheLatch);
+            auto it = cache.find(leafID);
+            node = it != cache.end() ? it->second : nullptr;
+        }
+        if (node) {
+            for (size_t i = 0; i < node->keys.size(); i++)
+                entries.push_back({node->keys[i], node->rids[i]});
+            payloads.insert(payloads.end(), node->payloads.begin(), node->payloads.end());
+            leafID = node->next;
+            continue;
+        }
+        alignas(IO_ALIGNMENT) char buffer[INDEX_PAGE_SIZE];
+        file->readNode(leafID, buffer);
+        NodePage<K> page = NodePage<K>::decode(buffer, payloadBytes);
+        for (size_t i = 0; i < page.keys.size(); i++)
+            entries.push_back({move(page.keys[i]), page.rids[i]});
+        payloads.insert(payloads.end(), page.payloads.begin(), page.payloads.end());
+        leafID = page.header.nextLeaf;
+    }
+
+    string tempFile = filename + ".compact";
+    std::remove(tempFile.c_str());
+    {
+        BasicBPlusTree<K> compacted(leafOrder, internalOrder, tempFile, cacheCapacity,
+                                    unique ? IndexKeys::Unique : IndexKeys::NonUnique, payloadBytes);
+        if (directIO) compacted.enableDirectIO();
+        compacted.bulkLoad(move(entries), fillFactor, move(payloads));
+        compacted.checkpoint(checkpointLSN);
+    }
+
+    clearCache();
+    delete file;
+    bool renamed = rename(tempFile.c_str(), filename.c_str()) == 0;
+    file = new BPlusDiskTree(filename);
+    if (directIO) file->enableDirectIO();
+    root = getNode(file->readRootID());
+    trimThreshold = cacheCapacity;
+    if (!renamed)
+        throw runtime_error("Failed to replace index " + filename + " with its compacted copy");
+}
+
+template <typename K>
+void BasicBPlusTree<K>::rebalanceInternal(
+    Node* node,
+    vector<Node*>& path)
 {
     if (node == root) {
         if (node->keys.empty()) {
-            root = node->children[0];
-            file->writeRootID(root->nodeID);
+            root = getNode(node->children[0]);
+            persistRoot();
+            discardNode(node);
         }
         return;
     }
 
-    BPlusNode* parent = path.back();
+    Node* parent = path.back();
     path.pop_back();
 
-    int index = 0;
-    BPlusNode* left = getLeftSibling(node, parent, index);
-    BPlusNode* right = getRightSibling(node, parent, index);
+    size_t index = 0;
+    uint32_t leftID = getLeftSibling(node, parent, index);
+    uint32_t rightID = getRightSibling(node, parent, index);
+    Node* left = leftID != INVALID_NODE ? getNode(leftID) : nullptr;
+    Node* right = rightID != INVALID_NODE ? getNode(rightID) : nullptr;
 
     // CASE 1 — Borrow from left
-    if (left && left->keys.size() > minKeys()) {
+    if (left && !left->keys.empty() && !underfull(left, left->keys.size() - 1) &&
+        canBorrow(node, left, true, parent->keys[index - 1])) {
+        Metrics::count(Counter::NodeBorrows);
 
         // Pull separator from parent
         node->keys.insert(node->keys.begin(),
             parent->keys[index - 1]);
+        node->rids.insert(node->rids.begin(),
+            parent->rids[index - 1]);
 
         // Move last child of left
         node->children.insert(node->children.begin(),
@@ -252,221 +1184,437 @@ void BPlusTree::rebalanceInternal(
 
         // Move key up from left to parent
         parent->keys[index - 1] = left->keys.back();
+        parent->rids[index - 1] = left->rids.back();
 
         left->keys.pop_back();
+        left->rids.pop_back();
         left->children.pop_back();
 
         persistNode(left);
         persistNode(node);
+        // A longer separator can overflow a parent of variable-length keys
+        if (overfull(parent))
+            splitInternal(parent, path);
         persistNode(parent);
         return;
     }
 
     // CASE 2 — Borrow from right
-    if (right && right->keys.size() > minKeys()) {
+    if (right && !right->keys.empty() && !underfull(right, 0) &&
+        canBorrow(node, right, false, parent->keys[index])) {
+        Metrics::count(Counter::NodeBorrows);
 
         node->keys.push_back(parent->keys[index]);
+        node->rids.push_back(parent->rids[index]);
 
         node->children.push_back(right->children.front());
 
         parent->keys[index] = right->keys.front();
+        parent->rids[index] = right->rids.front();
 
         right->keys.erase(right->keys.begin());
+        right->rids.erase(right->rids.begin());
         right->children.erase(right->children.begin());
 
         persistNode(right);
         persistNode(node);
+        if (overfull(parent))
+            splitInternal(parent, path);
         persistNode(parent);
         return;
     }
 
-    // CASE 3 — Merge
+    // CASE 3 — Merge, when the result fits in one node
 
-    if (left) {
+    if (left && canMerge(left, node, parent->keys[index - 1])) {
+        Metrics::count(Counter::NodeMerges);
 
         // Pull separator down
         left->keys.push_back(parent->keys[index - 1]);
+        left->rids.push_back(parent->rids[index - 1]);
 
         // Merge keys
         left->keys.insert(left->keys.end(),
             node->keys.begin(), node->keys.end());
+        left->rids.insert(left->rids.end(),
+            node->rids.begin(), node->rids.end());
 
         // Merge children
         left->children.insert(left->children.end(),
             node->children.begin(), node->children.end());
 
         parent->keys.erase(parent->keys.begin() + index - 1);
+        parent->rids.erase(parent->rids.begin() + index - 1);
         parent->children.erase(parent->children.begin() + index);
 
         persistNode(left);
         persistNode(parent);
+        discardNode(node);
 
-        if (parent->keys.size() < minKeys())
+        if (underfull(parent))
             rebalanceInternal(parent, path);
 
-    } else if (right) {
+    } else if (right && canMerge(node, right, parent->keys[index])) {
+        Metrics::count(Counter::NodeMerges);
 
         node->keys.push_back(parent->keys[index]);
+        node->rids.push_back(parent->rids[index]);
 
         node->keys.insert(node->keys.end(),
             right->keys.begin(), right->keys.end());
+        node->rids.insert(node->rids.end(),
+            right->rids.begin(), right->rids.end());
 
         node->children.insert(node->children.end(),
             right->children.begin(), right->children.end());
 
         parent->keys.erase(parent->keys.begin() + index);
+        parent->rids.erase(parent->rids.begin() + index);
         parent->children.erase(parent->children.begin() + index + 1);
 
         persistNode(node);
         persistNode(parent);
+        discardNode(right);
 
-        if (parent->keys.size() < minKeys())
+        if (underfull(parent))
             rebalanceInternal(parent, path);
     }
 }
 
-void BPlusTree::rebalanceLeaf(BPlusNode* leaf,
-                              vector<BPlusNode*>& path) {
+template <typename K>
+void BasicBPlusTree<K>::rebalanceLeaf(Node* leaf,
+                              vector<Node*>& path) {
 
-    BPlusNode* parent = path.back();
+    Node* parent = path.back();
     path.pop_back();
 
-    int index = 0;
-    BPlusNode* left = getLeftSibling(leaf, parent, index);
-    BPlusNode* right = getRightSibling(leaf, parent, index);
+    size_t index = 0;
+    uint32_t leftID = getLeftSibling(leaf, parent, index);
+    uint32_t rightID = getRightSibling(leaf, parent, index);
+    Node* left = leftID != INVALID_NODE ? getNode(leftID) : nullptr;
+    Node* right = rightID != INVALID_NODE ? getNode(rightID) : nullptr;
 
     // CASE 1 — Borrow from left
-    if (left && left->keys.size() > minKeys()) {
-        cout << "Borrowing from left\n";
+    if (left && !left->keys.empty() && !underfull(left, left->keys.size() - 1) &&
+        canBorrow(leaf, left, true, parent->keys[index - 1])) {
+        Metrics::count(Counter::NodeBorrows);
         leaf->keys.insert(leaf->keys.begin(),
                           left->keys.back());
         leaf->rids.insert(leaf->rids.begin(),
                           left->rids.back());
+        leaf->payloads.insert(leaf->payloads.begin(),
+                              left->payloadAt(left->keys.size() - 1), left->payloads.end());
 
         left->keys.pop_back();
         left->rids.pop_back();
+        left->payloads.resize(left->keys.size() * payloadBytes);
 
         parent->keys[index - 1] = leaf->keys.front();
+        parent->rids[index - 1] = leaf->rids.front();
 
         persistNode(left);
         persistNode(leaf);
+        if (overfull(parent))
+            splitInternal(parent, path);
         persistNode(parent);
         return;
     }
 
     // CASE 2 — Borrow from right
-    if (right && right->keys.size() > minKeys()) {
-        cout << "Borrowing from right\n";
+    if (right && !right->keys.empty() && !underfull(right, 0) &&
+        canBorrow(leaf, right, false, parent->keys[index])) {
+        Metrics::count(Counter::NodeBorrows);
         leaf->keys.push_back(right->keys.front());
         leaf->rids.push_back(right->rids.front());
+        leaf->payloads.insert(leaf->payloads.end(), right->payloadAt(0), right->payloadAt(1));
 
         right->keys.erase(right->keys.begin());
         right->rids.erase(right->rids.begin());
+        right->payloads.erase(right->payloadAt(0), right->payloadAt(1));
 
         parent->keys[index] = right->keys.front();
+        parent->rids[index] = right->rids.front();
 
         persistNode(right);
         persistNode(leaf);
+        if (overfull(parent))
+            splitInternal(parent, path);
         persistNode(parent);
         return;
     }
 
-    // CASE 3 — Merge
+    // CASE 3 — Merge, when the result fits in one node
 
-    if (left) {
-        cout << "Merging leaves\n";
+    if (left && canMerge(left, leaf, parent->keys[index - 1])) {
+        Metrics::count(Counter::NodeMerges);
         // merge into left
         left->keys.insert(left->keys.end(),
                           leaf->keys.begin(), leaf->keys.end());
         left->rids.insert(left->rids.end(),
                           leaf->rids.begin(), leaf->rids.end());
+        left->payloads.insert(left->payloads.end(),
+                              leaf->payloads.begin(), leaf->payloads.end());
 
         left->next = leaf->next;
 
         parent->keys.erase(parent->keys.begin() + index - 1);
+        parent->rids.erase(parent->rids.begin() + index - 1);
         parent->children.erase(parent->children.begin() + index);
 
         persistNode(left);
         persistNode(parent);
+        discardNode(leaf);
 
         if (parent == root && parent->keys.empty()) {
             root = left;
-            file->writeRootID(root->nodeID);
+            persistRoot();
+            discardNode(parent);
+            return;
         }
 
-    } else if (right) {
-        cout << "Merging leaves\n";
+    } else if (right && canMerge(leaf, right, parent->keys[index])) {
+        Metrics::count(Counter::NodeMerges);
         // merge right into leaf
         leaf->keys.insert(leaf->keys.end(),
                           right->keys.begin(), right->keys.end());
         leaf->rids.insert(leaf->rids.end(),
                           right->rids.begin(), right->rids.end());
+        leaf->payloads.insert(leaf->payloads.end(),
+                              right->payloads.begin(), right->payloads.end());
 
         leaf->next = right->next;
 
         parent->keys.erase(parent->keys.begin() + index);
+        parent->rids.erase(parent->rids.begin() + index);
         parent->children.erase(parent->children.begin() + index + 1);
 
         persistNode(leaf);
         persistNode(parent);
+        discardNode(right);
 
         if (parent == root && parent->keys.empty()) {
             root = leaf;
-            file->writeRootID(root->nodeID);
+            persistRoot();
+            discardNode(parent);
+            return;
         }
     }
 
     // Parent may now underflow
-    if (parent != root && parent->keys.size() < minKeys()) {
+    if (parent != root && underfull(parent)) {
         rebalanceInternal(parent, path);
     }
 }
 
 
-bool BPlusTree::remove(Key key) {
-    vector<BPlusNode*> path;
-    BPlusNode* leaf = findLeaf(key, path);
+template <typename K>
+bool BasicBPlusTree<K>::remove(const K& key) {
+    OpTimer timer(Op::IndexDelete);
+    if (unique) return removeEntry(key, nullptr);
+    // The first entry may start the next leaf, off the path to this key's
+    // leaf, so find its RID first and remove that exact entry
+    RID rid;
+    return search(key, rid) && removeEntry(key, &rid);
+}
 
-    auto it = lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
+template <typename K>
+bool BasicBPlusTree<K>::remove(const K& key, const RID& rid) {
+    OpTimer timer(Op::IndexDelete);
+    return removeEntry(key, &rid);
+}
 
-    if (it == leaf->keys.end() || *it != key)
-        return false;
+// Removes the entry (key, *rid), or any entry with key in a unique tree when rid is null
+template <typename K>
+bool BasicBPlusTree<K>::removeEntry(const K& key, const RID* rid) {
+    trimCache();
+    RID seek = rid ? *rid : MIN_RID;
+    auto matches = [&](Node* leaf, size_t index) {
+        return index < leaf->keys.size() && leaf->keys[index] == key && (!rid || leaf->rids[index] == *rid);
+    };
+    {
+        // Optimistic pass, unless the leaf would underflow
+        shared_lock<shared_mutex> tree(treeLatch);
+        vector<Node*> dummy;
+        Node* leaf = findLeaf(key, seek, dummy);
+        unique_lock<shared_mutex> leafLatch(leaf->latch);
+        size_t index = entryLowerBound(leaf, key, seek);
+        if (!matches(leaf, index))
+            return false;
+        if (leaf == root || !underfull(leaf, index)) {
+            leaf->keys.erase(leaf->keys.begin() + index);
+            leaf->rids.erase(leaf->rids.begin() + index);
+            leaf->payloads.erase(leaf->payloadAt(index), leaf->payloadAt(index + 1));
+            persistNode(leaf);
+            return true;
+        }
+    }
+
+    unique_lock<shared_mutex> tree(treeLatch);
+    vector<Node*> path;
+    Node* leaf = findLeaf(key, seek, path);
 
-    size_t index = distance(leaf->keys.begin(), it);
+    size_t index = entryLowerBound(leaf, key, seek);
+
+    if (!matches(leaf, index))
+        return false;
 
-    leaf->keys.erase(it);
+    StructureChange change(this);
+    leaf->keys.erase(leaf->keys.begin() + index);
     leaf->rids.erase(leaf->rids.begin() + index);
+    leaf->payloads.erase(leaf->payloadAt(index), leaf->payloadAt(index + 1));
 
-    if (leaf == root){
-        persistNode(leaf);
-        return true;
-    }
+    persistNode(leaf);
 
-    if (leaf->keys.size() < minKeys()) {
+    // Rebalancing may merge the leaf away; its write is then dropped
+    if (leaf != root && underfull(leaf)) {
         rebalanceLeaf(leaf, path);
     }
-
-    persistNode(leaf);
+    change.finish();
     return true;
 }
 
-vector<RID> BPlusTree::rangeScan(Key low, Key high){
+template <typename K>
+vector<RID> BasicBPlusTree<K>::rangeScan(const K& low, const K& high){
+    OpTimer timer(Op::IndexRange);
     vector<RID> result;
-    vector<BPlusNode*> dummy;
-    BPlusNode* node = findLeaf(low, dummy);
-    if (!node) return result;
-    auto it = lower_bound(node->keys.begin(), node->keys.end(), low);
-    size_t index = distance(node->keys.begin(), it);
-    while (node) {
+    scanLeaves(low, high, [&](const Node* leaf, size_t index) { result.push_back(leaf->rids[index]); });
+    return result;
+}
+
+template <typename K>
+void BasicBPlusTree<K>::visitRange(const K& low, const K& high, const EntryVisitor& visit) {
+    OpTimer timer(Op::IndexRange);
+    scanLeaves(low, high, [&](const Node* leaf, size_t index) {
+        visit(leaf->keys[index], leaf->rids[index], leaf->payloadAt(index));
+    });
+}
+
+// A long scan caches every leaf it passes and cannot evict under the shared
+// tree latch, so the cache is trimmed back once the scan lets go of it
+template <typename K>
+template <typename Emit>
+void BasicBPlusTree<K>::scanLeaves(const K& low, const K& high, Emit&& emit) {
+    trimCache();
+    walkLeaves(low, high, emit);
+    trimCache();
+}
+
+template <typename K>
+template <typename Emit>
+void BasicBPlusTree<K>::walkLeaves(const K& low, const K& high, Emit& emit) {
+    shared_lock<shared_mutex> tree(treeLatch);
+    vector<Node*> path;
+    Node* node = findLeaf(low, MIN_RID, path);
+    if (!node) return;
+    // The leaf is child childIndex of parent; children before readEnd were read ahead
+    const Node* parent = path.empty() ? nullptr : path.back();
+    size_t childIndex = 0, readEnd = 0;
+    if (parent) {
+        childIndex = find(parent->children.begin(), parent->children.end(), node->nodeID) - parent->children.begin();
+        readEnd = readAheadLeaves(parent, childIndex + 1, high);
+    }
+    shared_lock<shared_mutex> leafLatch(node->latch);
+    size_t index = nodeLowerBound(node->keys.data(), node->keys.size(), low);
+    while (true) {
         while (index < node->keys.size()) {
             if (node->keys[index] > high) {
-                return result;
+                return;
             }
-            result.push_back(node->rids[index]);
+            emit(node, index);
             index++;
         }
-        node = node->next;
+        if (node->next == INVALID_NODE) break;
+        uint32_t nextID = node->next;
+        bool sameParent = parent && childIndex + 1 < parent->children.size() && parent->children[childIndex + 1] == nextID;
+        if (sameParent && ++childIndex == readEnd) readEnd = readAheadLeaves(parent, childIndex, high);
+        // Latch the next leaf before letting go of this one
+        node = getNode(nextID);
+        leafLatch = shared_lock<shared_mutex>(node->latch);
         index = 0;
+        if (!sameParent && parent) {
+            // Past the parent's last child: find the next parent through the leaf's first entry
+            path.clear();
+            parent = nullptr;
+            if (!node->keys.empty() && findLeaf(node->keys[0], node->rids[0], path) == node && !path.empty()) {
+                parent = path.back();
+                childIndex = find(parent->children.begin(), parent->children.end(), nextID) - parent->children.begin();
+                readEnd = readAheadLeaves(parent, childIndex + 1, high);
+            }
+        }
     }
-    return result;
 }
+
+template <typename K>
+bool BasicBPlusTree<K>::updatePayload(const K& key, const RID& rid, const char* payload) {
+    trimCache();
+    shared_lock<shared_mutex> tree(treeLatch);
+    vector<Node*> dummy;
+    Node* leaf = findLeaf(key, rid, dummy);
+    unique_lock<shared_mutex> leafLatch(leaf->latch);
+    size_t index = entryLowerBound(leaf, key, rid);
+    if (index == leaf->keys.size() || leaf->keys[index] != key || leaf->rids[index] != rid) return false;
+    memcpy(leaf->payloadAt(index), payload, payloadBytes);
+    persistNode(leaf);
+    return true;
+}
+
+template <typename K>
+BasicIndexCursor<K> BasicBPlusTree<K>::openRange(const K& low, const K& high, size_t batchSize) {
+    return BasicIndexCursor<K>(this, low, high, batchSize);
+}
+
+template <typename K>
+bool BasicBPlusTree<K>::scanBatch(const K& from, bool inclusive, const RID& fromRID, const K& high, size_t max,
+                          vector<pair<K, RID>>& out) {
+    OpTimer timer(Op::IndexRange);
+    trimCache();
+    shared_lock<shared_mutex> tree(treeLatch);
+    vector<Node*> dummy;
+    RID seek = inclusive ? MIN_RID : fromRID;
+    Node* node = findLeaf(from, seek, dummy);
+    shared_lock<shared_mutex> leafLatch(node->latch);
+    size_t index = inclusive ? entryLowerBound(node, from, seek) : entryUpperBound(node, from, seek);
+    while (true) {
+        while (index < node->keys.size()) {
+            if (node->keys[index] > high) return true;
+            if (out.size() == max) return false;
+            out.push_back({node->keys[index], node->rids[index]});
+            index++;
+        }
+        if (node->next == INVALID_NODE) break;
+        // Latch the next leaf before letting go of this one
+        node = getNode(node->next);
+        leafLatch = shared_lock<shared_mutex>(node->latch);
+        index = 0;
+    }
+    return true;
+}
+
+template <typename K>
+BasicIndexCursor<K>::BasicIndexCursor(BasicBPlusTree<K>* tree, const K& low, const K& high, size_t batchSize)
+    : tree(tree), lastKey(low), lastRID(MIN_RID), high(high), batchSize(batchSize), started(false),
+      done(low > high) {
+    if (batchSize == 0) throw runtime_error("Cursor batch size must be positive");
+}
+
+template <typename K>
+bool BasicIndexCursor<K>::next(vector<pair<K, RID>>& batch) {
+    batch.clear();
+    if (done) return false;
+    done = tree->scanBatch(lastKey, !started, lastRID, high, batchSize, batch);
+    started = true;
+    if (batch.empty()) {
+        done = true;
+        return false;
+    }
+    lastKey = batch.back().first;
+    lastRID = batch.back().second;
+    return true;
+}
+
+template class BasicBPlusTree<int32_t>;
+template class BasicBPlusTree<int64_t>;
+template class BasicBPlusTree<string>;
+template class BasicIndexCursor<int32_t>;
+template class BasicIndexCursor<int64_t>;
+template class BasicIndexCursor<string>;
@@ -1,33 +1,280 @@
 #pragma once
 #include "include/Common.h"
+#include "NodeArena.h"
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <utility>
+#include <shared_mutex>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 
 using namespace std;
 
 class BPlusDiskTree; // forward declaration
-class BPlusNode; // forward declaration
+template <typename K> struct BPlusNode; // forward declaration
 
-class BPlusTree {
+constexpr size_t DEFAULT_NODE_CACHE = 1024; // nodes kept in memory per tree
+constexpr size_t DEFAULT_CURSOR_BATCH = 256; // entries or rows returned per cursor call
+
+template <typename K> class BasicBPlusTree;
+
+// Memory held by a tree's in-memory nodes
+struct TreeMemoryStats {
+    size_t reservedBytes; // slabs held by the node arenas
+    size_t usedBytes;     // node blocks in use, cached or being built
+    size_t liveNodes;
+};
+
+// A unique tree holds each key once. A non-unique tree, as used for
+// secondary indexes, holds any number of entries per key and orders them by
+// (key, RID); internal nodes then carry the RID of each separator as well,
+// so every entry has exactly one place in the tree.
+enum class IndexKeys { Unique, NonUnique };
+
+// Pull-based scan over the keys in [low, high], a batch at a time. Between
+// batches the cursor only remembers the last key it returned and seeks past
+// it on the next call, so it holds no nodes and survives concurrent splits
+// and merges. Stopping early is just not calling next again.
+template <typename K>
+class BasicIndexCursor {
 public:
-    BPlusTree(int order, string filename);
+    BasicIndexCursor(BasicBPlusTree<K>* tree, const K& low, const K& high, size_t batchSize = DEFAULT_CURSOR_BATCH);
+    // Replaces batch with the next entries; returns false once the range is exhausted
+    bool next(vector<pair<K, RID>>& batch);
+    void close() { done = true; }
+    // Continues from the same position in another tree over the same
+    // entries, such as one rebuilt to replace this one's
+    void rebind(BasicBPlusTree<K>* other) { tree = other; }
+private:
+    BasicBPlusTree<K>* tree;
+    K lastKey;
+    RID lastRID;
+    K high;
+    size_t batchSize;
+    bool started;
+    bool done;
+};
+
+// Thread safe: lookups, scans and inserts or removes that stay within one
+// leaf share the tree latch and only latch the leaf they touch. An insert
+// that would split or a remove that would underflow backs out and retries
+// with the tree latch held exclusively, so inner nodes never change while
+// any thread is descending through them.
+//
+// The tree is a template over its key type. Fixed-width keys (int32_t,
+// int64_t) have a compile-time node layout and capacity; string keys are
+// stored prefix compressed and a node is full when its page is, see
+// KeyTraits in NodePage.h. Tables index Key, as BPlusTree.
+//
+// A tree may give every leaf entry a payload of payloadBytes next to its
+// RID, opaque to the tree; covering indexes keep included column values
+// there. The width is fixed when the file is created, and leaves hold
+// fewer entries the wider it is (KeyTraits<K>::leafOrder).
+template <typename K>
+class BasicBPlusTree {
+public:
+    using Node = BPlusNode<K>;
+    // Called with each entry in place, under its leaf's latch; it must not
+    // call back into the tree
+    using EntryVisitor = function<void(const K& key, const RID& rid, const char* payload)>;
+
+    // Node capacity derived from the index page size (KeyTraits<K>::LEAF_ORDER / INTERNAL_ORDER)
+    BasicBPlusTree(string filename, size_t cacheCapacity = DEFAULT_NODE_CACHE);
+    BasicBPlusTree(string filename, IndexKeys keys, size_t cacheCapacity = DEFAULT_NODE_CACHE,
+                   uint32_t payloadBytes = 0);
+    // Smaller, fixed orders, mostly useful for exercising splits and merges in tests
+    BasicBPlusTree(int order, string filename, size_t cacheCapacity = DEFAULT_NODE_CACHE);
+    BasicBPlusTree(int leafOrder, int internalOrder, string filename, size_t cacheCapacity = DEFAULT_NODE_CACHE,
+                   IndexKeys keys = IndexKeys::Unique, uint32_t payloadBytes = 0);
+    ~BasicBPlusTree();
 
-    void insert(Key key, const RID& rid);
-    bool search(Key key, RID& rid);
-    bool remove(Key key);
-    vector<RID> rangeScan(Key low, Key high);
+    // payload points to payloadBytes bytes; null stores zeros
+    void insert(const K& key, const RID& rid, const char* payload = nullptr);
+    // Finds the first entry with key, copying its payload out when payload is not null
+    bool search(const K& key, RID& rid, char* payload = nullptr);
+    // Looks up many keys at once. The keys are sorted and descended together
+    // a level at a time, so keys that share a path visit each node once, the
+    // next node is prefetched into the CPU cache while one is searched, and
+    // the nodes a level is missing from the node cache are read as one batch
+    // of asynchronous reads. found[i] tells whether keys[i] has an entry, and
+    // rids[i] is then its first one.
+    void searchBatch(const vector<K>& keys, vector<RID>& rids, vector<bool>& found);
+    // Removes the first entry with key
+    bool remove(const K& key);
+    // Removes the entry (key, rid) only
+    bool remove(const K& key, const RID& rid);
+    // Overwrites the payload of the entry (key, rid) in place; false when there is none
+    bool updatePayload(const K& key, const RID& rid, const char* payload);
+    // Leaves are read ahead: the parent of the current leaf names the ones
+    // that follow, and those still in the range are read in batches of
+    // asynchronous reads before the scan reaches them
+    vector<RID> rangeScan(const K& low, const K& high);
+    // Visits the entries in [low, high] in order, with their payloads, and
+    // reads leaves ahead like rangeScan
+    void visitRange(const K& low, const K& high, const EntryVisitor& visit);
+    BasicIndexCursor<K> openRange(const K& low, const K& high, size_t batchSize = DEFAULT_CURSOR_BATCH);
+    // Appends up to max entries with from <= key <= high to out, skipping
+    // entries up to (from, fromRID) when !inclusive; in a unique tree that
+    // skips key from. Returns true when no entries remain past them.
+    bool scanBatch(const K& from, bool inclusive, const RID& fromRID, const K& high, size_t max,
+                   vector<pair<K, RID>>& out);
+    // Builds the tree bottom-up from (key, RID) pairs, sorting them first if
+    // needed. Nodes are filled to fillFactor of their capacity and written
+    // sequentially, leaves first. The tree must be empty. payloads holds
+    // entries[i]'s payload at i * payloadBytes, or is empty for zeros.
+    void bulkLoad(vector<pair<K, RID>> entries, double fillFactor = 1.0, vector<char> payloads = {});
+    bool isEmpty() const;
+    bool isUnique() const { return unique; }
+    uint32_t getPayloadBytes() const { return payloadBytes; }
+    // Number of levels, counting the root and the leaves
+    int getHeight();
+    size_t getCachedNodeCount() const;
+    TreeMemoryStats getMemoryStats() const;
+    // Node pages freed by merges, to be reused before the file grows
+    uint32_t getFreeNodeCount();
+    // Rewrites the tree into a new, dense file with the leaves in key order
+    // and no free pages. Other operations wait until it is done. A
+    // write-back tree must be checkpointed first.
+    void compactIndex(double fillFactor = 1.0);
+
+    // Write-back mode: changed nodes and root changes stay in memory until
+    // checkpoint(). Used when a write-ahead log makes the changes durable.
+    void enableWriteBack() { writeBack = true; }
+    void checkpoint(uint64_t lsn);
+    uint64_t getCheckpointLSN() const { return checkpointLSN; }
+    // Reads and writes node pages with O_DIRECT; the node cache already
+    // keeps the hot nodes, so the OS page cache would only hold them twice.
+    // Returns false when the file system does not support it.
+    bool enableDirectIO();
+    // True when a checkpoint was interrupted and the nodes on disk are inconsistent
+    bool isTorn() const { return torn; }
+    // Flags the nodes on disk as torn until the next checkpoint, so that a
+    // crash during changes that bypass the log forces a rebuild
+    void markTorn();
 private:
+    string filename;
     BPlusDiskTree* file;
-    BPlusNode* root;
-    int order;
-
-    void insertInternal(BPlusNode* node, Key key, BPlusNode* rightChild, vector<BPlusNode*>& path);
-    void persistNode(BPlusNode* node);
-    int minKeys() const;
-    void rebalanceLeaf(BPlusNode* leaf, vector<BPlusNode*>& path);
-    void rebalanceInternal(BPlusNode* node, vector<BPlusNode*>& path);
-    BPlusNode* findLeaf(Key key, vector<BPlusNode*>& path);
-    void splitLeaf(BPlusNode* leaf, vector<BPlusNode*>& path);
-    void splitInternal(BPlusNode* node, vector<BPlusNode*>& path);
-    BPlusNode* loadNode(uint32_t nodeID);
-};
\ No newline at end of file
+    Node* root;
+    size_t leafOrder;     // max keys in a leaf
+    size_t internalOrder; // max keys in an internal node
+    bool unique;
+    uint32_t payloadBytes; // per leaf entry
+
+    // Leaves and internal nodes are fixed-size blocks of their own size class
+    NodeArena leafArena;
+    NodeArena internalArena;
+
+    // Shared by operations that leave inner nodes and the root unchanged;
+    // held exclusively for splits, merges, bulk loads, checkpoints and eviction
+    mutable shared_mutex treeLatch;
+
+    // Nodes are loaded on first touch and kept in a second-chance cache keyed
+    // by node ID. Nodes are only evicted under the exclusive tree latch, so a
+    // pointer from getNode stays valid while the tree latch is held.
+    unordered_map<uint32_t, Node*> cache;
+    mutable shared_mutex cacheLatch; // guards the map itself
+    size_t cacheCapacity;
+    atomic<size_t> trimThreshold; // cache size that triggers the next trim
+
+    bool writeBack;
+    bool directIO;
+    bool rootDirty;
+    bool torn;
+    uint64_t checkpointLSN;
+    vector<uint32_t> pendingFree; // pages of discarded nodes, freed at the next checkpoint
+    // Write-through trees defer the writes of a split or merge to its end,
+    // so a node it changes several times is written once
+    bool deferWrites;
+    vector<Node*> deferred;
+    vector<uint32_t> reserved; // pages allocated ahead for a split, handed out by allocatePage
+
+    // Scope of a split or merge, entered under the exclusive tree latch.
+    // Defers the writes of a write-through tree, and on every way out of the
+    // scope writes them and frees the reserved pages a split did not use.
+    class StructureChange {
+    public:
+        explicit StructureChange(BasicBPlusTree* tree) : tree(tree), done(false) {
+            tree->deferWrites = !tree->writeBack;
+        }
+        ~StructureChange() {
+            if (done) return;
+            try {
+                tree->endStructureChange();
+            } catch (...) {
+                // Already unwinding; flushDeferred flagged the tree torn if a write failed
+            }
+        }
+        void finish() {
+            done = true;
+            tree->endStructureChange();
+        }
+    private:
+        BasicBPlusTree* tree;
+        bool done;
+    };
+
+    size_t entryLowerBound(const Node* node, const K& key, const RID& rid) const;
+    size_t entryUpperBound(const Node* node, const K& key, const RID& rid) const;
+    bool removeEntry(const K& key, const RID* rid);
+    void insertInternal(Node* node, const K& key, const RID& rid, Node* rightChild, vector<Node*>& path);
+    void persistNode(Node* node);
+    void writeNodeToDisk(Node* node);
+    // Writes the nodes in node ID order, in batches of asynchronous writes
+    void writeNodes(vector<Node*>& nodes);
+    void flushDeferred();
+    // Allocates the pages a split may need before anything changes, so a
+    // full file fails the insert up front rather than halfway through
+    void reservePages(size_t count);
+    // Pages a split of the leaf below path can take, counted on the safe side
+    size_t splitPages(const vector<Node*>& path) const;
+    // Frees the reserved pages left over and writes the deferred nodes
+    void endStructureChange();
+    // Serializes into an INDEX_PAGE_SIZE buffer
+    void encodeNode(const Node* node, char* page) const;
+    void persistRoot();
+    size_t minLeafKeys() const;
+    size_t minInternalKeys() const;
+    // Node capacity. Fixed-width keys only count entries; variable-length
+    // keys also count bytes. skip leaves out one entry.
+    size_t nodeSize(const Node* node, size_t skip = SIZE_MAX) const;
+    bool overfull(const Node* node) const;
+    bool underfull(const Node* node, size_t skip = SIZE_MAX) const;
+    bool canMerge(const Node* left, const Node* right, const K& separator) const;
+    bool canBorrow(const Node* node, const Node* sibling, bool fromLeft, const K& separator) const;
+    size_t splitPoint(const Node* node) const;
+    void rebalanceLeaf(Node* leaf, vector<Node*>& path);
+    void rebalanceInternal(Node* node, vector<Node*>& path);
+    Node* findLeaf(const K& key, const RID& rid, vector<Node*>& path);
+    void splitLeaf(Node* leaf, vector<Node*>& path);
+    void splitInternal(Node* node, vector<Node*>& path);
+    Node* newNode(bool leaf);
+    void freeNode(Node* node);
+    void discardNode(Node* node);
+    uint32_t allocatePage();
+    void releasePage(uint32_t nodeID);
+    Node* loadNode(uint32_t nodeID);
+    Node* decodeNode(uint32_t nodeID, const char* page);
+    // Reads the nodes not in the cache in one batch and caches them
+    void loadNodes(vector<uint32_t> nodeIDs);
+    // Loads up to READAHEAD_LEAVES children of parent from index from on that
+    // can hold keys <= high; returns the first child not covered
+    size_t readAheadLeaves(const Node* parent, size_t from, const K& high);
+    // Calls emit(leaf, index) for every entry in [low, high], in order
+    template <typename Emit>
+    void scanLeaves(const K& low, const K& high, Emit&& emit);
+    template <typename Emit>
+    void walkLeaves(const K& low, const K& high, Emit& emit);
+    Node* getNode(uint32_t nodeID);
+    void cacheNode(Node* node);
+    void trimCache();
+    void evictNodes();
+    void clearCache();
+    void markTornLocked();
+};
+
+using BPlusTree = BasicBPlusTree<Key>;
+using IndexCursor = BasicIndexCursor<Key>;
+using BPlusTree64 = BasicBPlusTree<int64_t>;
+using StringBPlusTree = BasicBPlusTree<string>;
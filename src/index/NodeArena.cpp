@@ -0,0 +1,49 @@
+//Implementation of the node slab allocator.
+
+#include "NodeArena.h"
+#include <algorithm>
+
+NodeArena::NodeArena(size_t blockSize)
+    : blockSize(max((blockSize + alignof(max_align_t) - 1) / alignof(max_align_t) * alignof(max_align_t),
+                    sizeof(void*))),
+      freeList(nullptr), carved(0), live(0) {
+    blocksPerSlab = max<size_t>(NODE_SLAB_BYTES / this->blockSize, 1);
+    carved = blocksPerSlab; // the first allocation opens a slab
+}
+
+NodeArena::~NodeArena() {
+    for (char* slab : slabs)
+        ::operator delete(slab);
+}
+
+void* NodeArena::allocate() {
+    lock_guard<mutex> guard(latch);
+    live++;
+    if (freeList) {
+        void* block = freeList;
+        freeList = *static_cast<void**>(block);
+        return block;
+    }
+    if (carved == blocksPerSlab) {
+        slabs.push_back(static_cast<char*>(::operator new(blocksPerSlab * blockSize)));
+        carved = 0;
+    }
+    return slabs.back() + blockSize * carved++;
+}
+
+void NodeArena::release(void* block) {
+    lock_guard<mutex> guard(latch);
+    *static_cast<void**>(block) = freeList;
+    freeList = block;
+    live--;
+}
+
+size_t NodeArena::reservedBytes() const {
+    lock_guard<mutex> guard(latch);
+    return slabs.size() * blocksPerSlab * blockSize;
+}
+
+size_t NodeArena::liveBlocks() const {
+    lock_guard<mutex> guard(latch);
+    return live;
+}
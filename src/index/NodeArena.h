@@ -0,0 +1,36 @@
+#pragma once
+//Node Arena
+//Slab allocator for the in-memory nodes of a B+ tree. Every block has the
+//same size, so blocks are carved out of large slabs and recycled through a
+//free list: loading, evicting and merging nodes does not go through the
+//general heap, and memory freed by one node is reused by the next.
+#include <vector>
+#include <cstddef>
+#include <mutex>
+using namespace std;
+
+constexpr size_t NODE_SLAB_BYTES = 256 * 1024; // memory requested from the heap at a time
+
+class NodeArena {
+public:
+    NodeArena(size_t blockSize);
+    ~NodeArena();
+
+    // Uninitialized block of blockSize bytes, aligned for any node
+    void* allocate();
+    void release(void* block);
+
+    size_t getBlockSize() const { return blockSize; }
+    // Bytes held in slabs, whether in use or free
+    size_t reservedBytes() const;
+    // Blocks handed out and not yet released
+    size_t liveBlocks() const;
+private:
+    size_t blockSize;
+    size_t blocksPerSlab;
+    vector<char*> slabs;
+    void* freeList; // each free block starts with a pointer to the next
+    size_t carved;  // blocks taken from the last slab so far
+    size_t live;
+    mutable mutex latch; // nodes are loaded by concurrent readers
+};
@@ -1,22 +1,227 @@
 #pragma once
 #include <vector>
+#include <string>
 #include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
 #include "include/Common.h"
 
 using namespace std;
 
 constexpr uint32_t INDEX_PAGE_SIZE = 4096;
+constexpr uint32_t INVALID_NODE = UINT32_MAX;
+constexpr uint32_t MAX_PAYLOAD_BYTES = 512; // widest leaf entry payload an index accepts
 
 struct NodeHeader {
     uint32_t nodeID;
     bool isLeaf;
+    bool separatorRIDs; // internal node that also stores the RID of each key (non-unique trees)
     uint16_t numKeys;
     uint32_t nextLeaf;
 };
 
+// Page layout: header, then keys, then one RID per key (leaf, or internal
+// with separatorRIDs), then one more child ID than keys (internal). Leaves
+// of a tree with a payload width, such as a covering index, follow their
+// RIDs with one fixed-size payload per key. How the keys are laid out
+// depends on the key type, see KeyTraits.
+//
+// Fixed-width keys are stored as a plain array, so node capacity is a key
+// count known at compile time. A node holds one extra entry in memory right
+// before it splits, never on disk.
+template <typename K>
+struct KeyTraits {
+    static constexpr bool VARIABLE = false;
+    static constexpr uint32_t TYPE_ID = sizeof(K) == sizeof(int32_t) ? 0 : 1; // recorded in the index meta page
+
+    static constexpr int LEAF_ORDER =
+        (INDEX_PAGE_SIZE - sizeof(NodeHeader)) / (sizeof(K) + sizeof(RID));
+    static constexpr int INTERNAL_ORDER =
+        (INDEX_PAGE_SIZE - sizeof(NodeHeader) - sizeof(uint32_t)) / (sizeof(K) + sizeof(uint32_t));
+    // Internal nodes of non-unique trees store a RID next to every separator key
+    static constexpr int NON_UNIQUE_INTERNAL_ORDER =
+        (INDEX_PAGE_SIZE - sizeof(NodeHeader) - sizeof(uint32_t)) / (sizeof(K) + sizeof(RID) + sizeof(uint32_t));
+
+    static_assert(sizeof(NodeHeader) + LEAF_ORDER * (sizeof(K) + sizeof(RID)) <= INDEX_PAGE_SIZE,
+                  "leaf node does not fit in an index page");
+    static_assert(sizeof(NodeHeader) + INTERNAL_ORDER * sizeof(K) + (INTERNAL_ORDER + 1) * sizeof(uint32_t) <= INDEX_PAGE_SIZE,
+                  "internal node does not fit in an index page");
+    static_assert(sizeof(NodeHeader) + NON_UNIQUE_INTERNAL_ORDER * (sizeof(K) + sizeof(RID)) +
+                  (NON_UNIQUE_INTERNAL_ORDER + 1) * sizeof(uint32_t) <= INDEX_PAGE_SIZE,
+                  "non-unique internal node does not fit in an index page");
+
+    // Leaf capacity when each entry also carries payloadBytes
+    static constexpr int leafOrder(uint32_t payloadBytes) {
+        return (INDEX_PAGE_SIZE - sizeof(NodeHeader)) / (sizeof(K) + sizeof(RID) + payloadBytes);
+    }
+    static void validate(const K&) {}
+    // Size of the keys, less keys[skip] if it exists
+    template <typename Keys>
+    static size_t keyBytes(const Keys& keys, size_t skip = SIZE_MAX) {
+        return (keys.size() - (skip < keys.size())) * sizeof(K);
+    }
+    static size_t write(const vector<K>& keys, char* out) {
+        if (!keys.empty()) memcpy(out, keys.data(), keys.size() * sizeof(K));
+        return keys.size() * sizeof(K);
+    }
+    static size_t read(const char* in, uint16_t numKeys, vector<K>& keys) {
+        keys.resize(numKeys);
+        if (numKeys) memcpy(keys.data(), in, numKeys * sizeof(K));
+        return numKeys * sizeof(K);
+    }
+};
+
+constexpr size_t MAX_STRING_KEY = 256; // longest string key an index accepts
+
+// String keys are prefix compressed: the prefix shared by every key in the
+// node is stored once, then each key's (uint16 length, bytes) suffix. Sorted
+// keys share exactly the prefix of the first and last one. Capacity is in
+// bytes; the orders below only bound the number of entries.
+template <>
+struct KeyTraits<string> {
+    static constexpr bool VARIABLE = true;
+    static constexpr uint32_t TYPE_ID = 2;
+
+    static constexpr int LEAF_ORDER =
+        (INDEX_PAGE_SIZE - sizeof(NodeHeader) - sizeof(uint16_t)) / (sizeof(uint16_t) + sizeof(RID));
+    static constexpr int INTERNAL_ORDER =
+        (INDEX_PAGE_SIZE - sizeof(NodeHeader) - sizeof(uint16_t) - sizeof(uint32_t)) /
+        (sizeof(uint16_t) + sizeof(uint32_t));
+    static constexpr int NON_UNIQUE_INTERNAL_ORDER =
+        (INDEX_PAGE_SIZE - sizeof(NodeHeader) - sizeof(uint16_t) - sizeof(uint32_t)) /
+        (sizeof(uint16_t) + sizeof(RID) + sizeof(uint32_t));
+
+    static constexpr int leafOrder(uint32_t payloadBytes) {
+        return (INDEX_PAGE_SIZE - sizeof(NodeHeader) - sizeof(uint16_t)) / (sizeof(uint16_t) + sizeof(RID) + payloadBytes);
+    }
+
+    static void validate(const string& key) {
+        if (key.size() > MAX_STRING_KEY)
+            throw runtime_error("Index key longer than " + to_string(MAX_STRING_KEY) + " bytes");
+    }
+
+    static size_t commonPrefix(const string& a, const string& b) {
+        size_t n = min(a.size(), b.size()), i = 0;
+        while (i < n && a[i] == b[i]) i++;
+        return i;
+    }
+
+    // Size of the keys of n entries with the given total length and shared prefix
+    static size_t keyBytes(size_t n, size_t totalLength, size_t prefix) {
+        return sizeof(uint16_t) + prefix + n * sizeof(uint16_t) + totalLength - n * prefix;
+    }
+
+    static size_t keyBytes(const vector<string>& keys, size_t skip = SIZE_MAX) {
+        size_t n = keys.size() - (skip < keys.size());
+        if (n == 0) return sizeof(uint16_t);
+        size_t total = 0;
+        for (size_t i = 0; i < keys.size(); i++)
+            if (i != skip) total += keys[i].size();
+        const string& first = keys[skip == 0 ? 1 : 0];
+        const string& last = keys[skip == keys.size() - 1 ? keys.size() - 2 : keys.size() - 1];
+        return keyBytes(n, total, commonPrefix(first, last));
+    }
+
+    static size_t write(const vector<string>& keys, char* out) {
+        uint16_t prefix = keys.empty() ? 0 : commonPrefix(keys.front(), keys.back());
+        char* pos = out;
+        memcpy(pos, &prefix, sizeof(prefix));
+        pos += sizeof(prefix);
+        if (prefix) memcpy(pos, keys.front().data(), prefix);
+        pos += prefix;
+        for (const auto& key : keys) {
+            uint16_t length = key.size() - prefix;
+            memcpy(pos, &length, sizeof(length));
+            pos += sizeof(length);
+            memcpy(pos, key.data() + prefix, length);
+            pos += length;
+        }
+        return pos - out;
+    }
+
+    static size_t read(const char* in, uint16_t numKeys, vector<string>& keys) {
+        const char* pos = in;
+        uint16_t prefix;
+        memcpy(&prefix, pos, sizeof(prefix));
+        pos += sizeof(prefix);
+        string shared(pos, prefix);
+        pos += prefix;
+        keys.resize(numKeys);
+        for (auto& key : keys) {
+            uint16_t length;
+            memcpy(&length, pos, sizeof(length));
+            pos += sizeof(length);
+            key.reserve(prefix + length);
+            key.assign(shared).append(pos, length);
+            pos += length;
+        }
+        return pos - in;
+    }
+};
+
+// The index used by tables is keyed on Key
+constexpr int LEAF_ORDER = KeyTraits<Key>::LEAF_ORDER;
+constexpr int INTERNAL_ORDER = KeyTraits<Key>::INTERNAL_ORDER;
+constexpr int NON_UNIQUE_INTERNAL_ORDER = KeyTraits<Key>::NON_UNIQUE_INTERNAL_ORDER;
+
+// Bytes a node takes in an index page, given the size of its keys
+inline size_t nodeBytes(size_t keyBytes, size_t numKeys, bool isLeaf, bool separatorRIDs, uint32_t payloadBytes = 0) {
+    size_t bytes = sizeof(NodeHeader) + keyBytes;
+    if (isLeaf || separatorRIDs) bytes += numKeys * sizeof(RID);
+    if (isLeaf) bytes += numKeys * payloadBytes;
+    if (!isLeaf) bytes += (numKeys + 1) * sizeof(uint32_t);
+    return bytes;
+}
+
+template <typename K>
 struct NodePage {
     NodeHeader header;
-    vector<Key> keys;
+    vector<K> keys;
     vector<uint32_t> children; // internal nodes
-    vector<RID> rids;          // leaf nodes
+    vector<RID> rids;          // leaf nodes, and internal nodes with separatorRIDs
+    vector<char> payloads;     // leaf nodes: payloadBytes per key, in key order
+
+    // Serializes into an INDEX_PAGE_SIZE buffer
+    void encode(char* page) const {
+        bool withRIDs = header.isLeaf || header.separatorRIDs;
+        if (nodeBytes(KeyTraits<K>::keyBytes(keys), keys.size(), header.isLeaf, header.separatorRIDs) +
+            payloads.size() > INDEX_PAGE_SIZE)
+            throw runtime_error("Node does not fit in an index page");
+        size_t offset = 0;
+        memcpy(page, &header, sizeof(NodeHeader));
+        offset += sizeof(NodeHeader);
+        offset += KeyTraits<K>::write(keys, page + offset);
+        if (withRIDs && !rids.empty()) {
+            memcpy(page + offset, rids.data(), rids.size() * sizeof(RID));
+            offset += rids.size() * sizeof(RID);
+        }
+        if (header.isLeaf && !payloads.empty())
+            memcpy(page + offset, payloads.data(), payloads.size());
+        if (!header.isLeaf)
+            memcpy(page + offset, children.data(), children.size() * sizeof(uint32_t));
+    }
+
+    // payloadBytes is the tree's; the page does not record it
+    static NodePage decode(const char* page, uint32_t payloadBytes = 0) {
+        NodePage node;
+        size_t offset = 0;
+        memcpy(&node.header, page, sizeof(NodeHeader));
+        offset += sizeof(NodeHeader);
+        offset += KeyTraits<K>::read(page + offset, node.header.numKeys, node.keys);
+        if ((node.header.isLeaf || node.header.separatorRIDs) && node.header.numKeys) {
+            node.rids.resize(node.header.numKeys);
+            memcpy(node.rids.data(), page + offset, node.header.numKeys * sizeof(RID));
+            offset += node.header.numKeys * sizeof(RID);
+        }
+        if (node.header.isLeaf && payloadBytes) {
+            node.payloads.assign(page + offset, page + offset + node.header.numKeys * payloadBytes);
+            offset += node.header.numKeys * payloadBytes;
+        }
+        if (!node.header.isLeaf) {
+            node.children.resize(node.header.numKeys + 1);
+            memcpy(node.children.data(), page + offset, (node.header.numKeys + 1) * sizeof(uint32_t));
+        }
+        return node;
+    }
 };
@@ -0,0 +1,152 @@
+//Implementation of the in-node search kernels.
+
+#include "NodeSearch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NODE_SEARCH_X86 1
+#endif
+
+static_assert(sizeof(Key) == sizeof(int32_t), "SIMD search kernels assume 32-bit keys");
+
+namespace {
+
+// Keys left for the SIMD scan once binary search has narrowed the range:
+// 32 keys are two 64-byte cache lines
+constexpr size_t SCAN_BLOCK = 32;
+
+// Narrows [0, n) to a window of at most SCAN_BLOCK keys that contains the
+// answer. Keys before the window are < key (or <= key for upper bounds).
+template <bool Upper>
+inline size_t narrow(const Key* keys, size_t& len, Key key) {
+    size_t lo = 0;
+    while (len > SCAN_BLOCK) {
+        size_t half = len / 2;
+        Key probe = keys[lo + half - 1];
+        bool right = Upper ? probe <= key : probe < key;
+        lo = right ? lo + half : lo; // compiles to a conditional move
+        len -= half;
+    }
+    return lo;
+}
+
+template <bool Upper>
+size_t countScalar(const Key* keys, size_t n, Key key) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++)
+        count += Upper ? keys[i] <= key : keys[i] < key;
+    return count;
+}
+
+template <bool Upper>
+size_t searchScalar(const Key* keys, size_t n, Key key) {
+    size_t len = n;
+    size_t lo = narrow<Upper>(keys, len, key);
+    return lo + countScalar<Upper>(keys + lo, len, key);
+}
+
+#ifdef NODE_SEARCH_X86
+
+// Counts keys below the search key four at a time: cmpgt yields an all-ones
+// lane per match and movemask packs one bit per lane
+template <bool Upper>
+__attribute__((target("sse4.2,popcnt")))
+size_t searchSSE42(const Key* keys, size_t n, Key key) {
+    size_t len = n;
+    size_t lo = narrow<Upper>(keys, len, key);
+    const Key* block = keys + lo;
+    __m128i needle = _mm_set1_epi32(key);
+    size_t count = 0, i = 0;
+    for (; i + 4 <= len; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+        // lower bound counts v < key; upper bound counts v <= key, i.e. not v > key
+        __m128i hit = Upper ? _mm_cmpgt_epi32(v, needle) : _mm_cmpgt_epi32(needle, v);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(hit));
+        count += Upper ? 4 - __builtin_popcount(mask) : __builtin_popcount(mask);
+    }
+    return lo + count + countScalar<Upper>(block + i, len - i, key);
+}
+
+template <bool Upper>
+__attribute__((target("avx2,popcnt")))
+size_t searchAVX2(const Key* keys, size_t n, Key key) {
+    size_t len = n;
+    size_t lo = narrow<Upper>(keys, len, key);
+    const Key* block = keys + lo;
+    __m256i needle = _mm256_set1_epi32(key);
+    size_t count = 0, i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+        __m256i hit = Upper ? _mm256_cmpgt_epi32(v, needle) : _mm256_cmpgt_epi32(needle, v);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+        count += Upper ? 8 - __builtin_popcount(mask) : __builtin_popcount(mask);
+    }
+    return lo + count + countScalar<Upper>(block + i, len - i, key);
+}
+
+#endif
+
+struct Kernel {
+    SearchKernel kind;
+    size_t (*lower)(const Key*, size_t, Key);
+    size_t (*upper)(const Key*, size_t, Key);
+};
+
+bool supported(SearchKernel kernel) {
+#ifdef NODE_SEARCH_X86
+    if (kernel == SearchKernel::AVX2) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    if (kernel == SearchKernel::SSE42) return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+    return true;
+#else
+    return kernel == SearchKernel::Scalar;
+#endif
+}
+
+Kernel makeKernel(SearchKernel kind) {
+    switch (kind) {
+#ifdef NODE_SEARCH_X86
+    case SearchKernel::AVX2: return {kind, searchAVX2<false>, searchAVX2<true>};
+    case SearchKernel::SSE42: return {kind, searchSSE42<false>, searchSSE42<true>};
+#endif
+    default: return {SearchKernel::Scalar, searchScalar<false>, searchScalar<true>};
+    }
+}
+
+Kernel detectKernel() {
+    if (supported(SearchKernel::AVX2)) return makeKernel(SearchKernel::AVX2);
+    if (supported(SearchKernel::SSE42)) return makeKernel(SearchKernel::SSE42);
+    return makeKernel(SearchKernel::Scalar);
+}
+
+Kernel& active() {
+    static Kernel kernel = detectKernel();
+    return kernel;
+}
+
+} // namespace
+
+size_t nodeLowerBound(const Key* keys, size_t n, Key key) {
+    return active().lower(keys, n, key);
+}
+
+size_t nodeUpperBound(const Key* keys, size_t n, Key key) {
+    return active().upper(keys, n, key);
+}
+
+SearchKernel activeSearchKernel() {
+    return active().kind;
+}
+
+const char* searchKernelName(SearchKernel kernel) {
+    switch (kernel) {
+    case SearchKernel::AVX2: return "avx2";
+    case SearchKernel::SSE42: return "sse4.2";
+    default: return "scalar";
+    }
+}
+
+bool forceSearchKernel(SearchKernel kernel) {
+    if (!supported(kernel)) return false;
+    active() = makeKernel(kernel);
+    return true;
+}
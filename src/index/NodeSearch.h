@@ -0,0 +1,55 @@
+#pragma once
+//In-node key search
+//Search kernels over the contiguous, sorted key array of a B+ tree node.
+//Large nodes are narrowed with a branch-free binary search down to a small
+//block of cache lines, which is then scanned with SIMD compares; the best
+//kernel supported by the CPU is selected once at startup.
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "include/Common.h"
+
+using namespace std;
+
+enum class SearchKernel { Scalar, SSE42, AVX2 };
+
+// Index of the first key >= key
+size_t nodeLowerBound(const Key* keys, size_t n, Key key);
+// Index of the first key > key
+size_t nodeUpperBound(const Key* keys, size_t n, Key key);
+
+inline size_t nodeLowerBound(const vector<Key>& keys, Key key) {
+    return nodeLowerBound(keys.data(), keys.size(), key);
+}
+
+inline size_t nodeUpperBound(const vector<Key>& keys, Key key) {
+    return nodeUpperBound(keys.data(), keys.size(), key);
+}
+
+// Other key types (int64, strings) use a plain binary search
+template <typename K>
+size_t nodeLowerBound(const K* keys, size_t n, const K& key) {
+    return lower_bound(keys, keys + n, key) - keys;
+}
+
+template <typename K>
+size_t nodeUpperBound(const K* keys, size_t n, const K& key) {
+    return upper_bound(keys, keys + n, key) - keys;
+}
+
+template <typename K>
+size_t nodeLowerBound(const vector<K>& keys, const K& key) {
+    return nodeLowerBound(keys.data(), keys.size(), key);
+}
+
+template <typename K>
+size_t nodeUpperBound(const vector<K>& keys, const K& key) {
+    return nodeUpperBound(keys.data(), keys.size(), key);
+}
+
+SearchKernel activeSearchKernel();
+const char* searchKernelName(SearchKernel kernel);
+// Overrides runtime detection, e.g. to benchmark kernels against each other.
+// Returns false if the CPU does not support the requested kernel.
+bool forceSearchKernel(SearchKernel kernel);
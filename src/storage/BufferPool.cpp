@@ -0,0 +1,283 @@
+//Implementation of the buffer pool that caches table pages in a fixed number of frames.
+
+#include "BufferPool.h"
+#include "WriteAheadLog.h"
+#include "include/Metrics.h"
+#include <stdexcept>
+#include <algorithm>
+
+BufferPool::BufferPool(const string& filename, size_t numFrames, const IOConfig& ioConfig)
+    : file(filename), io(file.descriptor(), ioConfig), wal(nullptr), frames(numFrames), clockHand(0), numPages(0), stats{} {
+    if (numFrames == 0) throw runtime_error("Buffer pool needs at least one frame");
+
+    uint64_t fileSize = file.size();
+    if (fileSize % PAGE_SIZE != 0) throw runtime_error("Corrupt table file: partial page detected");
+    numPages = fileSize / PAGE_SIZE;
+    // Every page carries the format; the first one stands for the file
+    if (numPages > 0) {
+        Page first(0);
+        file.read(0, first.data(), PAGE_SIZE);
+        if (!first.hasCurrentFormat())
+            throw runtime_error("Table file " + filename + " has an unsupported page format");
+    }
+}
+
+BufferPool::~BufferPool() {
+    try {
+        flushAll();
+    } catch (...) {
+        // Pages the failed log no longer covers must not be written anyway
+    }
+}
+
+Page* BufferPool::fetchPage(uint32_t pageID) {
+    unique_lock<mutex> lock(latch);
+    if (pageID >= numPages) {
+        throw runtime_error("Invalid page ID: out of bounds");
+    }
+
+    // Another thread is reading the page in: wait for it rather than read it twice
+    auto it = pageTable.find(pageID);
+    while (it != pageTable.end() && frames[it->second].loading) {
+        loaded.wait(lock);
+        it = pageTable.find(pageID);
+    }
+    if (it != pageTable.end()) {
+        Frame& frame = frames[it->second];
+        frame.pinCount++;
+        frame.referenced = true;
+        stats.hits++;
+        Metrics::count(Counter::PoolHits);
+        return &frame.page;
+    }
+
+    stats.misses++;
+    Metrics::count(Counter::PoolMisses);
+    size_t idx = startLoad(pageID);
+    // The frame is pinned and loading, so nothing else touches it while the latch is released
+    lock.unlock();
+    try {
+        readPageFromDisk(pageID, frames[idx].page);
+    } catch (...) {
+        lock.lock();
+        abortLoad(idx);
+        throw;
+    }
+    lock.lock();
+    finishLoad(idx);
+    frames[idx].pinCount++;
+    return &frames[idx].page;
+}
+
+Page* BufferPool::newPage() {
+    lock_guard<mutex> guard(latch);
+    size_t idx = findVictim();
+    Frame& frame = frames[idx];
+    uint32_t pageID = numPages++;
+    frame.page = Page(pageID);
+    frame.pageID = pageID;
+    frame.pinCount = 1;
+    frame.referenced = true;
+    frame.inUse = true;
+    // Write the empty page right away so the file length always covers numPages
+    writePageToDisk(frame);
+    pageTable[pageID] = idx;
+    return &frame.page;
+}
+
+void BufferPool::appendPage(const Page& page) {
+    lock_guard<mutex> guard(latch);
+    if (page.getPageID() != numPages)
+        throw runtime_error("Appended page must follow the last page");
+    file.write(static_cast<uint64_t>(numPages) * PAGE_SIZE, page.data(), PAGE_SIZE);
+    numPages++;
+    stats.writebacks++;
+    Metrics::count(Counter::PageWrites);
+    Metrics::count(Counter::PageBytesWritten, PAGE_SIZE);
+}
+
+void BufferPool::unpinPage(uint32_t pageID, bool isDirty) {
+    lock_guard<mutex> guard(latch);
+    auto it = pageTable.find(pageID);
+    if (it == pageTable.end()) return;
+    Frame& frame = frames[it->second];
+    if (frame.pinCount > 0) frame.pinCount--;
+    if (isDirty) {
+        frame.dirty = true;
+        stats.dirtied++;
+    }
+}
+
+void BufferPool::flushPage(uint32_t pageID) {
+    lock_guard<mutex> guard(latch);
+    auto it = pageTable.find(pageID);
+    if (it == pageTable.end()) return;
+    Frame& frame = frames[it->second];
+    if (frame.dirty) writePageToDisk(frame);
+}
+
+void BufferPool::flushAll() {
+    lock_guard<mutex> guard(latch);
+    vector<Frame*> dirty;
+    uint64_t maxLSN = 0;
+    for (auto& frame : frames) {
+        if (frame.inUse && frame.dirty) {
+            dirty.push_back(&frame);
+            maxLSN = max(maxLSN, frame.page.getPageLSN());
+        }
+    }
+    if (dirty.empty()) return;
+
+    // One log flush covers the whole batch; page order keeps the writes sequential
+    if (wal) wal->flushTo(maxLSN);
+    sort(dirty.begin(), dirty.end(), [](const Frame* a, const Frame* b) { return a->pageID < b->pageID; });
+    vector<IORequest> requests;
+    for (Frame* frame : dirty)
+        requests.push_back({true, static_cast<uint64_t>(frame->pageID) * PAGE_SIZE, frame->page.data(), PAGE_SIZE});
+    io.run(requests, [&](size_t i) {
+        dirty[i]->dirty = false;
+        stats.writebacks++;
+    });
+    Metrics::count(Counter::PoolFlushes);
+    Metrics::count(Counter::PageWrites, dirty.size());
+    Metrics::count(Counter::PageBytesWritten, dirty.size() * PAGE_SIZE);
+}
+
+void BufferPool::sync() {
+    file.datasync();
+}
+
+void BufferPool::prefetch(uint32_t firstPage, uint32_t count) {
+    vector<uint32_t> pageIDs(count);
+    for (uint32_t i = 0; i < count; i++)
+        pageIDs[i] = firstPage + i;
+    prefetch(pageIDs);
+}
+
+void BufferPool::prefetch(const vector<uint32_t>& pageIDs) {
+    unique_lock<mutex> lock(latch);
+    size_t limit = max<size_t>(1, frames.size() / 2);
+    vector<size_t> loading;
+    vector<IORequest> requests;
+    for (uint32_t pageID : pageIDs) {
+        if (loading.size() == limit) break;
+        if (pageID >= numPages || pageTable.count(pageID)) continue;
+        size_t idx;
+        try {
+            idx = startLoad(pageID);
+        } catch (const runtime_error&) {
+            break; // every other frame is pinned; read what has a frame
+        }
+        loading.push_back(idx);
+        requests.push_back({false, static_cast<uint64_t>(pageID) * PAGE_SIZE, frames[idx].page.data(), PAGE_SIZE});
+    }
+    if (loading.empty()) return;
+
+    lock.unlock();
+    try {
+        io.run(requests);
+    } catch (...) {
+        lock.lock();
+        for (size_t idx : loading) abortLoad(idx);
+        throw;
+    }
+    lock.lock();
+    for (size_t idx : loading) {
+        if (!frames[idx].page.hasCurrentFormat()) {
+            uint32_t pageID = frames[idx].pageID;
+            for (size_t other : loading) abortLoad(other);
+            throw runtime_error("Unsupported page format on page " + to_string(pageID));
+        }
+    }
+    for (size_t idx : loading) finishLoad(idx);
+    stats.prefetched += loading.size();
+    Metrics::count(Counter::PageReads, loading.size());
+    Metrics::count(Counter::PageBytesRead, loading.size() * PAGE_SIZE);
+}
+
+bool BufferPool::enableDirectIO() {
+    lock_guard<mutex> guard(latch);
+    return file.setDirect(true);
+}
+
+uint32_t BufferPool::getNumPages() const {
+    lock_guard<mutex> guard(latch);
+    return numPages;
+}
+
+BufferPoolStats BufferPool::getStats() const {
+    lock_guard<mutex> guard(latch);
+    return stats;
+}
+
+// CLOCK: sweep the frames, clearing reference bits, until an unpinned frame
+// with a cleared bit is found. Two full sweeps without a victim means every
+// frame is pinned.
+size_t BufferPool::findVictim() {
+    for (size_t step = 0; step < 2 * frames.size(); ++step) {
+        size_t idx = clockHand;
+        clockHand = (clockHand + 1) % frames.size();
+        Frame& frame = frames[idx];
+
+        if (!frame.inUse) return idx;
+        if (frame.pinCount > 0) continue;
+        if (frame.referenced) {
+            frame.referenced = false;
+            continue;
+        }
+
+        if (frame.dirty) writePageToDisk(frame);
+        pageTable.erase(frame.pageID);
+        frame.inUse = false;
+        stats.evictions++;
+        return idx;
+    }
+    throw runtime_error("Buffer pool exhausted: all frames are pinned");
+}
+
+size_t BufferPool::startLoad(uint32_t pageID) {
+    size_t idx = findVictim();
+    Frame& frame = frames[idx];
+    // Pinned until its read completes, so victim sweeps skip it
+    frame.pageID = pageID;
+    frame.pinCount = 1;
+    frame.dirty = false;
+    frame.referenced = true;
+    frame.inUse = true;
+    frame.loading = true;
+    pageTable[pageID] = idx;
+    return idx;
+}
+
+// Leaves the frame resident and unpinned; a fetch adds its own pin
+void BufferPool::finishLoad(size_t idx) {
+    frames[idx].loading = false;
+    frames[idx].pinCount--;
+    loaded.notify_all();
+}
+
+// Frees the frame; waiting fetches find the page missing and read it themselves
+void BufferPool::abortLoad(size_t idx) {
+    Frame& frame = frames[idx];
+    pageTable.erase(frame.pageID);
+    frame.inUse = false;
+    frame.loading = false;
+    frame.pinCount = 0;
+    loaded.notify_all();
+}
+
+void BufferPool::writePageToDisk(Frame& frame) {
+    if (wal) wal->flushTo(frame.page.getPageLSN());
+    file.write(static_cast<uint64_t>(frame.pageID) * PAGE_SIZE, frame.page.data(), PAGE_SIZE);
+    frame.dirty = false;
+    stats.writebacks++;
+    Metrics::count(Counter::PageWrites);
+    Metrics::count(Counter::PageBytesWritten, PAGE_SIZE);
+}
+
+void BufferPool::readPageFromDisk(uint32_t pageID, Page& page) {
+    file.read(static_cast<uint64_t>(pageID) * PAGE_SIZE, page.data(), PAGE_SIZE);
+    Metrics::count(Counter::PageReads);
+    Metrics::count(Counter::PageBytesRead, PAGE_SIZE);
+    if (!page.hasCurrentFormat()) throw runtime_error("Unsupported page format on page " + to_string(pageID));
+}
@@ -0,0 +1,118 @@
+#pragma once
+//Buffer Pool
+//Caches a bounded number of table pages in memory frames. Pages are pinned
+//while in use and unpinned pages are evicted with the CLOCK policy.
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include "Page.h"
+#include "include/BlockFile.h"
+#include "include/AsyncIO.h"
+using namespace std;
+
+class WriteAheadLog;
+
+constexpr size_t DEFAULT_POOL_FRAMES = 256; // 1 MB worth of 4 KB pages
+
+struct BufferPoolStats {
+    uint64_t hits;       // fetches served from a resident frame
+    uint64_t misses;     // fetches that had to read the page from disk
+    uint64_t evictions;  // frames reclaimed to make room for another page
+    uint64_t writebacks; // dirty pages written to disk
+    uint64_t dirtied;    // unpins that changed a page; dirtied / writebacks is how many changes a write covers
+    uint64_t prefetched; // pages read ahead of their fetch by prefetch
+};
+
+class BufferPool {
+public:
+    BufferPool(const string& filename, size_t numFrames = DEFAULT_POOL_FRAMES, const IOConfig& ioConfig = IOConfig());
+    ~BufferPool();
+
+    // Returns the page pinned; every fetch must be paired with unpinPage
+    Page* fetchPage(uint32_t pageID);
+    // Appends a fresh page to the file and returns it pinned
+    Page* newPage();
+    // Writes a fully built page straight to the end of the file, bypassing
+    // the frames; its page ID must be getNumPages()
+    void appendPage(const Page& page);
+    void unpinPage(uint32_t pageID, bool isDirty);
+    void flushPage(uint32_t pageID);
+    // Writes every dirty page as one batch of asynchronous writes
+    void flushAll();
+    // Forces every page written so far to stable storage
+    void sync();
+    // Reads the pages that are not resident into free or evicted frames as
+    // one batch of asynchronous reads, so the fetches that follow are hits.
+    // Takes at most half the frames, leaving the rest to pages in use.
+    void prefetch(const vector<uint32_t>& pageIDs);
+    void prefetch(uint32_t firstPage, uint32_t count);
+    // Reads and writes pages with O_DIRECT, bypassing the OS page cache so
+    // pages are not cached twice. Returns false when the file system does
+    // not support it. Call before the pool is used.
+    bool enableDirectIO();
+    // With a log attached, a dirty page is only written once the log is durable up to its pageLSN
+    void setWAL(WriteAheadLog* log) { wal = log; }
+
+    uint32_t getNumPages() const;
+    size_t getNumFrames() const { return frames.size(); }
+    BufferPoolStats getStats() const;
+    AsyncIOStats getIOStats() const { return io.getStats(); }
+private:
+    struct Frame {
+        Page page;
+        uint32_t pageID;
+        int pinCount;
+        bool dirty;
+        bool referenced; // CLOCK reference bit
+        bool inUse;
+        bool loading; // read in flight outside the latch; fetches of the page wait for it
+
+        Frame() : page(0), pageID(0), pinCount(0), dirty(false), referenced(false), inUse(false), loading(false) {}
+    };
+
+    BlockFile file;
+    AsyncIO io;
+    WriteAheadLog* wal;
+    vector<Frame> frames;
+    unordered_map<uint32_t, size_t> pageTable; // pageID -> frame index
+    size_t clockHand;
+    uint32_t numPages;
+    BufferPoolStats stats;
+    mutable mutex latch;
+    condition_variable loaded; // a frame finished loading, or gave up
+
+    size_t findVictim();
+    // Claims a victim frame for pageID, pinned and loading, under the latch
+    size_t startLoad(uint32_t pageID);
+    // Called with the latch held once the read of a frame is over
+    void finishLoad(size_t idx);
+    void abortLoad(size_t idx);
+    void writePageToDisk(Frame& frame);
+    void readPageFromDisk(uint32_t pageID, Page& page);
+};
+
+// Keeps a page pinned for the lifetime of the handle
+class PinnedPage {
+public:
+    PinnedPage(BufferPool* pool, Page* page) : pool(pool), page(page), dirty(false) {}
+    PinnedPage(const PinnedPage&) = delete;
+    PinnedPage& operator=(const PinnedPage&) = delete;
+    PinnedPage(PinnedPage&& other) : pool(other.pool), page(other.page), dirty(other.dirty) {
+        other.page = nullptr;
+    }
+    ~PinnedPage() {
+        if (page) pool->unpinPage(page->getPageID(), dirty);
+    }
+
+    void markDirty() { dirty = true; }
+    Page* get() const { return page; }
+    Page* operator->() const { return page; }
+    Page& operator*() const { return *page; }
+private:
+    BufferPool* pool;
+    Page* page;
+    bool dirty;
+};
@@ -0,0 +1,87 @@
+//Implementation of the free space map.
+
+#include "FreeSpaceMap.h"
+#include <stdexcept>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+FreeSpaceMap::FreeSpaceMap(const string& filename) : filename(filename), fd(-1), dirty(false) {
+    fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) throw runtime_error("Failed to open free space map " + filename);
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    buckets.resize(size);
+    if (size > 0 && pread(fd, buckets.data(), size, 0) != size)
+        throw runtime_error("Failed to read free space map " + filename);
+
+    blockMax.resize((buckets.size() + FSM_BLOCK_PAGES - 1) / FSM_BLOCK_PAGES, 0);
+    for (size_t i = 0; i < buckets.size(); i++)
+        blockMax[i / FSM_BLOCK_PAGES] = max(blockMax[i / FSM_BLOCK_PAGES], buckets[i]);
+}
+
+FreeSpaceMap::~FreeSpaceMap() {
+    flush();
+    close(fd);
+}
+
+uint32_t FreeSpaceMap::findPage(uint32_t bytes) {
+    lock_guard<mutex> guard(latch);
+    // Round up, so any page in a large enough bucket really has the room
+    uint32_t needed = (bytes + FSM_BUCKET_BYTES - 1) / FSM_BUCKET_BYTES;
+    if (needed > UINT8_MAX) return INVALID_PAGE;
+
+    for (size_t block = 0; block < blockMax.size(); block++) {
+        if (blockMax[block] < needed) continue;
+        size_t end = min<size_t>(buckets.size(), (block + 1) * FSM_BLOCK_PAGES);
+        for (size_t page = block * FSM_BLOCK_PAGES; page < end; page++) {
+            if (buckets[page] >= needed) return page;
+        }
+    }
+    return INVALID_PAGE;
+}
+
+void FreeSpaceMap::update(uint32_t pageID, uint32_t freeBytes) {
+    lock_guard<mutex> guard(latch);
+    uint8_t bucket = min<uint32_t>(freeBytes / FSM_BUCKET_BYTES, UINT8_MAX);
+    if (pageID >= buckets.size()) {
+        buckets.resize(pageID + 1, 0);
+        blockMax.resize((buckets.size() + FSM_BLOCK_PAGES - 1) / FSM_BLOCK_PAGES, 0);
+    } else if (buckets[pageID] == bucket) {
+        return;
+    }
+
+    uint8_t old = buckets[pageID];
+    buckets[pageID] = bucket;
+    dirty = true;
+
+    size_t block = pageID / FSM_BLOCK_PAGES;
+    if (bucket >= blockMax[block]) {
+        blockMax[block] = bucket;
+    } else if (old == blockMax[block]) {
+        // The page may have been the block's maximum
+        size_t end = min<size_t>(buckets.size(), (block + 1) * FSM_BLOCK_PAGES);
+        blockMax[block] = *max_element(buckets.begin() + block * FSM_BLOCK_PAGES, buckets.begin() + end);
+    }
+}
+
+uint32_t FreeSpaceMap::getNumPages() {
+    lock_guard<mutex> guard(latch);
+    return buckets.size();
+}
+
+void FreeSpaceMap::clear() {
+    lock_guard<mutex> guard(latch);
+    buckets.clear();
+    blockMax.clear();
+    dirty = true;
+}
+
+void FreeSpaceMap::flush() {
+    lock_guard<mutex> guard(latch);
+    if (!dirty) return;
+    if (pwrite(fd, buckets.data(), buckets.size(), 0) != static_cast<ssize_t>(buckets.size()) ||
+        ftruncate(fd, buckets.size()) != 0)
+        throw runtime_error("Failed to write free space map " + filename);
+    dirty = false;
+}
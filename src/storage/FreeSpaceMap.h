@@ -0,0 +1,39 @@
+#pragma once
+//Free Space Map
+//Records roughly how many bytes each heap page has free, one byte per page,
+//so inserts can find a page with room without reading pages. The map is a
+//hint: it is written at checkpoints but not logged, and callers check the
+//page itself before using it.
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <mutex>
+using namespace std;
+
+constexpr uint32_t INVALID_PAGE = UINT32_MAX;
+constexpr uint32_t FSM_BUCKET_BYTES = 16;  // free space granularity of one map entry
+constexpr uint32_t FSM_BLOCK_PAGES = 1024; // pages summarized by one search block
+
+class FreeSpaceMap {
+public:
+    FreeSpaceMap(const string& filename);
+    ~FreeSpaceMap();
+
+    // Returns a page recorded with at least bytes free, lowest page ID
+    // first, or INVALID_PAGE if there is none
+    uint32_t findPage(uint32_t bytes);
+    void update(uint32_t pageID, uint32_t freeBytes);
+    // Number of pages the map has entries for
+    uint32_t getNumPages();
+    // Drops every entry, before the map is rebuilt from the pages
+    void clear();
+    // Writes the map if it changed since the last flush
+    void flush();
+private:
+    string filename;
+    int fd;
+    vector<uint8_t> buckets;  // free bytes / FSM_BUCKET_BYTES per page, rounded down
+    vector<uint8_t> blockMax; // largest bucket in each block of FSM_BLOCK_PAGES
+    bool dirty;
+    mutex latch;
+};
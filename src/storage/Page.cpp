@@ -1,6 +1,7 @@
 #include "Page.h"
 #include <cstring>
 #include <stdexcept>
+#include <algorithm>
 //Structure of the page in memory:
 //Header → rows → free space ← slots
 
@@ -11,44 +12,175 @@ Page::Page(uint32_t id) : buffer(PAGE_SIZE, 0) {
     header->numSlots = 0;
     header->freeSpaceOffset = sizeof(PageHeader);
     header->pageID = id;
+    header->magic = PAGE_MAGIC;
+    header->version = PAGE_VERSION;
+    header->pageLSN = 0;
 }
 
 bool Page::canFit(uint32_t rowSize) const {
-    const PageHeader* header =
-        reinterpret_cast<const PageHeader*>(buffer.data());
+    uint32_t slotSize = findFreeSlot() < header()->numSlots ? 0 : sizeof(Slot);
+    return getFreeSpace() >= rowSize + slotSize;
+}
 
-    uint32_t freeSpace =
-        PAGE_SIZE
-        - header->freeSpaceOffset
-        - header->numSlots * sizeof(Slot);
+uint32_t Page::getFreeSpace() const {
+    const PageHeader* header = this->header();
+    uint32_t used = sizeof(PageHeader) + header->numSlots * sizeof(Slot);
+    for (uint16_t i = 0; i < header->numSlots; i++) {
+        const Slot* slot = slotAt(i);
+        if (slot->isOccupied) used += slot->length;
+    }
+    return PAGE_SIZE - used;
+}
 
-    return freeSpace >= (rowSize + sizeof(Slot));
+uint16_t Page::findFreeSlot() const {
+    uint16_t numSlots = header()->numSlots;
+    for (uint16_t i = 0; i < numSlots; i++) {
+        if (!slotAt(i)->isOccupied) return i;
+    }
+    return numSlots;
 }
 
-uint16_t Page::insertRow(const std::vector<char>& rowData) {
-    PageHeader* header = reinterpret_cast<PageHeader*>(buffer.data());
-    uint32_t rowSize = rowData.size();
+uint16_t Page::insertRow(const std::vector<char>& rowData, uint8_t flags) {
+    if (!canFit(rowData.size()))
+        throw runtime_error("Row does not fit in page");
+    uint16_t slotID = findFreeSlot();
+    placeRow(slotID, rowData, flags);
+    return slotID;
+}
 
-    // Insert the row data at the free space offset
-    uint16_t rowOffset = header->freeSpaceOffset;
-    memcpy(buffer.data() + rowOffset, rowData.data(), rowSize);
+void Page::insertRowAt(uint16_t slotID, const std::vector<char>& rowData, uint8_t flags) {
+    uint16_t numSlots = header()->numSlots;
+    if (slotID < numSlots && slotAt(slotID)->isOccupied)
+        throw runtime_error("Slot already occupied");
+    uint32_t newSlots = slotID < numSlots ? 0 : slotID + 1 - numSlots;
+    if (getFreeSpace() < rowData.size() + newSlots * sizeof(Slot))
+        throw runtime_error("Row does not fit in page");
+    placeRow(slotID, rowData, flags);
+}
 
-    // Update the header
-    header->freeSpaceOffset += rowSize;
+bool Page::updateRow(uint16_t slotID, const std::vector<char>& rowData, uint8_t flags) {
+    checkedSlot(slotID);
+    Slot* slot = slotAt(slotID);
+    if (rowData.size() <= slot->length) {
+        memcpy(buffer.data() + slot->offset, rowData.data(), rowData.size());
+        slot->length = rowData.size();
+        slot->flags = flags;
+        return true;
+    }
+    if (!canUpdate(slotID, rowData.size()))
+        return false;
+
+    // Give up the old bytes and write the row again like a fresh insert
+    PageHeader* header = this->header();
+    slot->isOccupied = false;
+    if (slot->offset + slot->length == header->freeSpaceOffset)
+        header->freeSpaceOffset = slot->offset;
+    placeRow(slotID, rowData, flags);
+    return true;
+}
+
+bool Page::canUpdate(uint16_t slotID, uint32_t rowSize) const {
+    const Slot* slot = checkedSlot(slotID);
+    return rowSize <= slot->length || getFreeSpace() + slot->length >= rowSize;
+}
+
+const Slot* Page::checkedSlot(uint16_t slotID) const {
+    if (slotID >= header()->numSlots)
+        throw runtime_error("Invalid slot ID");
+    const Slot* slot = slotAt(slotID);
+    if (!slot->isOccupied)
+        throw runtime_error("Attempt to read deleted row");
+    return slot;
+}
+
+uint8_t Page::getSlotFlags(uint16_t slotID) const {
+    return checkedSlot(slotID)->flags;
+}
+
+static RID decodeForward(const char* data) {
+    RID rid{};
+    memcpy(&rid.pageID, data, sizeof(uint32_t));
+    memcpy(&rid.slotID, data + sizeof(uint32_t), sizeof(uint16_t));
+    return rid;
+}
+
+vector<char> encodeForward(const RID& rid) {
+    vector<char> data(FORWARD_SIZE);
+    memcpy(data.data(), &rid.pageID, sizeof(uint32_t));
+    memcpy(data.data() + sizeof(uint32_t), &rid.slotID, sizeof(uint16_t));
+    return data;
+}
+
+RID Page::forwardOf(uint16_t slotID) const {
+    const Slot* slot = checkedSlot(slotID);
+    if (slot->flags != SLOT_FORWARD)
+        throw runtime_error("Slot is not a forwarding slot");
+    return decodeForward(buffer.data() + slot->offset);
+}
+
+RID Page::homeOf(uint16_t slotID) const {
+    const Slot* slot = checkedSlot(slotID);
+    if (slot->flags == SLOT_MOVED)
+        return decodeForward(buffer.data() + slot->offset);
+    return RID{getPageID(), slotID};
+}
+
+// Writes the row at the free space offset and points the slot at it. When
+// deleted rows leave too little contiguous room, the page is compacted first.
+void Page::placeRow(uint16_t slotID, const std::vector<char>& rowData, uint8_t flags) {
+    PageHeader* header = this->header();
+    uint16_t numSlots = max<uint16_t>(header->numSlots, slotID + 1);
+    int contiguous = static_cast<int>(PAGE_SIZE) - header->freeSpaceOffset - numSlots * static_cast<int>(sizeof(Slot));
+    if (contiguous < static_cast<int>(rowData.size()))
+        compact();
+
+    for (uint16_t i = header->numSlots; i < numSlots; i++)
+        *slotAt(i) = Slot{0, 0, false, 0};
+    header->numSlots = numSlots;
+
+    uint16_t rowOffset = header->freeSpaceOffset;
+    memcpy(buffer.data() + rowOffset, rowData.data(), rowData.size());
+    header->freeSpaceOffset += rowData.size();
 
-    // Create a new slot for this row
-    Slot* slot = reinterpret_cast<Slot*>(buffer.data() + PAGE_SIZE - (header->numSlots + 1) * sizeof(Slot));
+    Slot* slot = slotAt(slotID);
     slot->offset = rowOffset;
-    slot->length = rowSize;
+    slot->length = rowData.size();
     slot->isOccupied = true;
+    slot->flags = flags;
+}
 
-    header->numSlots += 1;
+void Page::compact() {
+    PageHeader* header = this->header();
+    vector<uint16_t> live;
+    for (uint16_t i = 0; i < header->numSlots; i++) {
+        if (slotAt(i)->isOccupied) live.push_back(i);
+        else *slotAt(i) = Slot{0, 0, false, 0};
+    }
+    // In offset order every row moves toward the header, never onto a row
+    // that has not been moved yet
+    sort(live.begin(), live.end(), [this](uint16_t a, uint16_t b) {
+        return slotAt(a)->offset < slotAt(b)->offset;
+    });
+
+    uint16_t offset = sizeof(PageHeader);
+    for (uint16_t id : live) {
+        Slot* slot = slotAt(id);
+        memmove(buffer.data() + offset, buffer.data() + slot->offset, slot->length);
+        slot->offset = offset;
+        offset += slot->length;
+    }
+    header->freeSpaceOffset = offset;
+}
 
-    return header->numSlots - 1;
+bool Page::isSlotOccupied(uint16_t slotID) const {
+    const PageHeader* header = reinterpret_cast<const PageHeader*>(buffer.data());
+    if (slotID >= header->numSlots) return false;
+    const Slot* slot = reinterpret_cast<const Slot*>(buffer.data() + PAGE_SIZE - (slotID + 1) * sizeof(Slot));
+    return slot->isOccupied;
 }
 
 void Page::deleteRow(uint16_t slotID) {
-    const PageHeader* header = reinterpret_cast<const PageHeader*>(buffer.data());
+    PageHeader* header = this->header();
     if (slotID >= header->numSlots)
         throw runtime_error("Invalid slot ID");
 
@@ -58,63 +190,56 @@ void Page::deleteRow(uint16_t slotID) {
         throw runtime_error("Row already deleted");
 
     slot->isOccupied = false;
+    // The last row written can give its bytes back right away
+    if (slot->offset + slot->length == header->freeSpaceOffset)
+        header->freeSpaceOffset = slot->offset;
 }
 
 
-vector<string> Page::readRow(uint16_t slotID) const {
-    const PageHeader* header = reinterpret_cast<const PageHeader*>(buffer.data());
-    
-    if (slotID >= header->numSlots) {
-        throw runtime_error("Invalid slot ID");
-    }
+RowView Page::rowView(uint16_t slotID) const {
+    const Slot* slot = checkedSlot(slotID);
+    if (slot->flags == SLOT_FORWARD)
+        throw runtime_error("Row has moved to another page");
+    if (slot->flags == SLOT_MOVED)
+        return RowView(buffer.data() + slot->offset + FORWARD_SIZE, slot->length - FORWARD_SIZE);
+    return RowView(buffer.data() + slot->offset, slot->length);
+}
 
-    const Slot* slot = reinterpret_cast<const Slot*>(buffer.data() + PAGE_SIZE - (slotID + 1) * sizeof(Slot));
-    if (!slot->isOccupied)
-        throw runtime_error("Attempt to read deleted row");
-    const char* rowData = buffer.data() + slot->offset;
-    uint16_t rowLength = slot->length;
+vector<string> Page::readRow(uint16_t slotID) const {
+    return rowView(slotID).materialize();
+}
 
-    // Parse the row data
-    vector<string> row;
-    size_t bytesRead = 0;
-    while (bytesRead < rowLength) {
-        uint32_t colSize;
-        memcpy(&colSize, rowData + bytesRead, sizeof(uint32_t));
-        bytesRead += sizeof(uint32_t);
+vector<vector<string>> Page::readAllRows() const {
+    vector<vector<string>> allRows;
+    for (const auto& entry : rows()) {
+        allRows.push_back(entry.row.materialize());
+    }
+    return allRows;
+}
 
-        string colData(rowData + bytesRead, colSize);
-        bytesRead += colSize;
+PageRowIterator::PageRowIterator(const Page* page, uint16_t slotID) : page(page), slotID(slotID) {
+    skipDeleted();
+}
 
-        row.push_back(colData);
-    }
+PageRow PageRowIterator::operator*() const {
+    return PageRow{slotID, page->rowView(slotID), page->homeOf(slotID)};
+}
 
-    return row;
+PageRowIterator& PageRowIterator::operator++() {
+    slotID++;
+    skipDeleted();
+    return *this;
 }
 
-vector<vector<string>> Page::readAllRows() const {
-    const PageHeader* header = reinterpret_cast<const PageHeader*>(buffer.data());
-    vector<vector<string>> allRows;
+void PageRowIterator::skipDeleted() {
+    while (slotID < page->getNumSlots() && (!page->isSlotOccupied(slotID) || page->isForwarded(slotID)))
+        slotID++;
+}
 
-    for (uint16_t i = 0; i < header->numSlots; ++i) {
-        const Slot* slot = reinterpret_cast<const Slot*>(buffer.data() + PAGE_SIZE - (i + 1) * sizeof(Slot));
-        const char* rowData = buffer.data() + slot->offset;
-        uint16_t rowLength = slot->length;
-
-        // Parse the row data
-        vector<string> row;
-        size_t bytesRead = 0;
-        while (bytesRead < rowLength) {
-            uint32_t colSize;
-            memcpy(&colSize, rowData + bytesRead, sizeof(uint32_t));
-            bytesRead += sizeof(uint32_t);
-
-            string colData(rowData + bytesRead, colSize);
-            bytesRead += colSize;
-
-            row.push_back(colData);
-        }
-        allRows.push_back(row);
-    }
+PageRowIterator PageRows::begin() const {
+    return PageRowIterator(page, 0);
+}
 
-    return allRows;
+PageRowIterator PageRows::end() const {
+    return PageRowIterator(page, page->getNumSlots());
 }
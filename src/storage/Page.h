@@ -2,39 +2,138 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include "RowView.h"
+#include "include/Common.h"
+#include "include/BlockFile.h"
 using namespace std;
 
 //constants that are evaluated at compile time
 constexpr uint32_t PAGE_SIZE = 4096; //4KB page size
+constexpr uint32_t PAGE_MAGIC = 0x4741504D; // "MPAG", absent from files older than page LSNs
+constexpr uint16_t PAGE_VERSION = 1; // layout of the header, slots and rows; bumped when it changes
+
+// Slot flags for rows that an update moved to another page
+constexpr uint8_t SLOT_FORWARD = 1; // slot holds the RID the row moved to
+constexpr uint8_t SLOT_MOVED = 2;   // row bytes are preceded by the RID of its original slot
+constexpr uint16_t FORWARD_SIZE = sizeof(uint32_t) + sizeof(uint16_t); // encoded RID
 
 struct Slot {
     uint16_t offset; // Offset of the record within the page
     uint16_t length; // Length of the record    
     bool isOccupied; // Whether this slot is currently occupied
+    uint8_t flags;   // SLOT_FORWARD / SLOT_MOVED, 0 for ordinary rows
 };
 
 struct PageHeader {
     uint32_t pageID;       // Unique identifier for the page
     uint16_t numSlots;      // Number of slots in the page
     uint16_t freeSpaceOffset; // Offset to the start of free space
+    uint32_t magic;         // PAGE_MAGIC
+    uint16_t version;       // PAGE_VERSION the page was written with
+    uint16_t reserved;
+    uint64_t pageLSN;       // LSN of the last log record applied to this page
+};
+
+class Page;
+
+// A live row of a page together with its slot ID and RID. A row moved here
+// by an update keeps the RID of its original slot.
+struct PageRow {
+    uint16_t slotID;
+    RowView row;
+    RID rid;
+};
+
+// Iterates the occupied slots of a page in slot order, decoding rows in place
+class PageRowIterator {
+public:
+    PageRowIterator(const Page* page, uint16_t slotID);
+    PageRow operator*() const;
+    PageRowIterator& operator++();
+    bool operator!=(const PageRowIterator& other) const { return slotID != other.slotID; }
+private:
+    const Page* page;
+    uint16_t slotID;
+    // Skips free slots and forwarding slots, whose rows live on other pages
+    void skipDeleted();
+};
+
+struct PageRows {
+    const Page* page;
+    PageRowIterator begin() const;
+    PageRowIterator end() const;
 };
 
 class Page {
 public:
     Page(uint32_t id);
     bool canFit(uint32_t rowSize) const;
+    // Bytes not taken by the header, live rows or the slot directory; space
+    // left behind by deleted rows counts, since inserts compact the page
+    uint32_t getFreeSpace() const;
     //get page id
     uint32_t getPageID() const {
         const PageHeader* header = reinterpret_cast<const PageHeader*>(buffer.data());
         return header->pageID;
     }
-    uint16_t insertRow(const std::vector<char>& rowData);
+    // Written in the layout this code reads; pages of older files are not
+    bool hasCurrentFormat() const {
+        const PageHeader* header = reinterpret_cast<const PageHeader*>(buffer.data());
+        return header->magic == PAGE_MAGIC && header->version == PAGE_VERSION;
+    }
+    uint64_t getPageLSN() const {
+        return reinterpret_cast<const PageHeader*>(buffer.data())->pageLSN;
+    }
+    void setPageLSN(uint64_t lsn) {
+        reinterpret_cast<PageHeader*>(buffer.data())->pageLSN = lsn;
+    }
+    uint16_t getNumSlots() const {
+        return reinterpret_cast<const PageHeader*>(buffer.data())->numSlots;
+    }
+    bool isSlotOccupied(uint16_t slotID) const;
+    // Reuses the lowest free slot before growing the directory
+    uint16_t insertRow(const std::vector<char>& rowData, uint8_t flags = 0);
+    // Places a row in the given slot, growing the directory up to it if
+    // needed; log replay uses it to put rows back where they were
+    void insertRowAt(uint16_t slotID, const std::vector<char>& rowData, uint8_t flags = 0);
+    // Replaces the bytes and flags of an occupied slot, in place when they fit
+    // the old row and otherwise elsewhere in the page. Returns false, leaving
+    // the page unchanged, when the page does not have the room.
+    bool updateRow(uint16_t slotID, const std::vector<char>& rowData, uint8_t flags = 0);
+    // Whether updateRow would find room for rowSize bytes in the slot
+    bool canUpdate(uint16_t slotID, uint32_t rowSize) const;
+    uint8_t getSlotFlags(uint16_t slotID) const;
+    bool isForwarded(uint16_t slotID) const { return isSlotOccupied(slotID) && getSlotFlags(slotID) == SLOT_FORWARD; }
+    // Where the row of a forwarding slot lives now
+    RID forwardOf(uint16_t slotID) const;
+    // RID a row is known by: its original slot for moved rows, its own otherwise
+    RID homeOf(uint16_t slotID) const;
     vector<vector<string>> readAllRows() const;
     vector<string> readRow(uint16_t slotID) const;
+    // Zero-copy access; the view is valid while the page is pinned and unchanged
+    RowView rowView(uint16_t slotID) const;
+    PageRows rows() const { return PageRows{this}; }
     void deleteRow(uint16_t slotID);
+    // Slides live rows together behind the header; slot IDs do not change
+    void compact();
 
     const char* data() const { return buffer.data(); }
     char* data() { return buffer.data(); }
 private:
-    vector<char> buffer;
-};
\ No newline at end of file
+    IOBuffer buffer; // aligned, so the buffer pool can read and write it directly
+
+    PageHeader* header() { return reinterpret_cast<PageHeader*>(buffer.data()); }
+    const PageHeader* header() const { return reinterpret_cast<const PageHeader*>(buffer.data()); }
+    Slot* slotAt(uint16_t slotID) {
+        return reinterpret_cast<Slot*>(buffer.data() + PAGE_SIZE - (slotID + 1) * sizeof(Slot));
+    }
+    const Slot* slotAt(uint16_t slotID) const {
+        return reinterpret_cast<const Slot*>(buffer.data() + PAGE_SIZE - (slotID + 1) * sizeof(Slot));
+    }
+    // First unoccupied slot, or numSlots when every slot is in use
+    uint16_t findFreeSlot() const;
+    void placeRow(uint16_t slotID, const std::vector<char>& rowData, uint8_t flags);
+    const Slot* checkedSlot(uint16_t slotID) const;
+};
+// Encoding of the RID stored by SLOT_FORWARD and SLOT_MOVED slots
+vector<char> encodeForward(const RID& rid);
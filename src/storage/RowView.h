@@ -0,0 +1,166 @@
+#pragma once
+//Row View
+//Read-only view of a serialized row that decodes it in place. Without a
+//schema the row is in the untyped length-prefixed column format; with one it
+//is in the typed format described in Schema.h and columns are read at fixed
+//offsets. Columns point into the page buffer, so a view is only valid while
+//the page it points into stays pinned and unchanged.
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <iterator>
+#include <cstddef>
+#include <charconv>
+#include "Schema.h"
+using namespace std;
+
+class RowView {
+public:
+    // Walks the columns of a row, yielding each column's stored bytes: the
+    // text of untyped rows, [uint32 length][bytes] ..., or the raw value
+    // of typed columns (empty for NULL)
+    class iterator {
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = string_view;
+        using difference_type = ptrdiff_t;
+        using pointer = const string_view*;
+        using reference = string_view;
+
+        explicit iterator(const char* pos) : view(nullptr), pos(pos), index(0) {}
+        iterator(const RowView* view, size_t index) : view(view), pos(nullptr), index(index) {}
+        string_view operator*() const {
+            if (view) return view->rawColumn(index);
+            uint32_t colSize;
+            memcpy(&colSize, pos, sizeof(uint32_t));
+            return string_view(pos + sizeof(uint32_t), colSize);
+        }
+        iterator& operator++() {
+            if (view) {
+                index++;
+                return *this;
+            }
+            uint32_t colSize;
+            memcpy(&colSize, pos, sizeof(uint32_t));
+            pos += sizeof(uint32_t) + colSize;
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return pos == other.pos && index == other.index; }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+    private:
+        const RowView* view; // typed rows only
+        const char* pos;     // untyped rows only
+        size_t index;
+    };
+
+    RowView() : rowData(nullptr), rowLength(0), schema(nullptr) {}
+    RowView(const char* data, uint16_t length, const Schema* schema = nullptr)
+        : rowData(data), rowLength(length), schema(schema) {}
+
+    iterator begin() const { return schema ? iterator(this, 0) : iterator(rowData); }
+    iterator end() const { return schema ? iterator(this, schema->size()) : iterator(rowData + rowLength); }
+
+    size_t columnCount() const {
+        if (schema) return schema->size();
+        size_t count = 0;
+        for (auto it = begin(); it != end(); ++it) count++;
+        return count;
+    }
+
+    string_view column(size_t i) const {
+        if (schema) return rawColumn(i);
+        size_t col = 0;
+        for (auto it = begin(); it != end(); ++it, ++col) {
+            if (col == i) return *it;
+        }
+        throw out_of_range("Column index out of range");
+    }
+
+    // Typed access. On rows without a schema nothing is NULL and the
+    // numeric getters parse the column text. A NULL column reads as zero
+    // or an empty string.
+    bool isNull(size_t i) const {
+        if (!schema) return false;
+        schema->column(i);
+        return (rowData[i / 8] >> (i % 8)) & 1;
+    }
+    int32_t getInt32(size_t i) const { return number<int32_t>(i, ColumnType::INT32); }
+    int64_t getInt64(size_t i) const { return number<int64_t>(i, ColumnType::INT64); }
+    double getDouble(size_t i) const { return number<double>(i, ColumnType::DOUBLE); }
+    // CHAR (without its zero padding) or VARCHAR
+    string_view getString(size_t i) const {
+        if (!schema) return column(i);
+        ColumnType type = schema->column(i).type;
+        if (type != ColumnType::CHAR && type != ColumnType::VARCHAR)
+            throw runtime_error("Column " + schema->column(i).name + " is not a string");
+        return rawColumn(i);
+    }
+
+    // The column as text, as the row API takes and returns it; "" for NULL
+    string columnText(size_t i) const {
+        if (!schema || isNull(i)) return string(column(i));
+        char buffer[32];
+        to_chars_result result{};
+        switch (schema->column(i).type) {
+        case ColumnType::INT32: result = to_chars(buffer, buffer + sizeof(buffer), getInt32(i)); break;
+        case ColumnType::INT64: result = to_chars(buffer, buffer + sizeof(buffer), getInt64(i)); break;
+        case ColumnType::DOUBLE: result = to_chars(buffer, buffer + sizeof(buffer), getDouble(i)); break;
+        default: return string(rawColumn(i));
+        }
+        return string(buffer, result.ptr);
+    }
+
+    // Copies the row out of the page
+    vector<string> materialize() const {
+        vector<string> row;
+        if (schema) {
+            for (size_t i = 0; i < schema->size(); i++) row.push_back(columnText(i));
+            return row;
+        }
+        for (auto col : *this) row.emplace_back(col);
+        return row;
+    }
+
+    const char* data() const { return rowData; }
+    uint16_t length() const { return rowLength; }
+    const Schema* getSchema() const { return schema; }
+private:
+    const char* rowData;
+    uint16_t rowLength;
+    const Schema* schema;
+
+    // Stored bytes of a typed column
+    string_view rawColumn(size_t i) const {
+        const Column& col = schema->column(i);
+        if (isNull(i)) return string_view();
+        const char* slot = rowData + schema->offsetOf(i);
+        if (col.type == ColumnType::CHAR)
+            return string_view(slot, strnlen(slot, col.length));
+        if (col.type == ColumnType::VARCHAR) {
+            uint16_t offset, length;
+            memcpy(&offset, slot, sizeof(uint16_t));
+            memcpy(&length, slot + sizeof(uint16_t), sizeof(uint16_t));
+            return string_view(rowData + offset, length);
+        }
+        return string_view(slot, fixedWidth(col));
+    }
+
+    template <typename T>
+    T number(size_t i, ColumnType type) const {
+        T value{};
+        if (!schema) {
+            string_view text = column(i);
+            auto result = from_chars(text.data(), text.data() + text.size(), value);
+            if (result.ec != errc() || result.ptr != text.data() + text.size())
+                throw runtime_error("Column " + to_string(i) + " is not a number");
+            return value;
+        }
+        if (schema->column(i).type != type)
+            throw runtime_error("Column " + schema->column(i).name + " has a different type");
+        memcpy(&value, rowData + schema->offsetOf(i), sizeof(T));
+        return value;
+    }
+};
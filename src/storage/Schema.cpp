@@ -0,0 +1,172 @@
+//Implementation of the table schema and typed row encoding.
+
+#include "Schema.h"
+#include "include/FileUtil.h"
+#include <fstream>
+#include <cstring>
+#include <charconv>
+#include <limits>
+
+namespace {
+
+constexpr uint32_t SCHEMA_MAGIC = 0x4843534D; // "MSCH"
+
+template <typename T>
+T parseNumber(const string& text, const Column& column) {
+    T value{};
+    auto result = from_chars(text.data(), text.data() + text.size(), value);
+    if (result.ec != errc() || result.ptr != text.data() + text.size())
+        throw runtime_error("Invalid value '" + text + "' for column " + column.name);
+    return value;
+}
+
+template <typename T>
+void store(vector<char>& row, uint16_t offset, T value) {
+    memcpy(row.data() + offset, &value, sizeof(T));
+}
+
+} // namespace
+
+uint16_t fixedWidth(const Column& column) {
+    switch (column.type) {
+    case ColumnType::INT32: return sizeof(int32_t);
+    case ColumnType::INT64: return sizeof(int64_t);
+    case ColumnType::DOUBLE: return sizeof(double);
+    case ColumnType::CHAR: return column.length;
+    case ColumnType::VARCHAR: return 2 * sizeof(uint16_t);
+    }
+    throw runtime_error("Unknown column type");
+}
+
+Schema::Schema(const vector<Column>& columns, size_t keyColumn)
+    : columns(columns), keyColumn(keyColumn), fixedEnd(0) {
+    if (columns.empty()) throw runtime_error("Schema needs at least one column");
+    if (keyColumn != NO_KEY_COLUMN && (keyColumn >= columns.size() || columns[keyColumn].type != ColumnType::INT32 ||
+                                       columns[keyColumn].nullable))
+        throw runtime_error("Key column must be a non-null INT32");
+
+    uint32_t offset = (columns.size() + 7) / 8;
+    for (const auto& column : columns) {
+        if ((column.type == ColumnType::CHAR || column.type == ColumnType::VARCHAR) && column.length == 0)
+            throw runtime_error("Column " + column.name + " needs a length");
+        offsets.push_back(offset);
+        offset += fixedWidth(column);
+        if (offset > UINT16_MAX) throw runtime_error("Schema does not fit in a row");
+    }
+    fixedEnd = offset;
+}
+
+vector<char> Schema::encode(const vector<string>& row) const {
+    if (row.size() != columns.size())
+        throw runtime_error("Row has " + to_string(row.size()) + " columns, schema has " + to_string(columns.size()));
+
+    vector<char> data(fixedEnd, 0);
+    for (size_t i = 0; i < columns.size(); i++) {
+        const Column& column = columns[i];
+        const string& text = row[i];
+        if (text.empty() && column.nullable) {
+            data[i / 8] |= 1 << (i % 8);
+            continue;
+        }
+        uint16_t offset = offsets[i];
+        switch (column.type) {
+        case ColumnType::INT32: store(data, offset, parseNumber<int32_t>(text, column)); break;
+        case ColumnType::INT64: store(data, offset, parseNumber<int64_t>(text, column)); break;
+        case ColumnType::DOUBLE: store(data, offset, parseNumber<double>(text, column)); break;
+        case ColumnType::CHAR:
+            if (text.size() > column.length)
+                throw runtime_error("Value too long for column " + column.name);
+            memcpy(data.data() + offset, text.data(), text.size());
+            break;
+        case ColumnType::VARCHAR: {
+            if (text.size() > column.length)
+                throw runtime_error("Value too long for column " + column.name);
+            if (data.size() + text.size() > UINT16_MAX)
+                throw runtime_error("Row too large");
+            uint16_t varOffset = data.size();
+            uint16_t varLength = text.size();
+            store(data, offset, varOffset);
+            store(data, offset + sizeof(uint16_t), varLength);
+            data.insert(data.end(), text.begin(), text.end());
+            break;
+        }
+        }
+    }
+    return data;
+}
+
+// File layout: magic, key column, column count, then per column its type,
+// nullable flag, length and length-prefixed name
+void Schema::save(const string& path) const {
+    vector<char> out;
+    auto put = [&out](const void* value, size_t size) {
+        const char* bytes = static_cast<const char*>(value);
+        out.insert(out.end(), bytes, bytes + size);
+    };
+    uint32_t magic = SCHEMA_MAGIC;
+    uint16_t key = keyColumn, count = columns.size();
+    put(&magic, sizeof(magic));
+    put(&key, sizeof(key));
+    put(&count, sizeof(count));
+    for (const auto& column : columns) {
+        uint8_t type = static_cast<uint8_t>(column.type), nullable = column.nullable;
+        uint16_t nameLength = column.name.size();
+        put(&type, sizeof(type));
+        put(&nullable, sizeof(nullable));
+        put(&column.length, sizeof(column.length));
+        put(&nameLength, sizeof(nameLength));
+        put(column.name.data(), nameLength);
+    }
+
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file.write(out.data(), out.size()) || !file.flush())
+        throw runtime_error("Failed to write schema " + path);
+    file.close();
+    syncFile(path);
+}
+
+Schema Schema::load(const string& path) {
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) return Schema();
+    vector<char> in((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+    size_t pos = 0;
+    auto get = [&](void* value, size_t size) {
+        if (pos + size > in.size()) throw runtime_error("Corrupt schema file " + path);
+        memcpy(value, in.data() + pos, size);
+        pos += size;
+    };
+    uint32_t magic;
+    uint16_t key, count;
+    get(&magic, sizeof(magic));
+    if (magic != SCHEMA_MAGIC) throw runtime_error("Corrupt schema file " + path);
+    get(&key, sizeof(key));
+    get(&count, sizeof(count));
+
+    vector<Column> columns(count);
+    for (auto& column : columns) {
+        uint8_t type, nullable;
+        uint16_t nameLength;
+        get(&type, sizeof(type));
+        get(&nullable, sizeof(nullable));
+        get(&column.length, sizeof(column.length));
+        get(&nameLength, sizeof(nameLength));
+        column.name.resize(nameLength);
+        get(column.name.data(), nameLength);
+        column.type = static_cast<ColumnType>(type);
+        column.nullable = nullable != 0;
+    }
+    return Schema(columns, key);
+}
+
+bool Schema::operator==(const Schema& other) const {
+    if (keyColumn != other.keyColumn || columns.size() != other.columns.size()) return false;
+    for (size_t i = 0; i < columns.size(); i++) {
+        const Column& a = columns[i];
+        const Column& b = other.columns[i];
+        if (a.name != b.name || a.type != b.type || a.nullable != b.nullable ||
+            ((a.type == ColumnType::CHAR || a.type == ColumnType::VARCHAR) && a.length != b.length))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+#pragma once
+//Table Schema
+//Column types of a table and the binary row format they imply:
+//[null bitmap][fixed region][variable data]
+//The null bitmap has one bit per column. Every column has a constant offset
+//in the fixed region: INT32, INT64 and DOUBLE store the value, CHAR(n) its
+//n bytes padded with zeros, and VARCHAR a (uint16 offset, uint16 length)
+//pair pointing into the variable data that follows. Any column is read
+//with a single lookup, and a NULL column's fixed bytes are zero.
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+using namespace std;
+
+enum class ColumnType : uint8_t {
+    INT32 = 1,
+    INT64 = 2,
+    DOUBLE = 3,
+    CHAR = 4,    // fixed width
+    VARCHAR = 5, // up to a maximum length
+};
+
+// Key column of a schema for rows that are never indexed, such as the
+// included columns a covering index stores
+constexpr size_t NO_KEY_COLUMN = SIZE_MAX;
+
+struct Column {
+    string name;
+    ColumnType type;
+    uint16_t length; // CHAR width or VARCHAR maximum in bytes; ignored otherwise
+    bool nullable;
+};
+
+class Schema {
+public:
+    // An empty schema: rows keep the untyped length-prefixed format
+    Schema() : keyColumn(0), fixedEnd(0) {}
+    // keyColumn is the indexed column and must be a non-null INT32, or NO_KEY_COLUMN
+    Schema(const vector<Column>& columns, size_t keyColumn = 0);
+
+    bool empty() const { return columns.empty(); }
+    size_t size() const { return columns.size(); }
+    const Column& column(size_t i) const {
+        if (i >= columns.size()) throw out_of_range("Column index out of range");
+        return columns[i];
+    }
+    size_t getKeyColumn() const { return keyColumn; }
+    // Byte offset of column i's fixed slot within a row
+    uint16_t offsetOf(size_t i) const { return offsets[i]; }
+    // Size of the null bitmap and fixed region, i.e. where variable data starts
+    uint16_t fixedSize() const { return fixedEnd; }
+
+    // Encodes a row given as text; in a nullable column an empty value is NULL
+    vector<char> encode(const vector<string>& row) const;
+
+    // Stored next to the table; loading a missing file gives an empty schema
+    void save(const string& path) const;
+    static Schema load(const string& path);
+    bool operator==(const Schema& other) const;
+    bool operator!=(const Schema& other) const { return !(*this == other); }
+private:
+    vector<Column> columns;
+    size_t keyColumn;
+    vector<uint16_t> offsets;
+    uint16_t fixedEnd;
+};
+
+// Width of a column's slot in the fixed region
+uint16_t fixedWidth(const Column& column);
@@ -0,0 +1,54 @@
+//Implementation of the pull-based table cursors.
+
+#include "TableCursor.h"
+#include "TableFile.h"
+#include "Page.h"
+#include <shared_mutex>
+#include <stdexcept>
+
+TableScanCursor::TableScanCursor(TableFile* table, size_t batchSize)
+    : table(table), pageID(0), slotID(0), batchSize(batchSize), done(false) {
+    if (batchSize == 0) throw runtime_error("Cursor batch size must be positive");
+}
+
+bool TableScanCursor::next(vector<vector<string>>& rows) {
+    rows.clear();
+    if (done) return false;
+
+    shared_lock<shared_mutex> guard(table->latch);
+    uint32_t numPages = table->pool->getNumPages();
+    while (pageID < numPages) {
+        PinnedPage page(table->pool, table->pool->fetchPage(pageID));
+        PageRowIterator it(page.get(), slotID);
+        PageRowIterator end = page->rows().end();
+        for (; it != end; ++it) {
+            if (rows.size() == batchSize) {
+                // Resume from this slot on the next call
+                slotID = (*it).slotID;
+                return true;
+            }
+            rows.push_back(table->bindSchema((*it).row).materialize());
+        }
+        pageID++;
+        slotID = 0;
+    }
+
+    done = true;
+    return !rows.empty();
+}
+
+IndexRangeCursor::IndexRangeCursor(TableFile* table, Key low, Key high, size_t batchSize)
+    : table(table), entries(table->index, low, high, batchSize) {}
+
+bool IndexRangeCursor::next(vector<vector<string>>& rows) {
+    rows.clear();
+    shared_lock<shared_mutex> guard(table->latch);
+    // setIncludedColumns may have replaced the index since the last batch
+    entries.rebind(table->index);
+    if (!entries.next(batch)) return false;
+    vector<RID> rids;
+    for (auto& entry : batch)
+        rids.push_back(entry.second);
+    rows = table->fetchRows(rids);
+    return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+//Table Cursors
+//Pull-based cursors over a table. Each call to next returns at most one
+//batch of rows, so memory stays constant however large the table or range,
+//and a caller can stop early (LIMIT) by simply not asking for more.
+//Nothing stays pinned between calls.
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "include/Common.h"
+#include "index/BPlusTree.h"
+using namespace std;
+
+class TableFile;
+
+// Full table scan in page and slot order
+class TableScanCursor {
+public:
+    TableScanCursor(TableFile* table, size_t batchSize = DEFAULT_CURSOR_BATCH);
+    // Replaces rows with the next batch; returns false once the table is exhausted
+    bool next(vector<vector<string>>& rows);
+    void close() { done = true; }
+private:
+    TableFile* table;
+    uint32_t pageID;
+    uint16_t slotID; // first slot of pageID not yet returned
+    size_t batchSize;
+    bool done;
+};
+
+// Rows whose key lies in [low, high], in key order. Each batch reads the
+// table's current primary index, so the cursor survives index rebuilds.
+class IndexRangeCursor {
+public:
+    IndexRangeCursor(TableFile* table, Key low, Key high, size_t batchSize = DEFAULT_CURSOR_BATCH);
+    bool next(vector<vector<string>>& rows);
+    void close() { entries.close(); }
+private:
+    TableFile* table;
+    IndexCursor entries;
+    vector<pair<Key, RID>> batch;
+};
@@ -2,37 +2,118 @@
 
 #include "TableFile.h"
 #include "index/BPlusTree.h"
+#include "index/NodePage.h"
+#include "include/FileUtil.h"
+#include "include/Metrics.h"
 #include "Page.h"
 #include <stdexcept>
 #include <cstdint>
 #include <vector>
 #include <cstring>
+#include <sstream>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <numeric>
+#include <sys/stat.h>
 
-TableFile::TableFile(const string& filename){
-    index = new BPlusTree(3, filename + "_index.db");
-    file.open(filename, ios::in | ios::out | ios::binary);
-    if (!file.is_open()) {
-        // If the file does not exist, create it
-        file.clear();
-        file.open(filename, ios::out | ios::binary);
-        file.close();
-        file.open(filename, ios::in | ios::out | ios::binary);
+namespace {
+
+constexpr uint32_t INDEX_CATALOG_MAGIC = 0x5844494D; // "MIDX"
+
+// The entry payload of the index on column, empty when it covers nothing
+const vector<char>& payloadOf(const map<size_t, vector<char>>& payloads, size_t column) {
+    static const vector<char> none;
+    auto it = payloads.find(column);
+    return it == payloads.end() ? none : it->second;
+}
+
+// The payload logged with an index record, or null when it does not fit the
+// tree, which then has no included columns or is rebuilt anyway
+const char* loggedPayload(const LogRecord& record, const BPlusTree* tree) {
+    uint32_t width = tree->getPayloadBytes();
+    return width > 0 && record.rowData.size() == width ? record.rowData.data() : nullptr;
+}
+
+// Appends one record per secondary index entry of the row at rid
+void appendIndexRecords(vector<LogRecord>& records, LogRecordType type, const RID& rid,
+                        const vector<pair<size_t, Key>>& entries, const map<size_t, vector<char>>& payloads = {}) {
+    for (const auto& entry : entries)
+        records.push_back(LogRecord{0, type, rid, entry.second, payloadOf(payloads, entry.first), 0, 0,
+                                    static_cast<uint16_t>(entry.first)});
+}
+
+// The projected columns of a row, all of them when projection is empty.
+// columns is scratch space for untyped rows, reused across calls.
+vector<string> projectRow(const RowView& row, const vector<size_t>& projection, vector<string_view>& columns) {
+    if (projection.empty()) return row.materialize();
+    vector<string> projected;
+    projected.reserve(projection.size());
+    if (row.getSchema()) {
+        // Typed columns sit at fixed offsets; no need to walk the row
+        for (size_t col : projection) projected.push_back(row.columnText(col));
+    } else {
+        columns.assign(row.begin(), row.end());
+        for (size_t col : projection) {
+            if (col >= columns.size()) throw out_of_range("Projected column out of range");
+            projected.emplace_back(columns[col]);
+        }
     }
-    file.seekg(0, ios::end);
-    size_t fileSize = file.tellg();
-    size_t numPages = fileSize / PAGE_SIZE;
-    if (fileSize % PAGE_SIZE != 0) throw runtime_error("Corrupt table file: partial page detected");
-    file.seekg(0, ios::beg);
-    for (uint32_t i = 0; i < numPages; ++i) {
-        Page page = readPageFromDisk(i);
-        pages.push_back(page);
+    return projected;
+}
+
+} // namespace
+
+TableFile::TableFile(const string& filename, size_t poolFrames, const IOConfig& ioConfig)
+    : TableFile(filename, Schema(), poolFrames, ioConfig) {}
+
+TableFile::TableFile(const string& filename, const Schema& schema, size_t poolFrames, const IOConfig& ioConfig)
+    : filename(filename), schema(schema), directIO(false), checkpointerStop(false),
+      checkpointerRunning(false), checkpointInterval(0), checkpointBytes(WAL_CHECKPOINT_BYTES), checkpoints(0) {
+    // The schema is fixed when the table is created; an empty one opens the
+    // table with whatever it was created with
+    string schemaFile = filename + "_schema.db";
+    Schema stored = Schema::load(schemaFile);
+    if (this->schema.empty()) {
+        this->schema = stored;
+    } else if (stored.empty()) {
+        struct stat st;
+        if (stat(filename.c_str(), &st) == 0 && st.st_size > 0)
+            throw runtime_error("Cannot add a schema to existing table " + filename);
+        this->schema.save(schemaFile);
+    } else if (stored != this->schema) {
+        throw runtime_error("Schema does not match table " + filename);
     }
+
+    // The catalog comes first: it holds the primary index's included columns
+    loadIndexCatalog();
+    index = openIndex(keyColumn());
+    pool = new BufferPool(filename, poolFrames, ioConfig);
+    fsm = new FreeSpaceMap(filename + "_fsm.db");
+    wal = new WriteAheadLog(filename + "_wal.log");
+    pool->setWAL(wal);
+    recover();
 }
 
 TableFile::~TableFile() {
-    if (file.is_open()) {
-        file.close();
+    try {
+        stopCheckpointer();
+    } catch (...) {
+        // The checkpoint below reports the same failure if it persists
+    }
+    try {
+        checkpoint();
+    } catch (...) {
+        // A failed log or disk: whatever was committed is replayed on the next open
     }
+    delete index;
+    for (auto& entry : secondaryIndexes)
+        delete entry.second;
+    delete pool;
+    delete fsm;
+    delete wal;
 }
 
 vector<char> serializeRow(const vector<string>& row) {
@@ -56,97 +137,1206 @@ vector<char> serializeRow(const vector<string>& row) {
 }
 
 vector<string> TableFile::getRow(const RID& rid) {
-    if (rid.pageID >= pages.size()) {
+    shared_lock<shared_mutex> guard(latch);
+    return fetchRow(rid);
+}
+
+vector<string> TableFile::fetchRow(const RID& rid, const vector<size_t>& projection) {
+    uint16_t slotID;
+    PinnedPage page = pinRow(rid, slotID);
+    vector<string_view> columns;
+    return projectRow(bindSchema(page->rowView(slotID)), projection, columns);
+}
+
+// Large results are a bitmap heap scan: every heap page is read once, in
+// page order, and each row is put back in its place in the result. Small
+// ones are fetched in key order, which is cheaper than grouping a few rows.
+vector<vector<string>> TableFile::fetchRows(const vector<RID>& rids, const vector<size_t>& projection) {
+    vector<vector<string>> result;
+    if (rids.size() >= BITMAP_SCAN_ROWS) {
+        result.resize(rids.size());
+        vector<string_view> columns;
+        visitRowsByPage(rids, [&](size_t i, const RowView& row) { result[i] = projectRow(row, projection, columns); });
+        return result;
+    }
+    result.reserve(rids.size());
+    size_t prefetched = 0;
+    for (size_t i = 0; i < rids.size(); i++) {
+        if (i == prefetched) prefetched = prefetchRows(rids, i);
+        result.push_back(fetchRow(rids[i], projection));
+    }
+    return result;
+}
+
+// Reads the heap pages of the rows from rids[from] on as one batch, up to
+// what the pool will prefetch at once, instead of one blocking read per
+// page as the rows are fetched. Returns the first row not covered.
+size_t TableFile::prefetchRows(const vector<RID>& rids, size_t from) {
+    size_t end = min(rids.size(), from + max<size_t>(1, pool->getNumFrames() / 2));
+    vector<uint32_t> pageIDs;
+    for (size_t i = from; i < end; i++)
+        pageIDs.push_back(rids[i].pageID);
+    sort(pageIDs.begin(), pageIDs.end());
+    pageIDs.erase(unique(pageIDs.begin(), pageIDs.end()), pageIDs.end());
+    if (pageIDs.size() > 1) pool->prefetch(pageIDs);
+    return end;
+}
+
+void TableFile::visitRowsByPage(const vector<RID>& rids, const function<void(size_t, const RowView&)>& visit) {
+    uint32_t numPages = pool->getNumPages();
+    vector<size_t> order(rids.size());
+    if (rids.size() >= numPages) {
+        // Counting sort: bucket boundaries from the rows per page
+        vector<size_t> start(numPages + 1, 0);
+        for (const RID& rid : rids) {
+            if (rid.pageID >= numPages) throw runtime_error("Invalid RID: pageID out of bounds");
+            start[rid.pageID + 1]++;
+        }
+        partial_sum(start.begin(), start.end(), start.begin());
+        for (size_t i = 0; i < rids.size(); i++)
+            order[start[rids[i].pageID]++] = i;
+    } else {
+        iota(order.begin(), order.end(), 0);
+        sort(order.begin(), order.end(), [&](size_t a, size_t b) { return rids[a] < rids[b]; });
+    }
+
+    size_t prefetchBatch = max<size_t>(1, pool->getNumFrames() / 2);
+    size_t pagesSeen = 0, prefetchedPages = 0;
+    for (size_t j = 0; j < order.size();) {
+        uint32_t pageID = rids[order[j]].pageID;
+        if (pageID >= numPages) throw runtime_error("Invalid RID: pageID out of bounds");
+        if (pagesSeen == prefetchedPages) {
+            // Read the next batch of distinct pages ahead of the fetches
+            vector<uint32_t> pageIDs;
+            for (size_t k = j; k < order.size() && pageIDs.size() < prefetchBatch; k++)
+                if (pageIDs.empty() || pageIDs.back() != rids[order[k]].pageID)
+                    pageIDs.push_back(rids[order[k]].pageID);
+            if (pageIDs.size() > 1) pool->prefetch(pageIDs);
+            prefetchedPages += pageIDs.size();
+        }
+        pagesSeen++;
+
+        PinnedPage page(pool, pool->fetchPage(pageID));
+        for (; j < order.size() && rids[order[j]].pageID == pageID; j++) {
+            uint16_t slotID = rids[order[j]].slotID;
+            if (!page->isForwarded(slotID)) {
+                visit(order[j], bindSchema(page->rowView(slotID)));
+                continue;
+            }
+            RID target = page->forwardOf(slotID);
+            PinnedPage moved(pool, pool->fetchPage(target.pageID));
+            visit(order[j], bindSchema(moved->rowView(target.slotID)));
+        }
+    }
+}
+
+// Pins the page holding the row known by rid, following the forwarding slot
+// left behind when an update moved the row; slotID is its slot on that page
+PinnedPage TableFile::pinRow(const RID& rid, uint16_t& slotID) {
+    if (rid.pageID >= pool->getNumPages()) {
         throw runtime_error("Invalid RID: pageID out of bounds");
     }
-    Page& page = pages[rid.pageID];
-    return page.readRow(rid.slotID);
+    PinnedPage page(pool, pool->fetchPage(rid.pageID));
+    slotID = rid.slotID;
+    if (!page->isForwarded(rid.slotID)) return page;
+    RID target = page->forwardOf(rid.slotID);
+    slotID = target.slotID;
+    return PinnedPage(pool, pool->fetchPage(target.pageID));
 }
 
 RID TableFile::insertRow(const vector<string>& row) {
-    auto rowData = serializeRow(row);
-
-    Page* page = getLastPage();
-    if (!page || !page->canFit(rowData.size())) {
-        // Need to create a new page
-        page = createNewPage();
-    }
-    uint16_t slotID = page->insertRow(rowData);
-    writePageToDisk(page);
-    RID rid = {page->getPageID(), slotID};
-    Key key = extractKeyFromRow(row);   // decide which column is indexed
-    index->insert(key, rid);
+    OpTimer timer(Op::TableInsert);
+    auto rowData = encodeRow(row);
+    Key key = extractKeyFromRow(row, rowData);   // decide which column is indexed
+
+    unique_lock<shared_mutex> guard(latch);
+    RowView view = bindSchema(RowView(rowData.data(), rowData.size()));
+    auto secondary = secondaryKeys(view);
+    auto payloads = entryPayloads(view);
+    RID rid;
+    uint64_t lsn;
+    {
+        PinnedPage page(pool, findPageFor(rowData.size()));
+        uint16_t slotID = page->insertRow(rowData);
+        rid = {page->getPageID(), slotID};
+        if (secondary.empty()) {
+            lsn = wal->logInsert(rid, key, rowData);
+        } else {
+            // Secondary keys are logged with the row, so a crash keeps all or none
+            vector<LogRecord> records{LogRecord{0, LogRecordType::RowInsert, rid, key, rowData, 0, 0, 0}};
+            appendIndexRecords(records, LogRecordType::IndexInsert, rid, secondary, payloads);
+            lsn = wal->logGroup(records);
+        }
+        page->setPageLSN(lsn);
+        page.markDirty();
+        fsm->update(rid.pageID, page->getFreeSpace());
+    }
+    index->insert(key, rid, payloadOf(payloads, keyColumn()).data());
+    for (const auto& entry : secondary)
+        secondaryIndexes[entry.first]->insert(entry.second, rid, payloadOf(payloads, entry.first).data());
+    guard.unlock();
+
+    // The page and index stay dirty in memory; the row is durable once its log record is
+    wal->commit(lsn);
+    maybeCheckpoint();
     return rid;
 }
 
 void TableFile::deleteByKey(Key k) {
+    OpTimer timer(Op::TableDelete);
     RID rid;
 
+    unique_lock<shared_mutex> guard(latch);
     if (!index->search(k, rid))
         throw runtime_error("Key not found");
-    pages[rid.pageID].deleteRow(rid.slotID);
-
-    writePageToDisk(&pages[rid.pageID]);
+    uint64_t lsn;
+    vector<pair<size_t, Key>> secondary;
+    {
+        PinnedPage page(pool, pool->fetchPage(rid.pageID));
+        vector<LogRecord> records{LogRecord{0, LogRecordType::RowDelete, rid, k, {}, 0, 0, 0}};
+        if (page->isForwarded(rid.slotID)) {
+            // The row itself lives on another page; free both slots
+            RID target = page->forwardOf(rid.slotID);
+            PinnedPage moved(pool, pool->fetchPage(target.pageID));
+            secondary = secondaryKeys(bindSchema(moved->rowView(target.slotID)));
+            page->deleteRow(rid.slotID);
+            moved->deleteRow(target.slotID);
+            records.push_back(LogRecord{0, LogRecordType::SlotFree, target, k, {}, 0, 0, 0});
+            appendIndexRecords(records, LogRecordType::IndexDelete, rid, secondary);
+            lsn = wal->logGroup(records);
+            moved->setPageLSN(lsn);
+            moved.markDirty();
+            fsm->update(target.pageID, moved->getFreeSpace());
+        } else {
+            secondary = secondaryKeys(bindSchema(page->rowView(rid.slotID)));
+            page->deleteRow(rid.slotID);
+            appendIndexRecords(records, LogRecordType::IndexDelete, rid, secondary);
+            lsn = wal->logGroup(records);
+        }
+        page->setPageLSN(lsn);
+        page.markDirty();
+        fsm->update(rid.pageID, page->getFreeSpace());
+    }
 
     index->remove(k);
+    for (const auto& entry : secondary)
+        secondaryIndexes[entry.first]->remove(entry.second, rid);
+    guard.unlock();
+
+    wal->commit(lsn);
+    maybeCheckpoint();
+}
+
+
+// Heap-only fast path first: the row is rewritten within its own page, in
+// place when the new encoding is no longer than the old one. Otherwise it
+// moves to a page with room and its slot keeps a forwarding RID, so the
+// index entry never changes; only a changed key, or a changed value of an
+// included column, touches the index. A row
+// that moved before is brought back to its page when it fits there again,
+// and is never forwarded twice. All log records of an update form one group.
+void TableFile::updateRow(Key k, const vector<string>& row) {
+    auto rowData = encodeRow(row);
+    Key newKey = extractKeyFromRow(row, rowData);
+
+    unique_lock<shared_mutex> guard(latch);
+    RID rid;
+    if (!index->search(k, rid))
+        throw runtime_error("Key not found");
+
+    vector<LogRecord> records;
+    vector<PinnedPage> pages; // kept pinned until their pageLSN is set
+    pages.reserve(3);
+    auto slotRecord = [&](LogRecordType type, const RID& at, const vector<char>& bytes, uint8_t flags) {
+        records.push_back(LogRecord{0, type, at, newKey, bytes, flags, 0, 0});
+    };
+
+    pages.emplace_back(pool, pool->fetchPage(rid.pageID));
+    Page* home = pages[0].get();
+    bool forwarded = home->isForwarded(rid.slotID);
+    RID target = forwarded ? home->forwardOf(rid.slotID) : rid;
+    Page* moved = nullptr;
+    if (forwarded) {
+        pages.emplace_back(pool, pool->fetchPage(target.pageID));
+        moved = pages[1].get();
+    }
+
+    // Secondary entries of the old row, read before its bytes are overwritten
+    Page* current = forwarded ? moved : home;
+    RowView oldRow = bindSchema(current->rowView(target.slotID));
+    auto oldSecondary = secondaryKeys(oldRow);
+    auto oldPayloads = entryPayloads(oldRow);
+    RowView newRow = bindSchema(RowView(rowData.data(), rowData.size()));
+    auto newSecondary = secondaryKeys(newRow);
+    auto newPayloads = entryPayloads(newRow);
+
+    vector<char> movedData = encodeForward(rid);
+    movedData.insert(movedData.end(), rowData.begin(), rowData.end());
+
+    if (home->updateRow(rid.slotID, rowData)) {
+        slotRecord(LogRecordType::RowUpdate, rid, rowData, 0);
+        if (forwarded) {
+            moved->deleteRow(target.slotID);
+            slotRecord(LogRecordType::SlotFree, target, {}, 0);
+        }
+    } else if (forwarded && moved->updateRow(target.slotID, movedData, SLOT_MOVED)) {
+        slotRecord(LogRecordType::RowUpdate, target, movedData, SLOT_MOVED);
+    } else {
+        // Checked before anything changes: a row shorter than a forwarding
+        // RID on a full page cannot move, and the update fails as a whole
+        if (!home->canUpdate(rid.slotID, FORWARD_SIZE))
+            throw runtime_error("No room for a forwarding slot");
+        if (forwarded) {
+            moved->deleteRow(target.slotID);
+            slotRecord(LogRecordType::SlotFree, target, {}, 0);
+        }
+        pages.emplace_back(pool, findPageFor(movedData.size()));
+        Page* dest = pages.back().get();
+        RID newTarget{dest->getPageID(), dest->insertRow(movedData, SLOT_MOVED)};
+        slotRecord(LogRecordType::RowUpdate, newTarget, movedData, SLOT_MOVED);
+
+        vector<char> forward = encodeForward(newTarget);
+        home->updateRow(rid.slotID, forward, SLOT_FORWARD); // room checked above
+        slotRecord(LogRecordType::RowUpdate, rid, forward, SLOT_FORWARD);
+    }
+
+    const vector<char>& payload = payloadOf(newPayloads, keyColumn());
+    if (newKey != k) {
+        index->remove(k);
+        index->insert(newKey, rid, payload.data());
+        records.push_back(LogRecord{0, LogRecordType::KeyUpdate, rid, newKey, payload, 0, k, 0});
+    } else if (payload != payloadOf(oldPayloads, keyColumn())) {
+        index->updatePayload(k, rid, payload.data());
+        records.push_back(
+            LogRecord{0, LogRecordType::IndexUpdate, rid, k, payload, 0, 0, static_cast<uint16_t>(keyColumn())});
+    }
+    // Only entries whose value changed are replaced
+    vector<pair<size_t, Key>> removed, added;
+    set_difference(oldSecondary.begin(), oldSecondary.end(), newSecondary.begin(), newSecondary.end(),
+                   back_inserter(removed));
+    set_difference(newSecondary.begin(), newSecondary.end(), oldSecondary.begin(), oldSecondary.end(),
+                   back_inserter(added));
+    for (const auto& entry : removed)
+        secondaryIndexes[entry.first]->remove(entry.second, rid);
+    for (const auto& entry : added)
+        secondaryIndexes[entry.first]->insert(entry.second, rid, payloadOf(newPayloads, entry.first).data());
+    appendIndexRecords(records, LogRecordType::IndexDelete, rid, removed);
+    appendIndexRecords(records, LogRecordType::IndexInsert, rid, added, newPayloads);
+    // Entries that stay only change when their included columns do
+    for (const auto& entry : newSecondary) {
+        const vector<char>& newPayload = payloadOf(newPayloads, entry.first);
+        if (newPayload == payloadOf(oldPayloads, entry.first) ||
+            !binary_search(oldSecondary.begin(), oldSecondary.end(), entry))
+            continue;
+        secondaryIndexes[entry.first]->updatePayload(entry.second, rid, newPayload.data());
+        records.push_back(LogRecord{0, LogRecordType::IndexUpdate, rid, entry.second, newPayload, 0, 0,
+                                    static_cast<uint16_t>(entry.first)});
+    }
+
+    uint64_t lsn = wal->logGroup(records);
+    for (auto& page : pages) {
+        page->setPageLSN(lsn);
+        page.markDirty();
+        fsm->update(page->getPageID(), page->getFreeSpace());
+    }
+    pages.clear();
+    guard.unlock();
+
+    wal->commit(lsn);
+    maybeCheckpoint();
+}
+
+vector<RID> TableFile::bulkInsert(const vector<vector<string>>& rows, double fillFactor) {
+    if (fillFactor <= 0 || fillFactor > 1)
+        throw runtime_error("bulkInsert fill factor must be in (0, 1]");
+
+    lock_guard<shared_mutex> guard(latch);
+    // Start from a clean log so the unlogged pages never need redo
+    checkpointLocked();
+    index->markTorn();
+    for (auto& entry : secondaryIndexes)
+        entry.second->markTorn();
+
+    uint32_t reserve = static_cast<uint32_t>(PAGE_SIZE * (1 - fillFactor));
+    vector<RID> rids;
+    vector<pair<Key, RID>> entries;
+    map<size_t, vector<pair<Key, RID>>> secondaryEntries;
+    map<size_t, vector<char>> entryPayloadBytes; // payloads of each covering index, in entry order
+    rids.reserve(rows.size());
+    entries.reserve(rows.size());
+
+    Page page(pool->getNumPages());
+    bool pageEmpty = true;
+    for (const auto& row : rows) {
+        auto rowData = encodeRow(row);
+        if (!page.canFit(rowData.size() + (pageEmpty ? 0 : reserve))) {
+            if (pageEmpty) throw runtime_error("Row does not fit in a page");
+            pool->appendPage(page);
+            fsm->update(page.getPageID(), page.getFreeSpace());
+            page = Page(page.getPageID() + 1);
+            pageEmpty = true;
+            if (!page.canFit(rowData.size())) throw runtime_error("Row does not fit in a page");
+        }
+        RID rid = {page.getPageID(), page.insertRow(rowData)};
+        pageEmpty = false;
+        rids.push_back(rid);
+        entries.push_back({extractKeyFromRow(row, rowData), rid});
+        RowView view = bindSchema(RowView(rowData.data(), rowData.size()));
+        auto payloads = entryPayloads(view);
+        const vector<char>& payload = payloadOf(payloads, keyColumn());
+        entryPayloadBytes[keyColumn()].insert(entryPayloadBytes[keyColumn()].end(), payload.begin(), payload.end());
+        for (const auto& entry : secondaryKeys(view)) {
+            secondaryEntries[entry.first].push_back({entry.second, rid});
+            const vector<char>& newPayload = payloadOf(payloads, entry.first);
+            entryPayloadBytes[entry.first].insert(entryPayloadBytes[entry.first].end(), newPayload.begin(),
+                                                  newPayload.end());
+        }
+    }
+    if (!pageEmpty) {
+        pool->appendPage(page);
+        fsm->update(page.getPageID(), page.getFreeSpace());
+    }
+    pool->sync();
+
+    auto load = [fillFactor](BPlusTree* tree, vector<pair<Key, RID>>& treeEntries, vector<char>& payloads) {
+        if (tree->isEmpty()) {
+            tree->bulkLoad(move(treeEntries), fillFactor, move(payloads));
+        } else {
+            // Rebuilding around a few new entries would rewrite the whole index
+            uint32_t width = tree->getPayloadBytes();
+            for (size_t i = 0; i < treeEntries.size(); i++)
+                tree->insert(treeEntries[i].first, treeEntries[i].second, width ? &payloads[i * width] : nullptr);
+        }
+    };
+    load(index, entries, entryPayloadBytes[keyColumn()]);
+    for (auto& entry : secondaryEntries)
+        load(secondaryIndexes[entry.first], entry.second, entryPayloadBytes[entry.first]);
+    checkpointLocked();
+    return rids;
+}
+
+vector<char> TableFile::encodeRow(const vector<string>& row) const {
+    return schema.empty() ? serializeRow(row) : schema.encode(row);
+}
+
+RowView TableFile::bindSchema(const RowView& row) const {
+    return schema.empty() ? row : RowView(row.data(), row.length(), &schema);
+}
+
+Key TableFile::extractKeyFromRow(const vector<string>& row, const vector<char>& rowData) {
+    if (!schema.empty()) return extractKeyFromRow(bindSchema(RowView(rowData.data(), rowData.size())));
+    return stoi(row[keyColumn()]);
+}
+
+// Typed rows store the key as an INT32 at a fixed offset, so this is a load
+Key TableFile::extractKeyFromRow(const RowView& row) {
+    if (row.getSchema()) return row.getInt32(schema.getKeyColumn());
+    return stoi(string(row.column(keyColumn())));
 }
 
+// NULL (or, in untyped rows, empty) columns have no key and are not indexed
+bool TableFile::columnKey(const RowView& row, size_t column, Key& key) const {
+    if (row.isNull(column) || (!row.getSchema() && row.column(column).empty())) return false;
+    key = row.getInt32(column);
+    return true;
+}
 
-Key TableFile::extractKeyFromRow(const vector<string>& row) {
-    int indexedColumn = 0;      // for now, hardcode
-    return stoi(row[indexedColumn]);
+// Sorted by column, like secondaryIndexes
+vector<pair<size_t, Key>> TableFile::secondaryKeys(const RowView& row) const {
+    vector<pair<size_t, Key>> keys;
+    for (const auto& entry : secondaryIndexes) {
+        Key key;
+        if (columnKey(row, entry.first, key)) keys.push_back({entry.first, key});
+    }
+    return keys;
 }
 
 vector<string> TableFile::findByKey(Key k) {
+    OpTimer timer(Op::TableLookup);
+    shared_lock<shared_mutex> guard(latch);
     RID rid;
     if (index->search(k, rid))
-        return getRow(rid);
+        return fetchRow(rid);
     throw runtime_error("Key not found");
 }
 
+vector<vector<string>> TableFile::findByKeys(const vector<Key>& keys) {
+    OpTimer timer(Op::TableBatchLookup);
+    shared_lock<shared_mutex> guard(latch);
+    vector<RID> rids;
+    vector<bool> found;
+    index->searchBatch(keys, rids, found);
+    vector<RID> hits;
+    vector<size_t> hitKeys; // index in keys of each hit
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (!found[i]) continue;
+        hits.push_back(rids[i]);
+        hitKeys.push_back(i);
+    }
+    vector<vector<string>> rows(keys.size());
+    visitRowsByPage(hits, [&](size_t i, const RowView& row) { rows[hitKeys[i]] = row.materialize(); });
+    return rows;
+}
+
 vector<vector<string>> TableFile::rangeQuery(Key low, Key high) {
-    auto rids = index->rangeScan(low, high);
+    OpTimer timer(Op::TableRange);
+    shared_lock<shared_mutex> guard(latch);
+    return fetchRows(index->rangeScan(low, high));
+}
 
-    vector<vector<string>> result;
-    for (auto &r : rids)
-        result.push_back(getRow(r));
+vector<string> TableFile::findByKey(Key k, const vector<size_t>& projection) {
+    OpTimer timer(Op::TableLookup);
+    shared_lock<shared_mutex> guard(latch);
+    RID rid;
+    vector<size_t> slots;
+    if (coveredSlots(keyColumn(), projection, slots)) {
+        vector<char> payload(index->getPayloadBytes());
+        if (!index->search(k, rid, payload.data())) throw runtime_error("Key not found");
+        Metrics::count(Counter::IndexOnlyRows);
+        auto it = included.find(keyColumn());
+        return coveredRow(k, payload.data(), it == included.end() ? nullptr : &it->second.layout, slots);
+    }
+    if (!index->search(k, rid)) throw runtime_error("Key not found");
+    return fetchRow(rid, projection);
+}
+
+vector<vector<string>> TableFile::rangeQuery(Key low, Key high, const vector<size_t>& projection) {
+    return rangeQueryByColumn(keyColumn(), low, high, projection);
+}
+
+void TableFile::createIndex(size_t column, const vector<size_t>& include) {
+    lock_guard<shared_mutex> guard(latch);
+    if (column == keyColumn())
+        throw runtime_error("Column " + to_string(column) + " is the primary index");
+    if (secondaryIndexes.count(column))
+        throw runtime_error("Column " + to_string(column) + " is already indexed");
+    if (!schema.empty() && schema.column(column).type != ColumnType::INT32)
+        throw runtime_error("Only INT32 columns can be indexed");
+    IncludedColumns columns;
+    if (!include.empty()) columns = makeIncluded(column, include);
+
+    // Built from the heap as of a checkpoint, so no log record predates it;
+    // it only counts as existing once the catalog lists it
+    checkpointLocked();
+    if (!include.empty()) included[column] = move(columns);
+    try {
+        secondaryIndexes[column] = buildSecondaryIndex(column);
+    } catch (...) {
+        included.erase(column);
+        throw;
+    }
+    saveIndexCatalog();
+    checkpointLocked();
+}
+
+bool TableFile::hasIndex(size_t column) const {
+    return column == keyColumn() || secondaryIndexes.count(column) > 0;
+}
+
+// The catalog is saved before the index is rebuilt with its new entry size;
+// a crash in between leaves an index file that no longer opens as the
+// catalog describes it, which openIndex replaces and recovery rebuilds
+void TableFile::setIncludedColumns(size_t column, const vector<size_t>& include) {
+    lock_guard<shared_mutex> guard(latch);
+    if (!hasIndex(column)) throw runtime_error("Column " + to_string(column) + " is not indexed");
+    IncludedColumns columns;
+    if (!include.empty()) columns = makeIncluded(column, include);
+
+    checkpointLocked();
+    if (include.empty())
+        included.erase(column);
+    else
+        included[column] = move(columns);
+    saveIndexCatalog();
+    if (column == keyColumn()) {
+        rebuildIndex();
+    } else {
+        delete secondaryIndexes[column];
+        secondaryIndexes[column] = buildSecondaryIndex(column);
+    }
+    checkpointLocked();
+}
+
+vector<size_t> TableFile::getIncludedColumns(size_t column) const {
+    auto it = included.find(column);
+    return it == included.end() ? vector<size_t>() : it->second.columns;
+}
+
+// Included columns must have fixed-width slots, so an entry's payload is a
+// copy of them; the index column itself is already the entry's key
+TableFile::IncludedColumns TableFile::makeIncluded(size_t column, const vector<size_t>& include) const {
+    if (schema.empty()) throw runtime_error("Only typed tables can include columns in an index");
+    vector<Column> columns;
+    for (size_t i = 0; i < include.size(); i++) {
+        const Column& c = schema.column(include[i]);
+        if (include[i] == column) throw runtime_error("Column " + c.name + " is the index key");
+        if (c.type == ColumnType::VARCHAR)
+            throw runtime_error("VARCHAR column " + c.name + " cannot be included in an index");
+        if (find(include.begin(), include.begin() + i, include[i]) != include.begin() + i)
+            throw runtime_error("Column " + c.name + " is included twice");
+        columns.push_back(c);
+    }
+    IncludedColumns result{include, Schema(columns, NO_KEY_COLUMN)};
+    if (result.layout.fixedSize() > MAX_PAYLOAD_BYTES)
+        throw runtime_error("Included columns take more than " + to_string(MAX_PAYLOAD_BYTES) + " bytes per entry");
+    return result;
+}
+
+uint32_t TableFile::payloadBytes(size_t column) const {
+    auto it = included.find(column);
+    return it == included.end() ? 0 : it->second.layout.fixedSize();
+}
+
+// The null bits, then each included column's fixed slot as the row stores it
+vector<char> TableFile::entryPayload(const IncludedColumns& include, const RowView& row) const {
+    const Schema& layout = include.layout;
+    vector<char> payload(layout.fixedSize(), 0);
+    for (size_t i = 0; i < include.columns.size(); i++) {
+        size_t col = include.columns[i];
+        if (row.isNull(col)) {
+            payload[i / 8] |= static_cast<char>(1 << (i % 8));
+            continue;
+        }
+        memcpy(payload.data() + layout.offsetOf(i), row.data() + schema.offsetOf(col), fixedWidth(schema.column(col)));
+    }
+    return payload;
+}
+
+map<size_t, vector<char>> TableFile::entryPayloads(const RowView& row) const {
+    map<size_t, vector<char>> payloads;
+    for (const auto& entry : included)
+        payloads[entry.first] = entryPayload(entry.second, row);
+    return payloads;
+}
+
+// Only typed tables: an untyped key column need not read back as the
+// integer text the index holds
+bool TableFile::coveredSlots(size_t column, const vector<size_t>& projection, vector<size_t>& slots) const {
+    if (schema.empty() || projection.empty() || !indexOn(column)) return false;
+    auto it = included.find(column);
+    slots.clear();
+    for (size_t col : projection) {
+        if (col == column) {
+            slots.push_back(SIZE_MAX);
+            continue;
+        }
+        if (it == included.end()) return false;
+        const vector<size_t>& columns = it->second.columns;
+        auto pos = find(columns.begin(), columns.end(), col);
+        if (pos == columns.end()) return false;
+        slots.push_back(pos - columns.begin());
+    }
+    return true;
+}
+
+vector<string> TableFile::coveredRow(Key key, const char* payload, const Schema* layout,
+                                     const vector<size_t>& slots) const {
+    RowView values(payload, layout ? layout->fixedSize() : 0, layout);
+    vector<string> row;
+    row.reserve(slots.size());
+    for (size_t slot : slots)
+        row.push_back(slot == SIZE_MAX ? to_string(key) : values.columnText(slot));
+    return row;
+}
+
+TreeMemoryStats TableFile::getIndexMemoryStats() {
+    shared_lock<shared_mutex> guard(latch);
+    TreeMemoryStats total = index->getMemoryStats();
+    for (auto& entry : secondaryIndexes) {
+        TreeMemoryStats stats = entry.second->getMemoryStats();
+        total.reservedBytes += stats.reservedBytes;
+        total.usedBytes += stats.usedBytes;
+        total.liveNodes += stats.liveNodes;
+    }
+    return total;
+}
+
+string TableFile::statsJSON() {
+    shared_lock<shared_mutex> guard(latch);
+    BufferPoolStats p = pool->getStats();
+    WALStats w = wal->getStats();
+    ostringstream out;
+    out << "{\"metrics\":" << Metrics::toJSON() << ",\"pool\":{\"frames\":" << pool->getNumFrames()
+        << ",\"hits\":" << p.hits << ",\"misses\":" << p.misses << ",\"evictions\":" << p.evictions
+        << ",\"writebacks\":" << p.writebacks << ",\"dirtied\":" << p.dirtied << ",\"prefetched\":" << p.prefetched
+        << "},\"wal\":{\"records\":" << w.records << ",\"commits\":" << w.commits << ",\"syncs\":" << w.syncs
+        << ",\"bytesWritten\":" << w.bytesWritten << "},\"checkpoints\":" << checkpoints << ",\"indexes\":[";
+    auto describe = [&](size_t column, BPlusTree* tree) {
+        out << "{\"column\":" << column << ",\"height\":" << tree->getHeight()
+            << ",\"cachedNodes\":" << tree->getCachedNodeCount() << ",\"freeNodes\":" << tree->getFreeNodeCount()
+            << ",\"included\":[";
+        vector<size_t> columns = getIncludedColumns(column);
+        for (size_t i = 0; i < columns.size(); i++)
+            out << (i ? "," : "") << columns[i];
+        out << "]}";
+    };
+    describe(keyColumn(), index);
+    for (auto& entry : secondaryIndexes) {
+        out << ",";
+        describe(entry.first, entry.second);
+    }
+    out << "]}";
+    return out.str();
+}
+
+vector<vector<string>> TableFile::findByColumn(size_t column, Key value) {
+    return rangeQueryByColumn(column, value, value);
+}
 
+vector<vector<string>> TableFile::rangeQueryByColumn(size_t column, Key low, Key high) {
+    return rangeQueryByColumn(column, low, high, {});
+}
+
+vector<vector<string>> TableFile::findByColumn(size_t column, Key value, const vector<size_t>& projection) {
+    return rangeQueryByColumn(column, value, value, projection);
+}
+
+vector<vector<string>> TableFile::rangeQueryByColumn(size_t column, Key low, Key high,
+                                                     const vector<size_t>& projection) {
+    OpTimer timer(Op::TableRange);
+    shared_lock<shared_mutex> guard(latch);
+    BPlusTree* tree = indexOn(column);
+    vector<size_t> slots;
+    if (coveredSlots(column, projection, slots)) {
+        // Index-only: the rows are built from the leaf entries as they are visited
+        auto it = included.find(column);
+        const Schema* layout = it == included.end() ? nullptr : &it->second.layout;
+        vector<vector<string>> result;
+        tree->visitRange(low, high, [&](const Key& key, const RID&, const char* payload) {
+            result.push_back(coveredRow(key, payload, layout, slots));
+        });
+        Metrics::count(Counter::IndexOnlyRows, result.size());
+        return result;
+    }
+    if (tree) return fetchRows(tree->rangeScan(low, high), projection);
+
+    vector<vector<string>> result;
+    vector<string_view> columns;
+    uint32_t numPages = pool->getNumPages();
+    for (uint32_t pageID = 0; pageID < numPages; ++pageID) {
+        PinnedPage page(pool, pool->fetchPage(pageID));
+        for (const auto& entry : page->rows()) {
+            RowView row = bindSchema(entry.row);
+            Key key;
+            if (columnKey(row, column, key) && key >= low && key <= high)
+                result.push_back(projectRow(row, projection, columns));
+        }
+    }
     return result;
 }
 
+void TableFile::forEachRow(const RowVisitor& visit) {
+    shared_lock<shared_mutex> guard(latch);
+    uint32_t numPages = pool->getNumPages();
+    for (uint32_t pageID = 0; pageID < numPages; ++pageID) {
+        PinnedPage page(pool, pool->fetchPage(pageID));
+        for (const auto& entry : page->rows())
+            visit(entry.rid, bindSchema(entry.row));
+    }
+}
+
+bool TableFile::visitByKey(Key k, const function<void(const RowView&)>& visit) {
+    OpTimer timer(Op::TableLookup);
+    shared_lock<shared_mutex> guard(latch);
+    RID rid;
+    if (!index->search(k, rid)) return false;
+    uint16_t slotID;
+    PinnedPage page = pinRow(rid, slotID);
+    visit(bindSchema(page->rowView(slotID)));
+    return true;
+}
+
+void TableFile::visitRange(Key low, Key high, const RowVisitor& visit) {
+    OpTimer timer(Op::TableRange);
+    shared_lock<shared_mutex> guard(latch);
+    vector<RID> rids = index->rangeScan(low, high);
+    size_t prefetched = 0;
+    for (size_t i = 0; i < rids.size(); i++) {
+        if (i == prefetched) prefetched = prefetchRows(rids, i);
+        const RID& rid = rids[i];
+        uint16_t slotID;
+        PinnedPage page = pinRow(rid, slotID);
+        visit(rid, bindSchema(page->rowView(slotID)));
+    }
+}
+
 vector<vector<string>> TableFile::scanAll() {
+    shared_lock<shared_mutex> guard(latch);
     vector<vector<string>> result;
 
-    for(auto& page : pages) {
-        auto rows = page.readAllRows();
-        result.insert(result.end(), rows.begin(), rows.end());
+    uint32_t numPages = pool->getNumPages();
+    for (uint32_t pageID = 0; pageID < numPages; ++pageID) {
+        PinnedPage page(pool, pool->fetchPage(pageID));
+        for (const auto& entry : page->rows())
+            result.push_back(bindSchema(entry.row).materialize());
     }
     return result;
 }
 
-Page* TableFile::getLastPage() {
-    if (pages.empty()) return nullptr;
-    return &pages.back();
+// Runs work over every morsel of the table on up to numThreads workers, the
+// calling thread being worker 0. The table latch is held throughout, so the
+// pages cannot change under the workers; they only share the buffer pool.
+void TableFile::runMorsels(size_t numThreads,
+                           const function<void(size_t, uint32_t, uint32_t, uint32_t)>& work) {
+    uint32_t numPages = pool->getNumPages();
+    uint32_t numMorsels = (numPages + SCAN_MORSEL_PAGES - 1) / SCAN_MORSEL_PAGES;
+    if (numThreads == 0) numThreads = max(1u, thread::hardware_concurrency());
+    numThreads = max<size_t>(1, min<size_t>(numThreads, numMorsels));
+
+    atomic<uint32_t> nextMorsel{0};
+    exception_ptr failure;
+    mutex failureLatch;
+    auto worker = [&](size_t workerID) {
+        try {
+            for (uint32_t m = nextMorsel++; m < numMorsels; m = nextMorsel++) {
+                uint32_t first = m * SCAN_MORSEL_PAGES;
+                uint32_t end = min(first + SCAN_MORSEL_PAGES, numPages);
+                // Workers interleave their morsels, which defeats the kernel's
+                // sequential read-ahead, so read the whole morsel as one batch
+                pool->prefetch(first, end - first);
+                work(workerID, m, first, end);
+            }
+        } catch (...) {
+            lock_guard<mutex> guard(failureLatch);
+            if (!failure) failure = current_exception();
+            nextMorsel = numMorsels; // stop the other workers early
+        }
+    };
+
+    vector<thread> workers;
+    for (size_t i = 1; i < numThreads; i++)
+        workers.emplace_back(worker, i);
+    worker(0);
+    for (auto& t : workers)
+        t.join();
+    if (failure) rethrow_exception(failure);
 }
 
-Page* TableFile::createNewPage() {
-    uint32_t newPageID = pages.size();
-    pages.emplace_back(newPageID);
-    return &pages.back();
+void TableFile::parallelScan(const RowPredicate& predicate, const ScanSink& sink, size_t numThreads) {
+    shared_lock<shared_mutex> guard(latch);
+    runMorsels(numThreads, [&](size_t worker, uint32_t, uint32_t firstPage, uint32_t endPage) {
+        for (uint32_t pageID = firstPage; pageID < endPage; ++pageID) {
+            PinnedPage page(pool, pool->fetchPage(pageID));
+            for (const auto& entry : page->rows()) {
+                RowView row = bindSchema(entry.row);
+                if (!predicate || predicate(row))
+                    sink(worker, entry.rid, row);
+            }
+        }
+    });
+}
+
+vector<vector<string>> TableFile::parallelScan(const RowPredicate& predicate, const vector<size_t>& projection,
+                                               size_t numThreads) {
+    shared_lock<shared_mutex> guard(latch);
+    // One result slot per morsel keeps the merged output in table order
+    uint32_t numMorsels = (pool->getNumPages() + SCAN_MORSEL_PAGES - 1) / SCAN_MORSEL_PAGES;
+    vector<vector<vector<string>>> morselRows(numMorsels);
+
+    runMorsels(numThreads, [&](size_t, uint32_t morsel, uint32_t firstPage, uint32_t endPage) {
+        auto& out = morselRows[morsel];
+        vector<string_view> columns;
+        for (uint32_t pageID = firstPage; pageID < endPage; ++pageID) {
+            PinnedPage page(pool, pool->fetchPage(pageID));
+            for (const auto& entry : page->rows()) {
+                RowView row = bindSchema(entry.row);
+                if (predicate && !predicate(row)) continue;
+                out.push_back(projectRow(row, projection, columns));
+            }
+        }
+    });
+
+    vector<vector<string>> result;
+    for (auto& rows : morselRows)
+        for (auto& row : rows)
+            result.push_back(move(row));
+    return result;
+}
+
+TableScanCursor TableFile::openScan(size_t batchSize) {
+    return TableScanCursor(this, batchSize);
 }
 
-void TableFile::writePageToDisk(Page* page) {
-    uint32_t pageID = page->getPageID();
-    file.seekp(pageID * PAGE_SIZE, ios::beg);
-    file.write(page->data(), PAGE_SIZE);
-    file.flush();
+IndexRangeCursor TableFile::openRange(Key low, Key high, size_t batchSize) {
+    return IndexRangeCursor(this, low, high, batchSize);
 }
 
-Page TableFile::readPageFromDisk(uint32_t pageID) {
-    Page page(pageID);
-    file.seekg(pageID * PAGE_SIZE, ios::beg);
-    if (!file.read(page.data(), PAGE_SIZE)) {
-        throw runtime_error("Failed to read page from disk");
+// Both helpers return the page pinned; the caller is responsible for unpinning it.
+// The free space map may be stale, so a candidate page is checked before use
+// and its entry corrected if it is fuller than recorded.
+Page* TableFile::findPageFor(uint32_t rowSize) {
+    uint32_t pageID;
+    while ((pageID = fsm->findPage(rowSize + sizeof(Slot))) != INVALID_PAGE) {
+        Page* page = pool->fetchPage(pageID);
+        if (page->canFit(rowSize)) return page;
+        fsm->update(pageID, page->getFreeSpace());
+        pool->unpinPage(pageID, false);
     }
+    return createNewPage();
+}
+
+Page* TableFile::createNewPage() {
+    Page* page = pool->newPage();
+    fsm->update(page->getPageID(), page->getFreeSpace());
     return page;
-}
\ No newline at end of file
+}
+
+void TableFile::checkpoint() {
+    lock_guard<shared_mutex> guard(latch);
+    checkpointLocked();
+}
+
+void TableFile::compactIndexes() {
+    lock_guard<shared_mutex> guard(latch);
+    checkpointLocked();
+    index->compactIndex();
+    for (auto& entry : secondaryIndexes)
+        entry.second->compactIndex();
+}
+
+void TableFile::maybeCheckpoint() {
+    if (wal->getSizeBytes() <= checkpointBytes) return;
+    if (checkpointerRunning) {
+        checkpointerWake.notify_one();
+        return;
+    }
+    checkpoint();
+}
+
+void TableFile::startCheckpointer(chrono::milliseconds interval, uint64_t walBytes) {
+    if (interval.count() <= 0) throw runtime_error("Checkpoint interval must be positive");
+    stopCheckpointer();
+    checkpointInterval = interval;
+    checkpointBytes = walBytes;
+    checkpointerStop = false;
+    checkpointerError = nullptr;
+    checkpointerRunning = true;
+    checkpointer = thread([this] { runCheckpointer(); });
+}
+
+void TableFile::stopCheckpointer() {
+    if (!checkpointer.joinable()) return;
+    {
+        lock_guard<mutex> guard(checkpointerLatch);
+        checkpointerStop = true;
+    }
+    checkpointerWake.notify_one();
+    checkpointer.join();
+    checkpointerRunning = false;
+    checkpointBytes = WAL_CHECKPOINT_BYTES;
+    if (checkpointerError) rethrow_exception(exchange(checkpointerError, nullptr));
+}
+
+// Dirty pages and nodes collect in memory between checkpoints, so a page
+// changed many times in an interval is written once
+void TableFile::runCheckpointer() {
+    unique_lock<mutex> guard(checkpointerLatch);
+    while (!checkpointerStop) {
+        checkpointerWake.wait_for(guard, checkpointInterval,
+                                  [this] { return checkpointerStop || wal->getSizeBytes() > checkpointBytes; });
+        if (checkpointerStop) break;
+        if (wal->isEmpty()) continue; // nothing changed since the last checkpoint
+        guard.unlock();
+        try {
+            checkpoint();
+        } catch (...) {
+            guard.lock();
+            checkpointerError = current_exception();
+            checkpointerRunning = false;
+            return;
+        }
+        guard.lock();
+    }
+}
+
+bool TableFile::enableDirectIO() {
+    lock_guard<shared_mutex> guard(latch);
+    directIO = pool->enableDirectIO() && index->enableDirectIO();
+    for (auto& entry : secondaryIndexes)
+        directIO = directIO && entry.second->enableDirectIO();
+    return directIO;
+}
+
+// Pages are forced before the index so that, once the log is truncated, both
+// reflect every logged mutation
+void TableFile::checkpointLocked() {
+    checkpoints++;
+    Metrics::count(Counter::Checkpoints);
+    uint64_t lsn = wal->flushAll();
+    pool->flushAll();
+    pool->sync();
+    fsm->flush();
+    index->checkpoint(lsn);
+    for (auto& entry : secondaryIndexes)
+        entry.second->checkpoint(lsn);
+    wal->truncate();
+}
+
+// Redo recovery: replays every record still in the log. Heap records are
+// applied only to pages whose pageLSN shows they are missing. The index on
+// disk is exactly the state of its last checkpoint, so records after that
+// checkpoint are replayed into it; if that checkpoint was interrupted the
+// index is rebuilt from the recovered heap instead.
+void TableFile::recover() {
+    vector<LogRecord> records = wal->readAll();
+    if (records.empty()) wal->advancePast(lastDurableLSN());
+    bool rebuild = index->isTorn();
+    // Pages appended after the map was last written have no entries
+    bool rebuildMap = fsm->getNumPages() != pool->getNumPages();
+    uint64_t indexLSN = index->getCheckpointLSN();
+
+    for (const auto& record : records) {
+        redoHeap(record);
+        if (!rebuild && record.lsn > indexLSN)
+            redoIndex(record);
+        redoSecondaryIndex(record);
+    }
+
+    if (rebuild) rebuildIndex();
+    bool rebuildSecondary = false;
+    for (auto& entry : secondaryIndexes) {
+        if (!entry.second->isTorn()) continue;
+        delete entry.second;
+        entry.second = buildSecondaryIndex(entry.first);
+        rebuildSecondary = true;
+    }
+    if (rebuildMap) rebuildFreeSpaceMap();
+    if (!records.empty() || rebuild || rebuildSecondary || rebuildMap) checkpointLocked();
+}
+
+// The highest LSN the index checkpoints carry, and, when the log had to be
+// created afresh, the pages too; new records must be numbered above it or
+// redo would take them for changes already applied
+uint64_t TableFile::lastDurableLSN() {
+    uint64_t lsn = index->getCheckpointLSN();
+    for (auto& entry : secondaryIndexes)
+        lsn = max(lsn, entry.second->getCheckpointLSN());
+    if (!wal->wasCreated()) return lsn;
+    uint32_t numPages = pool->getNumPages();
+    for (uint32_t pageID = 0; pageID < numPages; ++pageID) {
+        PinnedPage page(pool, pool->fetchPage(pageID));
+        lsn = max(lsn, page->getPageLSN());
+    }
+    return lsn;
+}
+
+void TableFile::redoHeap(const LogRecord& record) {
+    if (record.type == LogRecordType::KeyUpdate || record.type == LogRecordType::IndexInsert ||
+        record.type == LogRecordType::IndexDelete || record.type == LogRecordType::IndexUpdate)
+        return;
+
+    // Pages appended before the crash may not have reached the disk
+    while (record.rid.pageID >= pool->getNumPages()) {
+        pool->unpinPage(createNewPage()->getPageID(), true);
+    }
+
+    PinnedPage page(pool, pool->fetchPage(record.rid.pageID));
+    if (page->getPageLSN() >= record.lsn) return;
+
+    if (record.type == LogRecordType::RowInsert) {
+        page->insertRowAt(record.rid.slotID, record.rowData);
+    } else if (record.type == LogRecordType::RowUpdate) {
+        // Either rewrites a row or places a moved one in a free slot
+        if (!page->isSlotOccupied(record.rid.slotID))
+            page->insertRowAt(record.rid.slotID, record.rowData, record.slotFlags);
+        else if (!page->updateRow(record.rid.slotID, record.rowData, record.slotFlags))
+            throw runtime_error("Log replay mismatch: redone update does not fit");
+    } else {
+        page->deleteRow(record.rid.slotID);
+    }
+    page->setPageLSN(record.lsn);
+    page.markDirty();
+    fsm->update(record.rid.pageID, page->getFreeSpace());
+}
+
+// A row insert's payload comes from the logged row; key and payload updates
+// log the payload itself
+void TableFile::redoIndex(const LogRecord& record) {
+    if (record.type == LogRecordType::RowInsert) {
+        auto payloads = entryPayloads(bindSchema(RowView(record.rowData.data(), record.rowData.size())));
+        index->insert(record.key, record.rid, payloadOf(payloads, keyColumn()).data());
+    } else if (record.type == LogRecordType::RowDelete) {
+        index->remove(record.key);
+    } else if (record.type == LogRecordType::KeyUpdate) {
+        index->remove(record.oldKey);
+        index->insert(record.key, record.rid, loggedPayload(record, index));
+    } else if (record.type == LogRecordType::IndexUpdate && record.column == keyColumn()) {
+        if (const char* payload = loggedPayload(record, index)) index->updatePayload(record.key, record.rid, payload);
+    }
+}
+
+// Secondary indexes are checkpointed with the primary one but may be
+// rebuilt on their own, so each is checked against its own checkpoint LSN
+void TableFile::redoSecondaryIndex(const LogRecord& record) {
+    if (record.type != LogRecordType::IndexInsert && record.type != LogRecordType::IndexDelete &&
+        record.type != LogRecordType::IndexUpdate)
+        return;
+    auto it = secondaryIndexes.find(record.column);
+    if (it == secondaryIndexes.end()) return;
+    BPlusTree* tree = it->second;
+    if (tree->isTorn() || record.lsn <= tree->getCheckpointLSN()) return;
+    if (record.type == LogRecordType::IndexInsert) {
+        tree->insert(record.key, record.rid, loggedPayload(record, tree));
+    } else if (record.type == LogRecordType::IndexUpdate) {
+        if (const char* payload = loggedPayload(record, tree)) tree->updatePayload(record.key, record.rid, payload);
+    } else {
+        tree->remove(record.key, record.rid);
+    }
+}
+
+void TableFile::rebuildIndex() {
+    string indexFile = filename + "_index.db";
+    delete index;
+    std::remove(indexFile.c_str());
+    index = openIndex(keyColumn());
+    if (directIO) index->enableDirectIO();
+
+    vector<pair<Key, RID>> entries;
+    vector<char> payloads;
+    auto it = included.find(keyColumn());
+    uint32_t numPages = pool->getNumPages();
+    for (uint32_t pageID = 0; pageID < numPages; ++pageID) {
+        PinnedPage page(pool, pool->fetchPage(pageID));
+        for (const auto& entry : page->rows()) {
+            RowView row = bindSchema(entry.row);
+            entries.push_back({extractKeyFromRow(row), entry.rid});
+            if (it == included.end()) continue;
+            vector<char> payload = entryPayload(it->second, row);
+            payloads.insert(payloads.end(), payload.begin(), payload.end());
+        }
+    }
+    index->bulkLoad(entries, 1.0, move(payloads));
+}
+
+void TableFile::rebuildFreeSpaceMap() {
+    fsm->clear();
+    uint32_t numPages = pool->getNumPages();
+    for (uint32_t pageID = 0; pageID < numPages; ++pageID) {
+        PinnedPage page(pool, pool->fetchPage(pageID));
+        fsm->update(pageID, page->getFreeSpace());
+    }
+}
+
+string TableFile::secondaryIndexFile(size_t column) const {
+    return filename + "_index_" + to_string(column) + ".db";
+}
+
+// The primary or secondary index on column, or null if there is none
+BPlusTree* TableFile::indexOn(size_t column) const {
+    if (column == keyColumn()) return index;
+    auto it = secondaryIndexes.find(column);
+    return it == secondaryIndexes.end() ? nullptr : it->second;
+}
+
+// Opens the index on column with the entry payload of its included columns.
+// A file that does not open that way, left by a crash while they changed, is
+// started afresh and marked torn so that recovery rebuilds it.
+BPlusTree* TableFile::openIndex(size_t column) {
+    bool primary = column == keyColumn();
+    string indexFile = primary ? filename + "_index.db" : secondaryIndexFile(column);
+    IndexKeys keys = primary ? IndexKeys::Unique : IndexKeys::NonUnique;
+    BPlusTree* tree;
+    try {
+        tree = new BPlusTree(indexFile, keys, DEFAULT_NODE_CACHE, payloadBytes(column));
+    } catch (const runtime_error&) {
+        std::remove(indexFile.c_str());
+        tree = new BPlusTree(indexFile, keys, DEFAULT_NODE_CACHE, payloadBytes(column));
+        tree->markTorn();
+    }
+    tree->enableWriteBack();
+    return tree;
+}
+
+// Creates the index file for column afresh and bulk loads it from the heap
+BPlusTree* TableFile::buildSecondaryIndex(size_t column) {
+    string indexFile = secondaryIndexFile(column);
+    std::remove(indexFile.c_str());
+    BPlusTree* tree = openIndex(column);
+    try {
+        if (directIO) tree->enableDirectIO();
+        vector<pair<Key, RID>> entries;
+        vector<char> payloads;
+        auto it = included.find(column);
+        uint32_t numPages = pool->getNumPages();
+        for (uint32_t pageID = 0; pageID < numPages; ++pageID) {
+            PinnedPage page(pool, pool->fetchPage(pageID));
+            for (const auto& entry : page->rows()) {
+                RowView row = bindSchema(entry.row);
+                Key key;
+                if (!columnKey(row, column, key)) continue;
+                entries.push_back({key, entry.rid});
+                if (it == included.end()) continue;
+                vector<char> payload = entryPayload(it->second, row);
+                payloads.insert(payloads.end(), payload.begin(), payload.end());
+            }
+        }
+        tree->bulkLoad(move(entries), 1.0, move(payloads));
+    } catch (...) {
+        delete tree;
+        std::remove(indexFile.c_str());
+        throw;
+    }
+    return tree;
+}
+
+// Catalog layout: magic, count, then for each index its column and the
+// count and numbers of its included columns. The primary index is listed
+// only when it covers columns.
+void TableFile::loadIndexCatalog() {
+    string catalogFile = filename + "_indexes.db";
+    ifstream file(catalogFile, ios::binary);
+    if (!file.is_open()) return;
+    uint32_t magic = 0;
+    uint16_t count = 0;
+    file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    file.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!file || magic != INDEX_CATALOG_MAGIC)
+        throw runtime_error("Corrupt index catalog " + catalogFile);
+    auto readColumn = [&]() {
+        uint16_t column;
+        if (!file.read(reinterpret_cast<char*>(&column), sizeof(column)))
+            throw runtime_error("Corrupt index catalog " + catalogFile);
+        return static_cast<size_t>(column);
+    };
+    for (uint16_t i = 0; i < count; i++) {
+        size_t column = readColumn();
+        vector<size_t> include(readColumn());
+        for (size_t& col : include)
+            col = readColumn();
+        if (!include.empty()) included[column] = makeIncluded(column, include);
+        if (column != keyColumn()) secondaryIndexes[column] = openIndex(column);
+    }
+}
+
+// Written to a temporary file and renamed over the old one, so a crash
+// leaves either catalog intact
+void TableFile::saveIndexCatalog() const {
+    string catalogFile = filename + "_indexes.db";
+    string tempFile = catalogFile + ".tmp";
+    uint32_t magic = INDEX_CATALOG_MAGIC;
+    vector<size_t> columns;
+    if (included.count(keyColumn())) columns.push_back(keyColumn());
+    for (const auto& entry : secondaryIndexes)
+        columns.push_back(entry.first);
+    uint16_t count = columns.size();
+    {
+        ofstream file(tempFile, ios::binary | ios::trunc);
+        auto writeColumn = [&](size_t value) {
+            uint16_t column = value;
+            file.write(reinterpret_cast<const char*>(&column), sizeof(column));
+        };
+        file.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+        file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        for (size_t column : columns) {
+            vector<size_t> include = getIncludedColumns(column);
+            writeColumn(column);
+            writeColumn(include.size());
+            for (size_t col : include)
+                writeColumn(col);
+        }
+        if (!file.flush()) throw runtime_error("Failed to write index catalog " + catalogFile);
+    }
+    syncFile(tempFile);
+    if (rename(tempFile.c_str(), catalogFile.c_str()) != 0)
+        throw runtime_error("Failed to replace index catalog " + catalogFile);
+}
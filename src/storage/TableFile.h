@@ -5,30 +5,221 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <shared_mutex>
+#include <functional>
+#include <map>
 #include "include/Common.h"
+#include "BufferPool.h"
+#include "WriteAheadLog.h"
+#include "FreeSpaceMap.h"
+#include "RowView.h"
+#include "Schema.h"
+#include "TableCursor.h"
 using namespace std;
 
 class Page; //forward declaration
-class BPlusTree;
+
+constexpr uint64_t WAL_CHECKPOINT_BYTES = 16 * 1024 * 1024; // log size that triggers a checkpoint
+constexpr uint32_t SCAN_MORSEL_PAGES = 16; // pages a parallel scan worker claims at a time
+constexpr size_t BITMAP_SCAN_ROWS = 32; // index results this large are fetched page by page, not in key order
+
+// Called with each row in place; the view must not outlive the call
+using RowVisitor = function<void(const RID&, const RowView&)>;
+using RowPredicate = function<bool(const RowView&)>;
+// Per-worker sink of a parallel scan: called concurrently from different
+// workers, but never concurrently with the same worker index
+using ScanSink = function<void(size_t worker, const RID&, const RowView&)>;
 
 class TableFile {
 public:
-    TableFile(const string& filename);
+    // ioConfig sets the queue depth and batching of the heap file's async I/O
+    TableFile(const string& filename, size_t poolFrames = DEFAULT_POOL_FRAMES, const IOConfig& ioConfig = IOConfig());
+    // Creates a typed table, or opens one created with the same schema. Rows
+    // are still passed in and out as text, but stored in the binary format,
+    // and the visitors get schema-aware views with typed getters.
+    TableFile(const string& filename, const Schema& schema, size_t poolFrames = DEFAULT_POOL_FRAMES,
+              const IOConfig& ioConfig = IOConfig());
     ~TableFile();
     BPlusTree* index;
     RID insertRow(const vector<string>& row);
     vector<string> getRow(const RID& rid);
     vector<vector<string>> scanAll();
     vector<string> findByKey(Key k);
+    // Looks up many keys at once: rows[i] is the row with keys[i], or empty
+    // when there is none. The index descends the keys together (see
+    // BPlusTree::searchBatch) and each heap page is read and pinned once,
+    // in page order, for all the rows it holds.
+    vector<vector<string>> findByKeys(const vector<Key>& keys);
     void deleteByKey(Key k);
+    // Replaces the row indexed under k; the row keeps its RID
+    void updateRow(Key k, const vector<string>& row);
     vector<vector<string>> rangeQuery(Key low, Key high);
+    // Builds a secondary index over column from the existing rows and keeps
+    // it up to date from then on. Several rows may share a value; entries are
+    // ordered by (value, RID). Values are INT32 (integer text in untyped
+    // tables), and NULL or empty values are not indexed. include lists
+    // columns for the index to cover, as with setIncludedColumns.
+    void createIndex(size_t column, const vector<size_t>& include = {});
+    bool hasIndex(size_t column) const;
+    // Makes the primary or a secondary index on column a covering index:
+    // each entry also stores the values of the include columns, so projected
+    // queries that need nothing else are answered without reading the heap.
+    // Only fixed-width columns (INT32, INT64, DOUBLE, CHAR) of typed tables
+    // can be included, up to MAX_PAYLOAD_BYTES per entry with their null
+    // bits. Rebuilds the index; an empty include drops the included columns.
+    void setIncludedColumns(size_t column, const vector<size_t>& include);
+    vector<size_t> getIncludedColumns(size_t column) const;
+    // Rows whose column equals value, or lies in [low, high]. Uses the
+    // primary or a secondary index on column, and scans the table if none.
+    vector<vector<string>> findByColumn(size_t column, Key value);
+    vector<vector<string>> rangeQueryByColumn(size_t column, Key low, Key high);
+    // Projected variants: the projection columns (all when empty) of each
+    // matching row. When the index on the column covers every projected
+    // column they are read from its entries alone; otherwise the rows are
+    // fetched from the heap.
+    vector<string> findByKey(Key k, const vector<size_t>& projection);
+    vector<vector<string>> rangeQuery(Key low, Key high, const vector<size_t>& projection);
+    vector<vector<string>> findByColumn(size_t column, Key value, const vector<size_t>& projection);
+    vector<vector<string>> rangeQueryByColumn(size_t column, Key low, Key high, const vector<size_t>& projection);
+    // Zero-copy variants of scanAll, findByKey and rangeQuery: rows are
+    // decoded straight from the pinned page instead of being copied out
+    void forEachRow(const RowVisitor& visit);
+    bool visitByKey(Key k, const function<void(const RowView&)>& visit);
+    void visitRange(Key low, Key high, const RowVisitor& visit);
+    // Parallel scans: pages are split into morsels of SCAN_MORSEL_PAGES that
+    // workers claim one at a time, so a skewed morsel just keeps one worker
+    // busy longer while the others take the rest. The predicate runs on the
+    // in-place row while its page is pinned; a null predicate keeps every row.
+    // numThreads = 0 uses all hardware threads.
+    void parallelScan(const RowPredicate& predicate, const ScanSink& sink, size_t numThreads = 0);
+    // Returns the projected columns (all when empty) of matching rows in table order
+    vector<vector<string>> parallelScan(const RowPredicate& predicate, const vector<size_t>& projection,
+                                        size_t numThreads = 0);
+    // Streaming alternatives to scanAll and rangeQuery with constant memory
+    TableScanCursor openScan(size_t batchSize = DEFAULT_CURSOR_BATCH);
+    IndexRangeCursor openRange(Key low, Key high, size_t batchSize = DEFAULT_CURSOR_BATCH);
+    // Packs rows into new pages filled to fillFactor and appends them
+    // sequentially without logging each row. An empty index is built
+    // bottom-up; one that already has entries takes the new ones by regular
+    // inserts, a descent per row. Not atomic: after a crash any prefix of
+    // the pages may be present, and the index is rebuilt to match.
+    vector<RID> bulkInsert(const vector<vector<string>>& rows, double fillFactor = 1.0);
+    // Writes all dirty pages and index nodes, then truncates the log
+    void checkpoint();
+    // Checkpoints, then rewrites the primary and secondary indexes into
+    // dense files, dropping the node pages freed by deletes
+    void compactIndexes();
+    // Background checkpointing: a thread checkpoints every interval, and
+    // as soon as the log outgrows walBytes, so commits no longer pay for
+    // checkpoints. Until then, a commit that finds the log over
+    // WAL_CHECKPOINT_BYTES checkpoints inline. Stopped by the destructor.
+    void startCheckpointer(chrono::milliseconds interval, uint64_t walBytes = WAL_CHECKPOINT_BYTES);
+    // Waits for a running checkpoint, and rethrows the error that stopped
+    // the checkpointer, if any
+    void stopCheckpointer();
+    uint64_t getCheckpointCount() const { return checkpoints; }
+    // Reads and writes the heap and index files with O_DIRECT, leaving the
+    // caching to the buffer pool and the node caches. Returns false, keeping
+    // buffered I/O, when the file system does not support it.
+    bool enableDirectIO();
+    const Schema& getSchema() const { return schema; }
+    BufferPoolStats getBufferPoolStats() const { return pool->getStats(); }
+    WALStats getWALStats() const { return wal->getStats(); }
+    AsyncIOStats getIOStats() const { return pool->getIOStats(); }
+    // Node memory of the primary and every secondary index together
+    TreeMemoryStats getIndexMemoryStats();
+    // The process-wide metrics (see include/Metrics.h) together with this
+    // table's pool, log and index figures, tree heights included, as JSON
+    string statsJSON();
 private:
-    fstream file;
-    Page* getLastPage();
-    Page* createNewPage();
-    void writePageToDisk(Page* page);
-    Page readPageFromDisk(uint32_t pageID);
-    Key extractKeyFromRow(const vector<string>& row);
+    friend class TableScanCursor;
+    friend class IndexRangeCursor;
+
+    // Columns a covering index stores with each entry, in the typed row
+    // format of layout, a schema of just those columns
+    struct IncludedColumns {
+        vector<size_t> columns;
+        Schema layout;
+    };
 
-    vector<Page> pages;
+    string filename;
+    Schema schema; // empty for untyped tables
+    BufferPool* pool;
+    FreeSpaceMap* fsm;
+    WriteAheadLog* wal;
+    // Secondary indexes by column, listed in <table>_indexes.db
+    map<size_t, BPlusTree*> secondaryIndexes;
+    // Covering indexes by indexed column, the primary under keyColumn()
+    map<size_t, IncludedColumns> included;
+    bool directIO; // also applied to indexes opened or rebuilt later
+
+    thread checkpointer;
+    mutex checkpointerLatch;
+    condition_variable checkpointerWake;
+    bool checkpointerStop;
+    atomic<bool> checkpointerRunning; // false again once it stops on an error
+    exception_ptr checkpointerError;
+    chrono::milliseconds checkpointInterval;
+    atomic<uint64_t> checkpointBytes; // log size that triggers a checkpoint
+    atomic<uint64_t> checkpoints;
+    // Shared by readers, exclusive for anything that changes pages or the
+    // index; commits wait outside of it
+    shared_mutex latch;
+
+    Page* findPageFor(uint32_t rowSize);
+    Page* createNewPage();
+    vector<string> fetchRow(const RID& rid, const vector<size_t>& projection = {});
+    vector<vector<string>> fetchRows(const vector<RID>& rids, const vector<size_t>& projection = {});
+    size_t prefetchRows(const vector<RID>& rids, size_t from);
+    // Calls visit(i, row) for every rids[i], grouped by heap page in page
+    // order, so each page is pinned once; pages are prefetched in batches.
+    // When there are more rows than pages they are bucketed by page, a pass
+    // over a page bitmap, instead of sorted.
+    void visitRowsByPage(const vector<RID>& rids, const function<void(size_t, const RowView&)>& visit);
+    PinnedPage pinRow(const RID& rid, uint16_t& slotID);
+    vector<char> encodeRow(const vector<string>& row) const;
+    // Attaches the table schema to a view of a stored row
+    RowView bindSchema(const RowView& row) const;
+    Key extractKeyFromRow(const vector<string>& row, const vector<char>& rowData);
+    Key extractKeyFromRow(const RowView& row);
+    size_t keyColumn() const { return schema.empty() ? 0 : schema.getKeyColumn(); }
+    bool columnKey(const RowView& row, size_t column, Key& key) const;
+    // (column, value) of every secondary index entry the row needs
+    vector<pair<size_t, Key>> secondaryKeys(const RowView& row) const;
+    string secondaryIndexFile(size_t column) const;
+    BPlusTree* indexOn(size_t column) const;
+    BPlusTree* openIndex(size_t column);
+    BPlusTree* buildSecondaryIndex(size_t column);
+    IncludedColumns makeIncluded(size_t column, const vector<size_t>& include) const;
+    uint32_t payloadBytes(size_t column) const;
+    vector<char> entryPayload(const IncludedColumns& include, const RowView& row) const;
+    // Entry payload of the row for every covering index, by indexed column
+    map<size_t, vector<char>> entryPayloads(const RowView& row) const;
+    // Where each projected column sits in the payload of the index on
+    // column, SIZE_MAX for the indexed column itself; false unless the
+    // index covers the whole projection
+    bool coveredSlots(size_t column, const vector<size_t>& projection, vector<size_t>& slots) const;
+    vector<string> coveredRow(Key key, const char* payload, const Schema* layout,
+                              const vector<size_t>& slots) const;
+    void loadIndexCatalog();
+    void saveIndexCatalog() const;
+    void checkpointLocked();
+    // Called after a commit; checkpoints, or wakes the checkpointer, once
+    // the log outgrows checkpointBytes
+    void maybeCheckpoint();
+    void runCheckpointer();
+    void runMorsels(size_t numThreads,
+                    const function<void(size_t worker, uint32_t morsel, uint32_t firstPage, uint32_t endPage)>& work);
+    void recover();
+    uint64_t lastDurableLSN();
+    void redoHeap(const LogRecord& record);
+    void redoIndex(const LogRecord& record);
+    void redoSecondaryIndex(const LogRecord& record);
+    void rebuildIndex();
+    void rebuildFreeSpaceMap();
 };
\ No newline at end of file
@@ -0,0 +1,339 @@
+//Implementation of the write-ahead log with group commit.
+
+#include "WriteAheadLog.h"
+#include "include/Metrics.h"
+#include <stdexcept>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+//Log file layout:
+//LogFileHeader → record → record → ...
+//Each record is a fixed RecordHeader followed by a type specific payload.
+
+namespace {
+
+constexpr uint32_t LOG_MAGIC = 0x4C41574D; // "MWAL"
+
+struct LogFileHeader {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t startLSN; // LSN of the first record in the file
+};
+
+struct RecordHeader {
+    uint32_t length;   // payload length in bytes
+    uint32_t checksum; // FNV-1a over lsn, type and payload
+    uint64_t lsn;
+    uint8_t type;
+};
+
+constexpr size_t RECORD_HEADER_SIZE = sizeof(uint32_t) * 2 + sizeof(uint64_t) + sizeof(uint8_t);
+
+uint32_t fnv1a(const char* data, size_t len, uint32_t hash = 2166136261u) {
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t recordChecksum(uint64_t lsn, uint8_t type, const char* payload, size_t len) {
+    uint32_t hash = fnv1a(reinterpret_cast<const char*>(&lsn), sizeof(lsn));
+    hash = fnv1a(reinterpret_cast<const char*>(&type), sizeof(type), hash);
+    return fnv1a(payload, len, hash);
+}
+
+// Payload of row records: pageID, slotID, key, then row bytes for inserts,
+// slot flags and row bytes for updates, the old key for key updates, or the
+// column of an index entry; key and index updates and index inserts end
+// with the entry's included column values
+vector<char> encodeRowPayload(const RID& rid, Key key, const vector<char>* rowData) {
+    size_t size = sizeof(rid.pageID) + sizeof(rid.slotID) + sizeof(Key);
+    if (rowData) size += rowData->size();
+    vector<char> payload(size);
+    size_t offset = 0;
+    memcpy(payload.data() + offset, &rid.pageID, sizeof(rid.pageID));
+    offset += sizeof(rid.pageID);
+    memcpy(payload.data() + offset, &rid.slotID, sizeof(rid.slotID));
+    offset += sizeof(rid.slotID);
+    memcpy(payload.data() + offset, &key, sizeof(Key));
+    offset += sizeof(Key);
+    if (rowData && !rowData->empty()) memcpy(payload.data() + offset, rowData->data(), rowData->size());
+    return payload;
+}
+
+vector<char> encodeRecord(const LogRecord& record) {
+    switch (record.type) {
+    case LogRecordType::RowInsert:
+        return encodeRowPayload(record.rid, record.key, &record.rowData);
+    case LogRecordType::RowUpdate: {
+        vector<char> extra(1 + record.rowData.size());
+        extra[0] = static_cast<char>(record.slotFlags);
+        if (!record.rowData.empty()) memcpy(extra.data() + 1, record.rowData.data(), record.rowData.size());
+        return encodeRowPayload(record.rid, record.key, &extra);
+    }
+    case LogRecordType::KeyUpdate: {
+        vector<char> extra(sizeof(Key) + record.rowData.size());
+        memcpy(extra.data(), &record.oldKey, sizeof(Key));
+        if (!record.rowData.empty())
+            memcpy(extra.data() + sizeof(Key), record.rowData.data(), record.rowData.size());
+        return encodeRowPayload(record.rid, record.key, &extra);
+    }
+    case LogRecordType::IndexInsert:
+    case LogRecordType::IndexDelete:
+    case LogRecordType::IndexUpdate: {
+        vector<char> extra(sizeof(uint16_t) + record.rowData.size());
+        memcpy(extra.data(), &record.column, sizeof(uint16_t));
+        if (!record.rowData.empty())
+            memcpy(extra.data() + sizeof(uint16_t), record.rowData.data(), record.rowData.size());
+        return encodeRowPayload(record.rid, record.key, &extra);
+    }
+    default:
+        return encodeRowPayload(record.rid, record.key, nullptr);
+    }
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const string& filename)
+    : filename(filename), fd(-1), fileSize(0), startLSN(1), nextLSN(1), durableLSN(0),
+      flushing(false), failed(false), created(false), stats{} {
+    fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) throw runtime_error("Failed to open log file " + filename);
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    LogFileHeader header{};
+    if (size < static_cast<off_t>(sizeof(LogFileHeader))) {
+        writeHeader(1);
+        created = true;
+    } else {
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != LOG_MAGIC)
+            throw runtime_error("Corrupt log file: bad header");
+        startLSN = nextLSN = header.startLSN;
+        fileSize = size;
+    }
+    durableLSN = nextLSN - 1;
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    if (fd >= 0) {
+        // A failed log keeps its tail; syncing it again would only throw
+        if (!failed) flushAll();
+        close(fd);
+    }
+}
+
+// The new header is made durable before the records behind it are cut off.
+// A crash in between leaves records older than startLSN, which readAll
+// ignores; the log is never left without a header.
+void WriteAheadLog::writeHeader(uint64_t lsn) {
+    LogFileHeader header{LOG_MAGIC, 0, lsn};
+    if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        fdatasync(fd) != 0 ||
+        ftruncate(fd, sizeof(header)) != 0)
+        throw runtime_error("Failed to write log header");
+    startLSN = lsn;
+    fileSize = sizeof(header);
+}
+
+uint64_t WriteAheadLog::append(LogRecordType type, const vector<char>& payload) {
+    lock_guard<mutex> guard(latch);
+    return appendLocked(type, payload);
+}
+
+uint64_t WriteAheadLog::appendLocked(LogRecordType type, const vector<char>& payload) {
+    uint64_t lsn = nextLSN++;
+    uint8_t typeByte = static_cast<uint8_t>(type);
+
+    RecordHeader header{};
+    header.length = payload.size();
+    header.checksum = recordChecksum(lsn, typeByte, payload.data(), payload.size());
+    header.lsn = lsn;
+    header.type = typeByte;
+
+    size_t offset = tail.size();
+    tail.resize(offset + RECORD_HEADER_SIZE + payload.size());
+    char* out = tail.data() + offset;
+    memcpy(out, &header.length, sizeof(header.length));
+    memcpy(out + 4, &header.checksum, sizeof(header.checksum));
+    memcpy(out + 8, &header.lsn, sizeof(header.lsn));
+    memcpy(out + 16, &header.type, sizeof(header.type));
+    if (!payload.empty()) memcpy(out + RECORD_HEADER_SIZE, payload.data(), payload.size());
+
+    stats.records++;
+    return lsn;
+}
+
+uint64_t WriteAheadLog::logInsert(const RID& rid, Key key, const vector<char>& rowData) {
+    return append(LogRecordType::RowInsert, encodeRowPayload(rid, key, &rowData));
+}
+
+uint64_t WriteAheadLog::logDelete(const RID& rid, Key key) {
+    return append(LogRecordType::RowDelete, encodeRowPayload(rid, key, nullptr));
+}
+
+uint64_t WriteAheadLog::logGroup(const vector<LogRecord>& records) {
+    if (records.empty()) throw runtime_error("Empty log record group");
+    vector<vector<char>> payloads;
+    for (const auto& record : records)
+        payloads.push_back(encodeRecord(record));
+
+    lock_guard<mutex> guard(latch);
+    uint64_t lsn = 0;
+    for (size_t i = 0; i < records.size(); i++)
+        lsn = appendLocked(records[i].type, payloads[i]);
+    return lsn;
+}
+
+void WriteAheadLog::commit(uint64_t lsn) {
+    unique_lock<mutex> lock(latch);
+    stats.commits++;
+    syncUpTo(lock, lsn);
+}
+
+void WriteAheadLog::flushTo(uint64_t lsn) {
+    unique_lock<mutex> lock(latch);
+    syncUpTo(lock, lsn);
+}
+
+uint64_t WriteAheadLog::flushAll() {
+    unique_lock<mutex> lock(latch);
+    uint64_t last = nextLSN - 1;
+    syncUpTo(lock, last);
+    return last;
+}
+
+// Leader/follower group commit: the first waiter becomes the leader and
+// syncs everything appended so far; waiters that arrive meanwhile sleep and
+// are covered by the leader's sync, or lead the next one.
+// A failed write or sync fails the log for good: the batch it held is gone,
+// and after a failed fdatasync the kernel may have dropped the dirty pages,
+// so a retry could report success for records that never reached the disk.
+void WriteAheadLog::syncUpTo(unique_lock<mutex>& lock, uint64_t lsn) {
+    while (durableLSN < lsn) {
+        if (failed) throw runtime_error("Log file " + filename + " failed an earlier write");
+        if (flushing) {
+            flushed.wait(lock);
+            continue;
+        }
+        flushing = true;
+        vector<char> batch;
+        batch.swap(tail);
+        uint64_t batchLSN = nextLSN - 1;
+        uint64_t offset = fileSize;
+        lock.unlock();
+
+        bool ok = pwrite(fd, batch.data(), batch.size(), offset) == static_cast<ssize_t>(batch.size()) &&
+                  fdatasync(fd) == 0;
+
+        lock.lock();
+        flushing = false;
+        if (!ok) {
+            failed = true;
+            flushed.notify_all();
+            throw runtime_error("Failed to write log file " + filename);
+        }
+        fileSize += batch.size();
+        durableLSN = batchLSN;
+        stats.syncs++;
+        stats.bytesWritten += batch.size();
+        Metrics::count(Counter::LogFlushes);
+        Metrics::count(Counter::LogBytesWritten, batch.size());
+        flushed.notify_all();
+    }
+}
+
+vector<LogRecord> WriteAheadLog::readAll() {
+    lock_guard<mutex> guard(latch);
+    vector<LogRecord> records;
+    vector<char> data(fileSize - sizeof(LogFileHeader));
+    if (!data.empty() &&
+        pread(fd, data.data(), data.size(), sizeof(LogFileHeader)) != static_cast<ssize_t>(data.size()))
+        throw runtime_error("Failed to read log file " + filename);
+
+    size_t offset = 0;
+    while (offset + RECORD_HEADER_SIZE <= data.size()) {
+        const char* in = data.data() + offset;
+        RecordHeader header{};
+        memcpy(&header.length, in, sizeof(header.length));
+        memcpy(&header.checksum, in + 4, sizeof(header.checksum));
+        memcpy(&header.lsn, in + 8, sizeof(header.lsn));
+        memcpy(&header.type, in + 16, sizeof(header.type));
+
+        // A partially written or corrupt record ends the log
+        if (offset + RECORD_HEADER_SIZE + header.length > data.size()) break;
+        const char* payload = in + RECORD_HEADER_SIZE;
+        if (header.checksum != recordChecksum(header.lsn, header.type, payload, header.length)) break;
+        // Left from before the last truncate, whose cut was interrupted
+        if (header.lsn < startLSN) break;
+        size_t fixed = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(Key);
+        if (header.length < fixed) break;
+
+        LogRecord record{};
+        record.lsn = header.lsn;
+        record.type = static_cast<LogRecordType>(header.type);
+        memcpy(&record.rid.pageID, payload, sizeof(uint32_t));
+        memcpy(&record.rid.slotID, payload + 4, sizeof(uint16_t));
+        memcpy(&record.key, payload + 6, sizeof(Key));
+        const char* extra = payload + fixed;
+        size_t extraSize = header.length - fixed;
+        if (record.type == LogRecordType::RowInsert) {
+            record.rowData.assign(extra, extra + extraSize);
+        } else if (record.type == LogRecordType::RowUpdate && extraSize >= 1) {
+            record.slotFlags = static_cast<uint8_t>(extra[0]);
+            record.rowData.assign(extra + 1, extra + extraSize);
+        } else if (record.type == LogRecordType::KeyUpdate && extraSize >= sizeof(Key)) {
+            memcpy(&record.oldKey, extra, sizeof(Key));
+            record.rowData.assign(extra + sizeof(Key), extra + extraSize);
+        } else if ((record.type == LogRecordType::IndexInsert || record.type == LogRecordType::IndexDelete ||
+                    record.type == LogRecordType::IndexUpdate) &&
+                   extraSize >= sizeof(uint16_t)) {
+            memcpy(&record.column, extra, sizeof(uint16_t));
+            record.rowData.assign(extra + sizeof(uint16_t), extra + extraSize);
+        }
+        records.push_back(record);
+
+        offset += RECORD_HEADER_SIZE + header.length;
+    }
+
+    // Cut off the torn tail so new records are appended after the last intact one
+    fileSize = sizeof(LogFileHeader) + offset;
+    if (ftruncate(fd, fileSize) != 0) throw runtime_error("Failed to truncate log file " + filename);
+    if (!records.empty() && records.back().lsn >= nextLSN) {
+        nextLSN = records.back().lsn + 1;
+        durableLSN = records.back().lsn;
+    }
+    return records;
+}
+
+void WriteAheadLog::truncate() {
+    lock_guard<mutex> guard(latch);
+    if (!tail.empty() || flushing) throw runtime_error("Cannot truncate log with unsynced records");
+    writeHeader(nextLSN);
+}
+
+void WriteAheadLog::advancePast(uint64_t lsn) {
+    lock_guard<mutex> guard(latch);
+    if (lsn < nextLSN) return;
+    if (fileSize != sizeof(LogFileHeader) || !tail.empty())
+        throw runtime_error("Cannot advance the LSNs of a log that holds records");
+    writeHeader(lsn + 1);
+    nextLSN = lsn + 1;
+    durableLSN = lsn;
+}
+
+uint64_t WriteAheadLog::getSizeBytes() const {
+    lock_guard<mutex> guard(latch);
+    return fileSize + tail.size();
+}
+
+bool WriteAheadLog::isEmpty() const {
+    lock_guard<mutex> guard(latch);
+    return fileSize == sizeof(LogFileHeader) && tail.empty();
+}
+
+WALStats WriteAheadLog::getStats() const {
+    lock_guard<mutex> guard(latch);
+    return stats;
+}
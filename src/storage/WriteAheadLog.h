@@ -0,0 +1,97 @@
+#pragma once
+//Write-Ahead Log
+//Every table mutation is described by one compact log record. A mutation is
+//durable once its record is synced to the log; heap pages and index nodes are
+//written later, at checkpoints, and are replayed from the log after a crash.
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include "include/Common.h"
+using namespace std;
+
+enum class LogRecordType : uint8_t {
+    RowInsert = 1, // row bytes stored at rid, indexed under key
+    RowDelete = 2, // row at rid removed, key removed from the index
+    RowUpdate = 3, // slot at rid rewritten with rowData and slotFlags; no index change
+    SlotFree = 4,  // slot at rid released without touching the index
+    KeyUpdate = 5, // index entry of the row at rid moved from oldKey to key, with payload rowData
+    IndexInsert = 6, // (key, rid) added to the secondary index on column, with payload rowData
+    IndexDelete = 7, // (key, rid) removed from the secondary index on column
+    IndexUpdate = 8, // payload of (key, rid) in the index on column replaced by rowData
+};
+
+struct LogRecord {
+    uint64_t lsn;
+    LogRecordType type;
+    RID rid;
+    Key key;
+    vector<char> rowData; // RowInsert and RowUpdate: bytes stored in the slot; index records:
+                          // the included column values of the entry, if its index has any
+    uint8_t slotFlags;    // RowUpdate only
+    Key oldKey;           // KeyUpdate only
+    uint16_t column;      // IndexInsert, IndexDelete and IndexUpdate only
+};
+
+struct WALStats {
+    uint64_t records;      // log records appended
+    uint64_t commits;      // commit calls
+    uint64_t syncs;        // fdatasync calls; commits / syncs is the group commit factor
+    uint64_t bytesWritten;
+};
+
+class WriteAheadLog {
+public:
+    WriteAheadLog(const string& filename);
+    ~WriteAheadLog();
+
+    // Appends a record to the in-memory log tail and returns its LSN
+    uint64_t logInsert(const RID& rid, Key key, const vector<char>& rowData);
+    uint64_t logDelete(const RID& rid, Key key);
+    // Appends several records back to back, so a sync writes all of them or
+    // none; lsn fields are ignored. Returns the LSN of the last one.
+    uint64_t logGroup(const vector<LogRecord>& records);
+
+    // Blocks until every record up to lsn is on stable storage. Callers that
+    // arrive while another thread is syncing wait for it and are then synced
+    // together by a single write + fdatasync (group commit). Once a write
+    // or sync fails, this and every later commit or flush throws.
+    void commit(uint64_t lsn);
+    void flushTo(uint64_t lsn);
+    uint64_t flushAll();
+
+    // Returns every intact record in the log; a torn tail is discarded
+    vector<LogRecord> readAll();
+    // Drops all records once a checkpoint has made them redundant; LSNs keep increasing
+    void truncate();
+    // Makes the next LSN of an empty log greater than lsn
+    void advancePast(uint64_t lsn);
+    // The file had no header when opened, so earlier LSNs are unknown
+    bool wasCreated() const { return created; }
+
+    uint64_t getSizeBytes() const;
+    // No records since the last truncate
+    bool isEmpty() const;
+    WALStats getStats() const;
+private:
+    string filename;
+    int fd;
+    uint64_t fileSize;
+    uint64_t startLSN; // LSN in the header; records below it are stale
+
+    vector<char> tail;    // appended records not yet written
+    uint64_t nextLSN;
+    uint64_t durableLSN;
+    bool flushing;
+    bool failed; // a write or sync failed; nothing past durableLSN will be synced
+    bool created;
+    WALStats stats;
+    mutable mutex latch;
+    condition_variable flushed;
+
+    uint64_t append(LogRecordType type, const vector<char>& payload);
+    uint64_t appendLocked(LogRecordType type, const vector<char>& payload);
+    void writeHeader(uint64_t lsn);
+    void syncUpTo(unique_lock<mutex>& lock, uint64_t lsn);
+};
@@ -0,0 +1,131 @@
+//Correctness test for batched lookups.
+//BPlusTree::searchBatch must answer exactly as one search per key, and
+//TableFile::findByKeys exactly as one findByKey per key, for batches that
+//are unsorted, repeat keys, miss keys, fall outside the tree and span
+//every leaf. Trees are tried with a node cache far smaller than the tree,
+//so levels are read in batches, with and without duplicate keys, and the
+//table with rows forwarded off their pages. Exits non-zero on any mismatch
+//or error.
+//
+//Built by CMake as batch_lookup_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/BatchLookupTest.cpp storage/*.cpp index/*.cpp -o batch_lookup_test -lpthread
+//  ./batch_lookup_test
+#include <iostream>
+#include <map>
+#include <random>
+#include <cstdio>
+#include "storage/TableFile.h"
+
+using namespace std;
+
+constexpr int KEYS = 30000;     // entries in each tree, on even keys
+constexpr size_t CACHE_NODES = 16;
+constexpr int BATCHES = 40;
+constexpr int ROWS = 6000;
+
+static const string INDEX = "batch_lookup_test.db";
+static const string TABLE = "batch_lookup_test_table.db";
+
+static bool fail(const string& what) {
+    cerr << what << "\n";
+    return false;
+}
+
+static void removeTable() {
+    for (string suffix : {"", "_index.db", "_fsm.db", "_wal.log"})
+        remove((TABLE + suffix).c_str());
+}
+
+// Unsorted keys with repeats, misses between and beyond the entries
+static vector<Key> makeBatch(mt19937& rng, size_t size, Key high) {
+    vector<Key> keys;
+    for (size_t i = 0; i < size; i++) {
+        if (i % 10 == 9 && !keys.empty()) keys.push_back(keys[rng() % keys.size()]);
+        else keys.push_back(static_cast<Key>(rng() % (high + 200)) - 100);
+    }
+    return keys;
+}
+
+static bool trees(bool duplicates) {
+    string label = duplicates ? "Non-unique tree" : "Unique tree";
+    remove(INDEX.c_str());
+    BPlusTree tree(INDEX, duplicates ? IndexKeys::NonUnique : IndexKeys::Unique, CACHE_NODES);
+    for (int i = 0; i < KEYS; i++) {
+        Key key = duplicates ? i / 3 * 2 : i * 2;
+        tree.insert(key, RID{static_cast<uint32_t>(i), static_cast<uint16_t>(i % 9)});
+    }
+    mt19937 rng(duplicates ? 2 : 1);
+    for (int b = 0; b < BATCHES; b++) {
+        // From single keys up to batches far larger than a leaf
+        size_t size = b == 0 ? 1 : b == 1 ? 0 : 1 + rng() % (b < BATCHES / 2 ? 64 : 4000);
+        vector<Key> keys = makeBatch(rng, size, 2 * KEYS);
+        vector<RID> rids;
+        vector<bool> found;
+        tree.searchBatch(keys, rids, found);
+        if (rids.size() != keys.size() || found.size() != keys.size())
+            return fail(label + ": " + to_string(found.size()) + " answers for " + to_string(keys.size()) + " keys");
+        for (size_t i = 0; i < keys.size(); i++) {
+            RID rid;
+            bool expected = tree.search(keys[i], rid);
+            if (found[i] != expected) return fail(label + ": batch disagrees on " + to_string(keys[i]));
+            if (expected && (rids[i].pageID != rid.pageID || rids[i].slotID != rid.slotID))
+                return fail(label + ": batch found another entry for " + to_string(keys[i]));
+        }
+    }
+    return true;
+}
+
+static vector<string> makeRow(Key key, size_t noteLength) { return {to_string(key), string(noteLength, 'a' + key % 26)}; }
+
+static bool matches(TableFile& table, const map<Key, vector<string>>& reference, mt19937& rng, const string& phase) {
+    for (int b = 0; b < BATCHES; b++) {
+        vector<Key> keys = makeBatch(rng, b == 0 ? 0 : 1 + rng() % 2000, 2 * ROWS);
+        vector<vector<string>> rows = table.findByKeys(keys);
+        if (rows.size() != keys.size()) return fail(phase + ": " + to_string(rows.size()) + " rows for " + to_string(keys.size()) + " keys");
+        for (size_t i = 0; i < keys.size(); i++) {
+            auto it = reference.find(keys[i]);
+            if (it == reference.end()) {
+                if (!rows[i].empty()) return fail(phase + ": row found for missing key " + to_string(keys[i]));
+            } else if (rows[i] != it->second || (i % 50 == 0 && table.findByKey(keys[i]) != rows[i])) {
+                return fail(phase + ": wrong row for " + to_string(keys[i]));
+            }
+        }
+    }
+    return true;
+}
+
+static bool tables() {
+    removeTable();
+    map<Key, vector<string>> reference;
+    mt19937 rng(3);
+    TableFile table(TABLE);
+    for (Key key = 0; key < 2 * ROWS; key += 2) {
+        reference[key] = makeRow(key, rng() % 40);
+        table.insertRow(reference[key]);
+    }
+    if (!matches(table, reference, rng, "Table")) return false;
+
+    // Forwarded rows are read through the page they moved to
+    for (Key key = 0; key < 2 * ROWS; key += 10) {
+        reference[key] = makeRow(key, 600 + rng() % 400);
+        table.updateRow(key, reference[key]);
+    }
+    for (Key key = 4; key < 2 * ROWS; key += 14) {
+        table.deleteByKey(key);
+        reference.erase(key);
+    }
+    return matches(table, reference, rng, "Updated table");
+}
+
+int main() {
+    try {
+        if (!trees(false) || !trees(true) || !tables()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "batch lookup ok\n";
+    remove(INDEX.c_str());
+    removeTable();
+    return 0;
+}
@@ -0,0 +1,166 @@
+//Correctness test for the buffer pool.
+//A pool far smaller than the file evicts pages and writes the dirty ones
+//back, so changes survive a fresh pool; a pool whose frames are all pinned
+//refuses another page until one is unpinned. Pages are read outside the
+//pool latch, so threads that miss on the same page must share one read, and
+//a page must never be handed out before its read completes. Threads fetch
+//the same pages in the same order through a pool that holds them all, which
+//reads each page exactly once, then fetch random pages through a small pool
+//while one of them prefetches. Every fetched page is checked against what
+//was written. Exits non-zero on any mismatch or error.
+//
+//Built by CMake as buffer_pool_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/BufferPoolTest.cpp storage/*.cpp index/*.cpp -o buffer_pool_test -lpthread
+//  ./buffer_pool_test
+#include <iostream>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <cstdio>
+#include "storage/BufferPool.h"
+
+using namespace std;
+
+constexpr uint32_t PAGES = 600;
+constexpr int THREADS = 8;
+constexpr int FETCHES_PER_THREAD = 5000;
+constexpr size_t SMALL_POOL = 64; // frames; far fewer than pages, so fetches evict
+constexpr size_t TINY_POOL = 8;   // frames for the eviction checks
+
+static const string FILE_NAME = "buffer_pool_test.db";
+
+static uint64_t tagOf(uint32_t pageID) { return pageID * 7919ULL + 1; }
+
+static bool fail(const string& what) {
+    cerr << what << "\n";
+    return false;
+}
+
+// Each page carries its ID and a tag derived from it in the pageLSN
+static bool intact(const Page* page, uint32_t pageID) {
+    return page->getPageID() == pageID && page->getPageLSN() == tagOf(pageID);
+}
+
+static void writePages() {
+    remove(FILE_NAME.c_str());
+    BufferPool pool(FILE_NAME);
+    for (uint32_t i = 0; i < PAGES; i++) {
+        Page* page = pool.newPage();
+        page->setPageLSN(tagOf(page->getPageID()));
+        pool.unpinPage(page->getPageID(), true);
+    }
+    pool.flushAll();
+}
+
+// Changes pages through a tiny pool, then checks them through a fresh one
+static bool evictionAndWriteBack() {
+    {
+        BufferPool pool(FILE_NAME, TINY_POOL);
+        for (uint32_t pageID = 0; pageID < PAGES; pageID += 3) {
+            Page* page = pool.fetchPage(pageID);
+            page->setPageLSN(tagOf(pageID) + 1);
+            pool.unpinPage(pageID, true);
+        }
+        BufferPoolStats stats = pool.getStats();
+        if (stats.evictions < PAGES / 3 - TINY_POOL) return fail("Eviction: " + to_string(stats.evictions) + " evictions");
+        if (stats.writebacks < stats.evictions) return fail("Eviction: dirty pages evicted without a write-back");
+
+        Page* again = pool.fetchPage(PAGES - 3);
+        pool.unpinPage(PAGES - 3, false);
+        if (pool.getStats().hits != stats.hits + 1) return fail("Eviction: a resident page was read again");
+        if (again->getPageLSN() != tagOf(PAGES - 3) + 1) return fail("Eviction: a resident page lost its change");
+    }
+    BufferPool pool(FILE_NAME, TINY_POOL);
+    for (uint32_t pageID = 0; pageID < PAGES; pageID++) {
+        Page* page = pool.fetchPage(pageID);
+        bool changed = page->getPageLSN() == tagOf(pageID) + (pageID % 3 == 0);
+        // Put the page back as it was for the checks that follow
+        page->setPageLSN(tagOf(pageID));
+        pool.unpinPage(pageID, true);
+        if (!changed) return fail("Eviction: page " + to_string(pageID) + " has the wrong contents");
+    }
+    return true;
+}
+
+static bool allPinned() {
+    BufferPool pool(FILE_NAME, TINY_POOL);
+    for (uint32_t pageID = 0; pageID < TINY_POOL; pageID++) pool.fetchPage(pageID);
+    bool threw = false;
+    try {
+        pool.fetchPage(TINY_POOL);
+    } catch (const runtime_error&) {
+        threw = true;
+    }
+    if (!threw) return fail("Pinning: a fetch evicted a pinned page");
+    pool.unpinPage(3, false);
+    Page* page = pool.fetchPage(TINY_POOL);
+    if (!intact(page, TINY_POOL)) return fail("Pinning: wrong page after an unpin");
+    // The evicted frame was the unpinned one; the others are still resident
+    BufferPoolStats stats = pool.getStats();
+    for (uint32_t pageID : {0u, 7u}) {
+        if (!intact(pool.fetchPage(pageID), pageID)) return fail("Pinning: a pinned page changed");
+    }
+    if (pool.getStats().hits != stats.hits + 2) return fail("Pinning: a pinned page was evicted");
+    return true;
+}
+
+static bool sharedReads() {
+    BufferPool pool(FILE_NAME, PAGES);
+    atomic<int> wrong{0};
+    vector<thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&] {
+            for (uint32_t pageID = 0; pageID < PAGES; pageID++) {
+                Page* page = pool.fetchPage(pageID);
+                if (!intact(page, pageID)) wrong++;
+                pool.unpinPage(pageID, false);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    BufferPoolStats stats = pool.getStats();
+    if (wrong) return fail("Shared reads: " + to_string(wrong) + " pages with wrong contents");
+    if (stats.misses != PAGES) return fail("Shared reads: " + to_string(stats.misses) + " misses for " + to_string(PAGES) + " pages");
+    if (stats.hits + stats.misses != static_cast<uint64_t>(THREADS) * PAGES) return fail("Shared reads: fetches lost");
+    return true;
+}
+
+static bool randomReads() {
+    BufferPool pool(FILE_NAME, SMALL_POOL);
+    atomic<int> wrong{0};
+    vector<thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&, t] {
+            mt19937 rng(t);
+            for (int i = 0; i < FETCHES_PER_THREAD; i++) {
+                // Thread 0 reads a run ahead, as a scan does
+                if (t == 0 && i % 50 == 0) pool.prefetch(rng() % PAGES, 16);
+                uint32_t first = rng() % PAGES, second = rng() % PAGES;
+                Page* a = pool.fetchPage(first);
+                Page* b = pool.fetchPage(second);
+                if (!intact(a, first) || !intact(b, second)) wrong++;
+                pool.unpinPage(second, false);
+                pool.unpinPage(first, false);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    BufferPoolStats stats = pool.getStats();
+    if (wrong) return fail("Random reads: " + to_string(wrong) + " fetches with wrong contents");
+    if (stats.hits + stats.misses != 2ULL * THREADS * FETCHES_PER_THREAD) return fail("Random reads: fetches lost");
+    if (stats.prefetched == 0) return fail("Random reads: nothing prefetched");
+    return true;
+}
+
+int main() {
+    try {
+        writePages();
+        if (!evictionAndWriteBack() || !allPinned() || !sharedReads() || !randomReads()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "buffer pool ok\n";
+    remove(FILE_NAME.c_str());
+    return 0;
+}
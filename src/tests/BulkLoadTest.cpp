@@ -0,0 +1,169 @@
+//Correctness test for bottom-up bulk loading.
+//Trees are bulk loaded from shuffled entries at several fill factors, with
+//and without duplicate keys and payloads, and must return every entry in
+//key order, each with its own payload. They must then take random inserts
+//and removes like any other tree. Tables are bulk inserted into empty and
+//into populated, with room left in the pages, and every row must come back
+//through scans and the index, also after a reopen. Exits non-zero on any
+//mismatch or error.
+//
+//Built by CMake as bulk_load_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/BulkLoadTest.cpp storage/*.cpp index/*.cpp -o bulk_load_test -lpthread
+//  ./bulk_load_test
+#include <iostream>
+#include <map>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include "storage/TableFile.h"
+
+using namespace std;
+
+constexpr int ENTRIES = 20000;   // entries bulk loaded into each tree
+constexpr int STEPS = 5000;      // random operations after the load
+constexpr int PAYLOAD_BYTES = 8;
+constexpr int ROWS = 6000;       // rows per bulk insert into a table
+
+static const string INDEX = "bulk_load_test.db";
+static const string TABLE = "bulk_load_test_table.db";
+
+static bool fail(const string& what) {
+    cerr << what << "\n";
+    return false;
+}
+
+static void removeTable() {
+    for (string suffix : {"", "_index.db", "_fsm.db", "_wal.log"})
+        remove((TABLE + suffix).c_str());
+}
+
+// Equal keys come in runs of up to three when duplicates are allowed
+static Key keyOf(int i, bool duplicates) { return duplicates ? i / 3 * 2 : i * 2; }
+static RID ridOf(int i) { return RID{static_cast<uint32_t>(i), static_cast<uint16_t>(i % 11)}; }
+
+static bool loadTree(double fillFactor, bool duplicates) {
+    string label = "Tree at fill " + to_string(fillFactor) + (duplicates ? " with duplicates" : "") + ": ";
+    remove(INDEX.c_str());
+    BPlusTree tree(INDEX, duplicates ? IndexKeys::NonUnique : IndexKeys::Unique, DEFAULT_NODE_CACHE, PAYLOAD_BYTES);
+
+    vector<int> order(ENTRIES);
+    for (int i = 0; i < ENTRIES; i++) order[i] = i;
+    shuffle(order.begin(), order.end(), mt19937(3));
+    vector<pair<Key, RID>> entries;
+    vector<char> payloads(ENTRIES * PAYLOAD_BYTES);
+    for (int i = 0; i < ENTRIES; i++) {
+        entries.push_back({keyOf(order[i], duplicates), ridOf(order[i])});
+        uint64_t payload = order[i] * 31ULL;
+        memcpy(&payloads[i * PAYLOAD_BYTES], &payload, PAYLOAD_BYTES);
+    }
+    tree.bulkLoad(entries, fillFactor, payloads);
+
+    // (key, RID) -> payload
+    map<pair<Key, uint32_t>, uint64_t> reference;
+    for (int i = 0; i < ENTRIES; i++) reference[{keyOf(i, duplicates), ridOf(i).pageID}] = i * 31ULL;
+    mt19937 rng(9);
+    for (int step = 0; step < STEPS; step++) {
+        int i = rng() % (ENTRIES + 2000);
+        Key key = i < ENTRIES ? keyOf(i, duplicates) : 2 * i + 1;
+        pair<Key, uint32_t> entry{key, ridOf(i).pageID};
+        if (reference.count(entry)) {
+            if (!tree.remove(key, ridOf(i))) return fail(label + "cannot remove " + to_string(key));
+            reference.erase(entry);
+        } else {
+            uint64_t payload = i * 31ULL;
+            tree.insert(key, ridOf(i), reinterpret_cast<const char*>(&payload));
+            reference[entry] = payload;
+        }
+    }
+
+    vector<pair<Key, uint32_t>> found;
+    vector<uint64_t> foundPayloads;
+    tree.visitRange(-1, 1 << 30, [&](const Key& key, const RID& rid, const char* payload) {
+        uint64_t value;
+        memcpy(&value, payload, PAYLOAD_BYTES);
+        found.push_back({key, rid.pageID});
+        foundPayloads.push_back(value);
+    });
+    if (found.size() != reference.size()) return fail(label + "scan found " + to_string(found.size()) + " entries");
+    size_t i = 0;
+    for (const auto& entry : reference) {
+        if (found[i] != entry.first) return fail(label + "scan out of order at key " + to_string(entry.first.first));
+        if (foundPayloads[i] != entry.second) return fail(label + "wrong payload for key " + to_string(entry.first.first));
+        i++;
+    }
+
+    bool threw = false;
+    try {
+        tree.bulkLoad({{1, RID{1, 1}}});
+    } catch (const runtime_error&) {
+        threw = true;
+    }
+    if (!threw) return fail(label + "bulk load into a non-empty tree succeeded");
+    return true;
+}
+
+static vector<string> makeRow(Key key) { return {to_string(key), string(20 + key % 50, 'a' + key % 26)}; }
+
+static bool matches(TableFile& table, const map<Key, vector<string>>& reference, const string& phase) {
+    vector<vector<string>> rows = table.scanAll();
+    if (rows.size() != reference.size()) return fail(phase + ": scan found " + to_string(rows.size()) + " rows");
+    vector<vector<string>> ranged = table.rangeQuery(-10, 1 << 30);
+    if (ranged.size() != reference.size()) return fail(phase + ": index has " + to_string(ranged.size()) + " rows");
+    size_t i = 0;
+    for (const auto& entry : reference)
+        if (ranged[i++] != entry.second) return fail(phase + ": wrong row for key " + to_string(entry.first));
+    return true;
+}
+
+static bool loadTable() {
+    removeTable();
+    map<Key, vector<string>> reference;
+    vector<vector<string>> rows;
+    {
+        TableFile table(TABLE);
+        // Into an empty table the index is built bottom-up
+        for (Key key = 0; key < ROWS; key++) {
+            reference[key * 2] = makeRow(key * 2);
+            rows.push_back(reference[key * 2]);
+        }
+        shuffle(rows.begin(), rows.end(), mt19937(4));
+        vector<RID> rids = table.bulkInsert(rows);
+        if (rids.size() != rows.size()) return fail("Empty table: " + to_string(rids.size()) + " RIDs");
+        if (table.getRow(rids[17]) != rows[17]) return fail("Empty table: a RID names the wrong row");
+        if (!matches(table, reference, "Empty table")) return false;
+        uint32_t fullPages = table.getBufferPoolStats().writebacks;
+
+        // Into a populated one the index takes inserts; half-full pages take twice as many
+        rows.clear();
+        for (Key key = 0; key < ROWS; key++) {
+            reference[key * 2 + 1] = makeRow(key * 2 + 1);
+            rows.push_back(reference[key * 2 + 1]);
+        }
+        table.bulkInsert(rows, 0.5);
+        uint32_t halfPages = table.getBufferPoolStats().writebacks - fullPages;
+        if (halfPages < fullPages * 3 / 2) return fail("Half-full pages: " + to_string(halfPages) + " pages for " +
+                                                       to_string(fullPages) + " full ones");
+        if (!matches(table, reference, "Populated table")) return false;
+        table.insertRow(makeRow(-1));
+        reference[-1] = makeRow(-1);
+    }
+    TableFile reopened(TABLE);
+    return matches(reopened, reference, "Reopened table");
+}
+
+int main() {
+    try {
+        for (double fillFactor : {1.0, 0.7, 0.5})
+            for (bool duplicates : {false, true})
+                if (!loadTree(fillFactor, duplicates)) return 1;
+        if (!loadTable()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "bulk load ok\n";
+    remove(INDEX.c_str());
+    removeTable();
+    return 0;
+}
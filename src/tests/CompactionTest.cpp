@@ -0,0 +1,189 @@
+//Correctness test for node page recycling and index compaction.
+//Pages freed by merges must go on the free list, survive a reopen and be
+//taken by new nodes before the file grows. Compaction must then rewrite the
+//tree into a smaller file with no free pages and the same entries, while
+//other threads keep searching it, and the tree must go on taking changes.
+//A table's primary and secondary indexes are compacted the same way. Exits
+//non-zero on any mismatch or error.
+//
+//Built by CMake as compaction_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/CompactionTest.cpp storage/*.cpp index/*.cpp -o compaction_test -lpthread
+//  ./compaction_test
+#include <iostream>
+#include <set>
+#include <map>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <sys/stat.h>
+#include "storage/TableFile.h"
+
+using namespace std;
+
+constexpr int ORDER = 16;
+constexpr int KEYS = 40000;
+constexpr int READERS = 2;      // threads searching during compaction
+constexpr int ROWS = 20000;
+
+static const string INDEX = "compaction_test.db";
+static const string TABLE = "compaction_test_table.db";
+
+static bool fail(const string& what) {
+    cerr << what << "\n";
+    return false;
+}
+
+static void removeTable() {
+    for (string suffix : {"", "_index.db", "_fsm.db", "_wal.log", "_schema.db", "_indexes.db", "_index_1.db"})
+        remove((TABLE + suffix).c_str());
+}
+
+static uint64_t fileSize(const string& path) {
+    struct stat st{};
+    stat(path.c_str(), &st);
+    return st.st_size;
+}
+
+static RID ridOf(Key key) { return RID{static_cast<uint32_t>(key), static_cast<uint16_t>(key % 5)}; }
+
+static bool matches(BPlusTree& tree, const set<Key>& reference, const string& phase) {
+    vector<RID> rids = tree.rangeScan(0, 2 * KEYS);
+    if (rids.size() != reference.size()) return fail(phase + ": scan found " + to_string(rids.size()) + " entries");
+    size_t i = 0;
+    for (Key key : reference) {
+        if (rids[i++].pageID != ridOf(key).pageID) return fail(phase + ": scan out of order at " + to_string(key));
+        RID rid;
+        if (key % 17 == 0 && !tree.search(key, rid)) return fail(phase + ": search of " + to_string(key));
+    }
+    return true;
+}
+
+static bool recycling() {
+    remove(INDEX.c_str());
+    set<Key> reference;
+    mt19937 rng(2);
+    uint64_t fullSize;
+    uint32_t freed;
+    {
+        BPlusTree tree(ORDER, INDEX);
+        for (Key key = 0; key < KEYS; key++) {
+            tree.insert(key, ridOf(key));
+            reference.insert(key);
+        }
+        fullSize = fileSize(INDEX);
+        if (tree.getFreeNodeCount() != 0) return fail("Free pages before any delete");
+
+        // Whole key ranges go, so their leaves merge away
+        for (Key key = 0; key < KEYS; key++) {
+            if (key % 1000 < 800) {
+                tree.remove(key);
+                reference.erase(key);
+            }
+        }
+        freed = tree.getFreeNodeCount();
+        if (freed < KEYS * 8 / 10 / ORDER) return fail("Only " + to_string(freed) + " pages freed");
+        if (!matches(tree, reference, "Deleted")) return false;
+    }
+
+    BPlusTree tree(ORDER, INDEX);
+    if (tree.getFreeNodeCount() != freed) return fail("Free list lost on reopen: " + to_string(tree.getFreeNodeCount()));
+    // New keys in the emptied ranges take the freed pages
+    for (Key key = 0; key < KEYS; key++) {
+        if (key % 1000 < 800 && key % 2 == 0) {
+            tree.insert(key, ridOf(key));
+            reference.insert(key);
+        }
+    }
+    if (fileSize(INDEX) > fullSize) return fail("File grew from " + to_string(fullSize) + " to " + to_string(fileSize(INDEX)));
+    if (tree.getFreeNodeCount() >= freed) return fail("Freed pages not reused");
+    if (!matches(tree, reference, "Reused")) return false;
+
+    for (Key key = 0; key < KEYS; key++) {
+        if (reference.count(key) && rng() % 4) {
+            tree.remove(key);
+            reference.erase(key);
+        }
+    }
+
+    // Readers keep searching while the tree is rewritten under them
+    uint64_t sparseSize = fileSize(INDEX);
+    atomic<bool> done{false}, wrong{false};
+    vector<thread> readers;
+    for (int r = 0; r < READERS; r++)
+        readers.emplace_back([&, r] {
+            mt19937 local(r);
+            vector<Key> keys(reference.begin(), reference.end());
+            while (!done) {
+                Key key = keys[local() % keys.size()];
+                RID rid;
+                if (!tree.search(key, rid) || rid.pageID != ridOf(key).pageID) wrong = true;
+            }
+        });
+    tree.compactIndex();
+    done = true;
+    for (auto& reader : readers) reader.join();
+    if (wrong) return fail("A search during compaction went wrong");
+    if (tree.getFreeNodeCount() != 0) return fail("Compacted tree has free pages");
+    if (fileSize(INDEX) * 2 > sparseSize)
+        return fail("Compaction shrank the file only from " + to_string(sparseSize) + " to " + to_string(fileSize(INDEX)));
+    if (!matches(tree, reference, "Compacted")) return false;
+
+    for (Key key = KEYS; key < KEYS + 2000; key++) {
+        tree.insert(key, ridOf(key));
+        reference.insert(key);
+    }
+    if (!matches(tree, reference, "Compacted and grown")) return false;
+    BPlusTree reopened(ORDER, INDEX);
+    return matches(reopened, reference, "Compacted and reopened");
+}
+
+static bool tableIndexes() {
+    removeTable();
+    Schema schema({{"id", ColumnType::INT32, 0, false}, {"cust", ColumnType::INT32, 0, true}});
+    map<Key, vector<string>> reference;
+    {
+        TableFile table(TABLE, schema);
+        table.createIndex(1);
+        for (Key key = 0; key < ROWS; key++) {
+            reference[key] = {to_string(key), to_string(key % 97)};
+            table.insertRow(reference[key]);
+        }
+        for (Key key = 0; key < ROWS; key++) {
+            if (key % 10 < 9) {
+                table.deleteByKey(key);
+                reference.erase(key);
+            }
+        }
+        uint64_t primary = fileSize(TABLE + "_index.db"), secondary = fileSize(TABLE + "_index_1.db");
+        table.compactIndexes();
+        if (fileSize(TABLE + "_index.db") * 2 > primary || fileSize(TABLE + "_index_1.db") * 2 > secondary)
+            return fail("Table indexes did not shrink");
+        if (table.index->getFreeNodeCount() != 0) return fail("Compacted primary index has free pages");
+    }
+    TableFile table(TABLE, schema);
+    vector<vector<string>> ranged = table.rangeQuery(0, ROWS);
+    if (ranged.size() != reference.size()) return fail("Primary index has " + to_string(ranged.size()) + " rows");
+    size_t i = 0;
+    for (const auto& entry : reference)
+        if (ranged[i++] != entry.second) return fail("Primary index lost " + to_string(entry.first));
+    for (int cust = 0; cust < 97; cust += 7) {
+        size_t expected = 0;
+        for (const auto& entry : reference) expected += entry.first % 97 == cust;
+        if (table.findByColumn(1, cust).size() != expected) return fail("Secondary index lost customer " + to_string(cust));
+    }
+    return true;
+}
+
+int main() {
+    try {
+        if (!recycling() || !tableIndexes()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "compaction ok\n";
+    remove(INDEX.c_str());
+    removeTable();
+    return 0;
+}
@@ -0,0 +1,249 @@
+//Correctness test for covering indexes.
+//The primary and a secondary index include columns, NULLs among them, and
+//projected lookups and ranges must return what the heap holds through
+//inserts, updates, deletes and a bulk insert, without reading a single
+//heap page when the index covers the projection. A cursor must keep going
+//while its index is rebuilt with other columns, bad included columns must
+//be refused, and the included values must survive crashes and a reopen.
+//Exits non-zero on any mismatch or error.
+//
+//Built by CMake as covering_index_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/CoveringIndexTest.cpp storage/*.cpp index/*.cpp -o covering_index_test -lpthread
+//  ./covering_index_test
+#include <iostream>
+#include <map>
+#include <set>
+#include <random>
+#include <functional>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "storage/TableFile.h"
+
+using namespace std;
+
+constexpr int ROWS = 5000;
+constexpr int BULK_ROWS = 2000;
+constexpr int CUSTOMERS = 50;        // values of the secondary index column
+constexpr int ROUNDS = 3;            // crashes
+constexpr int OPS_PER_ROUND = 1200;  // committed operations before each crash
+
+using Reference = map<Key, vector<string>>;
+
+static const string TABLE = "covering_index_test.db";
+
+static void removeTable() {
+    for (string suffix : {"", "_index.db", "_fsm.db", "_wal.log", "_schema.db", "_indexes.db", "_index_1.db"})
+        remove((TABLE + suffix).c_str());
+}
+
+static Schema tableSchema() {
+    return Schema({{"id", ColumnType::INT32, 0, false},
+                   {"cust", ColumnType::INT32, 0, true},
+                   {"code", ColumnType::CHAR, 4, true},
+                   {"total", ColumnType::INT64, 0, true},
+                   {"note", ColumnType::VARCHAR, 1000, true}});
+}
+
+static vector<string> makeRow(Key key, int variant, size_t noteLength) {
+    int cust = (key + variant) % CUSTOMERS;
+    return {to_string(key), (key + variant) % 9 == 0 ? "" : to_string(cust),
+            (key + variant) % 7 == 0 ? "" : "c" + to_string((key + variant) % 100),
+            to_string(int64_t(key + variant) * 1000003), string(noteLength, 'a' + key % 26)};
+}
+
+static bool fail(const string& phase, const string& what) {
+    cerr << phase << ": " << what << "\n";
+    return false;
+}
+
+static vector<string> project(const vector<string>& row, const vector<size_t>& projection) {
+    vector<string> out;
+    for (size_t column : projection) out.push_back(row[column]);
+    return out;
+}
+
+static uint64_t heapFetches(TableFile& table) {
+    BufferPoolStats stats = table.getBufferPoolStats();
+    return stats.hits + stats.misses;
+}
+
+static bool check(TableFile& table, const Reference& reference, const string& phase) {
+    vector<size_t> primary{0, 2, 1, 3}, secondary{3, 1, 2};
+    Key low = reference.begin()->first, high = reference.rbegin()->first;
+    uint64_t fetches = heapFetches(table);
+
+    vector<vector<string>> covered = table.rangeQuery(low, high, primary);
+    if (covered.size() != reference.size()) return fail(phase, "covered range found " + to_string(covered.size()) + " rows");
+    size_t i = 0;
+    for (const auto& entry : reference) {
+        if (covered[i++] != project(entry.second, primary))
+            return fail(phase, "covered columns differ for " + to_string(entry.first));
+        if (entry.first % 13 == 0 && table.findByKey(entry.first, primary) != project(entry.second, primary))
+            return fail(phase, "covered lookup of " + to_string(entry.first));
+    }
+    for (int cust = 0; cust < CUSTOMERS; cust += 3) {
+        // Without the id, rows of one customer are compared as a multiset
+        multiset<vector<string>> expected;
+        for (const auto& entry : reference)
+            if (entry.second[1] == to_string(cust)) expected.insert(project(entry.second, secondary));
+        vector<vector<string>> rows = table.findByColumn(1, cust, secondary);
+        if (expected != multiset<vector<string>>(rows.begin(), rows.end()))
+            return fail(phase, "covered secondary lookup of customer " + to_string(cust));
+    }
+    size_t inRange = 0;
+    for (const auto& entry : reference)
+        inRange += !entry.second[1].empty() && stoi(entry.second[1]) >= 10 && stoi(entry.second[1]) <= 19;
+    if (table.rangeQueryByColumn(1, 10, 19, secondary).size() != inRange) return fail(phase, "covered secondary range");
+    if (heapFetches(table) != fetches)
+        return fail(phase, "covered queries read " + to_string(heapFetches(table) - fetches) + " heap pages");
+
+    // The note is not included, so these go to the heap and must agree
+    vector<size_t> uncovered{4, 0};
+    vector<vector<string>> fetched = table.rangeQuery(low, high, uncovered);
+    i = 0;
+    for (const auto& entry : reference)
+        if (fetched[i++] != project(entry.second, uncovered))
+            return fail(phase, "uncovered projection differs for " + to_string(entry.first));
+    return true;
+}
+
+static bool maintenance() {
+    removeTable();
+    Reference reference;
+    mt19937 rng(7);
+    TableFile* table = new TableFile(TABLE, tableSchema());
+    table->createIndex(1, {3, 2});
+    table->setIncludedColumns(0, {1, 2, 3});
+    if (table->getIncludedColumns(0) != vector<size_t>{1, 2, 3}) return fail("create", "included columns not kept");
+    for (size_t bad : {size_t(4), size_t(9)}) {
+        bool threw = false;
+        try {
+            table->setIncludedColumns(0, {bad});
+        } catch (const exception&) {
+            threw = true;
+        }
+        if (!threw) return fail("create", "column " + to_string(bad) + " included");
+    }
+
+    for (Key key = 0; key < ROWS; key++) {
+        reference[key] = makeRow(key, 0, rng() % 30);
+        table->insertRow(reference[key]);
+    }
+    if (!check(*table, reference, "insert")) return false;
+
+    // Included values change with the row, forwarded or not
+    for (Key key = 0; key < ROWS; key += 3) {
+        reference[key] = makeRow(key, 1 + rng() % 40, key % 2 ? 900 : rng() % 30);
+        table->updateRow(key, reference[key]);
+    }
+    for (Key key = 1; key < ROWS; key += 97) {
+        vector<string> row = reference[key];
+        row[0] = to_string(key + 100000);
+        table->updateRow(key, row);
+        reference.erase(key);
+        reference[key + 100000] = row;
+    }
+    for (Key key = 2; key < ROWS; key += 5) {
+        if (!reference.count(key)) continue;
+        table->deleteByKey(key);
+        reference.erase(key);
+    }
+    if (!check(*table, reference, "update")) return false;
+
+    vector<vector<string>> bulk;
+    for (Key key = 200000; key < 200000 + BULK_ROWS; key++) {
+        reference[key] = makeRow(key, 0, rng() % 30);
+        bulk.push_back(reference[key]);
+    }
+    table->bulkInsert(bulk);
+    if (!check(*table, reference, "bulk insert")) return false;
+
+    // A cursor keeps going while the primary index is rebuilt under it
+    IndexRangeCursor cursor = table->openRange(0, 300000, 50);
+    vector<vector<string>> page, streamed;
+    cursor.next(page);
+    streamed = page;
+    table->setIncludedColumns(0, {2});
+    while (cursor.next(page)) streamed.insert(streamed.end(), page.begin(), page.end());
+    if (streamed.size() != reference.size()) return fail("rebuild", "cursor found " + to_string(streamed.size()) + " rows");
+    size_t i = 0;
+    for (const auto& entry : reference)
+        if (streamed[i++] != entry.second) return fail("rebuild", "cursor returned a wrong row for " + to_string(entry.first));
+    table->setIncludedColumns(0, {1, 2, 3});
+
+    delete table;
+    TableFile reopened(TABLE);
+    if (reopened.getIncludedColumns(0) != vector<size_t>{1, 2, 3} || reopened.getIncludedColumns(1) != vector<size_t>{3, 2})
+        return fail("reopen", "included columns forgotten");
+    return check(reopened, reference, "reopen");
+}
+
+// The operations of one crash round. With a table they are applied to it
+// too; the reference alone is how the parent learns what the child committed.
+static void runOps(TableFile* table, Reference& reference, int round) {
+    mt19937 rng(round + 21);
+    for (int op = 0; op < OPS_PER_ROUND; op++) {
+        Key key = rng() % ROWS;
+        vector<string> row = makeRow(key, rng() % 100, rng() % 40);
+        auto it = reference.find(key);
+        if (it == reference.end()) {
+            if (table) table->insertRow(row);
+            reference[key] = row;
+        } else if (rng() % 3) {
+            if (table) table->updateRow(key, row);
+            it->second = row;
+        } else {
+            if (table) table->deleteByKey(key);
+            reference.erase(it);
+        }
+        // The last few hundred operations of a round are only in the log
+        if (table && op % 500 == 499) table->checkpoint();
+    }
+}
+
+static bool crash(const function<void()>& work) {
+    pid_t child = fork();
+    if (child == 0) {
+        try {
+            work();
+        } catch (const exception& e) {
+            cerr << e.what() << "\n";
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Continues from the table maintenance() left
+static bool crashes() {
+    Reference reference;
+    {
+        TableFile table(TABLE);
+        for (const auto& row : table.scanAll()) reference[stoi(row[0])] = row;
+    }
+    for (int round = 0; round < ROUNDS; round++) {
+        string phase = "crash " + to_string(round);
+        // Never closed, so nothing is flushed beyond what commits wrote
+        if (!crash([&] { runOps(new TableFile(TABLE), reference, round); })) return fail(phase, "the child failed");
+        runOps(nullptr, reference, round);
+        TableFile table(TABLE);
+        if (!check(table, reference, phase)) return false;
+    }
+    return true;
+}
+
+int main() {
+    try {
+        if (!maintenance() || !crashes()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "covering index ok\n";
+    removeTable();
+    return 0;
+}
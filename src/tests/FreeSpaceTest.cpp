@@ -0,0 +1,158 @@
+//Correctness test for the free space map and heap space reuse.
+//The map must always answer with the lowest page whose bucket holds the
+//requested bytes, across search blocks, after random updates, a flush and
+//a reopen. A table whose rows are deleted must take new rows into the
+//space they left, compacting pages to fit rows larger than any single
+//hole, instead of growing its file, also after it is reopened. Exits
+//non-zero on any mismatch or error.
+//
+//Built by CMake as free_space_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/FreeSpaceTest.cpp storage/*.cpp index/*.cpp -o free_space_test -lpthread
+//  ./free_space_test
+#include <iostream>
+#include <map>
+#include <random>
+#include <cstdio>
+#include <sys/stat.h>
+#include "storage/TableFile.h"
+
+using namespace std;
+
+constexpr uint32_t MAP_PAGES = 3000;  // spans several search blocks
+constexpr int QUERIES = 2000;
+constexpr int ROWS = 3000;
+constexpr size_t SMALL_ROW = 100;     // bytes of filler in the first rows
+constexpr size_t LARGE_ROW = 150;     // larger than the hole one small row leaves
+
+static const string MAP = "free_space_test_fsm.db";
+static const string TABLE = "free_space_test.db";
+
+static bool fail(const string& what) {
+    cerr << what << "\n";
+    return false;
+}
+
+static void removeTable() {
+    for (string suffix : {"", "_index.db", "_fsm.db", "_wal.log"})
+        remove((TABLE + suffix).c_str());
+}
+
+static uint64_t fileSize(const string& path) {
+    struct stat st{};
+    stat(path.c_str(), &st);
+    return st.st_size;
+}
+
+// The lowest page recorded with at least bytes free, as findPage rounds
+static uint32_t expectedPage(const vector<uint32_t>& freeBytes, uint32_t bytes) {
+    uint32_t needed = (bytes + FSM_BUCKET_BYTES - 1) / FSM_BUCKET_BYTES;
+    for (uint32_t page = 0; page < freeBytes.size(); page++)
+        if (min<uint32_t>(freeBytes[page] / FSM_BUCKET_BYTES, UINT8_MAX) >= needed) return page;
+    return INVALID_PAGE;
+}
+
+static bool searches(FreeSpaceMap& map, const vector<uint32_t>& freeBytes, mt19937& rng, const string& phase) {
+    for (int q = 0; q < QUERIES; q++) {
+        uint32_t bytes = rng() % PAGE_SIZE;
+        if (map.findPage(bytes) != expectedPage(freeBytes, bytes))
+            return fail(phase + ": wrong page for " + to_string(bytes) + " bytes");
+    }
+    return true;
+}
+
+static bool mapSearch() {
+    remove(MAP.c_str());
+    mt19937 rng(1);
+    vector<uint32_t> freeBytes(MAP_PAGES);
+    {
+        FreeSpaceMap map(MAP);
+        // Mostly full pages, so the answers are spread over the blocks
+        for (uint32_t page = 0; page < MAP_PAGES; page++) {
+            freeBytes[page] = rng() % 8 == 0 ? rng() % PAGE_SIZE : rng() % 200;
+            map.update(page, freeBytes[page]);
+        }
+        if (!searches(map, freeBytes, rng, "Map")) return false;
+        // Shrinking the largest page of a block must lower what the block offers
+        for (int i = 0; i < 5000; i++) {
+            uint32_t page = rng() % MAP_PAGES;
+            freeBytes[page] = rng() % 3 == 0 ? rng() % PAGE_SIZE : 0;
+            map.update(page, freeBytes[page]);
+        }
+        if (!searches(map, freeBytes, rng, "Updated map")) return false;
+        map.flush();
+    }
+    FreeSpaceMap map(MAP);
+    if (map.getNumPages() != MAP_PAGES) return fail("Reopened map has " + to_string(map.getNumPages()) + " pages");
+    if (!searches(map, freeBytes, rng, "Reopened map")) return false;
+    map.clear();
+    if (map.getNumPages() != 0 || map.findPage(1) != INVALID_PAGE) return fail("Cleared map still has pages");
+    return true;
+}
+
+static vector<string> makeRow(Key key, size_t filler) { return {to_string(key), string(filler, 'a' + key % 26)}; }
+
+static bool matches(TableFile& table, const map<Key, vector<string>>& reference, const string& phase) {
+    vector<vector<string>> rows = table.scanAll();
+    if (rows.size() != reference.size()) return fail(phase + ": scan found " + to_string(rows.size()) + " rows");
+    for (const auto& row : rows) {
+        auto it = reference.find(stoi(row[0]));
+        if (it == reference.end() || it->second != row) return fail(phase + ": wrong row " + row[0]);
+    }
+    return true;
+}
+
+static bool heapReuse() {
+    removeTable();
+    map<Key, vector<string>> reference;
+    uint64_t size;
+    {
+        TableFile table(TABLE);
+        for (Key key = 0; key < ROWS; key++) {
+            reference[key] = makeRow(key, SMALL_ROW);
+            table.insertRow(reference[key]);
+        }
+        table.checkpoint();
+        size = fileSize(TABLE);
+
+        // Every other row goes, leaving holes too small for the larger rows
+        for (Key key = 0; key < ROWS; key += 2) {
+            table.deleteByKey(key);
+            reference.erase(key);
+        }
+        for (Key key = ROWS; key < ROWS + ROWS / 4; key++) {
+            reference[key] = makeRow(key, LARGE_ROW);
+            table.insertRow(reference[key]);
+        }
+        table.checkpoint();
+        if (fileSize(TABLE) != size) return fail("Deleted space not reused: the heap grew by " +
+                                                 to_string(fileSize(TABLE) - size) + " bytes");
+        if (!matches(table, reference, "Reuse")) return false;
+
+        for (Key key = 1; key < ROWS; key += 4) {
+            table.deleteByKey(key);
+            reference.erase(key);
+        }
+    }
+    // The space freed before closing is found again through the saved map
+    TableFile table(TABLE);
+    for (Key key = 2 * ROWS; key < 2 * ROWS + ROWS / 8; key++) {
+        reference[key] = makeRow(key, LARGE_ROW);
+        table.insertRow(reference[key]);
+    }
+    table.checkpoint();
+    if (fileSize(TABLE) != size) return fail("Reopened table grew by " + to_string(fileSize(TABLE) - size) + " bytes");
+    return matches(table, reference, "Reopened");
+}
+
+int main() {
+    try {
+        if (!mapSearch() || !heapReuse()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "free space ok\n";
+    remove(MAP.c_str());
+    removeTable();
+    return 0;
+}
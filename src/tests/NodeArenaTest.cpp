@@ -0,0 +1,145 @@
+//Correctness test for the node slab allocator.
+//Blocks must be aligned, must not overlap, and must be carved out of slabs
+//only when no released block is left to reuse, also when threads allocate
+//and release at once. A tree kept fully in memory must give the nodes it
+//merges away back to its arenas and build new nodes out of them, so a
+//delete-heavy workload does not grow its memory. Exits non-zero on any
+//mismatch or error.
+//
+//Built by CMake as node_arena_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/NodeArenaTest.cpp index/*.cpp -o node_arena_test -lpthread
+//  ./node_arena_test
+#include <iostream>
+#include <set>
+#include <random>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+#include "index/NodeArena.h"
+#include "index/BPlusTree.h"
+
+using namespace std;
+
+constexpr size_t BLOCK_BYTES = 100;  // not a multiple of the alignment
+constexpr size_t BLOCKS = 10000;     // several slabs' worth
+constexpr int THREADS = 4;
+constexpr int THREAD_STEPS = 20000;
+constexpr int ORDER = 16;
+constexpr size_t CACHE_NODES = 100000; // the whole tree stays in memory
+constexpr int KEYS = 60000;
+
+static const string INDEX = "node_arena_test.db";
+
+static bool fail(const string& what) {
+    cerr << what << "\n";
+    return false;
+}
+
+static bool slabs() {
+    NodeArena arena(BLOCK_BYTES);
+    size_t block = arena.getBlockSize();
+    if (block < BLOCK_BYTES || block % alignof(max_align_t) != 0) return fail("Block size " + to_string(block));
+    if (arena.reservedBytes() != 0) return fail("Empty arena holds memory");
+
+    vector<char*> blocks;
+    for (size_t i = 0; i < BLOCKS; i++) {
+        char* b = static_cast<char*>(arena.allocate());
+        if (reinterpret_cast<uintptr_t>(b) % alignof(max_align_t) != 0) return fail("Unaligned block");
+        memset(b, static_cast<int>(i % 251), block);
+        blocks.push_back(b);
+    }
+    // Overlapping blocks would have overwritten each other's pattern
+    for (size_t i = 0; i < BLOCKS; i++)
+        for (size_t j = 0; j < block; j++)
+            if (static_cast<unsigned char>(blocks[i][j]) != i % 251) return fail("Blocks overlap");
+    size_t slabBytes = NODE_SLAB_BYTES / block * block;
+    size_t reserved = arena.reservedBytes();
+    if (reserved % slabBytes != 0 || reserved < BLOCKS * block || reserved >= BLOCKS * block + slabBytes)
+        return fail("Reserved " + to_string(reserved) + " bytes for " + to_string(BLOCKS) + " blocks");
+    if (arena.liveBlocks() != BLOCKS) return fail("Live blocks " + to_string(arena.liveBlocks()));
+
+    // Released blocks are handed out again before any new slab is opened
+    set<char*> released;
+    for (size_t i = 0; i < BLOCKS; i += 2) {
+        arena.release(blocks[i]);
+        released.insert(blocks[i]);
+    }
+    if (arena.liveBlocks() != BLOCKS / 2) return fail("Live blocks after release " + to_string(arena.liveBlocks()));
+    for (size_t i = 0; i < BLOCKS; i += 2) {
+        char* b = static_cast<char*>(arena.allocate());
+        if (!released.erase(b)) return fail("Block not taken from the released ones");
+    }
+    if (arena.reservedBytes() != reserved) return fail("Reuse opened a new slab");
+
+    // Threads allocating and releasing at once get distinct blocks
+    atomic<bool> shared{false};
+    vector<thread> threads;
+    for (int t = 0; t < THREADS; t++)
+        threads.emplace_back([&, t] {
+            mt19937 rng(t);
+            vector<char*> mine;
+            for (int step = 0; step < THREAD_STEPS; step++) {
+                if (!mine.empty() && rng() % 2) {
+                    char* b = mine.back();
+                    mine.pop_back();
+                    if (static_cast<unsigned char>(b[0]) != t) shared = true;
+                    arena.release(b);
+                } else {
+                    mine.push_back(static_cast<char*>(arena.allocate()));
+                    mine.back()[0] = static_cast<char>(t);
+                }
+            }
+            for (char* b : mine) arena.release(b);
+        });
+    for (auto& th : threads) th.join();
+    if (shared) return fail("A block was handed to two threads");
+    if (arena.liveBlocks() != BLOCKS) return fail("Live blocks after threads " + to_string(arena.liveBlocks()));
+    return true;
+}
+
+static bool treeMemory() {
+    remove(INDEX.c_str());
+    BPlusTree tree(ORDER, INDEX, CACHE_NODES);
+    mt19937 rng(1);
+    vector<Key> keys(KEYS);
+    for (int i = 0; i < KEYS; i++) keys[i] = i;
+    shuffle(keys.begin(), keys.end(), rng);
+
+    for (Key key : keys) tree.insert(key, RID{static_cast<uint32_t>(key), 0});
+    TreeMemoryStats full = tree.getMemoryStats();
+    if (full.liveNodes < static_cast<size_t>(KEYS / ORDER)) return fail("Only " + to_string(full.liveNodes) + " nodes live");
+    if (full.usedBytes > full.reservedBytes) return fail("More bytes used than reserved");
+
+    for (int round = 0; round < 3; round++) {
+        shuffle(keys.begin(), keys.end(), rng);
+        for (int i = 0; i < KEYS - 100; i++)
+            if (!tree.remove(keys[i])) return fail("Cannot remove " + to_string(keys[i]));
+        TreeMemoryStats emptied = tree.getMemoryStats();
+        if (emptied.liveNodes * 20 > full.liveNodes)
+            return fail("Merged nodes still live: " + to_string(emptied.liveNodes) + " of " + to_string(full.liveNodes));
+        for (int i = 0; i < KEYS - 100; i++) tree.insert(keys[i], RID{static_cast<uint32_t>(keys[i]), 0});
+        TreeMemoryStats refilled = tree.getMemoryStats();
+        if (refilled.reservedBytes > full.reservedBytes + 2 * NODE_SLAB_BYTES)
+            return fail("Round " + to_string(round) + ": arenas grew from " + to_string(full.reservedBytes) + " to " +
+                        to_string(refilled.reservedBytes) + " bytes");
+    }
+    vector<RID> rids = tree.rangeScan(0, KEYS);
+    if (rids.size() != static_cast<size_t>(KEYS)) return fail("Scan found " + to_string(rids.size()) + " entries");
+    for (int i = 0; i < KEYS; i++)
+        if (rids[i].pageID != static_cast<uint32_t>(i)) return fail("Scan out of order at " + to_string(i));
+    return true;
+}
+
+int main() {
+    try {
+        if (!slabs() || !treeMemory()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "node arena ok\n";
+    remove(INDEX.c_str());
+    return 0;
+}
@@ -0,0 +1,98 @@
+//Correctness test for lazy node loading through the node cache.
+//A tree many times larger than its cache takes random inserts and removes,
+//and the cache must stay within its capacity while every operation still
+//sees the right entries. Reopened, the tree loads only its root, a lookup
+//loads one node per level, and every key and a full scan come back right
+//through the same small cache. Exits non-zero on any mismatch or error.
+//
+//Built by CMake as node_cache_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/NodeCacheTest.cpp index/*.cpp -o node_cache_test -lpthread
+//  ./node_cache_test
+#include <iostream>
+#include <set>
+#include <random>
+#include <cstdio>
+#include "index/BPlusTree.h"
+
+using namespace std;
+
+constexpr int ORDER = 8;           // small, so the tree has many nodes
+constexpr size_t CACHE_NODES = 32;
+constexpr int STEPS = 40000;       // random operations
+constexpr int KEY_SPACE = 20000;
+
+static const string INDEX = "node_cache_test.db";
+
+static bool fail(const string& what) {
+    cerr << what << "\n";
+    return false;
+}
+
+static RID ridOf(Key key) { return RID{static_cast<uint32_t>(key), static_cast<uint16_t>(key % 7)}; }
+
+// An operation loads at most a path and the siblings it splits or merges with
+static bool cacheBounded(BPlusTree& tree) {
+    size_t limit = CACHE_NODES + 4 * tree.getHeight();
+    if (tree.getCachedNodeCount() <= limit) return true;
+    return fail("Cache holds " + to_string(tree.getCachedNodeCount()) + " nodes, more than " + to_string(limit));
+}
+
+static bool matches(BPlusTree& tree, const set<Key>& reference) {
+    for (Key key = 0; key < KEY_SPACE; key++) {
+        RID rid;
+        bool found = tree.search(key, rid);
+        if (found != (reference.count(key) > 0)) return fail("Search of " + to_string(key) + " is wrong");
+        if (found && (rid.pageID != ridOf(key).pageID || rid.slotID != ridOf(key).slotID))
+            return fail("Search of " + to_string(key) + " found the wrong RID");
+        if (key % 1000 == 0 && !cacheBounded(tree)) return false;
+    }
+    vector<RID> rids = tree.rangeScan(0, KEY_SPACE);
+    if (rids.size() != reference.size()) return fail("Scan found " + to_string(rids.size()) + " entries");
+    size_t i = 0;
+    for (Key key : reference)
+        if (rids[i++].pageID != ridOf(key).pageID) return fail("Scan out of order at " + to_string(key));
+    return cacheBounded(tree);
+}
+
+static bool run() {
+    set<Key> reference;
+    {
+        BPlusTree tree(ORDER, INDEX, CACHE_NODES);
+        mt19937 rng(5);
+        for (int step = 0; step < STEPS; step++) {
+            Key key = rng() % KEY_SPACE;
+            if (reference.count(key)) {
+                if (rng() % 3 == 0) continue;
+                if (!tree.remove(key)) return fail("Cannot remove " + to_string(key));
+                reference.erase(key);
+            } else {
+                tree.insert(key, ridOf(key));
+                reference.insert(key);
+            }
+            if (step % 1000 == 0 && !cacheBounded(tree)) return false;
+        }
+        if (tree.getHeight() < 4) return fail("Tree too shallow to test the cache");
+        if (!matches(tree, reference)) return false;
+    }
+
+    BPlusTree reopened(ORDER, INDEX, CACHE_NODES);
+    if (reopened.getCachedNodeCount() > 1) return fail("Opening loaded " + to_string(reopened.getCachedNodeCount()) + " nodes");
+    RID rid;
+    reopened.search(*reference.begin(), rid);
+    if (reopened.getCachedNodeCount() > static_cast<size_t>(reopened.getHeight()))
+        return fail("One lookup loaded " + to_string(reopened.getCachedNodeCount()) + " nodes");
+    return matches(reopened, reference);
+}
+
+int main() {
+    remove(INDEX.c_str());
+    try {
+        if (!run()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "node cache ok\n";
+    remove(INDEX.c_str());
+    return 0;
+}
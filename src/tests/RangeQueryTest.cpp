@@ -0,0 +1,167 @@
+//Correctness test for index range queries and their read-ahead.
+//A table is filled in random key order, so key ranges jump between heap
+//pages, and ranges below and above BITMAP_SCAN_ROWS, empty and inverted
+//ones included, must return their rows in key order, also once rows are
+//forwarded and deleted. With a buffer pool far smaller than the heap, a
+//range over the whole table must read each heap page about once. Trees
+//with a small node cache must return the same entries from rangeScan,
+//visitRange and cursors of any batch size. Exits non-zero on any mismatch
+//or error.
+//
+//Built by CMake as range_query_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/RangeQueryTest.cpp storage/*.cpp index/*.cpp -o range_query_test -lpthread
+//  ./range_query_test
+#include <iostream>
+#include <map>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <sys/stat.h>
+#include "storage/TableFile.h"
+
+using namespace std;
+
+constexpr int ROWS = 20000;
+constexpr size_t POOL_FRAMES = 16;   // far fewer than the heap's pages
+constexpr int KEYS = 40000;          // tree entries, on even keys
+constexpr size_t CACHE_NODES = 16;
+
+static const string TABLE = "range_query_test.db";
+static const string INDEX = "range_query_test_index.db";
+
+static bool fail(const string& what) {
+    cerr << what << "\n";
+    return false;
+}
+
+static void removeTable() {
+    for (string suffix : {"", "_index.db", "_fsm.db", "_wal.log"})
+        remove((TABLE + suffix).c_str());
+}
+
+static uint64_t fileSize(const string& path) {
+    struct stat st{};
+    stat(path.c_str(), &st);
+    return st.st_size;
+}
+
+static vector<string> makeRow(Key key, size_t noteLength) { return {to_string(key), string(noteLength, 'a' + key % 26)}; }
+
+static bool ranges(TableFile& table, const map<Key, vector<string>>& reference, const string& phase) {
+    vector<pair<Key, Key>> bounds = {{5, 5}, {100, 99}, {-50, -1}, {0, 60}, {1000, 1061}, {1000, 1062},
+                                     {2000, 2063}, {3000, 9000}, {-100, ROWS + 100}};
+    mt19937 rng(bounds.size());
+    for (int i = 0; i < 30; i++) {
+        Key low = rng() % ROWS;
+        bounds.push_back({low, low + rng() % (i < 20 ? 80 : 3000)});
+    }
+    for (const auto& [low, high] : bounds) {
+        string range = phase + ": [" + to_string(low) + ", " + to_string(high) + "]";
+        vector<vector<string>> rows = table.rangeQuery(low, high);
+        auto it = reference.lower_bound(low);
+        size_t i = 0;
+        for (; it != reference.end() && it->first <= high; ++it, ++i)
+            if (i >= rows.size() || rows[i] != it->second) return fail(range + " differs at key " + to_string(it->first));
+        if (i != rows.size()) return fail(range + " returned " + to_string(rows.size()) + " rows, not " + to_string(i));
+
+        // Cursors fetch the same rows a batch at a time
+        size_t batchSize = 1 + rng() % 100;
+        IndexRangeCursor cursor = table.openRange(low, high, batchSize);
+        vector<vector<string>> batch, streamed;
+        while (cursor.next(batch)) {
+            if (batch.size() > batchSize) return fail(range + ": cursor batch of " + to_string(batch.size()));
+            streamed.insert(streamed.end(), batch.begin(), batch.end());
+        }
+        if (streamed != rows) return fail(range + ": cursor differs from the range query");
+    }
+    return true;
+}
+
+static bool tableRanges() {
+    removeTable();
+    map<Key, vector<string>> reference;
+    mt19937 rng(4);
+    {
+        TableFile table(TABLE, POOL_FRAMES);
+        vector<Key> keys(ROWS);
+        for (int i = 0; i < ROWS; i++) keys[i] = i;
+        shuffle(keys.begin(), keys.end(), rng);
+        for (Key key : keys) {
+            reference[key] = makeRow(key, 20 + rng() % 40);
+            table.insertRow(reference[key]);
+        }
+        if (!ranges(table, reference, "Shuffled")) return false;
+        table.checkpoint();
+    }
+
+    // Cold, a full range reads each heap page about once, not once per row
+    {
+        TableFile table(TABLE, POOL_FRAMES);
+        uint64_t heapPages = fileSize(TABLE) / PAGE_SIZE;
+        table.rangeQuery(0, ROWS);
+        BufferPoolStats stats = table.getBufferPoolStats();
+        uint64_t reads = stats.misses + stats.prefetched;
+        if (reads > heapPages + heapPages / 10)
+            return fail("Full range read " + to_string(reads) + " pages of a " + to_string(heapPages) + "-page heap");
+
+        for (Key key = 0; key < ROWS; key += 7) {
+            reference[key] = makeRow(key, 500 + rng() % 500);
+            table.updateRow(key, reference[key]);
+        }
+        for (Key key = 3; key < ROWS; key += 5) {
+            table.deleteByKey(key);
+            reference.erase(key);
+        }
+        if (!ranges(table, reference, "Updated")) return false;
+    }
+    TableFile table(TABLE, POOL_FRAMES);
+    return ranges(table, reference, "Reopened");
+}
+
+static bool treeRanges() {
+    remove(INDEX.c_str());
+    {
+        BPlusTree tree(16, INDEX);
+        for (Key key = 0; key < KEYS; key++) tree.insert(key * 2, RID{static_cast<uint32_t>(key), 0});
+    }
+    // Reopened with a small cache, the scans read leaves ahead from disk
+    BPlusTree tree(16, INDEX, CACHE_NODES);
+    mt19937 rng(6);
+    for (int i = 0; i < 40; i++) {
+        Key low = static_cast<Key>(rng() % (2 * KEYS + 20)) - 10;
+        Key high = low + rng() % (i % 4 == 0 ? 2 * KEYS : 400);
+        string range = "Tree [" + to_string(low) + ", " + to_string(high) + "]";
+        vector<uint32_t> expected;
+        for (Key key = max(low, 0); key <= min(high, 2 * KEYS - 2); key++)
+            if (key % 2 == 0) expected.push_back(key / 2);
+
+        vector<RID> rids = tree.rangeScan(low, high);
+        vector<uint32_t> scanned, visited, streamed;
+        for (const RID& rid : rids) scanned.push_back(rid.pageID);
+        tree.visitRange(low, high, [&](const Key&, const RID& rid, const char*) { visited.push_back(rid.pageID); });
+        // Leaves read ahead are let go once a full scan ends
+        if (tree.getCachedNodeCount() > CACHE_NODES + 4 * tree.getHeight())
+            return fail(range + ": scan left " + to_string(tree.getCachedNodeCount()) + " nodes cached");
+        IndexCursor cursor = tree.openRange(low, high, 1 + rng() % 300);
+        vector<pair<Key, RID>> batch;
+        while (cursor.next(batch))
+            for (const auto& entry : batch) streamed.push_back(entry.second.pageID);
+        if (scanned != expected) return fail(range + ": rangeScan found " + to_string(scanned.size()) + " entries");
+        if (visited != expected) return fail(range + ": visitRange differs");
+        if (streamed != expected) return fail(range + ": cursor differs");
+    }
+    return true;
+}
+
+int main() {
+    try {
+        if (!tableRanges() || !treeRanges()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "range query ok\n";
+    remove(INDEX.c_str());
+    removeTable();
+    return 0;
+}
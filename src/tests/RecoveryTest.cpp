@@ -0,0 +1,135 @@
+//Crash recovery test for the write-ahead log of TableFile.
+//Each round forks a child that opens the table, runs a random mix of
+//inserts, deletes and the occasional checkpoint, and then _exits without
+//closing anything, like a crash. Every change it made was committed, so the
+//parent replays the same operations on a reference map, reopens the table
+//and checks the rows through the heap and the primary index. The last few
+//hundred operations of each round are only in the log, so they come back by
+//redo alone. Some rounds crash right after reopening, to recover twice in a
+//row. Exits non-zero on any mismatch or error.
+//
+//Built by CMake as recovery_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/RecoveryTest.cpp storage/*.cpp index/*.cpp -o recovery_test -lpthread
+//  ./recovery_test
+#include <iostream>
+#include <map>
+#include <random>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "storage/TableFile.h"
+
+using namespace std;
+
+constexpr int ROUNDS = 8;            // crashes
+constexpr int OPS_PER_ROUND = 1500;  // committed operations before each crash
+constexpr int KEY_SPACE = 4000;      // keys are drawn from [0, KEY_SPACE)
+
+using Reference = map<Key, vector<string>>;
+
+static const string TABLE = "recovery_test.db";
+
+static void removeTable() {
+    for (string suffix : {"", "_index.db", "_fsm.db", "_wal.log"})
+        remove((TABLE + suffix).c_str());
+}
+
+static vector<string> makeRow(Key key, mt19937& rng) {
+    return {to_string(key), to_string(rng() % 1000), string(10 + rng() % 40, 'a' + key % 26)};
+}
+
+// The operations of one round. With a table they are applied to it too;
+// the reference alone is how the parent learns what the child committed.
+static void runOps(TableFile* table, Reference& reference, int round) {
+    mt19937 rng(round + 1);
+    for (int op = 0; op < OPS_PER_ROUND; op++) {
+        Key key = rng() % KEY_SPACE;
+        auto it = reference.find(key);
+        if (it == reference.end()) {
+            vector<string> row = makeRow(key, rng);
+            if (table) table->insertRow(row);
+            reference[key] = row;
+        } else {
+            if (table) table->deleteByKey(key);
+            reference.erase(it);
+        }
+        // The last few hundred operations of a round are only in the log
+        if (table && op % 600 == 599) table->checkpoint();
+    }
+}
+
+static bool check(TableFile& table, const Reference& reference, int round) {
+    auto fail = [&](const string& what) {
+        cerr << "Round " << round << ": " << what << "\n";
+        return false;
+    };
+    vector<vector<string>> rows = table.scanAll();
+    if (rows.size() != reference.size()) return fail("scan found " + to_string(rows.size()) + " rows");
+    for (const auto& row : rows) {
+        auto it = reference.find(stoi(row[0]));
+        if (it == reference.end() || it->second != row) return fail("scan found a wrong row " + row[0]);
+    }
+    vector<vector<string>> ranged = table.rangeQuery(0, KEY_SPACE);
+    if (ranged.size() != reference.size()) return fail("primary index has " + to_string(ranged.size()) + " rows");
+    size_t i = 0;
+    for (const auto& entry : reference) {
+        if (ranged[i] != entry.second) return fail("primary index returned a wrong row for " + to_string(entry.first));
+        i++;
+    }
+    // Deleted keys must stay gone from the index too
+    for (Key key = 0; key < KEY_SPACE; key += 13) {
+        bool found = table.visitByKey(key, [](const RowView&) {});
+        if (found != (reference.count(key) > 0)) return fail("lookup of " + to_string(key) + " is wrong");
+    }
+    return true;
+}
+
+static bool crash(const function<void()>& work) {
+    pid_t child = fork();
+    if (child == 0) {
+        try {
+            work();
+        } catch (const exception& e) {
+            cerr << e.what() << "\n";
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main() {
+    removeTable();
+    Reference reference;
+    for (int round = 0; round < ROUNDS; round++) {
+        bool ok = crash([&] {
+            // Never closed, so nothing is flushed beyond what commits wrote
+            TableFile* table = new TableFile(TABLE);
+            runOps(table, reference, round);
+        });
+        if (!ok) {
+            cerr << "Round " << round << ": the child failed\n";
+            return 1;
+        }
+        runOps(nullptr, reference, round);
+        if (round % 3 == 1) {
+            // Recover, then crash again before anything new is logged
+            if (!crash([&] { new TableFile(TABLE); })) {
+                cerr << "Round " << round << ": recovery failed\n";
+                return 1;
+            }
+        }
+        try {
+            TableFile table(TABLE);
+            if (!check(table, reference, round)) return 1;
+        } catch (const exception& e) {
+            cerr << "Round " << round << ": " << e.what() << "\n";
+            return 1;
+        }
+    }
+    cout << ROUNDS << " crashes recovered, " << reference.size() << " rows\n";
+    removeTable();
+    return 0;
+}
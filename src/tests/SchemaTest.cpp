@@ -0,0 +1,192 @@
+//Correctness test for typed schemas and the binary row format.
+//Rows with every column type, NULLs and values at the edges of each type
+//are encoded and read back through RowView, both as text and through the
+//typed getters, and bad schemas and values must be rejected. A typed table
+//whose key is not its first column must return its rows unchanged through
+//scans, lookups and range queries, keep its schema across a reopen and
+//refuse to open with a different one. Exits non-zero on any mismatch or
+//error.
+//
+//Built by CMake as schema_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/SchemaTest.cpp storage/*.cpp index/*.cpp -o schema_test -lpthread
+//  ./schema_test
+#include <iostream>
+#include <map>
+#include <functional>
+#include <climits>
+#include <cstdlib>
+#include <cstdio>
+#include "storage/TableFile.h"
+
+using namespace std;
+
+constexpr int ROWS = 4000;
+constexpr uint16_t CODE_LENGTH = 6;   // CHAR width
+constexpr uint16_t NAME_LENGTH = 300; // VARCHAR maximum
+
+static const string TABLE = "schema_test.db";
+static const string SCHEMA_FILE = "schema_test_only.db";
+
+static void removeTable() {
+    for (string suffix : {"", "_index.db", "_fsm.db", "_wal.log", "_schema.db"})
+        remove((TABLE + suffix).c_str());
+}
+
+static bool fail(const string& what) {
+    cerr << what << "\n";
+    return false;
+}
+
+static bool throws(const function<void()>& action) {
+    try {
+        action();
+    } catch (const exception&) {
+        return true;
+    }
+    return false;
+}
+
+// The key is the second column, so it is found by its offset, not by position
+static Schema tableSchema() {
+    return Schema({{"name", ColumnType::VARCHAR, NAME_LENGTH, true},
+                   {"id", ColumnType::INT32, 0, false},
+                   {"total", ColumnType::INT64, 0, true},
+                   {"price", ColumnType::DOUBLE, 0, true},
+                   {"code", ColumnType::CHAR, CODE_LENGTH, false},
+                   {"flag", ColumnType::INT32, 0, true}},
+                  1);
+}
+
+static bool encoding() {
+    Schema schema = tableSchema();
+    vector<vector<string>> rows = {
+        {"alice", "1", "123456789012345", "2.5", "abc", "7"},
+        {"", to_string(INT32_MIN), to_string(INT64_MAX), "-0.125", "abcdef", ""},
+        {string(NAME_LENGTH, 'n'), to_string(INT32_MAX), to_string(INT64_MIN), "1e+300", "", "0"},
+        {"", "0", "", "", "x", ""},
+    };
+    for (const auto& row : rows) {
+        vector<char> data = schema.encode(row);
+        RowView view(data.data(), data.size(), &schema);
+        if (view.materialize() != row) return fail("Row with id " + row[1] + " does not round-trip");
+        if (view.columnCount() != schema.size()) return fail("Wrong column count");
+        if (view.getInt32(1) != stoi(row[1])) return fail("getInt32 of " + row[1]);
+        for (size_t i : {0, 2, 3, 5})
+            if (view.isNull(i) != row[i].empty()) return fail("NULL bit of column " + to_string(i));
+        if (!row[2].empty() && view.getInt64(2) != stoll(row[2])) return fail("getInt64 of " + row[2]);
+        if (!row[3].empty() && view.getDouble(3) != stod(row[3])) return fail("getDouble of " + row[3]);
+        if (view.getString(4) != row[4] || view.getString(0) != row[0]) return fail("getString of " + row[4]);
+        // Fixed-width columns sit at constant offsets whatever the strings hold
+        if (data.size() != schema.fixedSize() + row[0].size()) return fail("Row of " + to_string(data.size()) + " bytes");
+    }
+
+    vector<char> data = schema.encode(rows[0]);
+    RowView view(data.data(), data.size(), &schema);
+    if (!throws([&] { view.getInt64(1); }) || !throws([&] { view.getString(2); }) || !throws([&] { view.isNull(6); }))
+        return fail("Getter of the wrong type accepted");
+
+    // Untyped rows, [uint32 length][bytes] per column, parse their text instead
+    vector<char> untyped;
+    for (string column : {"12", "x"}) {
+        uint32_t length = column.size();
+        untyped.insert(untyped.end(), reinterpret_cast<char*>(&length), reinterpret_cast<char*>(&length + 1));
+        untyped.insert(untyped.end(), column.begin(), column.end());
+    }
+    RowView text(untyped.data(), untyped.size());
+    if (text.getInt32(0) != 12 || text.isNull(1) || !throws([&] { text.getInt32(1); }))
+        return fail("Untyped row getters");
+
+    vector<vector<string>> bad = {
+        {"a", "1", "2", "3"},                                   // too few columns
+        {"a", "", "2", "3", "c", "4"},                          // NULL key
+        {"a", "x1", "2", "3", "c", "4"},                        // not a number
+        {"a", "1", "99999999999999999999", "3", "c", "4"},      // out of range
+        {"a", "1", "2", "3", string(CODE_LENGTH + 1, 'c'), "4"}, // CHAR too long
+        {string(NAME_LENGTH + 1, 'n'), "1", "2", "3", "c", "4"}, // VARCHAR too long
+    };
+    for (const auto& row : bad)
+        if (!throws([&] { schema.encode(row); })) return fail("Bad row accepted: " + row[1]);
+
+    if (!throws([] { Schema(vector<Column>{}); }) || !throws([] { Schema({{"id", ColumnType::INT32, 0, true}}); }) ||
+        !throws([] { Schema({{"id", ColumnType::INT64, 0, false}}); }) ||
+        !throws([] { Schema({{"id", ColumnType::INT32, 0, false}, {"s", ColumnType::CHAR, 0, false}}); }))
+        return fail("Bad schema accepted");
+
+    remove(SCHEMA_FILE.c_str());
+    if (!Schema::load(SCHEMA_FILE).empty()) return fail("Missing schema file loaded as a schema");
+    schema.save(SCHEMA_FILE);
+    Schema loaded = Schema::load(SCHEMA_FILE);
+    remove(SCHEMA_FILE.c_str());
+    if (loaded != schema || loaded.getKeyColumn() != 1) return fail("Saved schema differs");
+    return true;
+}
+
+static vector<string> makeRow(Key key) {
+    string name = key % 5 == 0 ? "" : string(abs(key) % 40, 'a' + abs(key) % 26);
+    return {name, to_string(key), key % 3 == 0 ? "" : to_string(int64_t(key) << 33), to_string(key) + ".5",
+            "c" + to_string(key % 1000), key % 7 == 0 ? "" : to_string(-key)};
+}
+
+static bool matches(TableFile& table, const map<Key, vector<string>>& reference, const string& phase) {
+    vector<vector<string>> rows = table.scanAll();
+    if (rows.size() != reference.size()) return fail(phase + ": scan found " + to_string(rows.size()) + " rows");
+    for (const auto& row : rows)
+        if (reference.at(stoi(row[1])) != row) return fail(phase + ": scan found a wrong row " + row[1]);
+    vector<vector<string>> ranged = table.rangeQuery(-ROWS, ROWS);
+    if (ranged.size() != reference.size()) return fail(phase + ": range query found " + to_string(ranged.size()) + " rows");
+    size_t i = 0;
+    for (const auto& entry : reference) {
+        if (ranged[i++] != entry.second) return fail(phase + ": wrong row for key " + to_string(entry.first));
+        if (entry.first % 11 != 0) continue;
+        if (table.findByKey(entry.first) != entry.second) return fail(phase + ": lookup of " + to_string(entry.first));
+        bool typed = false;
+        table.visitByKey(entry.first, [&](const RowView& row) {
+            typed = row.getSchema() && row.getInt32(1) == entry.first && row.getDouble(3) == stod(entry.second[3]) &&
+                    row.isNull(2) == entry.second[2].empty();
+        });
+        if (!typed) return fail(phase + ": typed view of " + to_string(entry.first));
+    }
+    return true;
+}
+
+static bool typedTable() {
+    removeTable();
+    map<Key, vector<string>> reference;
+    {
+        TableFile table(TABLE, tableSchema());
+        for (Key key = -ROWS / 2; key < ROWS / 2; key++) {
+            reference[key] = makeRow(key);
+            table.insertRow(reference[key]);
+        }
+        if (!throws([&] { table.insertRow({"a", "1"}); })) return fail("Short row accepted");
+        for (Key key = 0; key < ROWS / 2; key += 4) {
+            reference[key][0] = string(NAME_LENGTH, 'u');
+            reference[key][5] = "";
+            table.updateRow(key, reference[key]);
+        }
+        if (!matches(table, reference, "Typed table")) return false;
+    }
+
+    // An empty schema opens the table with the stored one
+    {
+        TableFile reopened(TABLE);
+        if (reopened.getSchema() != tableSchema()) return fail("Reopened table lost its schema");
+        if (!matches(reopened, reference, "Reopened table")) return false;
+    }
+    Schema other({{"id", ColumnType::INT32, 0, false}, {"name", ColumnType::VARCHAR, NAME_LENGTH, true}});
+    if (!throws([&] { TableFile mismatched(TABLE, other); })) return fail("Table opened with a different schema");
+    TableFile table(TABLE, tableSchema());
+    return matches(table, reference, "Table reopened with its schema");
+}
+
+int main() {
+    try {
+        if (!encoding() || !typedTable()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "schema ok\n";
+    removeTable();
+    return 0;
+}
@@ -0,0 +1,215 @@
+//Correctness test for secondary indexes.
+//An index is created over a populated table and then kept up to date
+//through inserts, updates that change the indexed value, set it to NULL or
+//move the row, deletes and a bulk insert. After each phase every value and
+//several ranges are looked up against a reference map, NULLs must not be
+//indexed, and a column without an index must give the same answers by
+//scanning. Children then crash in the middle of such changes, and the
+//reopened table must find what they committed. Exits non-zero on any
+//mismatch or error.
+//
+//Built by CMake as secondary_index_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/SecondaryIndexTest.cpp storage/*.cpp index/*.cpp -o secondary_index_test -lpthread
+//  ./secondary_index_test
+#include <iostream>
+#include <map>
+#include <random>
+#include <functional>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "storage/TableFile.h"
+
+using namespace std;
+
+constexpr int ROWS = 4000;
+constexpr int CUSTOMERS = 60;        // values of the indexed column
+constexpr int ROUNDS = 4;            // crashes
+constexpr int OPS_PER_ROUND = 1500;  // committed operations before each crash
+
+using Reference = map<Key, vector<string>>;
+
+static const string TABLE = "secondary_index_test.db";
+
+static void removeTable() {
+    for (string suffix : {"", "_index.db", "_fsm.db", "_wal.log", "_schema.db", "_indexes.db", "_index_1.db"})
+        remove((TABLE + suffix).c_str());
+}
+
+// cust is indexed, region is the same kind of column without an index
+static Schema tableSchema() {
+    return Schema({{"id", ColumnType::INT32, 0, false},
+                   {"cust", ColumnType::INT32, 0, true},
+                   {"region", ColumnType::INT32, 0, true},
+                   {"note", ColumnType::VARCHAR, 1000, true}});
+}
+
+static vector<string> makeRow(Key key, int cust, size_t noteLength) {
+    string value = cust < 0 ? "" : to_string(cust);
+    return {to_string(key), value, value, string(noteLength, 'a' + key % 26)};
+}
+
+static bool fail(const string& phase, const string& what) {
+    cerr << phase << ": " << what << "\n";
+    return false;
+}
+
+static Reference keyed(const vector<vector<string>>& rows) {
+    Reference found;
+    for (const auto& row : rows) found[stoi(row[0])] = row;
+    return found;
+}
+
+static bool check(TableFile& table, const Reference& reference, const string& phase) {
+    map<int, Reference> byCustomer;
+    for (const auto& entry : reference)
+        if (!entry.second[1].empty()) byCustomer[stoi(entry.second[1])][entry.first] = entry.second;
+
+    for (int cust = -1; cust <= CUSTOMERS; cust++) {
+        vector<vector<string>> rows = table.findByColumn(1, cust);
+        if (keyed(rows) != byCustomer[cust] || rows.size() != byCustomer[cust].size())
+            return fail(phase, "lookup of customer " + to_string(cust));
+        if (cust % 10 == 0 && keyed(table.findByColumn(2, cust)) != byCustomer[cust])
+            return fail(phase, "scan for region " + to_string(cust));
+    }
+    for (int low = -5; low < CUSTOMERS; low += 13) {
+        int high = low + 9;
+        // Entries come in (value, RID) order, so rows arrive grouped by customer
+        vector<vector<string>> rows = table.rangeQueryByColumn(1, low, high);
+        size_t i = 0;
+        for (int cust = low; cust <= high; cust++) {
+            size_t count = byCustomer[cust].size();
+            if (i + count > rows.size() || keyed({rows.begin() + i, rows.begin() + i + count}) != byCustomer[cust])
+                return fail(phase, "range [" + to_string(low) + ", " + to_string(high) + "] at customer " + to_string(cust));
+            i += count;
+        }
+        if (i != rows.size()) return fail(phase, "range [" + to_string(low) + ", " + to_string(high) + "] has extra rows");
+        if (keyed(table.rangeQueryByColumn(2, low, high)) != keyed(rows))
+            return fail(phase, "scan of region range " + to_string(low));
+    }
+    return true;
+}
+
+static bool maintenance() {
+    removeTable();
+    Reference reference;
+    mt19937 rng(3);
+    TableFile* table = new TableFile(TABLE, tableSchema());
+    for (Key key = 0; key < ROWS; key++) {
+        // Every ninth customer is NULL
+        reference[key] = makeRow(key, key % 9 == 0 ? -1 : rng() % CUSTOMERS, rng() % 30);
+        table->insertRow(reference[key]);
+    }
+    if (table->hasIndex(1)) return fail("create", "index before it was created");
+    table->createIndex(1);
+    if (!table->hasIndex(1) || table->hasIndex(2)) return fail("create", "wrong columns indexed");
+    bool threw = false;
+    try {
+        table->createIndex(3);
+    } catch (const runtime_error&) {
+        threw = true;
+    }
+    if (!threw) return fail("create", "index over a VARCHAR column");
+    if (!check(*table, reference, "create")) return false;
+
+    for (Key key = ROWS; key < 2 * ROWS; key++) {
+        reference[key] = makeRow(key, key % 7 == 0 ? -1 : rng() % CUSTOMERS, rng() % 30);
+        table->insertRow(reference[key]);
+    }
+    if (!check(*table, reference, "insert")) return false;
+
+    // New values, NULLs both ways, and rows that grow off their page
+    for (Key key = 0; key < 2 * ROWS; key += 3) {
+        int cust = key % 4 == 0 ? -1 : rng() % CUSTOMERS;
+        reference[key] = makeRow(key, cust, key % 2 ? 800 : rng() % 30);
+        table->updateRow(key, reference[key]);
+    }
+    for (Key key = 1; key < 2 * ROWS; key += 4) {
+        table->deleteByKey(key);
+        reference.erase(key);
+    }
+    if (!check(*table, reference, "update")) return false;
+
+    vector<vector<string>> bulk;
+    for (Key key = 2 * ROWS; key < 3 * ROWS; key++) {
+        reference[key] = makeRow(key, key % 5 == 0 ? -1 : rng() % CUSTOMERS, rng() % 30);
+        bulk.push_back(reference[key]);
+    }
+    table->bulkInsert(bulk);
+    if (!check(*table, reference, "bulk insert")) return false;
+
+    delete table;
+    TableFile reopened(TABLE);
+    if (!reopened.hasIndex(1)) return fail("reopen", "index forgotten");
+    return check(reopened, reference, "reopen");
+}
+
+// The operations of one crash round. With a table they are applied to it
+// too; the reference alone is how the parent learns what the child committed.
+static void runOps(TableFile* table, Reference& reference, int round) {
+    mt19937 rng(round + 11);
+    for (int op = 0; op < OPS_PER_ROUND; op++) {
+        Key key = rng() % (3 * ROWS);
+        int cust = rng() % 8 == 0 ? -1 : rng() % CUSTOMERS;
+        auto it = reference.find(key);
+        vector<string> row = makeRow(key, cust, rng() % 40);
+        if (it == reference.end()) {
+            if (table) table->insertRow(row);
+            reference[key] = row;
+        } else if (rng() % 3) {
+            if (table) table->updateRow(key, row);
+            it->second = row;
+        } else {
+            if (table) table->deleteByKey(key);
+            reference.erase(it);
+        }
+        // The last few hundred operations of a round are only in the log
+        if (table && op % 600 == 599) table->checkpoint();
+    }
+}
+
+static bool crash(const function<void()>& work) {
+    pid_t child = fork();
+    if (child == 0) {
+        try {
+            work();
+        } catch (const exception& e) {
+            cerr << e.what() << "\n";
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Continues from the table maintenance() left
+static bool crashes() {
+    Reference reference;
+    {
+        TableFile table(TABLE);
+        reference = keyed(table.scanAll());
+    }
+    for (int round = 0; round < ROUNDS; round++) {
+        string phase = "crash " + to_string(round);
+        // Never closed, so nothing is flushed beyond what commits wrote
+        if (!crash([&] { runOps(new TableFile(TABLE), reference, round); })) return fail(phase, "the child failed");
+        runOps(nullptr, reference, round);
+        TableFile table(TABLE);
+        if (!check(table, reference, phase)) return false;
+    }
+    return true;
+}
+
+int main() {
+    try {
+        if (!maintenance() || !crashes()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "secondary index ok\n";
+    removeTable();
+    return 0;
+}
@@ -0,0 +1,97 @@
+//Correctness test for a tree of string keys with prefix compression.
+//Random inserts and removes of duplicate keys with long shared prefixes and
+//very different lengths keep nodes close to their page size while they
+//borrow, merge and split through a small cache. Every step is checked
+//against a reference multimap, and so is a full scan after reopening.
+//Exits non-zero on any mismatch or error.
+//
+//Built by CMake as string_tree_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/StringTreeTest.cpp index/*.cpp -o string_tree_test -lpthread
+//  ./string_tree_test
+#include <iostream>
+#include <map>
+#include <random>
+#include <cstdio>
+#include "index/BPlusTree.h"
+
+using namespace std;
+
+constexpr int STEPS = 60000;         // random operations
+constexpr int KEY_SPACE = 3000;      // distinct seeds for keys
+constexpr size_t CACHE_NODES = 64;   // small, so nodes are written and reread
+
+using Reference = multimap<string, pair<uint32_t, uint16_t>>;
+
+// 150 prefixes, each with up to 199 trailing characters
+static string makeKey(int i) {
+    char prefix[16];
+    snprintf(prefix, sizeof(prefix), "k%05d", i % 150);
+    return prefix + string(i % 200, 'q');
+}
+
+static bool matches(StringBPlusTree& tree, const Reference& reference) {
+    multimap<string, pair<uint32_t, uint16_t>> found;
+    tree.visitRange("", string(256, '\x7f'), [&](const string& key, const RID& rid, const char*) {
+        found.insert({key, {rid.pageID, rid.slotID}});
+    });
+    if (found.size() != reference.size()) return false;
+    // Duplicates of one key may come back in any order
+    for (auto it = reference.begin(); it != reference.end(); it = reference.upper_bound(it->first)) {
+        auto [a, b] = reference.equal_range(it->first);
+        auto [c, d] = found.equal_range(it->first);
+        multimap<pair<uint32_t, uint16_t>, int> expected, actual;
+        for (; a != b; ++a) expected.insert({a->second, 0});
+        for (; c != d; ++c) actual.insert({c->second, 0});
+        if (expected != actual) return false;
+    }
+    return true;
+}
+
+int main() {
+    string file = "string_tree_test.db";
+    remove(file.c_str());
+    Reference reference;
+    mt19937 rng(42);
+    {
+        StringBPlusTree tree(file, IndexKeys::NonUnique, CACHE_NODES);
+        for (int step = 0; step < STEPS; step++) {
+            string key = makeKey(rng() % KEY_SPACE);
+            RID rid{static_cast<uint32_t>(rng() % 50), static_cast<uint16_t>(rng() % 100)};
+            bool insert = rng() % 3 < 2;
+            try {
+                if (insert) {
+                    bool present = false;
+                    for (auto it = reference.lower_bound(key); it != reference.upper_bound(key); ++it)
+                        if (it->second == make_pair(rid.pageID, rid.slotID)) present = true;
+                    if (present) continue;
+                    tree.insert(key, rid);
+                    reference.insert({key, {rid.pageID, rid.slotID}});
+                } else {
+                    auto [first, last] = reference.equal_range(key);
+                    if (first == last) continue;
+                    advance(first, rng() % distance(first, last));
+                    if (!tree.remove(key, RID{first->second.first, first->second.second})) {
+                        cerr << "Step " << step << ": entry of " << key.size() << "-byte key not removed\n";
+                        return 1;
+                    }
+                    reference.erase(first);
+                }
+            } catch (const exception& e) {
+                cerr << "Step " << step << ": " << e.what() << "\n";
+                return 1;
+            }
+        }
+        if (!matches(tree, reference)) {
+            cerr << "Tree does not match the reference\n";
+            return 1;
+        }
+    }
+    StringBPlusTree reopened(file, IndexKeys::NonUnique, CACHE_NODES);
+    if (!matches(reopened, reference)) {
+        cerr << "Reopened tree does not match the reference\n";
+        return 1;
+    }
+    cout << reference.size() << " entries ok\n";
+    remove(file.c_str());
+    return 0;
+}
@@ -0,0 +1,125 @@
+//Correctness test for a tree whose file cannot grow.
+//With the index file capped at its current size, an insert that has to
+//split fails before it changes anything: the key is not in the tree, every
+//earlier entry is, and the tree keeps working. Merges free pages, which later
+//splits reuse under the same cap. Once the cap is lifted, inserts grow the
+//file again and everything survives a reopen. Exits non-zero on any mismatch
+//or error.
+//
+//Built by CMake as tree_failure_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/TreeFailureTest.cpp index/*.cpp -o tree_failure_test -lpthread
+//  ./tree_failure_test
+#include <iostream>
+#include <set>
+#include <cstdio>
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "index/BPlusTree.h"
+
+using namespace std;
+
+constexpr int ORDER = 4;          // small, so inserts split often
+constexpr int CACHE_NODES = 16;   // small, so nodes are written and reread
+constexpr int KEYS = 2000;        // inserted before the cap
+
+static const string INDEX = "tree_failure_test.db";
+
+static bool fail(const string& what) {
+    cerr << what << "\n";
+    return false;
+}
+
+static void capFileSize(uint64_t bytes) {
+    rlimit limit{};
+    getrlimit(RLIMIT_FSIZE, &limit);
+    limit.rlim_cur = bytes;
+    setrlimit(RLIMIT_FSIZE, &limit);
+}
+
+static void uncapFileSize() {
+    rlimit limit{};
+    getrlimit(RLIMIT_FSIZE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_FSIZE, &limit);
+}
+
+static uint64_t fileSize() {
+    struct stat st{};
+    stat(INDEX.c_str(), &st);
+    return st.st_size;
+}
+
+static bool matches(BPlusTree& tree, const set<Key>& reference) {
+    vector<RID> rids = tree.rangeScan(-1, 1 << 30);
+    if (rids.size() != reference.size()) return fail("Scan found " + to_string(rids.size()) + " entries");
+    for (Key key : reference) {
+        RID rid;
+        if (!tree.search(key, rid) || rid.pageID != static_cast<uint32_t>(key)) return fail("Lost key " + to_string(key));
+    }
+    return true;
+}
+
+static bool tryInsert(BPlusTree& tree, Key key) {
+    try {
+        tree.insert(key, RID{static_cast<uint32_t>(key), 0});
+        return true;
+    } catch (const runtime_error&) {
+        return false;
+    }
+}
+
+static bool run() {
+    set<Key> reference;
+    {
+        BPlusTree tree(ORDER, INDEX, CACHE_NODES);
+        for (Key key = 0; key < KEYS; key++) {
+            tree.insert(key, RID{static_cast<uint32_t>(key), 0});
+            reference.insert(key);
+        }
+        capFileSize(fileSize());
+
+        // Ascending keys fill the rightmost leaf, so a split comes within ORDER inserts
+        Key key = KEYS;
+        while (tryInsert(tree, key)) reference.insert(key++);
+        if (key >= KEYS + ORDER) return fail("No insert failed under the cap");
+        RID rid;
+        if (tree.search(key, rid)) return fail("The failed insert left its key behind");
+        if (!matches(tree, reference)) return false;
+
+        // Merges free pages that the next splits take instead of growing the file
+        for (Key removed = 0; removed < KEYS / 2; removed++) {
+            if (!tree.remove(removed)) return fail("Cannot remove " + to_string(removed));
+            reference.erase(removed);
+        }
+        for (int i = 0; i < 100; i++, key++) {
+            if (!tryInsert(tree, key)) return fail("Insert " + to_string(key) + " failed with free pages left");
+            reference.insert(key);
+        }
+        if (!matches(tree, reference)) return false;
+
+        uncapFileSize();
+        for (int i = 0; i < KEYS; i++, key++) {
+            tree.insert(key, RID{static_cast<uint32_t>(key), 0});
+            reference.insert(key);
+        }
+        if (!matches(tree, reference)) return false;
+    }
+    BPlusTree reopened(ORDER, INDEX, CACHE_NODES);
+    return matches(reopened, reference);
+}
+
+int main() {
+    // Writes past the size cap fail with EFBIG instead of killing the process
+    signal(SIGXFSZ, SIG_IGN);
+    remove(INDEX.c_str());
+    try {
+        if (!run()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "tree failure ok\n";
+    remove(INDEX.c_str());
+    return 0;
+}
@@ -0,0 +1,194 @@
+//Correctness test for TableFile::updateRow.
+//Rows grow until they no longer fit their page and are forwarded, shrink
+//back, grow again, change their key and are deleted, and after each phase
+//every row must come back once, through scans, key lookups, range queries
+//and the RID it was inserted under. Then children crash over and over in
+//the middle of such updates, and recovery must restore what they
+//committed. Exits non-zero on any mismatch or error.
+//
+//Built by CMake as update_test and run by ctest, or from src/:
+//  g++ -std=c++17 -O2 -I. tests/UpdateTest.cpp storage/*.cpp index/*.cpp -o update_test -lpthread
+//  ./update_test
+#include <iostream>
+#include <map>
+#include <random>
+#include <functional>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "storage/TableFile.h"
+
+using namespace std;
+
+constexpr int ROWS = 3000;
+constexpr int ROUNDS = 5;            // crashes
+constexpr int OPS_PER_ROUND = 1500;  // committed operations before each crash
+constexpr int KEY_SPACE = 2000;      // keys of the crash rounds
+
+using Reference = map<Key, vector<string>>;
+
+static const string TABLE = "update_test.db";
+
+static void removeTable() {
+    for (string suffix : {"", "_index.db", "_fsm.db", "_wal.log"})
+        remove((TABLE + suffix).c_str());
+}
+
+static vector<string> makeRow(Key key, size_t noteLength) {
+    return {to_string(key), to_string(key * 3), string(noteLength, 'a' + key % 26)};
+}
+
+static bool fail(const string& phase, const string& what) {
+    cerr << phase << ": " << what << "\n";
+    return false;
+}
+
+static bool check(TableFile& table, const Reference& reference, const string& phase) {
+    vector<vector<string>> rows = table.scanAll();
+    if (rows.size() != reference.size()) return fail(phase, "scan found " + to_string(rows.size()) + " rows");
+    for (const auto& row : rows) {
+        auto it = reference.find(stoi(row[0]));
+        if (it == reference.end() || it->second != row) return fail(phase, "scan found a wrong row " + row[0]);
+    }
+    vector<vector<string>> ranged = table.rangeQuery(reference.begin()->first, reference.rbegin()->first);
+    if (ranged.size() != reference.size()) return fail(phase, "range query found " + to_string(ranged.size()) + " rows");
+    size_t i = 0;
+    for (const auto& entry : reference) {
+        if (ranged[i++] != entry.second) return fail(phase, "range query returned a wrong row for " + to_string(entry.first));
+        if (entry.first % 7 == 0 && table.findByKey(entry.first) != entry.second)
+            return fail(phase, "lookup of " + to_string(entry.first));
+    }
+    return true;
+}
+
+static bool updates() {
+    removeTable();
+    Reference reference;
+    map<Key, RID> rids;
+    mt19937 rng(7);
+    TableFile* table = new TableFile(TABLE);
+    for (Key key = 0; key < ROWS; key++) {
+        reference[key] = makeRow(key, rng() % 30);
+        rids[key] = table->insertRow(reference[key]);
+    }
+
+    // Grown rows no longer fit their page and are forwarded
+    for (Key key = 0; key < ROWS; key += 3) {
+        reference[key] = makeRow(key, 200 + rng() % 800);
+        table->updateRow(key, reference[key]);
+    }
+    if (!check(*table, reference, "grow")) return false;
+    for (Key key = 0; key < ROWS; key += 30)
+        if (table->getRow(rids[key]) != reference[key]) return fail("grow", "RID of " + to_string(key) + " lost its row");
+
+    // Shrunk rows come back home or stay where they moved; grown again, they move on
+    for (Key key = 0; key < ROWS; key += 6) {
+        reference[key][2].resize(rng() % 20);
+        table->updateRow(key, reference[key]);
+    }
+    for (Key key = 0; key < ROWS; key += 12) {
+        reference[key][2].assign(1000 + rng() % 500, 'z');
+        table->updateRow(key, reference[key]);
+    }
+    if (!check(*table, reference, "shrink")) return false;
+    for (Key key = 0; key < ROWS; key += 6)
+        if (table->getRow(rids[key]) != reference[key]) return fail("shrink", "RID of " + to_string(key) + " lost its row");
+
+    // New keys, forwarded rows included
+    for (Key key = 1; key < ROWS; key += 97) {
+        vector<string> row = reference[key];
+        row[0] = to_string(key + 100000);
+        table->updateRow(key, row);
+        reference.erase(key);
+        reference[key + 100000] = row;
+    }
+    for (Key key = 0; key < ROWS; key += 5) {
+        if (!reference.count(key)) continue;
+        table->deleteByKey(key);
+        reference.erase(key);
+    }
+    if (!check(*table, reference, "key change")) return false;
+    bool threw = false;
+    try {
+        table->findByKey(1);
+    } catch (const runtime_error&) {
+        threw = true;
+    }
+    if (!threw) return fail("key change", "old key still found");
+
+    delete table;
+    TableFile reopened(TABLE);
+    return check(reopened, reference, "reopen");
+}
+
+// The operations of one crash round. With a table they are applied to it
+// too; the reference alone is how the parent learns what the child committed.
+static void runOps(TableFile* table, Reference& reference, int round) {
+    mt19937 rng(round + 1);
+    for (int op = 0; op < OPS_PER_ROUND; op++) {
+        Key key = rng() % KEY_SPACE;
+        int kind = rng() % 10;
+        auto it = reference.find(key);
+        if (it == reference.end()) {
+            vector<string> row = makeRow(key, 10 + rng() % 40);
+            if (table) table->insertRow(row);
+            reference[key] = row;
+        } else if (kind < 6) {
+            // Notes grow until they no longer fit the page and the row moves
+            vector<string> row = makeRow(key, min<size_t>(1500, it->second[2].size() * 2 + rng() % 50));
+            if (table) table->updateRow(key, row);
+            it->second = row;
+        } else if (kind < 8) {
+            vector<string> row = makeRow(key, rng() % 20);
+            if (table) table->updateRow(key, row);
+            it->second = row;
+        } else {
+            if (table) table->deleteByKey(key);
+            reference.erase(it);
+        }
+        // The last few hundred operations of a round are only in the log
+        if (table && op % 600 == 599) table->checkpoint();
+    }
+}
+
+static bool crash(const function<void()>& work) {
+    pid_t child = fork();
+    if (child == 0) {
+        try {
+            work();
+        } catch (const exception& e) {
+            cerr << e.what() << "\n";
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool crashes() {
+    removeTable();
+    Reference reference;
+    for (int round = 0; round < ROUNDS; round++) {
+        string phase = "crash " + to_string(round);
+        // Never closed, so nothing is flushed beyond what commits wrote
+        if (!crash([&] { runOps(new TableFile(TABLE), reference, round); })) return fail(phase, "the child failed");
+        runOps(nullptr, reference, round);
+        TableFile table(TABLE);
+        if (!check(table, reference, phase)) return false;
+    }
+    return true;
+}
+
+int main() {
+    try {
+        if (!updates() || !crashes()) return 1;
+    } catch (const exception& e) {
+        cerr << e.what() << "\n";
+        return 1;
+    }
+    cout << "update ok\n";
+    removeTable();
+    return 0;
+}